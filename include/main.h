@@ -2,10 +2,11 @@
 #define MAIN_H
 
 #include "MD_MAX72xx.h"
-#include "MD_Parola.h"
 #include "SPI.h"
 #include <Arduino.h>
 #include <Preferences.h>
+#include <LittleFS.h>
+#include <esp_heap_caps.h>
 
 #include <TaskScheduler.h>
 
@@ -20,6 +21,20 @@
 #include <HttpServer.h>
 #include <MemoryHandler.h>
 #include <MqttHandler.h>
+#include <SensorHandler.h>
+#include <DeviceRegistry.h>
+#include <PublishQueue.h>
+#include <BootProfiler.h>
+#include <TopicTable.h>
+#include <LatencyTrace.h>
+#include <WakeSource.h>
+#include <PowerManager.h>
+#include <TelemetryPipeline.h>
+#include <RestApi.h>
+#include <LivePush.h>
+#include <RulesEngine.h>
+#include <HistoryStore.h>
+#include <DisplayEngine.h>
 
 #define SSID "Esp32"
 #define PASS "esp32esp32"
@@ -29,25 +44,65 @@
 #define MAX_DEVICES 1
 #define CS_PIN 5
 #define HARDWARE_TYPE MD_MAX72XX::GENERIC_HW
+#define DIGIT_ROWS true             // Module wires the MAX72xx digits to rows, counts the worst case of SPI bytes if unsure
+#define NET_CORE 0
+#define NET_STACK 8192
+#define BUTTON_ACTIVE_INTERVAL 10   // Button tick period while pressed, interrupt driven when idle
+#define MQTT_IDLE_INTERVAL 1000     // MQTT housekeeping period, incoming data wakes the task
+#define MQTT_DRAIN_INTERVAL 5       // MQTT period while the publish queue drains
+#define WIFI_ACTIVE_INTERVAL 500    // WiFi tick period while connecting, blinks the LED
+#define WIFI_IDLE_INTERVAL 5000     // WiFi tick period while connected
+#define TELEMETRY_WINDOW 5000       // Sampling period of RSSI and heap, and longest wait of a due value
+#define RULES_TZ "UTC0"             // POSIX time zone of the rule schedules, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+#define RULES_NTP "pool.ntp.org"
 
-std::vector<String> wifi_credentials;
-std::vector<const char *> topics;
-std::vector<String> brocker_cred;
+NodeConfig config;
+TopicTable topics;
+BootProfiler bootProfiler;
 
 OneWire oneWire(15);
 DallasTemperature sensors(&oneWire);
 OneButton button(BUTTON_PIN, false);
-MD_Parola display = MD_Parola(HARDWARE_TYPE, CS_PIN, MAX_DEVICES);
+MD_MAX72XX matrix = MD_MAX72XX(HARDWARE_TYPE, CS_PIN, MAX_DEVICES);
+DisplayEngine display(matrix, MAX_DEVICES, DIGIT_ROWS);
 
 Preferences preferences;
 MemoryHandler memoryHandler(preferences);
+SensorHandler sensorHandler(sensors, memoryHandler);
+DeviceRegistry deviceRegistry;
 
 WifiHandler* wifiHandler;
 
+#ifdef MQTT_ASYNC
+AsyncMqtt client;               // AsyncTCP transport, wakes the network task on receive
+#else
 WiFiClient espClient;
 PubSubClient client(espClient);
+#endif
+PublishQueue publishQueue(LittleFS);
+HistoryStore history(LittleFS);  // Readings from the control loop, written by the network task
+CommandQueue commands;
+TelemetryQueue telemetry;
+CommandQueue http_commands;     // AsyncTCP task to control loop
+TelemetryQueue live_frames;     // JSON deltas for the WebSocket clients, control loop to network task
+TelemetryPipeline pipeline;     // Control loop only
+uint8_t temp_metrics;           // Id of the first temperature metric, one per sensor
+uint8_t device_metrics;         // Id of the first device metric, one per device
+int8_t rssi_metric;
+int8_t heap_metric;
+uint8_t relay_inputs;           // Id of the first relay state input of the rules, one per device
 MqttHandler* mqttHandler;
 
-Scheduler runner;
+Scheduler runner;       // Control loop, core 1
+Scheduler net_runner;   // Network stack, core 0
+TaskHandle_t net_task;
+WakeSource control_wake;        // Wakes the control loop for commands and button edges
+WakeSource net_wake;            // Wakes the network task for telemetry and WiFi events
+volatile bool button_edge = false;
+volatile uint32_t button_stamp = 0;   // TRACE_TIME_US() of the last button edge
+PowerManager power(BUTTON_PIN);
+RulesEngine rules(memoryHandler);   // Control loop, uploads arrive from the network and AsyncTCP tasks
+RestApi api(deviceRegistry, sensorHandler, http_commands, control_wake, rules);
+LivePush live(live_frames);
 
 #endif // MAIN_H
\ No newline at end of file
@@ -0,0 +1,491 @@
+#include "AsyncMqtt.h"
+
+#define PKT_CONNECT 0x10
+#define PKT_CONNACK 0x20
+#define PKT_PUBLISH 0x30
+#define PKT_PUBACK 0x40
+#define PKT_SUBSCRIBE 0x82      ///< Reserved flags 0010.
+#define PKT_SUBACK 0x90
+#define PKT_PINGREQ 0xC0
+#define PKT_PINGRESP 0xD0
+#define PKT_DISCONNECT 0xE0
+#define PUBLISH_QOS1 0x02
+#define PUBLISH_DUP 0x08
+
+AsyncMqtt::AsyncMqtt(){
+  memset(window, 0, sizeof(window));
+
+  for (AsyncClient& socket : sockets) {
+    socket.onConnect([](void* arg, AsyncClient* client) {
+      AsyncMqtt* self = static_cast<AsyncMqtt*>(arg);
+      if (self->current(client)) {
+        self->sendConnect(client);
+      }
+    }, this);
+    socket.onData([](void* arg, AsyncClient* client, void* data, size_t len) {
+      AsyncMqtt* self = static_cast<AsyncMqtt*>(arg);
+      if (self->current(client)) {
+        self->onData((const uint8_t*)data, len);
+      }
+    }, this);
+    socket.onDisconnect([](void* arg, AsyncClient* client) {
+      AsyncMqtt* self = static_cast<AsyncMqtt*>(arg);
+      if (!self->current(client)) {
+        return;  ///< Late close of an abandoned attempt, the current one is not affected.
+      }
+      if (self->rx_buf != nullptr) {
+        self->release(self->rx_buf);  ///< Partial packet of the closed connection.
+        self->rx_buf = nullptr;
+      }
+      self->tcp_closed.store(true, std::memory_order_release);
+      if (self->wake) self->wake();
+    }, this);
+  }
+}
+
+AsyncMqtt& AsyncMqtt::setServer(const char* domain, uint16_t broker_port){
+  host = domain;
+  port = broker_port;
+  return *this;
+}
+
+AsyncMqtt& AsyncMqtt::setCallback(Callback cb){
+  callback = cb;
+  return *this;
+}
+
+AsyncMqtt& AsyncMqtt::setSocketTimeout(uint16_t seconds){
+  timeout_ms = seconds * 1000UL;
+  return *this;
+}
+
+AsyncMqtt& AsyncMqtt::onReceive(void (*hook)()){
+  wake = hook;
+  return *this;
+}
+
+uint8_t* AsyncMqtt::alloc(size_t len){
+  uint8_t* buffer = nullptr;
+  if (len <= MQTT_ASYNC_SMALL) {
+    buffer = small.alloc();
+  }
+  if (buffer == nullptr && len <= MQTT_ASYNC_LARGE) {
+    buffer = large.alloc();  ///< Also taken when the small buffers run out.
+  }
+  return buffer;
+}
+
+void AsyncMqtt::release(uint8_t* buffer){
+  if (small.owns(buffer)) {
+    small.release(buffer);
+  } else {
+    large.release(buffer);
+  }
+}
+
+size_t AsyncMqtt::header(uint8_t* out, uint8_t type, uint32_t remaining){
+  size_t n = 0;
+  out[n++] = type;
+  do {
+    uint8_t digit = remaining & 0x7F;
+    remaining >>= 7;
+    out[n++] = remaining > 0 ? digit | 0x80 : digit;
+  } while (remaining > 0);
+  return n;
+}
+
+size_t AsyncMqtt::string(uint8_t* out, const char* text, size_t len){
+  out[0] = len >> 8;
+  out[1] = len;
+  memcpy(out + 2, text, len);
+  return len + 2;
+}
+
+bool AsyncMqtt::write(const uint8_t* packet, size_t len){
+  if (tcp->space() < len) {
+    return false;
+  }
+  tcp->add((const char*)packet, len);  ///< Copied, a window packet keeps its buffer for retransmission.
+  tcp->send();
+  last_tx = millis();
+  return true;
+}
+
+void AsyncMqtt::onData(const uint8_t* data, size_t len){
+  bool queued = false;
+
+  for (size_t i = 0; i < len; ) {
+    switch (rx_step) {
+      case RxStep::HEADER:
+        rx_header = data[i++];
+        rx_remaining = 0;
+        rx_shift = 0;
+        rx_step = RxStep::LENGTH;
+        break;
+
+      case RxStep::LENGTH: {
+        uint8_t digit = data[i++];
+        rx_remaining |= (uint32_t)(digit & 0x7F) << rx_shift;
+        rx_shift += 7;
+        if (digit & 0x80) {
+          if (rx_shift > 21) {
+            // A fifth length byte, the stream cannot be framed any more and the connection is closed
+            rx_step = RxStep::DISCARD;
+            rx_malformed.store(true, std::memory_order_release);
+            queued = true;
+          }
+          break;
+        }
+        rx_buf = alloc(rx_remaining + 1);
+        if (rx_buf == nullptr) {
+          rx_dropped++;  ///< Too large or the pool is empty, the bytes are skipped.
+        } else {
+          rx_buf[0] = rx_header;
+          rx_pos = 1;
+        }
+        rx_step = RxStep::BODY;
+        if (rx_remaining == 0) {
+          complete();
+          queued = true;
+        }
+        break;
+      }
+
+      case RxStep::BODY: {
+        size_t n = len - i < rx_remaining ? len - i : rx_remaining;
+        if (rx_buf != nullptr) {
+          memcpy(rx_buf + rx_pos, data + i, n);
+          rx_pos += n;
+        }
+        i += n;
+        rx_remaining -= n;
+        if (rx_remaining == 0) {
+          complete();
+          queued = true;
+        }
+        break;
+      }
+
+      case RxStep::DISCARD:
+        i = len;  ///< Until process() closes the connection.
+        break;
+    }
+  }
+  if (queued && wake) {
+    wake();
+  }
+}
+
+void AsyncMqtt::complete(){
+  if (rx_buf != nullptr && !rx.push({ rx_buf, rx_pos })) {
+    release(rx_buf);
+    rx_dropped++;
+  }
+  rx_buf = nullptr;
+  rx_step = RxStep::HEADER;
+}
+
+void AsyncMqtt::sendConnect(AsyncClient* client){
+  uint8_t packet[MQTT_ASYNC_SMALL];
+  size_t id_len = strnlen(client_id, sizeof(packet) - 16);
+  size_t n = header(packet, PKT_CONNECT, 10 + 2 + id_len);
+
+  if (rx_buf != nullptr) {
+    release(rx_buf);  ///< Partial packet of an abandoned attempt, its disconnect was ignored.
+    rx_buf = nullptr;
+  }
+  rx_step = RxStep::HEADER;
+  n += string(packet + n, "MQTT", 4);
+  packet[n++] = 4;        ///< Protocol level 3.1.1.
+  packet[n++] = 0x00;     ///< Clean session off, the broker keeps the unacknowledged publishes.
+  packet[n++] = MQTT_ASYNC_KEEPALIVE >> 8;
+  packet[n++] = MQTT_ASYNC_KEEPALIVE & 0xFF;
+  n += string(packet + n, client_id, id_len);
+  client->add((const char*)packet, n);
+  client->send();
+}
+
+bool AsyncMqtt::connect(const char* id){
+  process();
+  if (status == MQTT_CONNECTED) {
+    return true;
+  }
+  if (status == MQTT_CONNECTING) {
+    if (millis() - connect_ms >= timeout_ms) {
+      tcp->close(true);
+      status = MQTT_CONNECTION_TIMEOUT;
+    }
+    return false;
+  }
+
+  // The other socket, the disconnect of the last one may still be on its way
+  tcp = tcp == &sockets[0] ? &sockets[1] : &sockets[0];
+  client_id = id;
+  tcp_closed.store(false, std::memory_order_relaxed);
+  rx_malformed.store(false, std::memory_order_relaxed);
+  active.store(tcp, std::memory_order_release);
+  connect_ms = millis();
+  status = tcp->connect(host, port) ? MQTT_CONNECTING : MQTT_CONNECT_FAILED;
+  return false;
+}
+
+void AsyncMqtt::process(){
+  MqttPacket packet;
+
+  while (rx.pop(packet)) {
+    handle(packet.data, packet.length);
+    release(packet.data);
+  }
+  if (rx_malformed.exchange(false, std::memory_order_acquire)) {
+    tcp->close(true);
+    malformed++;
+    if (status == MQTT_CONNECTED) {
+      status = MQTT_CONNECTION_LOST;
+    } else if (status == MQTT_CONNECTING) {
+      status = MQTT_CONNECT_FAILED;
+    }
+  }
+  // Checked after the queue is empty, the packets received before the close are handled first
+  if (tcp_closed.load(std::memory_order_acquire)) {
+    if (status == MQTT_CONNECTED) {
+      status = MQTT_CONNECTION_LOST;
+    } else if (status == MQTT_CONNECTING) {
+      status = MQTT_CONNECT_FAILED;
+    }
+  }
+}
+
+void AsyncMqtt::handle(uint8_t* data, uint16_t length){
+  switch (data[0] & 0xF0) {
+    case PKT_CONNACK:
+      if (length < 3 || status != MQTT_CONNECTING) {
+        break;
+      }
+      status = data[2];  ///< 0 is accepted, 1..5 are the refusal codes reported by PubSubClient.
+      if (status != MQTT_CONNECTED) {
+        tcp->close(true);
+        break;
+      }
+      ping_ms = 0;
+      last_tx = millis();  ///< The CONNECT was sent by the AsyncTCP task, the keepalive starts now.
+      for (InFlight& slot : window) {
+        slot.resend = slot.data != nullptr;
+      }
+      resend();
+      break;
+
+    case PKT_PUBLISH: {
+      uint8_t qos = (data[0] >> 1) & 0x03;
+      if (length < 3) {
+        break;
+      }
+      uint16_t topic_len = (data[1] << 8) | data[2];
+      uint16_t pos = 3 + topic_len;
+      if (pos + (qos ? 2 : 0) > length) {
+        break;
+      }
+      uint16_t id = qos ? (data[pos] << 8) | data[pos + 1] : 0;
+      uint16_t payload = pos + (qos ? 2 : 0);
+
+      // NUL-terminate the topic in place by moving it over its length prefix, as PubSubClient does
+      memmove(data + 1, data + 3, topic_len);
+      data[1 + topic_len] = '\0';
+      if (callback) {
+        callback((char*)data + 1, data + payload, length - payload);
+      }
+      if (qos == 1) {
+        uint8_t ack[4] = { PKT_PUBACK, 2, (uint8_t)(id >> 8), (uint8_t)id };
+        write(ack, sizeof(ack));
+      }
+      break;
+    }
+
+    case PKT_PUBACK: {
+      if (length < 3) {
+        break;
+      }
+      uint16_t id = (data[1] << 8) | data[2];
+      for (InFlight& slot : window) {
+        if (slot.data != nullptr && slot.id == id) {
+          TRACE_RECORD(trace_ack, TRACE_TIME_US() - slot.stamp);
+          release(slot.data);
+          slot.data = nullptr;
+          acked++;
+          break;
+        }
+      }
+      break;
+    }
+
+    case PKT_PINGRESP:
+      ping_ms = 0;
+      break;
+
+    default:
+      break;  ///< SUBACK, QoS 0 subscriptions need no bookkeeping.
+  }
+}
+
+void AsyncMqtt::resend(){
+  for (;;) {
+    InFlight* oldest = nullptr;
+    for (InFlight& slot : window) {
+      if (slot.data != nullptr && slot.resend && (oldest == nullptr || (int32_t)(slot.seq - oldest->seq) < 0)) {
+        oldest = &slot;
+      }
+    }
+    if (oldest == nullptr) {
+      return;
+    }
+    oldest->data[0] |= PUBLISH_DUP;
+    if (!write(oldest->data, oldest->length)) {
+      return;  ///< TCP send buffer full, the rest goes out on the next loop().
+    }
+    oldest->stamp = TRACE_TIME_US();
+    oldest->resend = false;
+    retransmits++;
+  }
+}
+
+bool AsyncMqtt::loop(){
+  process();
+  if (status != MQTT_CONNECTED) {
+    return false;
+  }
+  resend();
+
+  uint32_t now = millis();
+  if (ping_ms != 0 && now - ping_ms >= MQTT_ASYNC_KEEPALIVE * 1000UL) {
+    tcp->close(true);  ///< No PINGRESP within a keepalive period, the broker is gone.
+    status = MQTT_CONNECTION_TIMEOUT;
+    return false;
+  }
+  if (ping_ms == 0 && now - last_tx >= MQTT_ASYNC_KEEPALIVE * 1000UL / 2) {
+    uint8_t ping[2] = { PKT_PINGREQ, 0 };
+    if (write(ping, sizeof(ping))) {
+      ping_ms = now;
+    }
+  }
+  return true;
+}
+
+bool AsyncMqtt::publish(const char* topic, const uint8_t* payload, unsigned int length){
+  InFlight* slot = nullptr;
+
+  if (status != MQTT_CONNECTED) {
+    return false;
+  }
+  for (InFlight& entry : window) {
+    if (entry.data == nullptr) {
+      slot = &entry;
+      break;
+    }
+  }
+  if (slot == nullptr) {
+    return false;  ///< Window full, the caller keeps the message in its queue.
+  }
+
+  size_t topic_len = strlen(topic);
+  uint32_t remaining = 2 + topic_len + 2 + length;
+  uint8_t* packet = alloc(remaining + 5);
+  if (packet == nullptr) {
+    return false;
+  }
+
+  // Packet identifiers are not reused while a publish with the same one is in flight
+  bool used;
+  do {
+    if (++next_id == 0) next_id = 1;
+    used = false;
+    for (InFlight& entry : window) {
+      used |= entry.data != nullptr && entry.id == next_id;
+    }
+  } while (used);
+
+  size_t n = header(packet, PKT_PUBLISH | PUBLISH_QOS1, remaining);
+  n += string(packet + n, topic, topic_len);
+  packet[n++] = next_id >> 8;
+  packet[n++] = next_id & 0xFF;
+  memcpy(packet + n, payload, length);
+  n += length;
+
+  if (!write(packet, n)) {
+    release(packet);
+    return false;
+  }
+  *slot = { packet, (uint16_t)n, next_id, next_seq++, TRACE_TIME_US(), false };
+  return true;
+}
+
+bool AsyncMqtt::publish(const char* topic, const char* payload){
+  return publish(topic, (const uint8_t*)payload, strlen(payload));
+}
+
+bool AsyncMqtt::subscribe(const char* topic){
+  return subscribe(&topic, 1) == 1;
+}
+
+uint8_t AsyncMqtt::subscribe(const char* const* topics, uint8_t count){
+  uint8_t packets = 0;
+  uint8_t first = 0;
+
+  if (status != MQTT_CONNECTED) {
+    return 0;
+  }
+  uint8_t* packet = alloc(MQTT_ASYNC_LARGE);
+  if (packet == nullptr) {
+    return 0;
+  }
+  while (first < count) {
+    // Take the filters which fit, the fixed header needs at most 3 bytes for this size
+    uint32_t remaining = 2;
+    uint8_t last = first;
+    while (last < count && 3 + remaining + 2 + strlen(topics[last]) + 1 <= MQTT_ASYNC_LARGE) {
+      remaining += 2 + strlen(topics[last]) + 1;
+      last++;
+    }
+    if (last == first) {
+      break;  ///< A single filter larger than a buffer.
+    }
+    if (++next_id == 0) next_id = 1;
+    size_t n = header(packet, PKT_SUBSCRIBE, remaining);
+    packet[n++] = next_id >> 8;
+    packet[n++] = next_id & 0xFF;
+    for (uint8_t i = first; i < last; i++) {
+      n += string(packet + n, topics[i], strlen(topics[i]));
+      packet[n++] = 0;  ///< Requested QoS 0.
+    }
+    if (!write(packet, n)) {
+      break;
+    }
+    packets++;
+    first = last;
+  }
+  release(packet);
+  return first == count ? packets : 0;
+}
+
+void AsyncMqtt::disconnect(){
+  if (status == MQTT_CONNECTED) {
+    uint8_t packet[2] = { PKT_DISCONNECT, 0 };
+    write(packet, sizeof(packet));
+  }
+  tcp->close();
+  status = MQTT_DISCONNECTED;
+}
+
+void AsyncMqtt::metrics(Print& out) const {
+  uint8_t in_flight = 0;
+  for (const InFlight& slot : window) {
+    in_flight += slot.data != nullptr;
+  }
+  out.printf("# TYPE mqtt_inflight gauge\nmqtt_inflight %u\n", in_flight);
+  out.printf("# TYPE mqtt_acked_total counter\nmqtt_acked_total %lu\n", (unsigned long)acked);
+  out.printf("# TYPE mqtt_retransmits_total counter\nmqtt_retransmits_total %lu\n", (unsigned long)retransmits);
+  out.printf("# TYPE mqtt_rx_dropped_total counter\nmqtt_rx_dropped_total %lu\n", (unsigned long)rx_dropped);
+  out.printf("# TYPE mqtt_malformed_total counter\nmqtt_malformed_total %lu\n", (unsigned long)malformed);
+  out.printf("# TYPE mqtt_buffers_used gauge\nmqtt_buffers_used{size=\"%u\"} %u\nmqtt_buffers_used{size=\"%u\"} %u\n",
+             MQTT_ASYNC_SMALL, small.used(), MQTT_ASYNC_LARGE, large.used());
+  out.printf("# TYPE mqtt_buffer_failures_total counter\nmqtt_buffer_failures_total %lu\n",
+             (unsigned long)(small.failCount() + large.failCount()));
+}
@@ -0,0 +1,243 @@
+#ifndef ASYNCMQTT_H
+#define ASYNCMQTT_H
+
+/**
+ * @class AsyncMqtt
+ * @brief An event-driven MQTT 3.1.1 client on AsyncTCP with a window of QoS 1 publishes.
+ *
+ * Offers the subset of the PubSubClient interface used by MqttHandler, so either one can be the
+ * transport (see MqttClient in MqttHandler.h). Unlike PubSubClient it never blocks:
+ * - connect() starts the TCP connection and returns false with state() MQTT_CONNECTING until
+ *   the CONNACK has been processed, or until the socket timeout turns it into a failure.
+ * - Received bytes are framed into packets on the AsyncTCP task, copied into pooled buffers and
+ *   handed to the network task through a queue; the receive hook wakes the network task, which
+ *   processes them in loop(). Callbacks therefore run on the network task, as with PubSubClient.
+ * - Publishes are QoS 1. Up to MQTT_ASYNC_WINDOW of them may be awaiting their PUBACK; they
+ *   keep their packet in a pooled buffer and are sent again with the DUP flag after a reconnect.
+ *   The session is persistent (clean session off), so the broker drops the duplicates.
+ * - Connect attempts alternate between two sockets. The events of the socket of an abandoned
+ *   attempt, such as its late disconnect after a timeout, are ignored by the callbacks.
+ * - A remaining length longer than the 4 bytes allowed by MQTT closes the connection.
+ *
+ * Packet buffers come from two BufferPools instead of one fixed MQTT_MAX_PACKET_SIZE buffer, so
+ * a burst of small packets does not need the memory of the largest one.
+ */
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <functional>
+#include <BufferPool.h>
+#include <SpscQueue.h>
+#include <LatencyTrace.h>
+
+#ifndef MQTT_CONNECTED
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+#endif
+#define MQTT_CONNECTING -5              ///< A connect is in progress, never reported by PubSubClient.
+
+#define MQTT_ASYNC_WINDOW 8             ///< QoS 1 publishes awaiting their PUBACK.
+#define MQTT_ASYNC_KEEPALIVE 15         ///< Keepalive in seconds.
+#define MQTT_ASYNC_SMALL 128            ///< Size of a small packet buffer.
+#define MQTT_ASYNC_SMALL_COUNT 16       ///< Number of small packet buffers.
+#define MQTT_ASYNC_LARGE 512            ///< Size of a large packet buffer, the largest packet received.
+#define MQTT_ASYNC_LARGE_COUNT 4        ///< Number of large packet buffers.
+#define MQTT_ASYNC_RX_LEN 8             ///< Received packets waiting for loop(), power of two.
+
+/**
+ * @brief A received packet: the fixed header byte followed by the variable header and payload.
+ */
+struct MqttPacket {
+    uint8_t* data;          ///< Pooled buffer.
+    uint16_t length;        ///< Bytes in the buffer.
+};
+
+/**
+ * @brief A QoS 1 publish awaiting its PUBACK.
+ */
+struct InFlight {
+    uint8_t* data;          ///< The encoded PUBLISH packet, nullptr if the slot is free.
+    uint16_t length;        ///< Packet length.
+    uint16_t id;            ///< Packet identifier.
+    uint32_t seq;           ///< Order of the first send, retransmits keep it.
+    uint32_t stamp;         ///< TRACE_TIME_US() of the last send.
+    bool resend;            ///< Waiting to be sent again after a reconnect.
+};
+
+class AsyncMqtt {
+public:
+    typedef std::function<void(char*, uint8_t*, unsigned int)> Callback;
+
+private:
+    /**
+     * @brief Step of the receive framer.
+     */
+    enum class RxStep : uint8_t { HEADER, LENGTH, BODY, DISCARD };
+
+    AsyncClient sockets[2];                         ///< Alternated per connect attempt.
+    AsyncClient* tcp = &sockets[0];                 ///< Socket of the current attempt, network task.
+    std::atomic<AsyncClient*> active{&sockets[0]};  ///< Same, read by the AsyncTCP callbacks.
+    const char* host = nullptr;                     ///< Broker address, not copied.
+    uint16_t port = 1883;                           ///< Broker port.
+    const char* client_id = nullptr;                ///< Client id of the last connect(), not copied.
+    Callback callback;                              ///< Called for every received PUBLISH.
+    void (*wake)() = nullptr;                       ///< Called on the AsyncTCP task when packets are queued.
+    uint32_t timeout_ms = 15000;                    ///< Time allowed from connect() to the CONNACK.
+
+    BufferPool<MQTT_ASYNC_SMALL, MQTT_ASYNC_SMALL_COUNT> small;     ///< Small packet buffers.
+    BufferPool<MQTT_ASYNC_LARGE, MQTT_ASYNC_LARGE_COUNT> large;     ///< Large packet buffers.
+    SpscQueue<MqttPacket, MQTT_ASYNC_RX_LEN> rx;    ///< AsyncTCP task to network task.
+
+    // Receive framer, AsyncTCP task only
+    RxStep rx_step = RxStep::HEADER;                ///< Current step.
+    uint8_t rx_header = 0;                          ///< Fixed header byte of the packet.
+    uint8_t rx_shift = 0;                           ///< Bit position of the next remaining length byte.
+    uint32_t rx_remaining = 0;                      ///< Bytes of the packet still to come.
+    uint8_t* rx_buf = nullptr;                      ///< Buffer of the packet, nullptr if it is skipped.
+    uint16_t rx_pos = 0;                            ///< Bytes in the buffer.
+    uint32_t rx_dropped = 0;                        ///< Packets skipped for lack of a buffer.
+    std::atomic<bool> tcp_closed{false};            ///< Set when the connection is closed.
+    std::atomic<bool> rx_malformed{false};          ///< Set when a packet cannot be framed.
+
+    // Session, network task only
+    int status = MQTT_DISCONNECTED;                 ///< Value of state().
+    uint32_t connect_ms = 0;                        ///< millis() of the connect attempt.
+    uint32_t last_tx = 0;                           ///< millis() of the last packet sent.
+    uint32_t ping_ms = 0;                           ///< millis() of the unanswered PINGREQ, 0 if none.
+    InFlight window[MQTT_ASYNC_WINDOW];             ///< Publishes awaiting their PUBACK.
+    uint16_t next_id = 1;                           ///< Next packet identifier.
+    uint32_t next_seq = 0;                          ///< Next send order.
+    uint32_t acked = 0;                             ///< Publishes acknowledged.
+    uint32_t retransmits = 0;                       ///< Publishes sent again after a reconnect.
+    uint32_t malformed = 0;                         ///< Connections closed for a malformed packet.
+
+    /**
+     * @brief Returns true if the event comes from the socket of the current attempt.
+     */
+    bool current(AsyncClient* client) const { return client == active.load(std::memory_order_acquire); }
+
+    uint8_t* alloc(size_t len);
+    void release(uint8_t* buffer);
+
+    /**
+     * @brief Frames received bytes into packets, called on the AsyncTCP task.
+     */
+    void onData(const uint8_t* data, size_t len);
+
+    /**
+     * @brief Queues the framed packet for the network task.
+     */
+    void complete();
+
+    /**
+     * @brief Sends the CONNECT packet, called on the AsyncTCP task once TCP is up.
+     */
+    void sendConnect(AsyncClient* client);
+
+    /**
+     * @brief Processes the received packets and the closing of the connection.
+     */
+    void process();
+
+    /**
+     * @brief Handles one received packet.
+     */
+    void handle(uint8_t* data, uint16_t length);
+
+    /**
+     * @brief Sends the publishes marked for retransmission, oldest first.
+     */
+    void resend();
+
+    /**
+     * @brief Writes a packet to the connection.
+     *
+     * @return False if it does not fit in the TCP send buffer, nothing is sent then.
+     */
+    bool write(const uint8_t* packet, size_t len);
+
+    /**
+     * @brief Encodes a fixed header.
+     *
+     * @return Length of the header.
+     */
+    static size_t header(uint8_t* out, uint8_t type, uint32_t remaining);
+
+    /**
+     * @brief Encodes a length-prefixed string.
+     *
+     * @return Bytes written.
+     */
+    static size_t string(uint8_t* out, const char* text, size_t len);
+
+public:
+    AsyncMqtt();
+
+    AsyncMqtt& setServer(const char* domain, uint16_t port);
+    AsyncMqtt& setCallback(Callback cb);
+
+    /**
+     * @brief Sets the time allowed for the broker to answer a connect, in seconds.
+     */
+    AsyncMqtt& setSocketTimeout(uint16_t seconds);
+
+    /**
+     * @brief Sets the hook called on the AsyncTCP task when packets are waiting for loop().
+     */
+    AsyncMqtt& onReceive(void (*hook)());
+
+    /**
+     * @brief Starts or polls a connect.
+     *
+     * @param id Client id, must stay valid while connected.
+     * @return True once connected, false while connecting (state() is MQTT_CONNECTING) or if
+     *         the attempt failed.
+     */
+    bool connect(const char* id);
+
+    /**
+     * @brief Processes received packets and keeps the connection alive.
+     *
+     * @return False if the connection is lost.
+     */
+    bool loop();
+
+    /**
+     * @brief Publishes a message with QoS 1.
+     *
+     * @return False if not connected, the window or the pool is full, or the TCP send buffer is.
+     */
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length);
+    bool publish(const char* topic, const char* payload);
+
+    /**
+     * @brief Subscribes to a topic with QoS 0.
+     */
+    bool subscribe(const char* topic);
+
+    /**
+     * @brief Subscribes to several topics with QoS 0 in as few SUBSCRIBE packets as fit in a
+     * large buffer, one packet for a typical topic table.
+     *
+     * @return Number of packets sent, 0 if not connected or a packet could not be sent.
+     */
+    uint8_t subscribe(const char* const* topics, uint8_t count);
+
+    void disconnect();
+    bool connected() const { return status == MQTT_CONNECTED; }
+    int state() const { return status; }
+
+    /**
+     * @brief Returns the number of received packets waiting for loop().
+     */
+    uint32_t available() const { return rx.size(); }
+
+    /**
+     * @brief Writes the window, retransmit and buffer counters in Prometheus text format.
+     */
+    void metrics(Print& out) const;
+};
+
+#endif // ASYNCMQTT_H
@@ -0,0 +1,26 @@
+#include "BootProfiler.h"
+#include <Hal.h>
+
+void BootProfiler::mark(const char* name) {
+  if (count >= BOOT_MAX_PHASES) {
+    return;
+  }
+  names[count] = name;
+  ends[count] = hal_time_us();  ///< Microseconds since boot.
+  count++;
+}
+
+size_t BootProfiler::format(char* buffer, size_t len) const {
+  size_t pos = 0;
+  int64_t start = 0;
+
+  buffer[0] = '\0';
+  for (uint8_t i = 0; i < count && pos < len; i++) {
+    pos += snprintf(buffer + pos, len - pos, "%s=%lu,", names[i], (unsigned long)(ends[i] - start));
+    start = ends[i];
+  }
+  if (pos < len) {
+    pos += snprintf(buffer + pos, len - pos, "total=%lu", (unsigned long)start);
+  }
+  return pos < len ? pos : len - 1;
+}
@@ -0,0 +1,42 @@
+#ifndef BOOTPROFILER_H
+#define BOOTPROFILER_H
+
+/**
+ * @class BootProfiler
+ * @brief Records the duration of each startup phase.
+ *
+ * Each call to mark() closes the current phase and timestamps it with hal_time_us(),
+ * so the breakdown of setup() can be published once the node is connected.
+ * Phase names are not copied, they must be string literals.
+ */
+#include <Arduino.h>
+
+#define BOOT_MAX_PHASES 16      ///< Maximum number of recorded phases.
+
+class BootProfiler {
+private:
+    const char* names[BOOT_MAX_PHASES];     ///< Phase names.
+    int64_t ends[BOOT_MAX_PHASES];          ///< End of each phase in microseconds since boot.
+    uint8_t count = 0;                      ///< Number of recorded phases.
+
+public:
+    /**
+     * @brief Ends the current phase.
+     *
+     * The phase starts at the end of the previous one, or at boot for the first phase.
+     * @param name Name of the phase.
+     */
+    void mark(const char* name);
+
+    /**
+     * @brief Formats the breakdown as comma-separated name=microseconds pairs.
+     *
+     * The last pair is the total time since boot of the last mark.
+     * @param buffer The output buffer.
+     * @param len Size of the buffer.
+     * @return Length of the formatted text.
+     */
+    size_t format(char* buffer, size_t len) const;
+};
+
+#endif // BOOTPROFILER_H
@@ -0,0 +1,80 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+/**
+ * @class BufferPool
+ * @brief A lock-free pool of fixed-size blocks in static memory.
+ *
+ * Replaces heap allocations of packet buffers: a block is taken with alloc() and handed back
+ * with release(). The free blocks are a bitmask updated with compare-and-swap, so any task may
+ * allocate and any task may release, e.g. a buffer filled on the AsyncTCP task and released by
+ * the network task.
+ *
+ * @tparam SIZE Size of one block in bytes.
+ * @tparam N Number of blocks, at most 32.
+ */
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+template <size_t SIZE, uint8_t N>
+class BufferPool {
+    static_assert(N > 0 && N <= 32, "BufferPool holds at most 32 blocks");
+
+private:
+    uint8_t blocks[N][SIZE];                        ///< Block storage.
+    std::atomic<uint32_t> free_mask{N == 32 ? 0xFFFFFFFFu : (1u << N) - 1};   ///< Bit i set if block i is free.
+    std::atomic<uint32_t> failures{0};              ///< alloc() calls which found no free block.
+
+public:
+    /**
+     * @brief Takes a free block.
+     *
+     * @return The block, nullptr if all blocks are in use.
+     */
+    uint8_t* alloc() {
+        uint32_t mask = free_mask.load(std::memory_order_relaxed);
+        while (mask != 0) {
+            uint8_t i = __builtin_ctz(mask);
+            if (free_mask.compare_exchange_weak(mask, mask & ~(1u << i), std::memory_order_acquire)) {
+                return blocks[i];
+            }
+        }
+        failures.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    /**
+     * @brief Hands a block back to the pool.
+     *
+     * @param block A block returned by alloc().
+     */
+    void release(uint8_t* block) {
+        uint8_t i = (block - blocks[0]) / SIZE;
+        free_mask.fetch_or(1u << i, std::memory_order_release);
+    }
+
+    /**
+     * @brief Returns true if the pointer is a block of this pool.
+     */
+    bool owns(const uint8_t* block) const {
+        return block >= blocks[0] && block < blocks[0] + sizeof(blocks);
+    }
+
+    /**
+     * @brief Returns the number of blocks in use.
+     */
+    uint8_t used() const { return N - __builtin_popcount(free_mask.load(std::memory_order_relaxed)); }
+
+    /**
+     * @brief Returns the number of allocations which failed because the pool was empty.
+     */
+    uint32_t failCount() const { return failures.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns the size of a block.
+     */
+    static constexpr size_t blockSize() { return SIZE; }
+};
+
+#endif // BUFFERPOOL_H
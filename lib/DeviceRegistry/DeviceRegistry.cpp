@@ -0,0 +1,142 @@
+#include "DeviceRegistry.h"
+
+// True for a relay the node must not drive, its pin is in DEVICE_RESERVED_PINS
+static bool reserved(const Device& dev) {
+  return dev.kind == DeviceKind::RELAY && (dev.pin >= 64 || (DEVICE_RESERVED_PINS & (1ULL << dev.pin)));
+}
+
+void DeviceRegistry::begin(MemoryHandler& memory) {
+  size_t len = memory.getDevices((uint8_t*)table, sizeof(table));
+  count = len / sizeof(Device);
+
+  if (count == 0) {
+    // Legacy layout, topic order 'temp:dev1:dev2:display'.
+    table[0] = {27, true, 1, DeviceKind::RELAY, false};
+    table[1] = {26, true, 2, DeviceKind::RELAY, false};
+    table[2] = {0, false, 3, DeviceKind::DISPLAY, false};
+    count = 3;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    table[i].state = false;
+    if (reserved(table[i])) {
+      Serial.printf("Relay %u on reserved GPIO %u is disabled.\n", i, table[i].pin);  ///< Stored by an older firmware.
+    } else if (table[i].kind == DeviceKind::RELAY) {
+      gpio.stage(table[i].pin, table[i].active_low);  ///< Inactive level, set before the pin becomes an output.
+    }
+  }
+  gpio.commit();
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (table[i].kind == DeviceKind::RELAY && !reserved(table[i])) {
+      pinMode(table[i].pin, OUTPUT);
+    }
+  }
+}
+
+bool DeviceRegistry::set(uint8_t id, bool on) {
+  if (id >= count || table[id].kind != DeviceKind::RELAY || reserved(table[id])) {
+    return false;
+  }
+  table[id].state = on;
+  gpio.stage(table[id].pin, on != table[id].active_low);
+  return true;
+}
+
+void DeviceRegistry::commit() {
+  gpio.commit();
+}
+
+// Output-capable GPIOs: below 34, without the flash pins 6 to 11 and the missing 20, 24 and 28 to 31
+static const uint64_t output_pins = ((1ULL << 34) - 1) & ~(0x3FULL << 6) & ~(1ULL << 20) & ~(1ULL << 24) & ~(0xFULL << 28);
+
+// Parses a decimal field of an entry, the whole field must be a number
+static bool parseNumber(const char* field, unsigned long& value) {
+  char* end;
+  if (field == nullptr || *field == '\0') {
+    return false;
+  }
+  value = strtoul(field, &end, 10);
+  return *end == '\0';
+}
+
+uint8_t DeviceRegistry::parse(const char* text, uint8_t topic_count, Device* devices, const char*& error) {
+  uint8_t count = 0;
+  uint64_t pins = 0;
+  bool display = false;
+
+  while (*text != '\0') {
+    char entry[32];
+    char* fields[5] = {nullptr};
+    char* save;
+    uint8_t n = 0;
+    size_t len = strcspn(text, ",");
+
+    if (len >= sizeof(entry)) {
+      error = "entry too long";
+      return 0;
+    }
+    memcpy(entry, text, len);
+    entry[len] = '\0';
+    text += text[len] == ',' ? len + 1 : len;
+    for (char* field = strtok_r(entry, ":", &save); field != nullptr && n < 5; field = strtok_r(nullptr, ":", &save)) {
+      fields[n++] = field;
+    }
+    if (n == 0) {
+      continue;  ///< Empty entry, e.g. a trailing comma.
+    }
+    if (count == DEVICE_CAPACITY) {
+      error = "too many devices";
+      return 0;
+    }
+
+    Device& dev = devices[count];
+    unsigned long pin = 0, topic = 0;
+    if (strcmp(fields[0], "relay") == 0 && (n == 3 || n == 4)) {
+      if (!parseNumber(fields[1], pin) || !parseNumber(fields[2], topic) ||
+          (n == 4 && strcmp(fields[3], "high") != 0 && strcmp(fields[3], "low") != 0)) {
+        error = "malformed relay";
+        return 0;
+      }
+      if (pin >= 64 || !(output_pins & (1ULL << pin))) {
+        error = "pin is not an output";
+        return 0;
+      }
+      if (DEVICE_RESERVED_PINS & (1ULL << pin)) {
+        error = "pin is used by the node";
+        return 0;
+      }
+      if (pins & (1ULL << pin)) {
+        error = "pin is used twice";
+        return 0;
+      }
+      pins |= 1ULL << pin;
+      dev = {(uint8_t)pin, n == 3 || strcmp(fields[3], "low") == 0, 0, DeviceKind::RELAY, false};
+    } else if (strcmp(fields[0], "display") == 0 && n == 2) {
+      if (!parseNumber(fields[1], topic)) {
+        error = "malformed display";
+        return 0;
+      }
+      if (display) {
+        error = "second display";
+        return 0;
+      }
+      display = true;
+      dev = {0, false, 0, DeviceKind::DISPLAY, false};
+    } else {
+      error = "unknown device";
+      return 0;
+    }
+    if (topic >= topic_count) {
+      error = "unknown topic";
+      return 0;
+    }
+    dev.topic = topic;
+    count++;
+  }
+
+  if (count == 0) {
+    error = "no devices";
+  }
+  return count;
+}
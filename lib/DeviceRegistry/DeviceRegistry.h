@@ -0,0 +1,107 @@
+#ifndef DEVICEREGISTRY_H
+#define DEVICEREGISTRY_H
+
+/**
+ * @class DeviceRegistry
+ * @brief A compact table of the devices (relays, display) controlled by the node.
+ *
+ * Each entry describes the pin, its polarity, the index of the topic controlling it and the
+ * current state. The table is loaded from MemoryHandler; if none is stored the legacy layout
+ * is used (relays on pins 27 and 26 for topics 1 and 2, display on topic 3).
+ * Relay changes are staged in a GpioBank and applied by commit(), so a scene switching many
+ * relays is written to the output registers at once.
+ * A new table is provisioned as text (see parse()) from the portal or over MQTT and is
+ * loaded on the next boot.
+ */
+#include <Arduino.h>
+#include <GpioBank.h>
+#include <MemoryHandler.h>
+
+#define DEVICE_CAPACITY 16      ///< Maximum number of devices in the table.
+#define DEVICE_TEXT_LEN 256     ///< Longest device table text, including terminator.
+
+#ifndef DEVICE_RESERVED_PINS
+/// GPIOs used by the node itself: LED, matrix CS, button, OneWire, SPI clock and data, the UART0
+/// console (1 and 3), and the strapping pins 0 and 12, which a relay driver could pull into the
+/// download mode or the 1.8 V flash voltage at reset.
+#define DEVICE_RESERVED_PINS ((1ULL << 0) | (1ULL << 1) | (1ULL << 2) | (1ULL << 3) | (1ULL << 5) | (1ULL << 12) | \
+                              (1ULL << 14) | (1ULL << 15) | (1ULL << 18) | (1ULL << 23))
+#endif
+
+/**
+ * @brief Kind of a device.
+ */
+enum class DeviceKind : uint8_t {
+    RELAY,      ///< Output pin switching a relay.
+    DISPLAY     ///< The LED matrix display, has no pin.
+};
+
+/**
+ * @brief One entry of the device table, stored as-is in memory.
+ */
+struct Device {
+    uint8_t pin;            ///< GPIO number of the relay.
+    bool active_low;        ///< True if a LOW level turns the device on.
+    uint8_t topic;          ///< Index of the controlling topic in the topic list.
+    DeviceKind kind;        ///< Kind of the device.
+    bool state;             ///< Current state, true is on.
+};
+
+class DeviceRegistry {
+private:
+    Device table[DEVICE_CAPACITY];  ///< Device entries.
+    uint8_t count = 0;              ///< Number of valid entries.
+    GpioBank gpio;                  ///< Output registers of the relay pins.
+
+public:
+    /**
+     * @brief Loads the device table and configures the relay pins.
+     *
+     * All relays start switched off. A relay stored on a pin which was reserved since keeps its
+     * id but its pin is never driven.
+     * @param memory Reference to the MemoryHandler holding the table.
+     */
+    void begin(MemoryHandler& memory);
+
+    /**
+     * @brief Stages a new state for a device.
+     *
+     * The pin level is applied on the next commit().
+     * @param id Index of the device in the table.
+     * @param on True to switch the device on.
+     * @return False if the id is not a relay or its pin is reserved.
+     */
+    bool set(uint8_t id, bool on);
+
+    /**
+     * @brief Applies all staged relay states in one write.
+     */
+    void commit();
+
+    /**
+     * @brief Returns the number of devices in the table.
+     */
+    uint8_t size() const { return count; }
+
+    /**
+     * @brief Returns a device entry.
+     */
+    const Device& operator[](uint8_t id) const { return table[id]; }
+
+    /**
+     * @brief Parses and validates a device table written as comma-separated entries,
+     * 'relay:<pin>:<topic>[:high]' or 'display:<topic>'.
+     *
+     * Relays are active low unless marked high. Relay pins must be output-capable GPIOs (below
+     * 34, not the flash pins 6 to 11 or a missing pin), not in DEVICE_RESERVED_PINS and used
+     * once. There is at most one display.
+     * @param text NUL-terminated table text.
+     * @param topic_count Number of topics in the topic list, topics are indexes into it.
+     * @param devices Receives up to DEVICE_CAPACITY entries, switched off.
+     * @param error Receives the reason when the table is rejected.
+     * @return Number of entries, 0 if the table is rejected.
+     */
+    static uint8_t parse(const char* text, uint8_t topic_count, Device* devices, const char*& error);
+};
+
+#endif // DEVICEREGISTRY_H
@@ -0,0 +1,125 @@
+#include "DisplayEngine.h"
+#include <LatencyTrace.h>
+
+DisplayEngine::DisplayEngine(MD_MAX72XX& mx, uint8_t count, bool rows)
+  : matrix(mx), devices(count > DISPLAY_DEVICES_MAX ? DISPLAY_DEVICES_MAX : count), digit_rows(rows) {}
+
+void DisplayEngine::begin(){
+  matrix.control(MD_MAX72XX::UPDATE, MD_MAX72XX::OFF);   // Nothing is sent until commit() calls update()
+  matrix.clear();
+  matrix.update();
+  memset(committed, 0, sizeof(committed));
+}
+
+bool DisplayEngine::show(const char* text, DisplayEffect effect){
+  bool fits = depth < DISPLAY_QUEUE_LEN;
+  if (!fits) {
+    head = (head + 1) % DISPLAY_QUEUE_LEN;   // Dropping the oldest, the newest text is the one that matters
+    depth--;
+    dropped++;
+  }
+  DisplayMessage& message = queue[(head + depth) % DISPLAY_QUEUE_LEN];
+  strncpy(message.text, text, DISPLAY_TEXT_LEN - 1);
+  message.text[DISPLAY_TEXT_LEN - 1] = '\0';
+  message.effect = effect;
+  depth++;
+  return fits;
+}
+
+void DisplayEngine::render(const char* text){
+  uint8_t glyph[8];
+  strip_len = 0;
+
+  for (const char* p = text; *p != '\0'; p++) {
+    uint8_t width = matrix.getChar((uint8_t)*p, sizeof(glyph), glyph);
+    if (strip_len + width > DISPLAY_STRIP_LEN) {
+      break;
+    }
+    memcpy(strip + strip_len, glyph, width);
+    strip_len += width;
+    for (uint8_t i = 0; i < DISPLAY_CHAR_SPACING && p[1] != '\0' && strip_len < DISPLAY_STRIP_LEN; i++) {
+      strip[strip_len++] = 0;
+    }
+  }
+}
+
+void DisplayEngine::start(){
+  const DisplayMessage& message = queue[head];
+  uint16_t width = devices * 8;
+
+  render(message.text);
+  scrolling = message.effect == DisplayEffect::SCROLL ||
+              (message.effect == DisplayEffect::AUTO && strip_len > width);
+  offset = scrolling ? -(int16_t)width : 0;   // A scrolling text enters from the right edge
+  showing = true;
+  head = (head + 1) % DISPLAY_QUEUE_LEN;
+  depth--;
+  messages++;
+}
+
+void DisplayEngine::commit(){
+  uint16_t width = devices * 8;
+  uint16_t changed = 0;
+  uint8_t lines = 0;
+
+  for (uint16_t x = 0; x < width; x++) {
+    if (frame[x] != committed[x]) {
+      uint16_t column = width - 1 - x;   // MD_MAX72XX counts columns from the right
+      matrix.setColumn(column, frame[x]);
+      committed[x] = frame[x];
+      lines |= 1 << (column % 8);
+      changed++;
+    }
+  }
+  frames++;
+  if (changed == 0) {
+    skipped++;
+    return;
+  }
+  matrix.update();
+
+  // One transaction per digit line flagged, 2 bytes for every device of the chain
+  last_bytes = (digit_rows ? 8 : __builtin_popcount(lines)) * 2 * devices;
+  spi_bytes += last_bytes;
+  columns += changed;
+}
+
+bool DisplayEngine::tick(){
+  uint32_t start_cycles = TRACE_CYCLES();
+  uint16_t width = devices * 8;
+
+  if (!showing) {
+    if (depth == 0) {
+      return false;
+    }
+    start();
+  }
+
+  for (uint16_t x = 0; x < width; x++) {
+    int32_t column = offset + x;
+    frame[x] = column >= 0 && column < strip_len ? strip[column] : 0;
+  }
+  commit();
+
+  if (!scrolling) {
+    showing = false;
+  } else if (++offset >= (int16_t)strip_len) {
+    if (depth > 0) {
+      showing = false;   // Pass complete, the next message takes over
+    } else {
+      offset = -(int16_t)width;
+    }
+  }
+  TRACE_RECORD(trace_display_frame, TRACE_CYCLES() - start_cycles);
+  return showing || depth > 0;
+}
+
+void DisplayEngine::metrics(Print& out) const {
+  out.printf("# TYPE display_messages_total counter\ndisplay_messages_total %lu\n", (unsigned long)messages);
+  out.printf("# TYPE display_messages_dropped_total counter\ndisplay_messages_dropped_total %lu\n", (unsigned long)dropped);
+  out.printf("# TYPE display_frames_total counter\ndisplay_frames_total %lu\n", (unsigned long)frames);
+  out.printf("# TYPE display_frames_skipped_total counter\ndisplay_frames_skipped_total %lu\n", (unsigned long)skipped);
+  out.printf("# TYPE display_columns_total counter\ndisplay_columns_total %lu\n", (unsigned long)columns);
+  out.printf("# TYPE display_spi_bytes_total counter\ndisplay_spi_bytes_total %lu\n", (unsigned long)spi_bytes);
+  out.printf("# TYPE display_spi_bytes_last gauge\ndisplay_spi_bytes_last %u\n", last_bytes);
+}
@@ -0,0 +1,128 @@
+#ifndef DISPLAYENGINE_H
+#define DISPLAYENGINE_H
+
+/**
+ * @class DisplayEngine
+ * @brief A non-blocking text engine for the MAX72xx LED matrix, pushing only what changed.
+ *
+ * Messages are queued by show() and rendered by tick(), which the control loop runs as its own
+ * task, one frame per call. A text which fits the matrix is printed left aligned, a longer one
+ * scrolls across it and repeats until the next message is queued.
+ *
+ * Each frame is rendered into a column buffer with the MD_MAX72XX font and compared with the
+ * frame last sent. Automatic updates of MD_MAX72XX are off, only the changed columns are written
+ * and update() then sends only the digit registers of the changed devices, one SPI transaction
+ * per register line with no-ops for the devices which did not change. A frame equal to the last
+ * one sends nothing. MD_Parola is not used, its displayAnimate() turns automatic updates back on
+ * and sends every redrawn frame in full.
+ *
+ * The SPI bytes of each frame are counted from the digit lines MD_MAX72XX sends. A module which
+ * wires the MAX72xx digits to the matrix rows (digit_rows) resends all lines of a changed device,
+ * one wired to the columns only the lines of the changed columns.
+ */
+#include <Arduino.h>
+#include <MD_MAX72xx.h>
+#include <MqttHandler.h>
+
+#define DISPLAY_QUEUE_LEN 4             ///< Messages waiting to be shown, the oldest is dropped when full.
+#define DISPLAY_DEVICES_MAX 16          ///< Largest chain of 8x8 devices.
+#define DISPLAY_STRIP_LEN 256           ///< Columns of a rendered text, longer texts are cut.
+#define DISPLAY_CHAR_SPACING 1          ///< Blank columns between characters.
+#define DISPLAY_FRAME_MS 40             ///< Frame period while a text scrolls.
+
+/**
+ * @brief How a message is shown.
+ */
+enum class DisplayEffect : uint8_t {
+    AUTO,       ///< Printed if it fits the matrix, otherwise scrolled.
+    PRINT,      ///< Printed left aligned, cut at the right edge.
+    SCROLL      ///< Scrolled from right to left until the next message.
+};
+
+/**
+ * @brief A queued message.
+ */
+struct DisplayMessage {
+    char text[DISPLAY_TEXT_LEN];    ///< NUL-terminated text.
+    DisplayEffect effect;           ///< How the text is shown.
+};
+
+class DisplayEngine {
+private:
+    MD_MAX72XX& matrix;                             ///< The matrix driver, automatic updates off.
+    uint8_t devices;                                ///< Number of devices in the chain.
+    bool digit_rows;                                ///< True if the MAX72xx digits drive the matrix rows.
+    DisplayMessage queue[DISPLAY_QUEUE_LEN];        ///< Messages waiting to be shown.
+    uint8_t head = 0;                               ///< Index of the oldest queued message.
+    uint8_t depth = 0;                              ///< Number of queued messages.
+
+    uint8_t strip[DISPLAY_STRIP_LEN];               ///< Columns of the current text, left to right.
+    uint16_t strip_len = 0;                         ///< Columns used in strip.
+    bool scrolling = false;                         ///< True if the current text scrolls.
+    bool showing = false;                           ///< True until the current text is fully shown.
+    int16_t offset = 0;                             ///< Text column at the left edge, negative while entering.
+
+    uint8_t frame[DISPLAY_DEVICES_MAX * 8];         ///< Frame being rendered, left to right.
+    uint8_t committed[DISPLAY_DEVICES_MAX * 8];     ///< Frame last sent to the matrix.
+
+    uint32_t messages = 0;                          ///< Messages started.
+    uint32_t dropped = 0;                           ///< Messages dropped from a full queue.
+    uint32_t frames = 0;                            ///< Frames rendered.
+    uint32_t skipped = 0;                           ///< Frames equal to the last one, nothing sent.
+    uint32_t columns = 0;                           ///< Columns written.
+    uint32_t spi_bytes = 0;                         ///< Bytes sent over SPI.
+    uint16_t last_bytes = 0;                        ///< Bytes sent for the last frame which changed.
+
+    /**
+     * @brief Renders a text into strip with the MD_MAX72XX font.
+     */
+    void render(const char* text);
+
+    /**
+     * @brief Starts the oldest queued message.
+     */
+    void start();
+
+    /**
+     * @brief Writes the columns which differ from the committed frame and sends them.
+     */
+    void commit();
+
+public:
+    /**
+     * @brief Constructor for DisplayEngine class.
+     *
+     * @param mx The matrix driver, its begin() must run before the begin() of the engine.
+     * @param count Number of devices in the chain, at most DISPLAY_DEVICES_MAX.
+     * @param rows True if the module wires the MAX72xx digits to the matrix rows, only used to
+     *             count the SPI bytes.
+     */
+    DisplayEngine(MD_MAX72XX& mx, uint8_t count, bool rows);
+
+    /**
+     * @brief Turns automatic updates off and clears the matrix.
+     */
+    void begin();
+
+    /**
+     * @brief Queues a text, called by the control loop only.
+     *
+     * @return False if the queue was full and the oldest message was dropped.
+     */
+    bool show(const char* text, DisplayEffect effect = DisplayEffect::AUTO);
+
+    /**
+     * @brief Renders and sends the next frame, starting the next message when one is done.
+     *
+     * @return False once the last message is fully shown and nothing is queued, the task can
+     *         then be disabled until show() is called again.
+     */
+    bool tick();
+
+    /**
+     * @brief Writes the frame and SPI counters in Prometheus text format.
+     */
+    void metrics(Print& out) const;
+};
+
+#endif // DISPLAYENGINE_H
@@ -0,0 +1,35 @@
+#include "GpioBank.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <soc/gpio_struct.h>
+#endif
+
+void GpioBank::stage(uint8_t pin, bool level) {
+  uint64_t bit = 1ULL << pin;
+  if (level) {
+    set_mask |= bit;
+    clear_mask &= ~bit;
+  } else {
+    clear_mask |= bit;
+    set_mask &= ~bit;
+  }
+}
+
+void GpioBank::commit() {
+  if (set_mask == 0 && clear_mask == 0) {
+    return;  ///< Nothing staged.
+  }
+
+#ifdef ARDUINO_ARCH_ESP32
+  // Writes to the w1ts/w1tc registers only affect the pins whose bits are set.
+  if ((uint32_t)set_mask) GPIO.out_w1ts = (uint32_t)set_mask;
+  if ((uint32_t)clear_mask) GPIO.out_w1tc = (uint32_t)clear_mask;
+  if (set_mask >> 32) GPIO.out1_w1ts.val = (uint32_t)(set_mask >> 32);
+  if (clear_mask >> 32) GPIO.out1_w1tc.val = (uint32_t)(clear_mask >> 32);
+#endif
+
+  levels = (levels | set_mask) & ~clear_mask;
+  set_mask = 0;
+  clear_mask = 0;
+  commits++;
+}
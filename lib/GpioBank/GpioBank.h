@@ -0,0 +1,49 @@
+#ifndef GPIOBANK_H
+#define GPIOBANK_H
+
+/**
+ * @class GpioBank
+ * @brief Batched GPIO output writes through the set/clear registers.
+ *
+ * Output levels are staged into set and clear masks and committed together, so switching
+ * many relays costs one register write per bank instead of one digitalWrite() per pin.
+ * On ESP32 the masks go to GPIO.out_w1ts/out_w1tc (pins 0..31) and GPIO.out1_w1ts/out1_w1tc
+ * (pins 32..39). On other targets the bank keeps the levels in memory, which serves as the
+ * host mock for exercising the commit path off-device.
+ */
+#include <Arduino.h>
+
+class GpioBank {
+private:
+    uint64_t set_mask = 0;      ///< Pins staged to go high.
+    uint64_t clear_mask = 0;    ///< Pins staged to go low.
+    uint64_t levels = 0;        ///< Output levels after the last commit.
+    uint32_t commits = 0;       ///< Number of commits which wrote to the registers.
+
+public:
+    /**
+     * @brief Stages an output level for a pin.
+     *
+     * The level is applied on the next commit(). Staging the same pin again overrides it.
+     * @param pin The GPIO number (0..39).
+     * @param level The output level.
+     */
+    void stage(uint8_t pin, bool level);
+
+    /**
+     * @brief Writes all staged levels to the output registers at once.
+     */
+    void commit();
+
+    /**
+     * @brief Returns the output levels after the last commit, one bit per pin.
+     */
+    uint64_t state() const { return levels; }
+
+    /**
+     * @brief Returns the number of commits which wrote to the registers.
+     */
+    uint32_t commitCount() const { return commits; }
+};
+
+#endif // GPIOBANK_H
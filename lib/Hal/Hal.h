@@ -0,0 +1,85 @@
+#ifndef HAL_H
+#define HAL_H
+
+/**
+ * @file Hal.h
+ * @brief Thin hardware abstraction for the timing and checksum primitives used by the handlers.
+ *
+ * On ESP32 the functions map directly to the IDF calls and compile to the same code as calling
+ * them in place. On other targets they fall back to portable implementations, so the modules
+ * using them can be compiled and timed on a development host.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <esp_timer.h>
+#include <esp_rom_crc.h>
+#include <esp_cpu.h>
+#if __has_include(<esp_private/esp_clk.h>)
+#include <esp_private/esp_clk.h>
+#else
+#include <esp32/clk.h>
+#endif
+#else
+#include <chrono>
+#endif
+
+/**
+ * @brief Returns the time since boot in microseconds.
+ */
+inline int64_t hal_time_us() {
+#ifdef ARDUINO_ARCH_ESP32
+    return esp_timer_get_time();
+#else
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * @brief Returns the CPU cycle counter, wraps around every few seconds.
+ *
+ * On other targets a nanosecond clock is returned instead.
+ */
+inline uint32_t hal_cycles() {
+#ifdef ARDUINO_ARCH_ESP32
+    return esp_cpu_get_ccount();
+#else
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * @brief Returns the current CPU frequency in MHz, which changes under dynamic frequency scaling.
+ *
+ * On other targets 1000 is returned, the rate of the nanosecond clock of hal_cycles().
+ */
+inline uint32_t hal_cpu_mhz() {
+#ifdef ARDUINO_ARCH_ESP32
+    return esp_clk_cpu_freq() / 1000000;
+#else
+    return 1000;
+#endif
+}
+
+/**
+ * @brief Computes the CRC-32 (IEEE 802.3, little-endian) of a buffer.
+ */
+inline uint32_t hal_crc32(const uint8_t* data, size_t len) {
+#ifdef ARDUINO_ARCH_ESP32
+    return esp_rom_crc32_le(0, data, len);  ///< Table-driven implementation in ROM.
+#else
+    uint32_t crc = 0xFFFFFFFF;
+    while (len--) {
+        crc ^= *data++;
+        for (uint8_t k = 0; k < 8; k++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+    return ~crc;
+#endif
+}
+
+#endif // HAL_H
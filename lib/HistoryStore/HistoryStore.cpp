@@ -0,0 +1,511 @@
+#include "HistoryStore.h"
+#include <PayloadCodec.h>
+
+// Writes the low n bits of value MSB first, bits already past pos are overwritten
+static bool put_bits(uint8_t* body, uint16_t& pos, uint32_t value, uint8_t n) {
+  if (pos + n > HISTORY_PAGE_BITS) {
+    return false;
+  }
+  while (n > 0) {
+    uint8_t room = 8 - (pos & 7);
+    uint8_t take = n < room ? n : room;
+    uint8_t mask = ((1u << take) - 1) << (room - take);
+    uint8_t chunk = (value >> (n - take)) << (room - take);
+    body[pos >> 3] = (body[pos >> 3] & ~mask) | (chunk & mask);
+    pos += take;
+    n -= take;
+  }
+  return true;
+}
+
+static uint32_t get_bits(const uint8_t* body, uint16_t& pos, uint8_t n) {
+  uint32_t value = 0;
+  if (pos + n > HISTORY_PAGE_BITS) {
+    pos = HISTORY_PAGE_BITS + 1;  ///< Corrupt page, gorilla_next() stops.
+    return 0;
+  }
+  while (n > 0) {
+    uint8_t room = 8 - (pos & 7);
+    uint8_t take = n < room ? n : room;
+    value = (value << take) | ((body[pos >> 3] >> (room - take)) & ((1u << take) - 1));
+    pos += take;
+    n -= take;
+  }
+  return value;
+}
+
+static HistoryPageHeader page_header(const uint8_t* page) {
+  HistoryPageHeader header;
+  memcpy(&header, page, sizeof(header));  ///< The page buffer is not aligned.
+  return header;
+}
+
+bool gorilla_append(uint8_t* page, GorillaState& state, uint32_t time, float value) {
+  HistoryPageHeader header = page_header(page);
+  uint8_t* body = page + sizeof(HistoryPageHeader);
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  if (state.count == 0) {
+    // First sample: the time is in the header, the value is stored as is
+    state = GorillaState();
+    put_bits(body, state.bits, bits, 32);
+    state.leading = 0xFF;
+    header.first = time;
+  } else {
+    if (time < state.time) {
+      return false;  ///< The clock went back, start a new page.
+    }
+    GorillaState saved = state;
+    int32_t delta = time - state.time;
+    int32_t dod = delta - state.delta;
+    bool ok;
+
+    // Delta of delta in a prefix-coded bucket, one bit at a steady interval
+    if (dod == 0) {
+      ok = put_bits(body, state.bits, 0, 1);
+    } else if (dod >= -63 && dod <= 64) {
+      ok = put_bits(body, state.bits, 0b10, 2) && put_bits(body, state.bits, dod + 63, 7);
+    } else if (dod >= -255 && dod <= 256) {
+      ok = put_bits(body, state.bits, 0b110, 3) && put_bits(body, state.bits, dod + 255, 9);
+    } else if (dod >= -2047 && dod <= 2048) {
+      ok = put_bits(body, state.bits, 0b1110, 4) && put_bits(body, state.bits, dod + 2047, 12);
+    } else {
+      ok = put_bits(body, state.bits, 0b1111, 4) && put_bits(body, state.bits, (uint32_t)dod, 32);
+    }
+
+    // XOR with the previous value, only the window of changed bits is stored
+    uint32_t x = bits ^ state.value;
+    if (x == 0) {
+      ok = ok && put_bits(body, state.bits, 0, 1);
+    } else {
+      uint8_t leading = __builtin_clz(x);
+      uint8_t trailing = __builtin_ctz(x);
+      if (state.leading != 0xFF && leading >= state.leading && trailing >= state.trailing) {
+        ok = ok && put_bits(body, state.bits, 0b10, 2) &&
+             put_bits(body, state.bits, x >> state.trailing, 32 - state.leading - state.trailing);
+      } else {
+        uint8_t len = 32 - leading - trailing;
+        ok = ok && put_bits(body, state.bits, 0b11, 2) && put_bits(body, state.bits, leading, 5) &&
+             put_bits(body, state.bits, len - 1, 5) && put_bits(body, state.bits, x >> trailing, len);
+        state.leading = leading;
+        state.trailing = trailing;
+      }
+    }
+    if (!ok) {
+      state = saved;  ///< The bits past the saved position are free again.
+      return false;
+    }
+    state.delta = delta;
+  }
+  state.time = time;
+  state.value = bits;
+  state.count++;
+  header.count = state.count;
+  header.last = time;
+  memcpy(page, &header, sizeof(header));
+  return true;
+}
+
+bool gorilla_next(const uint8_t* page, GorillaState& state, uint32_t& time, float& value) {
+  HistoryPageHeader header = page_header(page);
+  const uint8_t* body = page + sizeof(HistoryPageHeader);
+
+  if (state.count >= header.count || state.bits > HISTORY_PAGE_BITS) {
+    return false;
+  }
+  if (state.count == 0) {
+    state.value = get_bits(body, state.bits, 32);
+    state.time = header.first;
+    state.delta = 0;
+    state.leading = 0xFF;
+  } else {
+    int32_t dod;
+    if (get_bits(body, state.bits, 1) == 0) {
+      dod = 0;
+    } else if (get_bits(body, state.bits, 1) == 0) {
+      dod = (int32_t)get_bits(body, state.bits, 7) - 63;
+    } else if (get_bits(body, state.bits, 1) == 0) {
+      dod = (int32_t)get_bits(body, state.bits, 9) - 255;
+    } else if (get_bits(body, state.bits, 1) == 0) {
+      dod = (int32_t)get_bits(body, state.bits, 12) - 2047;
+    } else {
+      dod = (int32_t)get_bits(body, state.bits, 32);
+    }
+    state.delta += dod;
+    state.time += state.delta;
+
+    if (get_bits(body, state.bits, 1) != 0) {
+      if (get_bits(body, state.bits, 1) != 0) {
+        state.leading = get_bits(body, state.bits, 5);
+        state.trailing = 32 - state.leading - (get_bits(body, state.bits, 5) + 1);
+      }
+      if (state.leading == 0xFF || state.leading + state.trailing >= 32) {
+        state.bits = HISTORY_PAGE_BITS + 1;  ///< Corrupt page.
+        return false;
+      }
+      state.value ^= get_bits(body, state.bits, 32 - state.leading - state.trailing) << state.trailing;
+    }
+    if (state.bits > HISTORY_PAGE_BITS) {
+      return false;
+    }
+  }
+  state.count++;
+  time = state.time;
+  memcpy(&value, &state.value, sizeof(value));
+  return true;
+}
+
+HistoryStore::HistoryStore(fs::FS& filesystem) : fs(filesystem) {
+  for (HistoryPage& page : index) {
+    page.series = HISTORY_NONE;
+  }
+  for (HistorySeries& open : series) {
+    open.state = GorillaState();
+  }
+  for (HistoryQuery& query : queries) {
+    query.owner = nullptr;
+  }
+}
+
+void HistoryStore::segmentPath(char* path, size_t len, uint32_t seq) {
+  snprintf(path, len, "/hs_%lu", (unsigned long)seq);
+}
+
+void HistoryStore::begin(bool mounted) {
+  char path[16];
+  uint32_t pages = 0;
+
+  lock = xSemaphoreCreateMutex();
+  fs_ready = mounted;
+  if (!fs_ready) {
+    Serial.println("History store not available, samples are not kept.");
+    return;
+  }
+
+  // Finding the oldest and the newest segment left from before the reboot
+  File root = fs.open("/");
+  for (File file = root.openNextFile(); file; file = root.openNextFile()) {
+    const char* name = file.name();
+    if (name[0] == '/') name++;  ///< Some core versions report the full path.
+    if (strncmp(name, "hs_", 3) != 0) {
+      continue;
+    }
+    uint32_t seq = strtoul(name + 3, nullptr, 10);
+    if (empty || seq < read_seq) read_seq = seq;
+    if (empty || seq > write_seq) {
+      write_seq = seq;
+      write_page = file.size() / HISTORY_PAGE_LEN;
+    }
+    empty = false;
+  }
+  if (empty) {
+    return;
+  }
+
+  // Segments beyond the capacity would share index slots
+  for (; write_seq - read_seq + 1 > HISTORY_SEGMENT_COUNT; read_seq++) {
+    segmentPath(path, sizeof(path), read_seq);
+    fs.remove(path);
+  }
+  if (write_page > HISTORY_SEGMENT_PAGES) {
+    write_page = HISTORY_SEGMENT_PAGES;
+  }
+
+  // Rebuilding the index from the page headers
+  for (uint32_t seq = read_seq; seq <= write_seq; seq++) {
+    segmentPath(path, sizeof(path), seq);
+    File file = fs.open(path, FILE_READ);
+    for (uint8_t page = 0; file && page < HISTORY_SEGMENT_PAGES; page++) {
+      HistoryPageHeader header;
+      if (!file.seek(page * HISTORY_PAGE_LEN) || file.read((uint8_t*)&header, sizeof(header)) != sizeof(header)) {
+        break;
+      }
+      if (header.magic == HISTORY_PAGE_MAGIC && header.series < HISTORY_SERIES) {
+        entry(seq, page) = { header.first, header.last, header.series };
+        pages++;
+      }
+    }
+  }
+  Serial.printf("Recovered %lu history page(s) from flash.\n", (unsigned long)pages);
+}
+
+void HistoryStore::flush(HistorySeries& open) {
+  char path[16];
+  HistoryPageHeader header = page_header(open.page);
+
+  open.state = GorillaState();
+  if (!fs_ready || header.count == 0) {
+    return;
+  }
+
+  if (empty) {
+    write_seq++;  ///< Always start a fresh segment file.
+    read_seq = write_seq;
+    write_page = 0;
+    empty = false;
+  } else if (write_page >= HISTORY_SEGMENT_PAGES) {
+    if (write_seq - read_seq + 1 >= HISTORY_SEGMENT_COUNT) {
+      // Store is full, drop the oldest segment.
+      for (uint8_t page = 0; page < HISTORY_SEGMENT_PAGES; page++) {
+        entry(read_seq, page).series = HISTORY_NONE;
+      }
+      segmentPath(path, sizeof(path), read_seq);
+      fs.remove(path);
+      read_seq++;
+    }
+    write_seq++;
+    write_page = 0;
+  }
+
+  segmentPath(path, sizeof(path), write_seq);
+  File file = fs.open(path, FILE_APPEND);
+  if (!file || file.write(open.page, HISTORY_PAGE_LEN) != HISTORY_PAGE_LEN) {
+    write_errors++;
+    write_page = HISTORY_SEGMENT_PAGES;  ///< Pages must stay aligned, continue in a new segment.
+    return;
+  }
+  file.close();
+  entry(write_seq, write_page++) = { header.first, header.last, header.series };
+  pages_written++;
+}
+
+void HistoryStore::append(const HistorySample& sample) {
+  HistorySeries& open = series[sample.series];
+  uint16_t before = open.state.bits;
+
+  for (uint8_t attempt = 0; attempt < 2; attempt++) {
+    if (open.state.count == 0) {
+      HistoryPageHeader header = { HISTORY_PAGE_MAGIC, sample.series, 0, 0, 0 };
+      memcpy(open.page, &header, sizeof(header));
+      open.opened = millis();
+      before = 0;
+    }
+    if (gorilla_append(open.page, open.state, sample.time, sample.value)) {
+      appended++;
+      encoded_bits += open.state.bits - before;
+      return;
+    }
+    flush(open);  ///< Page full or the clock went back, the sample starts the next page.
+  }
+}
+
+void HistoryStore::record(uint8_t sensor, uint32_t time, float value) {
+  if (sensor >= HISTORY_SERIES || time < HISTORY_TIME_MIN) {
+    return;
+  }
+  samples.push({ time, value, sensor });  ///< Encoded and written by the network task.
+}
+
+void HistoryStore::drain() {
+  HistorySample sample;
+  bool locked = false;
+
+  if (lock == nullptr) {
+    return;
+  }
+  while (samples.pop(sample)) {
+    if (!locked) {
+      locked = xSemaphoreTake(lock, portMAX_DELAY) == pdTRUE;
+    }
+    append(sample);
+  }
+
+  // Writing out the pages of slow sensors, so a reset loses at most HISTORY_PAGE_AGE of them
+  uint32_t now = millis();
+  for (HistorySeries& open : series) {
+    if (open.state.count > 0 && now - open.opened >= HISTORY_PAGE_AGE) {
+      if (!locked) {
+        locked = xSemaphoreTake(lock, portMAX_DELAY) == pdTRUE;
+      }
+      flush(open);
+    }
+  }
+  if (locked) {
+    xSemaphoreGive(lock);
+  }
+}
+
+bool HistoryStore::load(HistoryQuery& query) {
+  char path[16];
+  bool found = false;
+
+  xSemaphoreTake(lock, portMAX_DELAY);
+  if (!query.last_page) {
+    if (!empty && query.seq < read_seq) {
+      query.seq = read_seq;  ///< Its next segment was dropped meanwhile.
+      query.page_index = 0;
+    }
+    // Stored pages of the series overlapping the range, oldest first
+    while (!empty && !found && (query.seq < write_seq || (query.seq == write_seq && query.page_index < write_page))) {
+      if (query.page_index >= HISTORY_SEGMENT_PAGES) {
+        query.seq++;
+        query.page_index = 0;
+        continue;
+      }
+      const HistoryPage& page = entry(query.seq, query.page_index++);
+      if (page.series != query.series || page.last < query.from || page.first > query.to) {
+        continue;
+      }
+      segmentPath(path, sizeof(path), query.seq);
+      File file = fs.open(path, FILE_READ);
+      found = file && file.seek((query.page_index - 1) * HISTORY_PAGE_LEN) &&
+              file.read(query.page, HISTORY_PAGE_LEN) == HISTORY_PAGE_LEN;
+    }
+    // Then the open page, its samples are the newest
+    if (!found) {
+      const HistorySeries& open = series[query.series];
+      HistoryPageHeader header = page_header(open.page);
+      query.last_page = true;
+      if (open.state.count > 0 && header.last >= query.from && header.first <= query.to) {
+        memcpy(query.page, open.page, HISTORY_PAGE_LEN);
+        found = true;
+      }
+    }
+  }
+  xSemaphoreGive(lock);
+
+  query.state = GorillaState();
+  query.loaded = found;
+  return found;
+}
+
+bool HistoryStore::next(HistoryQuery& query, uint32_t& time, float& value) {
+  for (;;) {
+    if (!query.loaded && !load(query)) {
+      return false;
+    }
+    if (!gorilla_next(query.page, query.state, time, value)) {
+      query.loaded = false;
+      continue;
+    }
+    if (time < query.from) {
+      continue;
+    }
+    if (time > query.to) {
+      query.loaded = false;
+      query.last_page = true;  ///< Pages are in time order, nothing later is in the range.
+      return false;
+    }
+    return true;
+  }
+}
+
+size_t HistoryStore::fill(HistoryQuery& query, uint8_t* buffer, size_t max_len) {
+  size_t length = 0;
+
+  while (length < max_len) {
+    if (query.text_pos < query.text_len) {
+      size_t n = query.text_len - query.text_pos;
+      n = n < max_len - length ? n : max_len - length;
+      memcpy(buffer + length, query.text + query.text_pos, n);
+      query.text_pos += n;
+      length += n;
+      continue;
+    }
+    query.text_pos = 0;
+    query.text_len = 0;
+
+    int n = 0;
+    if (query.step == 0) {
+      n = snprintf(query.text, sizeof(query.text), "{\"sensor\":%u,\"points\":[", query.series);
+      query.step = 1;
+    } else if (query.step == 1) {
+      uint32_t time;
+      float value;
+      if (next(query, time, value)) {
+        char number[16];
+        number[PayloadWriter::formatFixed(number, value, 4)] = '\0';  ///< 0.0625 is the finest sensor step.
+        n = snprintf(query.text, sizeof(query.text), "%s[%lu,%s]", query.points ? "," : "", (unsigned long)time, number);
+        query.points++;
+      } else {
+        query.step = 2;
+      }
+    } else if (query.step == 2) {
+      n = snprintf(query.text, sizeof(query.text), "]}");
+      query.step = 3;
+    } else {
+      break;
+    }
+    query.text_len = n > 0 && (size_t)n < sizeof(query.text) ? n : 0;
+  }
+
+  if (length == 0) {
+    points_sent += query.points;
+    release(query, query.owner);  ///< Response complete.
+  }
+  return length;
+}
+
+void HistoryStore::release(HistoryQuery& query, void* owner) {
+  if (query.owner == owner) {
+    query.owner = nullptr;
+  }
+}
+
+void HistoryStore::handleQuery(AsyncWebServerRequest* request) {
+  AsyncWebParameter* sensor = request->getParam("sensor");
+  AsyncWebParameter* from = request->getParam("from");
+  AsyncWebParameter* to = request->getParam("to");
+  char* end = nullptr;
+  unsigned long id = sensor ? strtoul(sensor->value().c_str(), &end, 10) : HISTORY_SERIES;
+
+  if (sensor == nullptr || *end != '\0' || id >= HISTORY_SERIES) {
+    request->send(400, "application/json", "{\"error\":\"unknown sensor\"}");
+    return;
+  }
+  HistoryQuery* query = nullptr;
+  for (HistoryQuery& slot : queries) {
+    if (slot.owner == nullptr) {
+      query = &slot;
+      break;
+    }
+  }
+  if (query == nullptr || lock == nullptr) {
+    request->send(503, "application/json", "{\"error\":\"busy\"}");
+    return;
+  }
+
+  query->owner = request;
+  query->series = id;
+  query->from = from ? strtoul(from->value().c_str(), nullptr, 10) : 0;
+  query->to = to ? strtoul(to->value().c_str(), nullptr, 10) : UINT32_MAX;
+  query->seq = 0;
+  query->page_index = 0;
+  query->loaded = false;
+  query->last_page = false;
+  query->step = 0;
+  query->points = 0;
+  query->text_len = 0;
+  query->text_pos = 0;
+  query_count++;
+
+  // Decoded chunk by chunk as the TCP window opens, a slot is freed at the end or on disconnect
+  AsyncWebServerResponse* response = request->beginChunkedResponse("application/json",
+    [this, query, request](uint8_t* buffer, size_t max_len, size_t) -> size_t {
+      return query->owner == request ? fill(*query, buffer, max_len) : 0;
+    });
+  request->onDisconnect([this, query, request]() {
+    release(*query, request);
+  });
+  request->send(response);
+}
+
+void HistoryStore::serve(AsyncWebServer& server) {
+  server.on("/api/history", HTTP_GET, [this](AsyncWebServerRequest *request) {
+    handleQuery(request);
+  });
+}
+
+void HistoryStore::metrics(Print& out) const {
+  uint32_t stored = empty ? 0 : (write_seq - read_seq) * HISTORY_SEGMENT_PAGES + write_page;
+  out.printf("# TYPE history_samples_total counter\nhistory_samples_total %lu\n", (unsigned long)appended);
+  out.printf("# TYPE history_encoded_bytes_total counter\nhistory_encoded_bytes_total %lu\n", (unsigned long)(encoded_bits / 8));
+  out.printf("# TYPE history_samples_dropped_total counter\nhistory_samples_dropped_total %lu\n", (unsigned long)samples.dropCount());
+  out.printf("# TYPE history_pages gauge\nhistory_pages %lu\n", (unsigned long)stored);
+  out.printf("# TYPE history_pages_capacity gauge\nhistory_pages_capacity %u\n", HISTORY_SEGMENT_COUNT * HISTORY_SEGMENT_PAGES);
+  out.printf("# TYPE history_pages_written_total counter\nhistory_pages_written_total %lu\n", (unsigned long)pages_written);
+  out.printf("# TYPE history_write_errors_total counter\nhistory_write_errors_total %lu\n", (unsigned long)write_errors);
+  out.printf("# TYPE history_queries_total counter\nhistory_queries_total %lu\n", (unsigned long)query_count);
+  out.printf("# TYPE history_points_streamed_total counter\nhistory_points_streamed_total %lu\n", (unsigned long)points_sent);
+}
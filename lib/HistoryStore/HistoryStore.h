@@ -0,0 +1,245 @@
+#ifndef HISTORYSTORE_H
+#define HISTORYSTORE_H
+
+/**
+ * @class HistoryStore
+ * @brief A compressed time series store of the sensor readings on LittleFS.
+ *
+ * Every series (one per sensor) is encoded Gorilla style into fixed-size pages: timestamps as
+ * the delta of their delta, which is a single bit at a steady sampling interval, and values as
+ * the XOR with the previous value, which only keeps the bits that changed. The page of each
+ * series is filled in RAM and appended to a segment file when full, or when it is older than
+ * HISTORY_PAGE_AGE so an idle sensor loses little on a reset. Segment files hold
+ * HISTORY_SEGMENT_PAGES pages and the oldest is deleted when HISTORY_SEGMENT_COUNT are in use,
+ * as in PublishQueue. A RAM index of the first and last timestamp of every stored page lets a
+ * query read only the pages of its series and time range.
+ *
+ * GET /api/history?sensor=N&from=T&to=T streams the decoded points as JSON with a chunked
+ * response, a few points per TCP segment, so a long range never has to fit in RAM.
+ *
+ * Samples are queued by the control loop with record() and encoded by the network task in
+ * drain(). Queries run on the AsyncTCP task, a mutex guards the index, the files and the open
+ * pages against drain(). Timestamps are Unix seconds, samples taken before SNTP has set the
+ * clock are not recorded.
+ */
+#include <Arduino.h>
+#include <FS.h>
+#include <ESPAsyncWebServer.h>
+#include <SpscQueue.h>
+
+#define HISTORY_SERIES 12               ///< Number of series, one per sensor.
+#define HISTORY_PAGE_LEN 256            ///< Size of a page, header included.
+#define HISTORY_SEGMENT_PAGES 16        ///< Pages per segment file, one 4 KB flash sector.
+#define HISTORY_SEGMENT_COUNT 16        ///< Maximum number of segment files.
+#define HISTORY_PAGE_AGE 21600000       ///< Longest time a page stays in RAM, in milliseconds.
+#define HISTORY_QUEUE_LEN 16            ///< Samples waiting for drain(), power of two.
+#define HISTORY_QUERIES 2               ///< Queries streamed at the same time.
+#define HISTORY_TIME_MIN 1600000000     ///< Samples older than this were taken before SNTP set the clock.
+#define HISTORY_PAGE_MAGIC 0xA7         ///< First byte of a written page.
+#define HISTORY_NONE 0xFF               ///< Index entry of a page not in use.
+
+/**
+ * @brief Header at the start of each page, followed by the encoded bits.
+ */
+struct HistoryPageHeader {
+    uint8_t magic;          ///< HISTORY_PAGE_MAGIC.
+    uint8_t series;         ///< Series of the samples.
+    uint16_t count;         ///< Number of samples.
+    uint32_t first;         ///< Timestamp of the first sample.
+    uint32_t last;          ///< Timestamp of the last sample.
+};
+
+#define HISTORY_PAGE_BITS ((HISTORY_PAGE_LEN - sizeof(HistoryPageHeader)) * 8)    ///< Encoded bits per page.
+
+/**
+ * @brief Encoder or decoder state of one page.
+ */
+struct GorillaState {
+    uint16_t bits;          ///< Bits written or read.
+    uint16_t count;         ///< Samples written or read.
+    uint32_t time;          ///< Timestamp of the previous sample.
+    int32_t delta;          ///< Interval before the previous sample.
+    uint32_t value;         ///< Bits of the previous value.
+    uint8_t leading;        ///< Leading zero bits of the previous XOR window, 0xFF if none yet.
+    uint8_t trailing;       ///< Trailing zero bits of the previous XOR window.
+};
+
+/**
+ * @brief Appends a sample to a page, starting it if it is empty.
+ *
+ * @param page The page, HISTORY_PAGE_LEN bytes.
+ * @param state Encoder state of the page.
+ * @return False if the sample does not fit or is older than the last one, the page is
+ *         unchanged then.
+ */
+bool gorilla_append(uint8_t* page, GorillaState& state, uint32_t time, float value);
+
+/**
+ * @brief Decodes the next sample of a page.
+ *
+ * @param page The page, HISTORY_PAGE_LEN bytes.
+ * @param state Decoder state, zeroed before the first sample.
+ * @return False once all samples of the page were read.
+ */
+bool gorilla_next(const uint8_t* page, GorillaState& state, uint32_t& time, float& value);
+
+/**
+ * @brief A sample passed from the control loop to the network task.
+ */
+struct HistorySample {
+    uint32_t time;          ///< Unix time in seconds.
+    float value;            ///< Reading.
+    uint8_t series;         ///< Series, the sensor index.
+};
+
+/**
+ * @brief Index entry of a stored page.
+ */
+struct HistoryPage {
+    uint32_t first;         ///< Timestamp of the first sample.
+    uint32_t last;          ///< Timestamp of the last sample.
+    uint8_t series;         ///< Series of the page, HISTORY_NONE if the slot is free.
+};
+
+/**
+ * @brief The page of a series being filled.
+ */
+struct HistorySeries {
+    uint8_t page[HISTORY_PAGE_LEN];     ///< Page in RAM.
+    GorillaState state;                 ///< Encoder state.
+    uint32_t opened;                    ///< millis() of the first sample.
+};
+
+/**
+ * @brief A query being streamed.
+ */
+struct HistoryQuery {
+    void* owner;                        ///< Request streaming the query, nullptr if the slot is free.
+    uint8_t series;                     ///< Series queried.
+    uint32_t from;                      ///< First timestamp included.
+    uint32_t to;                        ///< Last timestamp included.
+    uint32_t seq;                       ///< Segment of the next stored page to look at.
+    uint8_t page_index;                 ///< Page in that segment.
+    bool loaded;                        ///< True while page holds a page being decoded.
+    bool last_page;                     ///< True once the open page of the series was loaded.
+    uint8_t step;                       ///< 0 header, 1 points, 2 footer, 3 done.
+    uint32_t points;                    ///< Points sent.
+    uint8_t page[HISTORY_PAGE_LEN];     ///< Copy of the page being decoded.
+    GorillaState state;                 ///< Decoder state.
+    char text[40];                      ///< Formatted text not sent yet.
+    uint8_t text_len;                   ///< Length of the text.
+    uint8_t text_pos;                   ///< Bytes of the text sent.
+};
+
+class HistoryStore {
+private:
+    fs::FS& fs;                                 ///< Filesystem holding the segments.
+    bool fs_ready = false;                      ///< True if the segments can be used.
+    SemaphoreHandle_t lock = nullptr;           ///< Guards the index, files and open pages.
+    SpscQueue<HistorySample, HISTORY_QUEUE_LEN> samples;    ///< Control loop to network task.
+    HistorySeries series[HISTORY_SERIES];       ///< Open page of each series.
+    HistoryPage index[HISTORY_SEGMENT_COUNT * HISTORY_SEGMENT_PAGES];  ///< Stored pages, by segment slot.
+    uint32_t read_seq = 0;                      ///< Sequence number of the oldest segment.
+    uint32_t write_seq = 0;                     ///< Sequence number of the segment being appended.
+    uint8_t write_page = 0;                     ///< Pages written to the segment being appended.
+    bool empty = true;                          ///< True if no segment exists.
+    HistoryQuery queries[HISTORY_QUERIES];      ///< Queries being streamed.
+
+    uint32_t appended = 0;                      ///< Samples encoded.
+    uint32_t encoded_bits = 0;                  ///< Bits of the encoded samples.
+    uint32_t pages_written = 0;                 ///< Pages appended to the segments.
+    uint32_t write_errors = 0;                  ///< Pages lost to a failed write.
+    uint32_t query_count = 0;                   ///< Queries started.
+    uint32_t points_sent = 0;                   ///< Points streamed by finished queries.
+
+    /**
+     * @brief Builds the file name of a segment.
+     */
+    static void segmentPath(char* path, size_t len, uint32_t seq);
+
+    /**
+     * @brief Returns the index entry of a page.
+     */
+    HistoryPage& entry(uint32_t seq, uint8_t page) {
+        return index[(seq % HISTORY_SEGMENT_COUNT) * HISTORY_SEGMENT_PAGES + page];
+    }
+
+    /**
+     * @brief Encodes one sample, writing the page of its series first if it is full.
+     */
+    void append(const HistorySample& sample);
+
+    /**
+     * @brief Appends the page of a series to the segments and empties it, called with the lock held.
+     */
+    void flush(HistorySeries& open);
+
+    /**
+     * @brief Loads the next page of a query, stored or open.
+     *
+     * @return False if no page of the range is left.
+     */
+    bool load(HistoryQuery& query);
+
+    /**
+     * @brief Decodes the next point of a query in its range.
+     *
+     * @return False once the range is exhausted.
+     */
+    bool next(HistoryQuery& query, uint32_t& time, float& value);
+
+    /**
+     * @brief Fills a chunk of the response of a query, called on the AsyncTCP task.
+     *
+     * @return Bytes written, 0 once the response is complete.
+     */
+    size_t fill(HistoryQuery& query, uint8_t* buffer, size_t max_len);
+
+    /**
+     * @brief Frees the slot of a query, if it still belongs to the request.
+     */
+    void release(HistoryQuery& query, void* owner);
+
+    void handleQuery(AsyncWebServerRequest* request);
+
+public:
+    /**
+     * @brief Constructor for HistoryStore class.
+     *
+     * @param filesystem The mounted filesystem used for the segments.
+     */
+    explicit HistoryStore(fs::FS& filesystem);
+
+    /**
+     * @brief Rebuilds the index from the segments left from before the last reboot.
+     *
+     * @param mounted True if the filesystem was mounted successfully, otherwise nothing is stored.
+     */
+    void begin(bool mounted);
+
+    /**
+     * @brief Registers GET /api/history, must be called before server.begin().
+     */
+    void serve(AsyncWebServer& server);
+
+    /**
+     * @brief Queues a reading, called by the control loop only.
+     *
+     * @param sensor Index of the sensor.
+     * @param time Unix time in seconds, readings before HISTORY_TIME_MIN are ignored.
+     * @param value The reading.
+     */
+    void record(uint8_t sensor, uint32_t time, float value);
+
+    /**
+     * @brief Encodes the queued readings and writes full or aged pages, called by the network task.
+     */
+    void drain();
+
+    /**
+     * @brief Writes the sample, compression and query counters in Prometheus text format.
+     */
+    void metrics(Print& out) const;
+};
+
+#endif // HISTORYSTORE_H
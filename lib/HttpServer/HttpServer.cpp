@@ -2,183 +2,148 @@
 
 AsyncWebServer server(80);
 
-// HTML web page to handle input fields including topics
-const char index_html[] PROGMEM = R"rawliteral(
-<!DOCTYPE HTML>
-<html>
-<head>
-  <title>ESP Input Form</title>
-  <meta name="viewport" content="width=device-width, initial-scale=1">
-  <style>
-    body {
-      display: flex;
-      justify-content: center;
-      align-items: center;
-      height: 100vh;
-      margin: 0;
-      font-family: Arial, sans-serif;
-      flex-direction: column;
+// Writes text into HTML, escaping the characters which could break out of the markup
+static size_t printEscaped(Print& out, const char* text) {
+  size_t n = 0;
+  for (; *text; text++) {
+    switch (*text) {
+      case '<': n += out.print("&lt;"); break;
+      case '>': n += out.print("&gt;"); break;
+      case '&': n += out.print("&amp;"); break;
+      case '"': n += out.print("&quot;"); break;
+      default: n += out.write(*text); break;
     }
-    form {
-      text-align: center;
-      padding: 20px;
-      border: 1px solid #ccc;
-      border-radius: 8px;
-    }
-    input[type="text"] {
-      padding: 8px;
-      margin: 10px;
-      width: 200px;
-      border: 1px solid #ccc;
-      border-radius: 4px;
-    }
-    input[type="submit"] {
-      padding: 8px 16px;
-      background-color: #4CAF50;
-      color: white;
-      border: none;
-      border-radius: 4px;
-      cursor: pointer;
-    }
-    input[type="submit"]:hover {
-      background-color: #45a049;
-    }
-    .extra-fields {
-      display: none; /* Initially hidden */
-    }
-  </style>
-  <script>
-    function toggleBrokerFields() {
-      var anonymousChecked = document.getElementById("anonymous").checked;
-      var brokerFields = document.getElementById("brokerFields");
-      var input6 = document.getElementById("input6");
-
-      // Set the value of input6 based on the checkbox state
-      input6.value = anonymousChecked ? "true" : "false"; // 'true' if checked, 'false' if unchecked
-
-      if (anonymousChecked) {
-        brokerFields.style.display = "none"; // Hide fields if anonymous is checked
-      } else {
-        brokerFields.style.display = "block"; // Show fields if anonymous is unchecked
-      }
-    }
-  </script>
-</head>
-<body>
-  <form action="/submit" method="GET">
-    SSID: <input type="text" name="input1"><br>
-    Password: <input type="text" name="input2"><br>
-    Broker ip:port: <input type="text" name="input3"><br>
-
-    <!-- Anonymous checkbox -->
-    Anonymous: <input type="checkbox" id="anonymous" checked onclick="toggleBrokerFields()"><br>
-
-    <!-- Broker fields, initially hidden if Anonymous is checked -->
-    <div id="brokerFields" class="extra-fields">
-      Broker Username: <input type="text" name="input4"><br>
-      Broker Password: <input type="text" name="input5"><br>
-    </div>
-
-    <!-- Topics field -->
-    Topics (set topics in oreder 'temp:dev1:dev2'): <input type="text" name="topics"><br>
-
-    <!-- Hidden input to pass the checkbox state -->
-    <input type="hidden" id="input6" name="input6" value="true">
-
-    <input type="submit" value="Submit">
-  </form>
-</body>
-</html>
-)rawliteral";
+  }
+  return n;
+}
+
+// Returns the value of a query parameter, or the fallback if it is missing
+static const char* param(AsyncWebServerRequest *request, const char* name, const char* fallback) {
+  AsyncWebParameter* p = request->getParam(name);
+  return p ? p->value().c_str() : fallback;
+}
+
+// Logs the cost of a request: body bytes, heap taken while handling it and handler time
+static void logRequest(AsyncWebServerRequest *request, int code, size_t bytes, uint32_t heap_before, int64_t start) {
+  uint32_t heap_after = ESP.getFreeHeap();
+  Serial.printf("HTTP %s %d, %u B body, %d B heap, %u us\n", request->url().c_str(), code, (unsigned)bytes,
+                (int)(heap_before - heap_after), (unsigned)(hal_time_us() - start));
+}
+
+// Serves a gzipped asset from flash, or a bodyless 304 if the client already has it
+static void serveAsset(AsyncWebServerRequest *request, const WebAsset& asset) {
+  uint32_t heap_before = ESP.getFreeHeap();
+  int64_t start = hal_time_us();
+  AsyncWebServerResponse *response;
+  bool cached = request->hasHeader("If-None-Match") && request->header("If-None-Match") == asset.etag;
+
+  if (cached) {
+    response = request->beginResponse(304);
+  } else {
+    response = request->beginResponse_P(200, asset.type, asset.data, asset.length);
+    response->addHeader("Content-Encoding", "gzip");
+  }
+  response->addHeader("ETag", asset.etag);
+  response->addHeader("Cache-Control", "no-cache");  // Revalidated on every load, a firmware update shows at once
+  logRequest(request, cached ? 304 : 200, cached ? 0 : asset.length, heap_before, start);
+  request->send(response);
+}
 
 void runHttpServer(MemoryHandler& memoryHandler) {
 
-  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send_P(200, "text/html", index_html);
-  });
+  for (const WebAsset& asset : web_assets) {
+    server.on(asset.path, HTTP_GET, [&asset](AsyncWebServerRequest *request) {
+      serveAsset(request, asset);
+    });
+  }
 
   server.on("/submit", HTTP_GET, [&memoryHandler](AsyncWebServerRequest *request) {
-    String input1 = request->hasParam("input1")
-                        ? request->getParam("input1")->value()
-                        : "N/A";
-    String input2 = request->hasParam("input2")
-                        ? request->getParam("input2")->value()
-                        : "N/A";
-    String input3 = request->hasParam("input3")
-                        ? request->getParam("input3")->value()
-                        : "N/A";
-    String input4 = request->hasParam("input4")
-                        ? request->getParam("input4")->value()
-                        : "N/A";
-    String input5 = request->hasParam("input5")
-                        ? request->getParam("input5")->value()
-                        : "N/A";                        
-    String input6 = request->hasParam("input6")
-                        ? request->getParam("input6")->value()
-                        : "true";  // Default to true if the param is not present
-    String topics = request->hasParam("topics")
-                        ? request->getParam("topics")->value()
-                        : "N/A";
-
-    // Convert input6 to a boolean (true or false)
-    bool isAnonymous = (input6 == "true");
+    uint32_t heap_before = ESP.getFreeHeap();
+    int64_t start = hal_time_us();
+
+    const char* ssid = param(request, "input1", "N/A");
+    const char* wifi_pass = param(request, "input2", "N/A");
+    const char* broker_addr = param(request, "input3", "N/A");
+    const char* broker_usr = param(request, "input4", "N/A");
+    const char* broker_pass = param(request, "input5", "N/A");
+    const char* topics = param(request, "topics", "N/A");
+
+    // Convert input6 to a boolean (true or false), default to true if the param is not present
+    bool isAnonymous = strcmp(param(request, "input6", "true"), "true") == 0;
 
     // Now pass input6 and topics to the writeCredentials function
-    memoryHandler.writeCredentials(input1, input2, input3, input4, input5, isAnonymous, topics);
-
-    // Combine inputs into a single string
-    String combinedInputs =
-        "SSID: " + input1 + ", Password: " + input2 + ", Broker_addr: " + input3 + ", Broker_usr: " + input4 + ", Broker_pass: " + input5 + ", Topics: " + topics + ", Anonymous: " + (isAnonymous ? "true" : "false");
-    Serial.println(combinedInputs);
-
-    request->send(200, "text/html",
-      "<html>"
-      "<head>"
-      "<style>"
-      "body {"
-      "  font-family: Arial, sans-serif;"
-      "  background-color: #f4f4f4;"
-      "  color: #333;"
-      "  margin: 0;"
-      "  padding: 0;"
-      "  text-align: center;"
-      "}"
-      "h1 {"
-      "  color: #4CAF50;"
-      "  font-size: 36px;"
-      "  margin-top: 50px;"
-      "}"
-      "p {"
-      "  font-size: 18px;"
-      "  margin: 20px;"
-      "  line-height: 1.6;"
-      "}"
-      "a {"
-      "  color: #ffffff;"
-      "  background-color: #4CAF50;"
-      "  padding: 10px 20px;"
-      "  text-decoration: none;"
-      "  border-radius: 5px;"
-      "  font-size: 18px;"
-      "}"
-      "a:hover {"
-      "  background-color: #45a049;"
-      "}"
-      "footer {"
-      "  margin-top: 40px;"
-      "  font-size: 14px;"
-      "  color: #777;"
-      "}"
-      "</style>"
-      "</head>"
-      "<body>"
-      "<h1>Received Inputs</h1>"
-      "<p>" + combinedInputs + "</p>"
-      "<p>Now you can restart ESP32, or rewrite configuration.</p>"
-      "<a href=\"/\">Return to Home Page</a>"
-      "</body>"
-      "</html>");
+    memoryHandler.writeCredentials(ssid, wifi_pass, broker_addr, broker_usr, broker_pass, isAnonymous, topics);
+
+    // Payload codec of each topic, TEXT for names which are missing or unknown
+    if (request->hasParam("codecs")) {
+      const String& list = request->getParam("codecs")->value();
+      uint8_t codecs[CONFIG_MAX_TOPICS];
+      size_t count = 0;
+      int from = 0;
+      while (from <= (int)list.length() && count < CONFIG_MAX_TOPICS) {
+        int end = list.indexOf(':', from);
+        if (end < 0) end = list.length();
+        Codec codec = Codec::TEXT;
+        codec_parse(list.c_str() + from, end - from, codec);
+        codecs[count++] = (uint8_t)codec;
+        from = end + 1;
+      }
+      memoryHandler.putCodecs(codecs, count);
+    }
+
+    // Device table, stored only if valid, the previous one is kept otherwise
+    const char* devices = param(request, "devices", "");
+    const char* devices_status = "unchanged";
+    if (devices[0] != '\0') {
+      Device table[DEVICE_CAPACITY];
+      uint8_t topic_count = 1;
+      for (const char* p = topics; *p != '\0'; p++) {
+        topic_count += *p == ':';
+      }
+      uint8_t count = DeviceRegistry::parse(devices, topic_count, table, devices_status);
+      if (count > 0) {
+        memoryHandler.putDevices((const uint8_t*)table, count * sizeof(Device));
+        devices_status = devices;
+      }
+    }
+
+    Serial.printf("SSID: %s, Password: %s, Broker_addr: %s, Broker_usr: %s, Broker_pass: %s, Topics: %s, Anonymous: %s\n",
+                  ssid, wifi_pass, broker_addr, broker_usr, broker_pass, topics, isAnonymous ? "true" : "false");
+
+    // Streaming the page into the response, without building it as a String first
+    AsyncResponseStream *response = request->beginResponseStream("text/html");
+    size_t bytes = response->print("<html><head><link rel=\"stylesheet\" href=\"/result.css\"></head><body>"
+                                   "<h1>Received Inputs</h1><p>SSID: ");
+    bytes += printEscaped(*response, ssid);
+    bytes += response->print(", Password: ");
+    bytes += printEscaped(*response, wifi_pass);
+    bytes += response->print(", Broker_addr: ");
+    bytes += printEscaped(*response, broker_addr);
+    bytes += response->print(", Broker_usr: ");
+    bytes += printEscaped(*response, broker_usr);
+    bytes += response->print(", Broker_pass: ");
+    bytes += printEscaped(*response, broker_pass);
+    bytes += response->print(", Topics: ");
+    bytes += printEscaped(*response, topics);
+    bytes += response->print(", Anonymous: ");
+    bytes += response->print(isAnonymous ? "true" : "false");
+    bytes += response->print(", Devices: ");
+    bytes += printEscaped(*response, devices_status);
+    bytes += response->print("</p><p>Now you can restart ESP32, or rewrite configuration.</p>"
+                             "<a href=\"/\">Return to Home Page</a></body></html>");
+    logRequest(request, 200, bytes, heap_before, start);
+    request->send(response);
+  });
+
+  server.begin();
+}
+
+void runMetricsServer(void (*metrics)(Print& out)) {
 
+  server.on("/metrics", HTTP_GET, [metrics](AsyncWebServerRequest *request) {
+    AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+    metrics(*response);  // Written straight into the response buffer, no intermediate String
+    request->send(response);
   });
 
   server.begin();
@@ -5,7 +5,20 @@
 #include <ESPAsyncWebServer.h>
 // #include "memory.h"
 #include <MemoryHandler.h>
+#include <PayloadCodec.h>
+#include <DeviceRegistry.h>
+#include <Hal.h>
+#include "WebAssets.h"
+
+extern AsyncWebServer server;   ///< Port 80, shared by the portal, /metrics and the REST API.
 
 void runHttpServer(MemoryHandler& memoryHandler);
 
+/**
+ * @brief Serves GET /metrics in Prometheus text format in station mode.
+ *
+ * @param metrics Writes the metrics to the response stream, called on the AsyncTCP task.
+ */
+void runMetricsServer(void (*metrics)(Print& out));
+
 #endif // HTTPSERVER_H
\ No newline at end of file
@@ -0,0 +1,115 @@
+// Generated by scripts/embed_assets.py from web/, do not edit.
+#ifndef WEBASSETS_H
+#define WEBASSETS_H
+
+#include <Arduino.h>
+
+/**
+ * @brief A gzip-compressed static file of the portal.
+ */
+struct WebAsset {
+    const char* path;       ///< URL path.
+    const char* type;       ///< Content type.
+    const uint8_t* data;    ///< Gzip-compressed content in flash.
+    size_t length;          ///< Compressed length.
+    const char* etag;       ///< Quoted content hash.
+};
+
+// index.html: 2795 bytes, 1064 gzipped
+const uint8_t asset_index_html[] PROGMEM = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x9d, 0x56, 0x59, 0x6f, 0xe3, 0x36,
+    0x10, 0x7e, 0xcf, 0xaf, 0x98, 0xd5, 0x3e, 0xd8, 0x59, 0x58, 0xbe, 0x36, 0x49, 0xb7, 0x8a, 0x9c,
+    0x22, 0x9b, 0xa3, 0x09, 0xd0, 0xa2, 0x01, 0x9c, 0x3e, 0x14, 0x45, 0x1f, 0x68, 0x91, 0xb6, 0xb8,
+    0x91, 0x44, 0x81, 0xa4, 0x9c, 0x18, 0xc5, 0xfe, 0xf7, 0x0e, 0x0f, 0xd1, 0x8a, 0x9d, 0x63, 0xd1,
+    0x17, 0x5b, 0x1a, 0x72, 0xe6, 0xfb, 0xe6, 0x56, 0xfa, 0xe1, 0xf2, 0x8f, 0x8b, 0xfb, 0xbf, 0xee,
+    0xae, 0xe0, 0xe6, 0xfe, 0xf7, 0xdf, 0xce, 0x0e, 0xd2, 0x5c, 0x97, 0x85, 0xf9, 0x63, 0x84, 0x9e,
+    0x1d, 0x00, 0xa4, 0x9a, 0xeb, 0x82, 0x9d, 0x5d, 0xcd, 0xef, 0xe0, 0xb6, 0xaa, 0x1b, 0x0d, 0xd7,
+    0x42, 0x96, 0xe9, 0xc8, 0x49, 0xcd, 0x79, 0xc9, 0x34, 0x81, 0x8a, 0x94, 0x6c, 0x16, 0xad, 0x39,
+    0x7b, 0xac, 0x85, 0xd4, 0x11, 0x64, 0xa2, 0xd2, 0xac, 0xd2, 0xb3, 0xe8, 0x91, 0x53, 0x9d, 0xcf,
+    0x28, 0x5b, 0xf3, 0x8c, 0xc5, 0xf6, 0x65, 0x00, 0xbc, 0xe2, 0x9a, 0x93, 0x22, 0x56, 0x19, 0x29,
+    0xd8, 0x6c, 0x12, 0x59, 0x33, 0x4a, 0x6f, 0x9c, 0x41, 0x80, 0x85, 0xa0, 0x1b, 0xf8, 0xd7, 0x3e,
+    0x02, 0x50, 0xae, 0xea, 0x82, 0x6c, 0x12, 0x58, 0x16, 0xec, 0xe9, 0xd4, 0x0b, 0xbf, 0x35, 0x4a,
+    0xf3, 0xe5, 0x26, 0xf6, 0x30, 0x09, 0x64, 0xf8, 0xcb, 0x64, 0x7b, 0x4c, 0x0a, 0xbe, 0xaa, 0x62,
+    0xae, 0x59, 0xa9, 0x76, 0x8f, 0x72, 0xc6, 0x57, 0x39, 0x2a, 0x4c, 0xc6, 0xe3, 0x75, 0xde, 0x0a,
+    0x4b, 0x22, 0x57, 0xbc, 0x4a, 0x60, 0xdc, 0x0a, 0x96, 0x68, 0x37, 0x5e, 0x92, 0x92, 0x17, 0x08,
+    0x7c, 0x2e, 0x91, 0xec, 0x00, 0x14, 0xa9, 0x54, 0xac, 0x98, 0xe4, 0xcb, 0x70, 0x0b, 0x19, 0xc5,
+    0x94, 0x4b, 0x96, 0x69, 0x2e, 0x50, 0x3d, 0x13, 0x45, 0x53, 0x56, 0xee, 0xf4, 0xfb, 0x81, 0xb3,
+    0x23, 0xcb, 0xe0, 0x89, 0x66, 0x4f, 0x3a, 0xb6, 0xd4, 0x76, 0x49, 0xd5, 0x84, 0x52, 0x5e, 0xad,
+    0x12, 0x98, 0x8e, 0xeb, 0xe0, 0xe3, 0x42, 0x48, 0xca, 0x24, 0x32, 0xad, 0x9f, 0x40, 0x89, 0x82,
+    0x53, 0xf8, 0x98, 0x65, 0xd9, 0xf3, 0xd3, 0x58, 0x12, 0xca, 0x1b, 0x74, 0xf2, 0x4b, 0xab, 0xe7,
+    0x70, 0xb9, 0xc9, 0xd4, 0xdf, 0x7a, 0x53, 0x63, 0x52, 0x0c, 0x6c, 0xf4, 0x4f, 0x60, 0x11, 0xb0,
+    0xbe, 0x6c, 0xa1, 0x5a, 0xff, 0x27, 0x1d, 0x78, 0x9b, 0x2b, 0xc3, 0xe8, 0xff, 0x52, 0x3a, 0x7a,
+    0x9d, 0x92, 0x6a, 0x16, 0x25, 0x7f, 0x8d, 0x14, 0x4c, 0x4e, 0x3a, 0x88, 0x24, 0x7b, 0x58, 0x49,
+    0xd1, 0x54, 0x14, 0x73, 0x5d, 0x08, 0xc4, 0xfe, 0x78, 0x74, 0x71, 0x7e, 0x7d, 0x1c, 0x32, 0xe5,
+    0xa5, 0x8f, 0x39, 0x66, 0x7b, 0x97, 0x66, 0x25, 0x2a, 0xf6, 0x1e, 0x39, 0xb4, 0xd0, 0x48, 0x65,
+    0x4c, 0xd4, 0x82, 0x6f, 0x73, 0xf2, 0x3a, 0xe7, 0x24, 0x17, 0x6b, 0x26, 0x03, 0xf3, 0x97, 0x08,
+    0x1e, 0x93, 0xf1, 0xd1, 0xcf, 0x5d, 0x3b, 0x43, 0x4c, 0x81, 0x24, 0xf1, 0x92, 0xb3, 0x82, 0xaa,
+    0xfd, 0xca, 0xb6, 0x3c, 0x61, 0xf4, 0x09, 0x1b, 0xcc, 0x36, 0x46, 0xb1, 0x81, 0x9c, 0x53, 0xca,
+    0x2a, 0xf8, 0x34, 0x0a, 0x56, 0xd2, 0x51, 0xe8, 0x90, 0x54, 0x65, 0x92, 0xd7, 0xda, 0x35, 0xcb,
+    0xb2, 0xa9, 0x6c, 0xf9, 0x81, 0x16, 0xab, 0x55, 0xc1, 0xbe, 0x4a, 0xf1, 0xc0, 0xe4, 0xb5, 0x45,
+    0xea, 0x1f, 0x06, 0xac, 0x35, 0x91, 0x40, 0x10, 0x67, 0x53, 0x8a, 0x46, 0x5d, 0xe4, 0x2c, 0x7b,
+    0x60, 0x14, 0x66, 0x40, 0x45, 0xd6, 0x94, 0x58, 0x8a, 0xc3, 0x15, 0xd3, 0x57, 0x05, 0x33, 0x8f,
+    0x5f, 0x37, 0xb7, 0xb4, 0x1f, 0x85, 0xbb, 0xd1, 0xe1, 0x30, 0x73, 0xd7, 0x4f, 0x3b, 0xa6, 0x16,
+    0x1d, 0x94, 0xb7, 0xcc, 0x74, 0xef, 0x45, 0x87, 0x5d, 0x0b, 0x36, 0xb4, 0x27, 0x6f, 0xe9, 0xba,
+    0x1b, 0x46, 0xcb, 0xab, 0x8d, 0x46, 0x30, 0x67, 0x1a, 0x74, 0xce, 0xd0, 0x42, 0xd1, 0x30, 0x10,
+    0xcb, 0xd6, 0xcc, 0x82, 0x28, 0xf4, 0xc7, 0x04, 0x01, 0x0f, 0x2d, 0xdf, 0x85, 0xc0, 0x12, 0xd5,
+    0x44, 0x33, 0xaf, 0xec, 0x2e, 0x0e, 0x9d, 0xe2, 0x6c, 0x3f, 0x16, 0xbf, 0x40, 0xa4, 0x65, 0xc3,
+    0x22, 0x48, 0x20, 0x5a, 0x92, 0x42, 0xb1, 0xe8, 0xd4, 0x00, 0xf6, 0x8c, 0xb0, 0x07, 0x7c, 0x09,
+    0x3e, 0x0a, 0x03, 0xe8, 0xd9, 0x63, 0x2b, 0xc3, 0xd0, 0x3b, 0x69, 0x4b, 0x11, 0x65, 0xfd, 0x5d,
+    0xd3, 0xdb, 0x24, 0xc0, 0xb3, 0xb8, 0x0d, 0x6d, 0x3e, 0x87, 0xbe, 0x0a, 0x90, 0x53, 0x64, 0xea,
+    0xc0, 0xc1, 0xde, 0x70, 0xca, 0xc0, 0x97, 0x0b, 0xda, 0x0c, 0x26, 0x81, 0xab, 0x96, 0x88, 0xb7,
+    0xf9, 0x1d, 0x18, 0xb2, 0xf9, 0x61, 0x88, 0x45, 0x21, 0xb2, 0x07, 0x87, 0x31, 0xcf, 0xc5, 0xe3,
+    0x6b, 0x18, 0x5b, 0xc7, 0x3c, 0x4a, 0xb7, 0x0c, 0x7d, 0xf1, 0xa5, 0x23, 0xb7, 0x22, 0x52, 0x33,
+    0xae, 0x6d, 0x59, 0xda, 0x69, 0x47, 0x6c, 0x35, 0xce, 0xa2, 0x91, 0x6f, 0x18, 0xc0, 0xfd, 0x90,
+    0x0b, 0x3a, 0x8b, 0x7e, 0xbd, 0xba, 0x8f, 0x5c, 0xc9, 0xce, 0xe7, 0xb7, 0x97, 0x09, 0xa4, 0x36,
+    0x25, 0xd0, 0x19, 0x52, 0x7e, 0x8b, 0x58, 0x39, 0x6e, 0x85, 0x74, 0x21, 0xdd, 0xfd, 0x3b, 0xa2,
+    0xd4, 0x23, 0xf6, 0xef, 0x7b, 0x3a, 0xd3, 0x8e, 0x8e, 0xeb, 0x03, 0xe0, 0x75, 0x62, 0x16, 0xd2,
+    0x7b, 0x9a, 0x9f, 0xbd, 0xa6, 0x55, 0x4d, 0x3f, 0xc4, 0x31, 0x9c, 0x87, 0x70, 0x84, 0x72, 0x8a,
+    0x63, 0x67, 0x3a, 0x1c, 0xed, 0x58, 0x6d, 0x2f, 0x46, 0xc0, 0xd1, 0xdd, 0x6d, 0x07, 0xb5, 0x19,
+    0xc3, 0xfa, 0xcc, 0x0a, 0x9e, 0x3d, 0x20, 0xfe, 0x0b, 0xad, 0xba, 0xc7, 0xc0, 0x7b, 0xe0, 0x32,
+    0x14, 0x96, 0xe6, 0x76, 0x36, 0x60, 0xce, 0xce, 0x5f, 0xa8, 0x8b, 0x40, 0x33, 0xa5, 0x7c, 0x6d,
+    0x99, 0x3c, 0x6b, 0x42, 0xc8, 0x0a, 0x8c, 0xe6, 0x2c, 0xea, 0x4e, 0x24, 0x9f, 0x96, 0x10, 0xb4,
+    0x3f, 0x71, 0xcb, 0x99, 0xe0, 0xbc, 0x17, 0xb5, 0xa3, 0x4e, 0xbc, 0x83, 0xf2, 0x8f, 0x26, 0xeb,
+    0xb8, 0xa3, 0x9c, 0x8e, 0x90, 0x6b, 0xd7, 0xf7, 0x7b, 0x51, 0xf3, 0x4c, 0x39, 0xdf, 0x83, 0x43,
+    0x5e, 0xd8, 0x57, 0x66, 0x08, 0xb8, 0x67, 0x5e, 0x81, 0x90, 0x0c, 0x07, 0x3b, 0x36, 0x2a, 0x2b,
+    0xeb, 0x04, 0xbf, 0x33, 0x26, 0xe6, 0x67, 0xda, 0x3b, 0x7c, 0x03, 0xdf, 0x29, 0xef, 0x05, 0xfc,
+    0x42, 0x50, 0xd6, 0x82, 0x0e, 0x40, 0xd4, 0xa6, 0x8e, 0x49, 0x11, 0xe0, 0xfd, 0x71, 0xbf, 0x46,
+    0x34, 0x6b, 0xc1, 0x60, 0x3e, 0xe9, 0x1e, 0x4e, 0x84, 0x6f, 0x4a, 0x54, 0x3d, 0x64, 0x02, 0xbd,
+    0x0c, 0xf7, 0x0c, 0x4a, 0xd8, 0x70, 0x35, 0x74, 0x2f, 0x89, 0xb9, 0x63, 0x7f, 0xde, 0xa4, 0x94,
+    0x59, 0xe3, 0x7b, 0x94, 0x2e, 0xed, 0x77, 0xd3, 0xeb, 0x9c, 0xda, 0xf3, 0xbe, 0x03, 0x94, 0xcc,
+    0xec, 0x93, 0xe9, 0x4f, 0xc9, 0x64, 0xe0, 0x1f, 0x4f, 0x92, 0x69, 0x92, 0xe3, 0x17, 0xcf, 0xa0,
+    0x5d, 0x36, 0x9f, 0x91, 0x5d, 0x8d, 0x61, 0x23, 0x15, 0xf5, 0x5e, 0xf0, 0x8a, 0xb2, 0xa7, 0xb7,
+    0xb8, 0xb9, 0x8f, 0xb7, 0x7d, 0x72, 0x37, 0xbe, 0x0e, 0x9d, 0x9a, 0xc0, 0x25, 0xae, 0xd4, 0x0b,
+    0x03, 0x78, 0x5b, 0x90, 0x5d, 0x00, 0x57, 0xc4, 0xae, 0x55, 0xfc, 0xa4, 0xef, 0x56, 0x07, 0xbe,
+    0xd9, 0x51, 0x3d, 0x73, 0x53, 0xb9, 0x85, 0xed, 0x5a, 0x68, 0xe7, 0x8b, 0xbf, 0x37, 0x77, 0xaf,
+    0x76, 0x10, 0x8d, 0xcc, 0x24, 0x32, 0x13, 0xca, 0x8d, 0x26, 0x9c, 0x54, 0xf6, 0x9b, 0xf6, 0x3f,
+    0x1d, 0x5e, 0x5e, 0x1e, 0xeb, 0x0a, 0x00, 0x00,
+};
+
+// result.css: 508 bytes, 272 gzipped
+const uint8_t asset_result_css[] PROGMEM = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x75, 0x90, 0xd1, 0x4e, 0xc3, 0x30,
+    0x0c, 0x45, 0xdf, 0xfb, 0x15, 0x91, 0x78, 0x25, 0xa8, 0xa5, 0xed, 0x06, 0xd9, 0xd3, 0x84, 0xc4,
+    0x7f, 0x78, 0x4d, 0xd2, 0x5a, 0x74, 0x71, 0xe5, 0x66, 0x68, 0x03, 0xed, 0xdf, 0x49, 0xd2, 0x75,
+    0x1d, 0x1a, 0x24, 0x4f, 0xb6, 0x6f, 0xae, 0xcf, 0xcd, 0x8e, 0xf4, 0x49, 0x7c, 0x67, 0x42, 0x58,
+    0x72, 0x5e, 0x5a, 0xd8, 0x63, 0x7f, 0x52, 0x62, 0xcb, 0x08, 0xfd, 0xa3, 0x18, 0xc1, 0x8d, 0x72,
+    0x34, 0x8c, 0x76, 0x13, 0x14, 0x3b, 0x68, 0x3e, 0x5a, 0xa6, 0x83, 0xd3, 0xb2, 0xa1, 0x9e, 0x58,
+    0x89, 0x07, 0x5b, 0xc5, 0x1b, 0x87, 0x73, 0xa7, 0x2c, 0xcb, 0x58, 0xee, 0x81, 0x5b, 0x74, 0x4a,
+    0xe4, 0xb1, 0x18, 0x40, 0x6b, 0x74, 0xed, 0xa5, 0xf2, 0xe6, 0xe8, 0x25, 0xf4, 0xd8, 0x86, 0x71,
+    0x63, 0x9c, 0x37, 0xbc, 0xc9, 0xce, 0x59, 0x57, 0x24, 0x8a, 0xd9, 0xa6, 0x7a, 0xdb, 0xbe, 0xd7,
+    0x49, 0x9e, 0xb8, 0x46, 0xfc, 0x32, 0x4a, 0x94, 0xab, 0xe1, 0xb8, 0x98, 0x4b, 0x4f, 0x83, 0x12,
+    0x75, 0x1e, 0x7b, 0xe7, 0x6c, 0x58, 0x42, 0x4c, 0xe2, 0xe2, 0xe5, 0x56, 0xac, 0xc4, 0x73, 0x3e,
+    0xd5, 0x3d, 0x3a, 0x23, 0x3b, 0x83, 0x6d, 0xe7, 0x83, 0xe8, 0x69, 0x15, 0x1f, 0xc3, 0xaf, 0xdd,
+    0x36, 0x9d, 0x7f, 0x12, 0x2f, 0x60, 0xd7, 0x54, 0x45, 0x70, 0xbe, 0xda, 0xa7, 0x74, 0xda, 0x34,
+    0xc4, 0xe0, 0x91, 0xc2, 0x5e, 0x47, 0xce, 0x24, 0x2f, 0x62, 0x6d, 0x58, 0x32, 0x68, 0x3c, 0x8c,
+    0x81, 0x7b, 0x92, 0xdf, 0x01, 0x07, 0x18, 0xd5, 0xd1, 0xa7, 0xe1, 0x84, 0xf4, 0x17, 0x40, 0x0d,
+    0x79, 0xf5, 0x1a, 0x85, 0x96, 0xc8, 0x5f, 0x74, 0xb7, 0x3f, 0x52, 0xe5, 0xf7, 0xd6, 0xd5, 0xd4,
+    0x9a, 0x3d, 0xd6, 0xeb, 0x75, 0x34, 0xf8, 0x01, 0xa2, 0x05, 0x56, 0x50, 0xfc, 0x01, 0x00, 0x00,
+};
+
+const WebAsset web_assets[] = {
+    {"/", "text/html", asset_index_html, sizeof(asset_index_html), "\"12792a18d7e5e156\""},
+    {"/result.css", "text/css", asset_result_css, sizeof(asset_result_css), "\"589489a7084fdefd\""},
+};
+
+#endif // WEBASSETS_H
@@ -0,0 +1,101 @@
+#include "LatencyTrace.h"
+
+#ifdef LATENCY_TRACE
+LatencyHistogram trace_read("mqtt_read", TRACE_UNITS_CYCLES);
+LatencyHistogram trace_dispatch("mqtt_dispatch", TRACE_UNITS_CYCLES);
+LatencyHistogram trace_gpio("mqtt_to_gpio", 1);
+LatencyHistogram trace_publish("mqtt_publish", TRACE_UNITS_CYCLES);
+LatencyHistogram trace_format("telemetry_format", TRACE_UNITS_CYCLES);
+LatencyHistogram trace_button("button_wake", 1);
+LatencyHistogram trace_api("http_api", 1);
+LatencyHistogram trace_http_gpio("http_to_gpio", 1);
+LatencyHistogram trace_ack("mqtt_ack", 1);
+LatencyHistogram trace_ready("mqtt_ready", 1);
+LatencyHistogram trace_display("display_command", TRACE_UNITS_CYCLES);
+LatencyHistogram trace_display_frame("display_frame", TRACE_UNITS_CYCLES);
+
+static LatencyHistogram* const histograms[] = { &trace_read, &trace_dispatch, &trace_gpio, &trace_publish, &trace_format, &trace_button,
+                                                 &trace_api, &trace_http_gpio, &trace_ack, &trace_ready, &trace_display,
+                                                 &trace_display_frame };
+#endif
+
+LatencyHistogram::LatencyHistogram(const char* metric, uint32_t units)
+  : name(metric), units_per_us(units == TRACE_UNITS_CYCLES ? 1000 : units), cycles(units == TRACE_UNITS_CYCLES) {
+  memset(counts, 0, sizeof(counts));
+}
+
+uint64_t LatencyHistogram::upperBound(uint8_t index){
+  if (index < (1u << HIST_SUB_BITS)) {
+    return index + 1;
+  }
+  uint8_t msb = (index >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+  uint8_t sub = index & ((1u << HIST_SUB_BITS) - 1);
+  uint8_t shift = msb - HIST_SUB_BITS;
+  return ((uint64_t)((1u << HIST_SUB_BITS) + sub + 1)) << shift;
+}
+
+uint32_t LatencyHistogram::percentile(uint8_t pct) const {
+  uint32_t target = ((uint64_t)total * pct + 99) / 100;
+  uint32_t seen = 0;
+
+  if (total == 0) {
+    return 0;
+  }
+  for (uint16_t i = 0; i < HIST_BUCKETS; i++) {
+    seen += counts[i];
+    if (seen >= target) {
+      uint64_t bound = upperBound(i) < max ? upperBound(i) : max;  ///< The top bucket is capped by the largest sample.
+      return (bound + units_per_us - 1) / units_per_us;  ///< Round up to whole microseconds.
+    }
+  }
+  return (max + units_per_us - 1) / units_per_us;
+}
+
+size_t LatencyHistogram::summary(char* buffer, size_t len) const {
+  int n = snprintf(buffer, len, "%lu/%lu/%lu/%lu", (unsigned long)total,
+                   (unsigned long)percentile(50), (unsigned long)percentile(99),
+                   (unsigned long)((max + units_per_us - 1) / units_per_us));
+  return n < (int)len ? n : len - 1;
+}
+
+void LatencyHistogram::prometheus(Print& out) const {
+  uint32_t cumulative = 0;
+  int16_t last = -1;
+
+  for (int16_t i = HIST_BUCKETS - 1; i >= 0; i--) {
+    if (counts[i] != 0) {
+      last = i | ((1 << HIST_SUB_BITS) - 1);  ///< Round up to the end of the octave.
+      break;
+    }
+  }
+
+  out.printf("# TYPE latency_%s_seconds histogram\n", name);
+  // Log-linear buckets are folded to one per power of two, which keeps the series count small.
+  for (int16_t i = 0; i <= last; i++) {
+    cumulative += counts[i];
+    if ((i & ((1 << HIST_SUB_BITS) - 1)) == (1 << HIST_SUB_BITS) - 1) {
+      out.printf("latency_%s_seconds_bucket{le=\"%.9g\"} %lu\n", name,
+                 (double)upperBound(i) / units_per_us / 1e6, (unsigned long)cumulative);
+    }
+  }
+  out.printf("latency_%s_seconds_bucket{le=\"+Inf\"} %lu\n", name, (unsigned long)total);
+  out.printf("latency_%s_seconds_sum %.9g\n", name, (double)sum / units_per_us / 1e6);
+  out.printf("latency_%s_seconds_count %lu\n", name, (unsigned long)total);
+}
+
+const LatencyHistogram* latency_histogram(uint8_t index){
+#ifdef LATENCY_TRACE
+  if (index < sizeof(histograms) / sizeof(histograms[0])) {
+    return histograms[index];
+  }
+#endif
+  return nullptr;
+}
+
+void latency_prometheus(Print& out){
+#ifdef LATENCY_TRACE
+  for (LatencyHistogram* hist : histograms) {
+    hist->prometheus(out);
+  }
+#endif
+}
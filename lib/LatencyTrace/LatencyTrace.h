@@ -0,0 +1,141 @@
+#ifndef LATENCYTRACE_H
+#define LATENCYTRACE_H
+
+/**
+ * @file LatencyTrace.h
+ * @brief Hot-path latency tracing with fixed-bucket log-linear histograms in static memory.
+ *
+ * Samples are taken with the CPU cycle counter (same-core intervals) or the microsecond timer
+ * (intervals crossing cores) and recorded into histograms with four linear sub-buckets per
+ * power of two, so recording is a count-leading-zeros, a shift and an increment.
+ * Cycle samples are converted to nanoseconds at the CPU frequency of the moment they are
+ * recorded, the cycle counter slows down with the clock under dynamic frequency scaling.
+ * Everything compiles out unless LATENCY_TRACE is defined: the stamps read 0, TRACE_RECORD()
+ * only casts its value to void, so the stamps taken for it do not become unused variables, and
+ * the histograms are not allocated.
+ */
+#include <Arduino.h>
+#include <Hal.h>
+
+#define HIST_SUB_BITS 2                         ///< log2 of the linear sub-buckets per power of two.
+#define HIST_BUCKETS (32 << HIST_SUB_BITS)      ///< Buckets covering the whole 32-bit range.
+
+#define TRACE_UNITS_CYCLES 0                    ///< Units of a histogram of hal_cycles() samples.
+
+/**
+ * @class LatencyHistogram
+ * @brief A log-linear histogram of latency samples.
+ *
+ * Each histogram must be recorded from one core only. Reading it from another core while it
+ * is recorded may see a slightly inconsistent snapshot, which is acceptable for statistics.
+ */
+class LatencyHistogram {
+private:
+    const char* name;                   ///< Metric name, a string literal.
+    uint32_t units_per_us;              ///< Sample units per microsecond, 1000 for cycle samples.
+    bool cycles;                        ///< True if samples are cycles, stored as nanoseconds.
+    uint32_t counts[HIST_BUCKETS];      ///< Sample count per bucket.
+    uint32_t total = 0;                 ///< Number of samples.
+    uint64_t sum = 0;                   ///< Sum of all samples.
+    uint32_t max = 0;                   ///< Largest sample.
+
+public:
+    /**
+     * @brief Constructor for LatencyHistogram class.
+     *
+     * @param metric Metric name, a string literal.
+     * @param units Sample units per microsecond, e.g. 1, or TRACE_UNITS_CYCLES for cycle samples.
+     */
+    LatencyHistogram(const char* metric, uint32_t units);
+
+    /**
+     * @brief Returns the bucket of a sample.
+     */
+    static uint8_t bucket(uint32_t value) {
+        if (value < (1u << HIST_SUB_BITS)) {
+            return value;
+        }
+        uint8_t msb = 31 - __builtin_clz(value);
+        uint8_t sub = (value >> (msb - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1);
+        return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) | sub;
+    }
+
+    /**
+     * @brief Returns the exclusive upper bound of a bucket in sample units.
+     */
+    static uint64_t upperBound(uint8_t index);
+
+    /**
+     * @brief Records a sample.
+     */
+    void record(uint32_t value) {
+        if (cycles) {
+            // Nanoseconds at the current frequency, 16.16 fixed point to stay clear of a 64-bit division
+            uint64_t ns = ((uint64_t)value * ((1000u << 16) / hal_cpu_mhz())) >> 16;
+            value = ns < UINT32_MAX ? ns : UINT32_MAX;
+        }
+        counts[bucket(value)]++;
+        total++;
+        sum += value;
+        if (value > max) max = value;
+    }
+
+    /**
+     * @brief Returns the upper bound of the bucket holding the given percentile, in microseconds.
+     */
+    uint32_t percentile(uint8_t pct) const;
+
+    /**
+     * @brief Returns the metric name.
+     */
+    const char* metric() const { return name; }
+
+    /**
+     * @brief Formats count, p50, p99 and max in microseconds as count/p50/p99/max.
+     */
+    size_t summary(char* buffer, size_t len) const;
+
+    /**
+     * @brief Writes the histogram in Prometheus text format, one bucket per power of two.
+     */
+    void prometheus(Print& out) const;
+};
+
+#ifdef LATENCY_TRACE
+extern LatencyHistogram trace_read;         ///< Start of mqtt_client.loop() to callback entry, cycles.
+extern LatencyHistogram trace_dispatch;     ///< Callback entry to command queued, cycles.
+extern LatencyHistogram trace_gpio;         ///< Callback entry to relay GPIO edge on core 1, microseconds.
+extern LatencyHistogram trace_publish;      ///< Duration of mqtt_client.publish(), cycles.
+extern LatencyHistogram trace_format;       ///< Building one telemetry payload, cycles.
+extern LatencyHistogram trace_button;       ///< Button edge interrupt to the control loop awake, microseconds.
+extern LatencyHistogram trace_api;          ///< Duration of a REST API handler, microseconds.
+extern LatencyHistogram trace_http_gpio;    ///< REST relay command queued to relay GPIO edge on core 1, microseconds.
+extern LatencyHistogram trace_ready;        ///< Start of a connect attempt to the subscriptions sent, microseconds.
+extern LatencyHistogram trace_ack;          ///< QoS 1 publish sent to PUBACK processed (AsyncMqtt), microseconds.
+extern LatencyHistogram trace_display;      ///< Display command applied by the control loop, cycles.
+extern LatencyHistogram trace_display_frame;    ///< Rendering and sending one display frame, cycles.
+
+#define TRACE_CYCLES() hal_cycles()
+#define TRACE_TIME_US() ((uint32_t)hal_time_us())
+#define TRACE_RECORD(hist, value) (hist).record(value)
+#else
+#define TRACE_CYCLES() 0u
+#define TRACE_TIME_US() 0u
+#define TRACE_RECORD(hist, value) do { (void)(value); } while (0)
+#endif
+
+#define LATENCY_SUMMARY_LEN 48                  ///< Buffer for summary(), four 32-bit counts.
+
+/**
+ * @brief Returns a histogram by position, for publishing one stats topic per histogram.
+ *
+ * @return nullptr past the last histogram or if tracing is compiled out.
+ */
+const LatencyHistogram* latency_histogram(uint8_t index);
+
+/**
+ * @brief Writes all histograms in Prometheus text format, nothing if tracing is compiled out.
+ */
+void latency_prometheus(Print& out);
+
+#endif // LATENCYTRACE_H
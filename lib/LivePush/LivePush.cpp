@@ -0,0 +1,107 @@
+#include "LivePush.h"
+
+#define LIVE_HEAP_RESERVE 32768     ///< Free heap kept for the rest of the firmware in the capacity estimate.
+
+LivePush::LivePush(TelemetryQueue& queue) : socket(LIVE_PATH), frames(queue) {}
+
+void LivePush::onEvent(AsyncWebSocketClient* client, AwsEventType type){
+  if (type == WS_EVT_CONNECT) {
+    uint32_t heap = ESP.getFreeHeap();
+    uint8_t n;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    n = clients.load(std::memory_order_relaxed);
+    if (n < LIVE_MAX_CLIENTS) {
+      table[n] = client;
+      stale[n] = false;
+      clients.store(++n, std::memory_order_relaxed);
+    } else {
+      n = 0;
+    }
+    xSemaphoreGive(lock);
+
+    if (n == 0) {
+      client->close();  ///< Table full, every client costs a TCP connection and a send queue.
+      return;
+    }
+    if (n > peak) {
+      peak = n;
+    }
+    if (heap_idle > heap) {
+      heap_per_client = (heap_idle - heap) / n;
+    }
+    Serial.printf("WS client %u connected, %u clients, %u B heap each\n", (unsigned)client->id(), n, (unsigned)heap_per_client);
+  } else if (type == WS_EVT_DISCONNECT) {
+    // Waits for a drain() in progress, the client is destroyed once this returns
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint8_t n = clients.load(std::memory_order_relaxed);
+    for (uint8_t i = 0; i < n; i++) {
+      if (table[i] == client) {
+        table[i] = table[n - 1];  ///< Swap with the last entry, the order does not matter.
+        stale[i] = stale[n - 1];
+        clients.store(n - 1, std::memory_order_relaxed);
+        break;
+      }
+    }
+    xSemaphoreGive(lock);
+  }
+}
+
+void LivePush::begin(AsyncWebServer& server, const char* username, const char* password){
+  lock = xSemaphoreCreateMutex();
+  socket.setAuthentication(username, password);  ///< Copied by the library.
+  socket.onEvent([this](AsyncWebSocket*, AsyncWebSocketClient* client, AwsEventType type, void*, uint8_t*, size_t) {
+    onEvent(client, type);
+  });
+  server.addHandler(&socket);
+}
+
+void LivePush::drain(){
+  Telemetry frame;
+
+  if (clients.load(std::memory_order_relaxed) == 0) {
+    heap_idle = ESP.getFreeHeap();  ///< Baseline of the heap estimate, taken while nobody is connected.
+  }
+  while (frames.pop(frame)) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    uint8_t n = clients.load(std::memory_order_relaxed);
+    for (uint8_t i = 0; i < n; i++) {
+      AsyncWebSocketClient* client = table[i];
+      if (client->status() != WS_CONNECTED) {
+        continue;  ///< Closing, its disconnect event is waiting for the lock.
+      }
+      if (client->queueIsFull()) {
+        stale[i] = true;   ///< Stale frames are dropped, the client reloads the state later.
+        dropped++;
+        continue;
+      }
+      if (stale[i]) {
+        client->text("{\"resync\":true}");
+        stale[i] = false;
+      }
+      client->text(frame.payload, frame.length);
+      sent++;
+    }
+    xSemaphoreGive(lock);
+  }
+}
+
+void LivePush::metrics(Print& out) const {
+  uint8_t n = clients.load(std::memory_order_relaxed);
+  uint32_t heap = ESP.getFreeHeap();
+  uint32_t capacity = n;
+
+  // Clients the free heap could still hold, at the measured cost of one client
+  if (heap_per_client > 0 && heap > LIVE_HEAP_RESERVE) {
+    capacity += (heap - LIVE_HEAP_RESERVE) / heap_per_client;
+  }
+  if (capacity > LIVE_MAX_CLIENTS) {
+    capacity = LIVE_MAX_CLIENTS;
+  }
+  out.printf("# TYPE live_clients gauge\nlive_clients %u\n", n);
+  out.printf("# TYPE live_clients_peak gauge\nlive_clients_peak %u\n", peak);
+  out.printf("# TYPE live_clients_capacity gauge\nlive_clients_capacity %lu\n", (unsigned long)capacity);
+  out.printf("# TYPE live_heap_per_client_bytes gauge\nlive_heap_per_client_bytes %lu\n", (unsigned long)heap_per_client);
+  out.printf("# TYPE live_frames_sent_total counter\nlive_frames_sent_total %lu\n", (unsigned long)sent);
+  out.printf("# TYPE live_frames_dropped_total counter\nlive_frames_dropped_total %lu\n", (unsigned long)dropped);
+}
@@ -0,0 +1,88 @@
+#ifndef LIVEPUSH_H
+#define LIVEPUSH_H
+
+/**
+ * @class LivePush
+ * @brief A WebSocket channel pushing telemetry deltas to dashboards on the LAN.
+ *
+ * The control loop mirrors every telemetry payload into a JSON frame, {"name":value,...}, and
+ * queues it; the network task fans each frame out to all connected clients.
+ *
+ * Clients are created and destroyed on the AsyncTCP task. LivePush keeps its own table of them,
+ * filled by the connect and disconnect events under a mutex which drain() holds while sending,
+ * so a client cannot be destroyed while a frame is queued on it. Only the public client API is
+ * used, each client copies the frame into its own send queue.
+ *
+ * A client whose send queue is full misses the frame instead of queuing it without limit. It is
+ * marked stale and gets {"resync":true} before its next frame, telling it to reload the full
+ * state from GET /api/state and GET /api/sensors.
+ *
+ * The handshake requires HTTP Basic authentication with the same credentials as the REST POST
+ * endpoints, the pushed telemetry is not open to the whole LAN.
+ *
+ * Heap cost per client is estimated from the free heap at each connect, relative to the free
+ * heap last seen by drain() while no client was connected, and published with the connection
+ * counters in /metrics.
+ */
+#include <Arduino.h>
+#include <atomic>
+#include <ESPAsyncWebServer.h>
+#include <MqttHandler.h>
+
+#define LIVE_MAX_CLIENTS 4              ///< Connections accepted, more are closed at once.
+#define LIVE_PATH "/ws"
+
+class LivePush {
+private:
+    AsyncWebSocket socket;                      ///< The WebSocket endpoint.
+    TelemetryQueue& frames;                     ///< JSON frames from the control loop, topic unused.
+    SemaphoreHandle_t lock = nullptr;           ///< Guards the client table and the clients in it.
+    AsyncWebSocketClient* table[LIVE_MAX_CLIENTS];  ///< Connected clients, valid while in the table.
+    bool stale[LIVE_MAX_CLIENTS];               ///< True if the client missed a frame.
+    std::atomic<uint8_t> clients{0};            ///< Number of connected clients.
+    uint8_t peak = 0;                           ///< Largest number of clients connected at once.
+    uint32_t heap_idle = 0;                     ///< Free heap while no client was connected, 0 until seen.
+    uint32_t heap_per_client = 0;               ///< Heap taken per connected client, last estimate.
+    uint32_t sent = 0;                          ///< Frames handed to clients, counted per client.
+    uint32_t dropped = 0;                       ///< Frames missed by a client with a full queue.
+
+    /**
+     * @brief Adds or removes a client, called on the AsyncTCP task.
+     */
+    void onEvent(AsyncWebSocketClient* client, AwsEventType type);
+
+public:
+    /**
+     * @brief Constructor for LivePush class.
+     *
+     * @param queue Queue of the frames, the control loop is its producer and the network task
+     *              its consumer.
+     */
+    explicit LivePush(TelemetryQueue& queue);
+
+    /**
+     * @brief Registers the endpoint, must be called before server.begin().
+     *
+     * @param server The server of the node.
+     * @param username User name required by the handshake.
+     * @param password Password required by the handshake.
+     */
+    void begin(AsyncWebServer& server, const char* username, const char* password);
+
+    /**
+     * @brief Returns true if a client is connected, the control loop skips the frames otherwise.
+     */
+    bool active() const { return clients.load(std::memory_order_relaxed) > 0; }
+
+    /**
+     * @brief Sends the queued frames to every client, called by the network task.
+     */
+    void drain();
+
+    /**
+     * @brief Writes the connection and frame counters in Prometheus text format.
+     */
+    void metrics(Print& out) const;
+};
+
+#endif // LIVEPUSH_H
@@ -1,139 +1,243 @@
 #include "MemoryHandler.h"
+#include <Hal.h>
 
-MemoryHandler::MemoryHandler(Preferences& obj): pref(obj) {}
+MemoryHandler::MemoryHandler(Preferences& obj): pref(obj), lock(xSemaphoreCreateMutex()) {}
 
-void MemoryHandler::writeCredentials(String ssid, String wifi_pass, String broker_addr, String broker_usr, String broker_pass, bool anonymous, String topics) {
-  pref.begin("wifi");  ///< Start writing Wi-Fi credentials to the "wifi" namespace.
-  pref.putString("ssid", ssid);
-  pref.putString("pass", wifi_pass);
-  pref.end();
-
-  int8_t colonIndex = broker_addr.indexOf(':'); ///< Find the colon separator in the broker address (IP:port).
-  pref.begin("broker");  ///< Start writing broker credentials to the "broker" namespace.
-  pref.putString("ip", broker_addr.substring(0, colonIndex));  ///< Store the broker IP address.
-  pref.putString("port", broker_addr.substring(colonIndex + 1));  ///< Store the broker port.
-  pref.putString("usr", broker_usr);  ///< Store the broker username.
-  pref.putString("pass", broker_pass);  ///< Store the broker password.
-  pref.putBool("anonymous", anonymous);  ///< Store the anonymous connection flag.
-  pref.putString("topics", topics);  ///< Store the topics.
-  pref.end();
+bool MemoryHandler::open(const char* name, bool read_only) {
+  xSemaphoreTake(lock, portMAX_DELAY);
+  opens++;  ///< Every begin() reopens the NVS namespace, count them for the boot profile.
+  return pref.begin(name, read_only);
 }
 
-std::vector<String> MemoryHandler::getWifiCredentials() {
-  pref.begin("wifi", true);  ///< Open the "wifi" namespace in read-only mode.
-  String ssid = pref.getString("ssid");  ///< Retrieve the Wi-Fi SSID.
-  String pass = pref.getString("pass");  ///< Retrieve the Wi-Fi password.
+void MemoryHandler::close() {
   pref.end();
-  return {ssid, pass};  ///< Return the credentials as a vector.
+  xSemaphoreGive(lock);
 }
 
-std::vector<String> MemoryHandler::getBrokerCredentials() {
-  pref.begin("broker", true);  ///< Open the "broker" namespace in read-only mode.
-  String ip = pref.getString("ip");  ///< Retrieve the broker IP address.
-  String port = pref.getString("port");  ///< Retrieve the broker port.
-  String usr = pref.getString("usr");  ///< Retrieve the broker username.
-  String pass = pref.getString("pass");  ///< Retrieve the broker password.
-  pref.end();
-  return {ip, port, usr, pass};  ///< Return the credentials as a vector.
+uint32_t MemoryHandler::recordCrc(const ConfigRecord& record) {
+  return hal_crc32((const uint8_t*)&record, offsetof(ConfigRecord, crc));
 }
 
-std::vector<const char*> MemoryHandler::getBrokerTopics() {
-  pref.begin("broker", true);  ///< Open the "broker" namespace in read-only mode.
-  const String tp = pref.getString("topics");  ///< Retrieve the topics string.
-  pref.end();
-
-  std::vector<const char*> topicVector;
+void MemoryHandler::packTopics(ConfigRecord& record, const char* tp) {
+  uint16_t pos = 0;
   int startIdx = 0;
+  int tp_len = strlen(tp);
 
+  record.topic_count = 0;
   // Iterate over the input string and split by ':'
-  for (int i = 0; i <= tp.length(); i++) {
-    if (i == tp.length() || tp[i] == ':') {
-      String topic = tp.substring(startIdx, i);  ///< Extract the topic string.
-      char* topicCStr = new char[topic.length() + 1];  ///< Create a buffer for the topic.
-      strcpy(topicCStr, topic.c_str());  ///< Copy the topic string into the buffer.
-      topicVector.push_back(topicCStr);  ///< Add the topic to the vector.
+  for (int i = 0; i <= tp_len; i++) {
+    if (i == tp_len || tp[i] == ':') {
+      uint16_t len = i - startIdx;
+      if (record.topic_count == CONFIG_MAX_TOPICS || len > 255 || pos + len + 1 > CONFIG_ARENA_LEN) {
+        Serial.println("Topic list does not fit the configuration, remaining topics dropped!");
+        return;
+      }
+      memcpy(record.arena + pos, tp + startIdx, len);  ///< Copy the topic into the arena.
+      record.arena[pos + len] = '\0';
+      record.topics[record.topic_count++] = {pos, (uint8_t)len};
+      pos += len + 1;
       startIdx = i + 1;  ///< Update the start index for the next topic.
     }
   }
+}
+
+bool MemoryHandler::readRecord(ConfigRecord& record) {
+  open("node", true);  ///< Open the "node" namespace in read-only mode.
+  size_t len = pref.isKey("cfg") ? pref.getBytes("cfg", &record, sizeof(record)) : 0;
+  close();
 
-  return topicVector;  ///< Return the list of topics.
+  if (len == 0) {
+    return false;
+  }
+  if (len != sizeof(record) || record.version != CONFIG_VERSION || record.size != sizeof(record)) {
+    Serial.println("Stored configuration has an unknown layout!");
+    return false;
+  }
+  if (record.crc != recordCrc(record)) {
+    Serial.println("Stored configuration is corrupted!");
+    return false;
+  }
+  return true;
 }
 
-void MemoryHandler::clearMemory() {
-  writeCredentials("", "", "", "", "", false, "");  ///< Write empty values for cleaning.
+void MemoryHandler::writeRecord(ConfigRecord& record) {
+  record.version = CONFIG_VERSION;
+  record.size = sizeof(record);
+  record.crc = recordCrc(record);
+
+  open("node");  ///< Open the "node" namespace.
+  pref.putBytes("cfg", &record, sizeof(record));  ///< The whole configuration in one write.
+  close();
 }
 
-bool MemoryHandler::isWiFiConfigAvailable() {
-  pref.begin("wifi", true);  ///< Open the "wifi" namespace in read-only mode.
+bool MemoryHandler::readLegacy(ConfigRecord& record) {
+  memset(&record, 0, sizeof(record));  ///< Zero the padding, it is covered by the CRC.
+
+  open("wifi", true);  ///< Open the legacy "wifi" namespace in read-only mode.
+  bool found = pref.isKey("ssid");
+  strlcpy(record.ssid, pref.getString("ssid", "").c_str(), sizeof(record.ssid));
+  strlcpy(record.wifi_pass, pref.getString("pass", "").c_str(), sizeof(record.wifi_pass));
+  close();
+
+  open("broker", true);  ///< Open the legacy "broker" namespace in read-only mode.
+  found = found || pref.isKey("ip");
+  strlcpy(record.broker_ip, pref.getString("ip", "").c_str(), sizeof(record.broker_ip));
+  record.broker_port = pref.getString("port", "0").toInt();
+  strlcpy(record.broker_usr, pref.getString("usr", "").c_str(), sizeof(record.broker_usr));
+  strlcpy(record.broker_pass, pref.getString("pass", "").c_str(), sizeof(record.broker_pass));
+  record.anonymous = pref.getBool("anonymous", true);
+  packTopics(record, pref.getString("topics", "").c_str());
+  close();
+
+  return found;
+}
 
-  bool ssidExists = pref.isKey("ssid");  ///< Check if the "ssid" key exists.
-  bool passwordExists = pref.isKey("pass");  ///< Check if the "pass" key exists.
+void MemoryHandler::writeCredentials(const char* ssid, const char* wifi_pass, const char* broker_addr, const char* broker_usr, const char* broker_pass, bool anonymous, const char* topics) {
+  ConfigRecord record;
+  memset(&record, 0, sizeof(record));  ///< Zero the padding, it also clears the cached access point.
+
+  const char* colon = strchr(broker_addr, ':'); ///< Find the colon separator in the broker address (IP:port).
+  size_t ip_len = colon ? colon - broker_addr : strlen(broker_addr);
+  strlcpy(record.ssid, ssid, sizeof(record.ssid));
+  strlcpy(record.wifi_pass, wifi_pass, sizeof(record.wifi_pass));
+  strlcpy(record.broker_ip, broker_addr, ip_len + 1 < sizeof(record.broker_ip) ? ip_len + 1 : sizeof(record.broker_ip));
+  record.broker_port = colon ? atoi(colon + 1) : 0;
+  strlcpy(record.broker_usr, broker_usr, sizeof(record.broker_usr));
+  strlcpy(record.broker_pass, broker_pass, sizeof(record.broker_pass));
+  record.anonymous = anonymous;
+  packTopics(record, topics);
+
+  writeRecord(record);
+}
 
-  if (ssidExists && passwordExists) {
-    String ssid = pref.getString("ssid", "");
-    String password = pref.getString("pass", "");
+bool MemoryHandler::loadConfig(NodeConfig& config) {
+  ConfigRecord& record = config.record;
 
-    // If the SSID or password is empty, the configuration is invalid
-    if (ssid.isEmpty() || password.isEmpty()) {
-      Serial.println("Wi-Fi configuration keys exist, but values are empty.");
-      pref.end();
+  if (!readRecord(record)) {
+    if (!readLegacy(record)) {
+      Serial.println("Configuration not found.");
       return false;
-    } else {
-      Serial.println("Wi-Fi configuration found.");
-      pref.end();
-      return true;
     }
-  } else {
-    Serial.println("Wi-Fi configuration keys do not exist.");
-    pref.end();
+
+    // Migrate to the record and drop the legacy keys, so a corrupted record never falls back to stale values.
+    Serial.println("Migrating legacy configuration.");
+    writeRecord(record);
+    open("wifi");
+    pref.clear();
+    close();
+    open("broker");
+    pref.clear();
+    close();
+  }
+
+  if (record.ssid[0] == '\0' || record.wifi_pass[0] == '\0') {
+    Serial.println("Wi-Fi configuration keys exist, but values are empty.");
+    return false;
+  }
+  if (record.broker_ip[0] == '\0' || record.broker_port == 0) {
+    Serial.println("Broker configuration exists, but IP and Port are empty.");
     return false;
   }
+  if (!record.anonymous && (record.broker_usr[0] == '\0' || record.broker_pass[0] == '\0' || record.topic_count == 0)) {
+    Serial.println("Broker Username, Password or Topics not found!");
+    return false;
+  }
+
+  config.wifi = {record.ssid, record.wifi_pass};
+  config.broker = {record.broker_ip, String(record.broker_port), record.broker_usr, record.broker_pass};
+  return true;
+}
+
+void MemoryHandler::clearMemory() {
+  // Every namespace of the node, a reset must not leave a device table or rules behind for the next owner.
+  static const char* const spaces[] = {"node", "wifi", "broker", "sensors", "devices", "power", "codecs", "rules"};
+  for (const char* name : spaces) {
+    open(name);
+    pref.clear();
+    close();
+  }
 }
 
-bool MemoryHandler::isBrokerConfigAvailable() {
-  pref.begin("broker", true);  ///< Open the "broker" namespace in read-only mode.
+void MemoryHandler::putSensorRoms(const uint8_t* roms, size_t len) {
+  open("sensors");  ///< Open the "sensors" namespace.
+  pref.putBytes("roms", roms, len);  ///< Store the whole table as one blob.
+  close();
+}
 
-  if (pref.isKey("ip") && pref.isKey("port")) {
-    String ip = pref.getString("ip", "");
-    String port = pref.getString("port", "");
-    String usr = pref.getString("usr", "");
-    String pass = pref.getString("pass", "");
-    bool anonymous = pref.getBool("anonymous", true);
-    String topics = pref.getString("topics", "");
+size_t MemoryHandler::getSensorRoms(uint8_t* roms, size_t max_len) {
+  open("sensors", true);  ///< Open the "sensors" namespace in read-only mode.
+  size_t len = pref.isKey("roms") ? pref.getBytes("roms", roms, max_len) : 0;
+  close();
+  return len;
+}
 
-    if (ip.isEmpty() || port.isEmpty()) {
-      pref.end();
-      Serial.println("Broker configuration exists, but IP and Port are empty.");
-      return false;
-    }
+void MemoryHandler::putDevices(const uint8_t* devices, size_t len) {
+  open("devices");  ///< Open the "devices" namespace.
+  pref.putBytes("table", devices, len);  ///< Store the whole table as one blob.
+  close();
+}
 
-    Serial.println("Broker configuration found:");
-    if (anonymous) {
-      Serial.println("Connection type: Anonymous");
-      pref.end();
-      return true;
-    }
+size_t MemoryHandler::getDevices(uint8_t* devices, size_t max_len) {
+  open("devices", true);  ///< Open the "devices" namespace in read-only mode.
+  size_t len = pref.isKey("table") ? pref.getBytes("table", devices, max_len) : 0;
+  close();
+  return len;
+}
 
-    if (!usr.isEmpty() && !pass.isEmpty()) {
-      Serial.println("Connection type: Private");
-      if (!topics.isEmpty()) {
-        Serial.println("Topics: " + topics);
-      } else {
-        Serial.println("Topics field is empty!");
-        pref.end();
-        return false;
-      }
+void MemoryHandler::putPowerPolicy(const uint8_t* policy, size_t len) {
+  open("power");  ///< Open the "power" namespace.
+  pref.putBytes("policy", policy, len);  ///< Store the whole policy as one blob.
+  close();
+}
 
-      pref.end();
-      return true;
-    } else {
-      Serial.println("Broker Username or Password not found!");
-      pref.end();
-      return false;
-    }
-  } else {
-    pref.end();
-    Serial.println("Broker configuration keys do not exist!");
-    return false;
+size_t MemoryHandler::getPowerPolicy(uint8_t* policy, size_t max_len) {
+  open("power", true);  ///< Open the "power" namespace in read-only mode.
+  size_t len = pref.isKey("policy") ? pref.getBytes("policy", policy, max_len) : 0;
+  close();
+  return len;
+}
+
+void MemoryHandler::putCodecs(const uint8_t* codecs, size_t len) {
+  open("codecs");  ///< Open the "codecs" namespace.
+  pref.putBytes("table", codecs, len);  ///< Store the whole list as one blob.
+  close();
+}
+
+size_t MemoryHandler::getCodecs(uint8_t* codecs, size_t max_len) {
+  open("codecs", true);  ///< Open the "codecs" namespace in read-only mode.
+  size_t len = pref.isKey("table") ? pref.getBytes("table", codecs, max_len) : 0;
+  close();
+  return len;
+}
+
+void MemoryHandler::putRules(const char* text, size_t len) {
+  open("rules");  ///< Open the "rules" namespace.
+  pref.putBytes("source", text, len);  ///< Stored as source, compiled at boot.
+  close();
+}
+
+size_t MemoryHandler::getRules(char* text, size_t max_len) {
+  open("rules", true);  ///< Open the "rules" namespace in read-only mode.
+  size_t len = pref.isKey("source") ? pref.getBytes("source", text, max_len) : 0;
+  close();
+  return len;
+}
+
+void MemoryHandler::putWifiCache(const uint8_t* bssid, uint8_t channel) {
+  ConfigRecord record;
+  if (!readRecord(record)) {
+    return;
+  }
+  memcpy(record.bssid, bssid, sizeof(record.bssid));
+  record.channel = channel;
+  writeRecord(record);  ///< Rewrite the record, it only happens when the access point changes.
+}
+
+uint8_t MemoryHandler::getWifiCache(uint8_t* bssid) {
+  ConfigRecord record;
+  if (!readRecord(record)) {
+    return 0;
   }
+  memcpy(bssid, record.bssid, sizeof(record.bssid));
+  return record.channel;
 }
@@ -11,6 +11,68 @@
 #include <Preferences.h>
 #include <vector>
 
+#define CONFIG_VERSION 1        ///< Layout version of ConfigRecord, bump on every change.
+#define CONFIG_MAX_TOPICS 16    ///< Maximum number of broker topics.
+#define CONFIG_ARENA_LEN 512    ///< Size of the topic arena, including terminators.
+
+/**
+ * @brief Location of one topic inside the topic arena.
+ */
+struct TopicView {
+    uint16_t offset;    ///< Offset of the first character in the arena.
+    uint8_t length;     ///< Length without the terminator.
+};
+
+/**
+ * @brief The stored node configuration, written with one putBytes() and read with one getBytes().
+ *
+ * Strings are NUL-terminated. Topics are stored back to back, NUL-terminated, in one arena and
+ * addressed through views, so they can be used in place without copies.
+ */
+struct ConfigRecord {
+    uint16_t version;                       ///< CONFIG_VERSION of the writer.
+    uint16_t size;                          ///< sizeof(ConfigRecord) of the writer.
+    char ssid[33];                          ///< Wi-Fi SSID.
+    char wifi_pass[65];                     ///< Wi-Fi password.
+    char broker_ip[64];                     ///< Broker address.
+    uint16_t broker_port;                   ///< Broker port.
+    char broker_usr[32];                    ///< Broker username.
+    char broker_pass[64];                   ///< Broker password.
+    bool anonymous;                         ///< Flag indicating if broker connection is anonymous.
+    uint8_t bssid[6];                       ///< Cached BSSID of the last access point.
+    uint8_t channel;                        ///< Cached channel of the last access point, 0 if none.
+    uint8_t topic_count;                    ///< Number of topics.
+    TopicView topics[CONFIG_MAX_TOPICS];    ///< Topic views into the arena.
+    char arena[CONFIG_ARENA_LEN];           ///< Topic strings.
+    uint32_t crc;                           ///< CRC-32 of all preceding bytes.
+
+    /**
+     * @brief Returns a topic as a NUL-terminated string inside the arena.
+     */
+    const char* topic(uint8_t i) const { return arena + topics[i].offset; }
+
+    /**
+     * @brief Returns the user name asked by the LAN API and the WebSocket, the broker user name,
+     *        or "admin" if the broker is anonymous.
+     */
+    const char* apiUser() const { return anonymous ? "admin" : broker_usr; }
+
+    /**
+     * @brief Returns the password matching apiUser(), the broker password, or the Wi-Fi password
+     *        if the broker is anonymous.
+     */
+    const char* apiPass() const { return anonymous ? wifi_pass : broker_pass; }
+};
+
+/**
+ * @brief The whole node configuration, loaded in one pass at boot.
+ */
+struct NodeConfig {
+    ConfigRecord record;                ///< The stored configuration.
+    std::vector<String> wifi;           ///< Wi-Fi SSID and password.
+    std::vector<String> broker;         ///< Broker IP, port, username and password.
+};
+
 class MemoryHandler {
 private:
     String wifi_ssid = "";               ///< Wi-Fi SSID.
@@ -22,6 +84,57 @@ private:
     String topics = "";                  ///< Broker topics as a colon-separated string.
 
     Preferences& pref;                   ///< Reference to the Preferences object for non-volatile storage.
+    SemaphoreHandle_t lock;              ///< Held from open() to close(), both cores share the one handle.
+    uint16_t opens = 0;                  ///< Number of namespace opens since boot, counted under the lock.
+
+    /**
+     * @brief Takes the lock, opens a Preferences namespace and counts the open.
+     * 
+     * Every open() is paired with a close(), the network task and the control loop both store
+     * tables and their begin() and end() calls must not interleave on the shared handle.
+     * @param name The namespace.
+     * @param read_only True to open the namespace in read-only mode.
+     * @return True if the namespace was opened.
+     */
+    bool open(const char* name, bool read_only = false);
+
+    /**
+     * @brief Closes the namespace opened by open() and gives the lock back.
+     */
+    void close();
+
+    /**
+     * @brief Reads the configuration from the record blob.
+     * 
+     * @param record Receives the record.
+     * @return True if a record of the current version with a valid CRC was read.
+     */
+    bool readRecord(ConfigRecord& record);
+
+    /**
+     * @brief Seals the record with version, size and CRC, and writes it with one putBytes().
+     */
+    void writeRecord(ConfigRecord& record);
+
+    /**
+     * @brief Builds a record from the legacy per-key storage in the "wifi" and "broker" namespaces.
+     * 
+     * @param record Receives the record.
+     * @return True if legacy keys were found.
+     */
+    bool readLegacy(ConfigRecord& record);
+
+    /**
+     * @brief Splits a colon-separated topics string into the topic arena of a record.
+     * 
+     * Topics which do not fit the arena or exceed CONFIG_MAX_TOPICS are dropped.
+     */
+    static void packTopics(ConfigRecord& record, const char* tp);
+
+    /**
+     * @brief Computes the CRC-32 of a record, excluding the crc field.
+     */
+    static uint32_t recordCrc(const ConfigRecord& record);
 public:
     /**
      * @brief Constructor for MemoryHandler class.
@@ -44,54 +157,132 @@ public:
      * @param anonymous Boolean flag indicating if the broker connection is anonymous.
      * @param topics The list of broker topics to subscribe to, in a colon-separated format.
      */
-    void writeCredentials(String ssid, String wifi_pass, String broker_addr, String broker_usr, String broker_pass, bool anonymous, String topics);
+    void writeCredentials(const char* ssid, const char* wifi_pass, const char* broker_addr, const char* broker_usr, const char* broker_pass, bool anonymous, const char* topics);
 
     /**
      * @brief Removes credentials for wifi, mqtt brocker and mqtt topics locaded in energy independent memory.
      * 
-     * This function should be called for resetting the EIM.
+     * This function should be called for resetting the EIM. The sensor, device, power, codec and
+     * rules namespaces are cleared as well, the node boots into the portal with defaults.
      */
     void clearMemory();
 
     /**
-     * @brief Retrieves the stored Wi-Fi credentials.
+     * @brief Loads and validates the whole configuration.
+     * 
+     * The record is read with a single getBytes() and verified by version and CRC. If no valid
+     * record is stored, the legacy per-key configuration is migrated into a new record.
+     * @param config Receives the configuration.
+     * @return True if Wi-Fi and broker configuration are available and valid, false otherwise.
+     */
+    bool loadConfig(NodeConfig& config);
+
+    /**
+     * @brief Returns the number of Preferences namespace opens since boot.
+     */
+    uint16_t openCount() const { return opens; }
+
+    /**
+     * @brief Stores the ROM address table of the temperature sensors.
+     * 
+     * @param roms Packed 8-byte ROM addresses.
+     * @param len Length of the table in bytes.
+     */
+    void putSensorRoms(const uint8_t* roms, size_t len);
+
+    /**
+     * @brief Retrieves the stored ROM address table of the temperature sensors.
+     * 
+     * @param roms Buffer receiving the packed 8-byte ROM addresses.
+     * @param max_len Size of the buffer in bytes.
+     * @return Number of bytes read, 0 if no table is stored.
+     */
+    size_t getSensorRoms(uint8_t* roms, size_t max_len);
+
+    /**
+     * @brief Stores the device table.
+     * 
+     * @param devices Packed device entries.
+     * @param len Length of the table in bytes.
+     */
+    void putDevices(const uint8_t* devices, size_t len);
+
+    /**
+     * @brief Retrieves the stored device table.
+     * 
+     * @param devices Buffer receiving the packed device entries.
+     * @param max_len Size of the buffer in bytes.
+     * @return Number of bytes read, 0 if no table is stored.
+     */
+    size_t getDevices(uint8_t* devices, size_t max_len);
+
+    /**
+     * @brief Stores the power management policy.
+     * 
+     * @param policy Packed policy record.
+     * @param len Length of the record in bytes.
+     */
+    void putPowerPolicy(const uint8_t* policy, size_t len);
+
+    /**
+     * @brief Retrieves the stored power management policy.
+     * 
+     * @param policy Buffer receiving the packed policy record.
+     * @param max_len Size of the buffer in bytes.
+     * @return Number of bytes read, 0 if no policy is stored.
+     */
+    size_t getPowerPolicy(uint8_t* policy, size_t max_len);
+
+    /**
+     * @brief Stores the payload codec of each topic.
+     * 
+     * @param codecs One codec per topic, in topic order.
+     * @param len Number of codecs.
+     */
+    void putCodecs(const uint8_t* codecs, size_t len);
+
+    /**
+     * @brief Retrieves the stored payload codecs.
      * 
-     * This function retrieves the SSID and password of the stored Wi-Fi configuration.
-     * @return A vector of strings containing the SSID and password.
+     * @param codecs Buffer receiving one codec per topic.
+     * @param max_len Size of the buffer.
+     * @return Number of codecs read, 0 if none are stored.
      */
-    std::vector<String> getWifiCredentials();
+    size_t getCodecs(uint8_t* codecs, size_t max_len);
 
     /**
-     * @brief Retrieves the stored broker credentials.
+     * @brief Stores the source text of the automation rules.
      * 
-     * This function retrieves the broker address (IP, port), username, and password.
-     * @return A vector of strings containing the broker IP, port, username, and password.
+     * @param text The rules, not NUL-terminated.
+     * @param len Length of the text.
      */
-    std::vector<String> getBrokerCredentials();
+    void putRules(const char* text, size_t len);
 
     /**
-     * @brief Retrieves the list of topics for the broker.
+     * @brief Retrieves the source text of the automation rules.
      * 
-     * This function retrieves the list of topics (in a colon-separated string) for subscribing to the broker.
-     * @return A vector of const char* representing the topics.
+     * @param text Buffer receiving the text, not NUL-terminated.
+     * @param max_len Size of the buffer.
+     * @return Length of the text, 0 if no rules are stored.
      */
-    std::vector<const char*> getBrokerTopics();
+    size_t getRules(char* text, size_t max_len);
 
     /**
-     * @brief Checks if the Wi-Fi credentials are available in memory.
+     * @brief Stores the BSSID and channel of the last WiFi access point.
      * 
-     * This function checks if the SSID and password keys are available and non-empty in memory.
-     * @return True if Wi-Fi credentials are available and valid, false otherwise.
+     * The cache is part of the configuration record and is removed whenever new credentials are written.
+     * @param bssid The 6-byte BSSID.
+     * @param channel The WiFi channel.
      */
-    bool isWiFiConfigAvailable();
+    void putWifiCache(const uint8_t* bssid, uint8_t channel);
 
     /**
-     * @brief Checks if the broker credentials are available in memory.
+     * @brief Retrieves the cached BSSID and channel of the last WiFi access point.
      * 
-     * This function checks if the necessary broker credentials (IP, port) and topics are available in memory.
-     * @return True if broker credentials are available and valid, false otherwise.
+     * @param bssid Buffer receiving the 6-byte BSSID.
+     * @return The WiFi channel, 0 if nothing is cached.
      */
-    bool isBrokerConfigAvailable();
+    uint8_t getWifiCache(uint8_t* bssid);
 };
 
 #endif // MEMORYHANDLER_H
@@ -1,94 +1,254 @@
 #include "MqttHandler.h"
 
-MqttHandler::MqttHandler(PubSubClient& client, DallasTemperature& sensor, MD_Parola& display, std::vector<const char*>& topics, std::vector<String>& credentials) 
-: mqtt_client(client), temp_sensor(sensor), disp(display), topic_list(topics), cred(credentials) { }
-
-void MqttHandler::device(bool state, uint8_t id){
-    digitalWrite(id, state); ///< Toggles the device (relay) on or off based on the state.
+#ifdef MQTT_ASYNC
+// All filters in one SUBSCRIBE packet, a single round trip to the SUBACK
+static uint8_t subscribe_all(MqttClient& client, const char* const* filters, uint8_t count){
+  return client.subscribe(filters, count);
 }
-
-void MqttHandler::display(String letter){
-  disp.setTextAlignment(PA_LEFT);  ///< Set text alignment to left for display.
-  disp.print(letter);  ///< Display the provided letter/character.
+#else
+// PubSubClient has no multi-topic SUBSCRIBE, one packet per filter
+static uint8_t subscribe_all(MqttClient& client, const char* const* filters, uint8_t count){
+  for (uint8_t i = 0; i < count; i++) {
+    if (!client.subscribe(filters[i])) {
+      return 0;
+    }
+  }
+  return count;
 }
+#endif
 
-void MqttHandler::callback(char *topic, byte* message, unsigned int length){
-  String messageTemp;
-  
-  for (int i = 0; i < length; i++) {
-    messageTemp += (char)message[i];  ///< Convert byte message to string.
-  }
-
-  // Handle device control based on topics
-  if (topic_list.size() > 0 && String(topic) == String(topic_list[1])) {
-    if (messageTemp == "on") {
-      device(false, 27); ///< Turn on device connected to pin 27.
-    } else if (messageTemp == "off") {
-      device(true, 27); ///< Turn off device connected to pin 27.
+MqttHandler::MqttHandler(MqttClient& client, DeviceRegistry& registry, PublishQueue& pending, CommandQueue& command_queue, TelemetryQueue& telemetry_queue, TopicTable& topics, std::vector<String>& credentials) 
+: topic_list(topics), cred(credentials), devices(registry), queue(pending), commands(command_queue), telemetry(telemetry_queue), mqtt_client(client) { }
+
+void MqttHandler::routes_setup(){
+  router.clear();
+  for (uint8_t id = 0; id < devices.size(); id++) {
+    const Device& dev = devices[id];
+    if (dev.topic >= topic_list.size()) {
+      continue;  ///< Topic not configured, the device stays unreachable.
     }
+    router.add(topic_list[dev.topic], dev.kind == DeviceKind::RELAY ? RouteKind::RELAY : RouteKind::DISPLAY, id);
+  }
+  for (uint8_t i = 0; i < custom_count; i++) {
+    router.add(custom_topics[i], RouteKind::CUSTOM, i, custom_handlers[i]);
   }
+}
 
-  if (topic_list.size() > 1 && String(topic) == String(topic_list[2])) {
-    if (messageTemp == "on") {
-      device(false, 26); ///< Turn on device connected to pin 26.
-    } else if (messageTemp == "off") {
-      device(true, 26); ///< Turn off device connected to pin 26.
-    }
+void MqttHandler::callback(char *topic, byte* message, unsigned int length){
+  uint32_t dispatch_stamp = TRACE_CYCLES();
+  TRACE_RECORD(trace_read, dispatch_stamp - read_stamp);
+
+  const Route* route = router.find(topic);  ///< One walk down the trie, one node per topic level.
+  if (route == nullptr) {
+    return;
   }
 
-  if (topic_list.size() > 2 && String(topic) == String(topic_list[3])) {
-    display(messageTemp);  ///< Display received character on the display.
+  Command cmd;
+  cmd.stamp = TRACE_TIME_US();  ///< Cross-core interval, the cycle counters of the two cores are not in sync.
+  switch (route->kind) {
+    case RouteKind::RELAY:
+      cmd.kind = CommandKind::RELAY;
+      cmd.device = route->arg;  ///< Route argument is the device id.
+      if (!codec_read_switch(topic_list.codec(devices[route->arg].topic), message, length, cmd.on)) {
+        return;
+      }
+      commands.push(cmd);  ///< Applied by the control loop on core 1.
+      break;
+    case RouteKind::DISPLAY:
+      cmd.kind = CommandKind::DISPLAY;
+      // Decoded in place, text which does not fit the buffer is truncated.
+      if (!codec_read_text(topic_list.codec(devices[route->arg].topic), message, length, cmd.text, sizeof(cmd.text))) {
+        return;
+      }
+      commands.push(cmd);  ///< Shown by the display task of the control loop.
+      break;
+    case RouteKind::CUSTOM:
+      route->handler(message, length);
+      break;
+    default:
+      break;
   }
+  TRACE_RECORD(trace_dispatch, TRACE_CYCLES() - dispatch_stamp);
 }
 
 void MqttHandler::mqtt_setup(){
   mqtt_client.setServer(cred[0].c_str(), cred[1].toInt());  ///< Set up MQTT broker address and port.
   mqtt_client.setCallback(std::bind(&MqttHandler::callback, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));  ///< Set up callback for incoming messages.
+  mqtt_client.setSocketTimeout(MQTT_SOCKET_TIMEOUT);  ///< Bound the wait for CONNACK, the default is 15 s.
+  routes_setup();  ///< Build the trie once, before the first message can arrive.
+  snprintf(client_id, sizeof(client_id), "esp32-client-%s", WiFi.macAddress().c_str());
+
+  state = MqttState::WAIT_NETWORK;  ///< The first attempt is made by mqtt_loop() as soon as WiFi is up.
+  backoff = MQTT_BACKOFF_MIN;
+  next_attempt = millis();
+}
 
-  while (!mqtt_client.connected()) {
-    String client_id = "esp32-client-";
-    client_id += String(WiFi.macAddress());
-    Serial.printf("Connecting client %s to the MQTT broker...\n", client_id.c_str());
+void MqttHandler::mqtt_connect(){
+  if (state != MqttState::CONNECTING) {
+    Serial.printf("Connecting client %s to the MQTT broker...\n", client_id);
+    attempt_stamp = TRACE_TIME_US();
+  }
+  if (mqtt_client.connect(client_id)) {
+    Serial.printf("Connected to broker at %s:%s\n", cred[0].c_str(), cred[1].c_str());
+    mqtt_subscribe();
+    TRACE_RECORD(trace_ready, TRACE_TIME_US() - attempt_stamp);
+    state = MqttState::CONNECTED;
+    backoff = MQTT_BACKOFF_MIN;
+    return;
+  }
+  if (mqtt_client.state() == MQTT_CONNECTING) {
+    state = MqttState::CONNECTING;  ///< The CONNACK has not arrived yet.
+    return;
+  }
 
-    if (mqtt_client.connect(client_id.c_str())) {
-      Serial.printf("Connected to broker at %s:%s\n", cred[0].c_str(), cred[1].c_str());
-      Serial.println("Subscribed to topics:");
+  // Exponential backoff with jitter, so a fleet does not reconnect in lockstep after an outage.
+  uint32_t delay_ms = backoff / 2 + random(backoff / 2 + 1);
+  Serial.printf("Failed to connect with state %d, retrying in %u ms\n", mqtt_client.state(), (unsigned)delay_ms);
+  next_attempt = millis() + delay_ms;
+  backoff = backoff * 2 > MQTT_BACKOFF_MAX ? MQTT_BACKOFF_MAX : backoff * 2;
+  state = MqttState::BACKOFF;
+}
 
-      for (const char* topic : topic_list) {
-        mqtt_client.subscribe(topic);  ///< Subscribe to each topic in the topic list.
-        Serial.println(topic);
-      }
-    } else {
-      Serial.print("Failed to connect with state ");
-      Serial.println(mqtt_client.state());
-      delay(2000);
-    }
+void MqttHandler::mqtt_subscribe(){
+  const char* filters[CONFIG_MAX_TOPICS + MQTT_CUSTOM_ROUTES];
+  uint8_t count = topic_list.size();
+
+  for (uint8_t i = 0; i < count; i++) {
+    filters[i] = topic_list[i];
+  }
+#ifdef MQTT_WILDCARD_SUBSCRIBE
+  static char wildcard[CONFIG_ARENA_LEN];  ///< Outlives the call, printed below.
+  if (topic_list.wildcard(wildcard, sizeof(wildcard))) {
+    filters[0] = wildcard;  ///< One filter for every topic, the router picks the routed ones.
+    count = 1;
+  }
+#endif
+  for (uint8_t i = 0; i < custom_count; i++) {
+    filters[count++] = custom_topics[i];  ///< Not below the topic prefix, never collapsed.
+  }
+  uint8_t packets = subscribe_all(mqtt_client, filters, count);
+  Serial.printf("Subscribed to %u filters in %u packets:\n", count, packets);
+  for (uint8_t i = 0; i < count; i++) {
+    Serial.println(filters[i]);
   }
 }
 
 void MqttHandler::mqtt_loop(){
-  if (!mqtt_client.connected()) {
-    String client_id = "esp32-client-";
-    client_id += String(WiFi.macAddress());
-    Serial.printf("Attempting to reconnect client %s to MQTT broker...\n", client_id.c_str());
-
-    if (mqtt_client.connect(client_id.c_str())) {
-      Serial.println("Reconnected successfully!");
-      for (const char* topic : topic_list) {
-        mqtt_client.subscribe(topic);  ///< Resubscribe to topics after reconnect.
+  Telemetry msg;
+  while (telemetry.pop(msg)) {
+    mqtt_publish(msg.topic, msg.payload, msg.length);  ///< Readings from the control loop, queued if offline.
+  }
+
+  switch (state) {
+    case MqttState::CONNECTED:
+      read_stamp = TRACE_CYCLES();
+      if (mqtt_client.loop()) {  ///< Process incoming messages.
+        mqtt_drain();
+        return;
       }
-    } else {
-      Serial.print("Failed to reconnect with state ");
-      Serial.println(mqtt_client.state());
+      Serial.printf("Lost connection to the MQTT broker with state %d\n", mqtt_client.state());
+      state = MqttState::WAIT_NETWORK;
+      next_attempt = millis();
+      break;
+
+    case MqttState::WAIT_NETWORK:
+      if (WiFi.status() != WL_CONNECTED) {
+        break;
+      }
+      state = MqttState::BACKOFF;
+      // The attempt may be due already, mqtt_loop() is not polled often.
+      [[fallthrough]];
+
+    case MqttState::BACKOFF:
+      if (WiFi.status() != WL_CONNECTED) {
+        state = MqttState::WAIT_NETWORK;
+      } else if ((int32_t)(millis() - next_attempt) >= 0) {
+        mqtt_connect();  ///< At most one attempt per backoff period.
+      }
+      break;
+
+    case MqttState::CONNECTING:
+      mqtt_connect();  ///< Polls the attempt, which times out after MQTT_SOCKET_TIMEOUT.
+      break;
+
+    default:
+      break;
+  }
+}
+
+void MqttHandler::mqtt_publish(uint8_t topic, const char* payload, size_t length){
+  if (topic >= topic_list.size()) {
+    return;  ///< Topic not configured.
+  }
+  if (state == MqttState::CONNECTED && queue.empty()) {
+    uint32_t start = TRACE_CYCLES();
+    bool sent = mqtt_client.publish(topic_list[topic], (const uint8_t*)payload, length);
+    TRACE_RECORD(trace_publish, TRACE_CYCLES() - start);
+    if (sent) {
+      return;
     }
   }
-  mqtt_client.loop();  ///< Process incoming messages.
+  queue.push(topic, payload, length, time(nullptr));  ///< Keep the message until the broker is back.
 }
 
-void MqttHandler::mqtt_send_temp(){
-  char buffer[10];
-  float temp = temp_sensor.getTempCByIndex(0);  ///< Read the temperature from the sensor.
-  mqtt_client.publish(topic_list[0], dtostrf(temp, 6, 2, buffer));  ///< Send the temperature data to the MQTT broker.
+void MqttHandler::mqtt_drain(){
+  PendingPublish entry;
+  uint8_t stamped[QUEUE_PAYLOAD_LEN + PAYLOAD_FIELD_MAX];
+
+  // Limit the burst, so draining a long backlog does not delay incoming messages.
+  for (uint8_t i = 0; i < QUEUE_DRAIN_BURST && queue.front(entry); i++) {
+    if (entry.topic >= topic_list.size()) {
+      queue.pop();  ///< Topic no longer configured.
+      continue;
+    }
+    size_t length = entry.length;
+    memcpy(stamped, entry.payload, length);
+    if (entry.timestamp >= QUEUE_CLOCK_SET) {
+      length = codec_stamp(topic_list.codec(entry.topic), stamped, length, sizeof(stamped), entry.timestamp);  ///< Late, carries the time it was queued.
+    }
+    if (!mqtt_client.publish(topic_list[entry.topic], stamped, length)) {
+      return;  ///< Keep the entry, retry on the next call.
+    }
+    queue.pop();
+  }
+}
+
+bool MqttHandler::mqtt_connected(){
+  return state == MqttState::CONNECTED;
+}
+
+bool MqttHandler::mqtt_publish_stat(const char* name, const char* payload){
+  char topic[96];
+  if (state != MqttState::CONNECTED) {
+    return false;
+  }
+  snprintf(topic, sizeof(topic), "%s/$SYS/%s", client_id, name);
+  return mqtt_client.publish(topic, payload);
+}
+
+bool MqttHandler::mqtt_add_handler(const char* name, RouteHandler handler){
+  if (custom_count >= MQTT_CUSTOM_ROUTES) {
+    return false;
+  }
+  char* topic = custom_topics[custom_count];
+  int len = snprintf(topic, MQTT_CUSTOM_TOPIC_LEN, "%s/%s", client_id, name);
+  if (len < 0 || len >= MQTT_CUSTOM_TOPIC_LEN || !router.add(topic, RouteKind::CUSTOM, custom_count, handler)) {
+    return false;
+  }
+  custom_handlers[custom_count++] = handler;  ///< Kept for routes_setup(), subscribed on the next connect.
+  return true;
+}
+
+void MqttHandler::mqtt_send_telemetry(const char* payload, size_t length){
+  Telemetry msg;
+
+  if (length == 0 || length > sizeof(msg.payload)) {
+    return;
+  }
+  msg.topic = 0;
+  msg.length = length;
+  memcpy(msg.payload, payload, length);
+  telemetry.push(msg);  ///< Published by the network task.
 }
 
 void MqttHandler::mqtt_disconnect(){
@@ -7,91 +7,233 @@
  *
  * This class handles the setup, connection, and communication with an MQTT broker.
  * It also handles device control (e.g., relays) based on MQTT messages, as well as sending
- * temperature data from a DallasTemperature sensor.
+ * temperature data read by the SensorHandler.
+ *
+ * The connection is driven by the network task on core 0. Device commands are not applied there,
+ * they are passed to the control loop on core 1 through a CommandQueue, and readings from the
+ * control loop come back through a TelemetryQueue. mqtt_send_telemetry() is the only member called
+ * from core 1.
+ *
+ * The transport is PubSubClient, or AsyncMqtt on AsyncTCP when MQTT_ASYNC is defined.
  */
 #include <WiFi.h>
 #include <PubSubClient.h>
+#include <AsyncMqtt.h>
 #include <vector>
 #include <list>
 #include <functional> 
 #include <Arduino.h>
-#include <DallasTemperature.h>
-#include "MD_Parola.h"
+#include <TopicRouter.h>
+#include <DeviceRegistry.h>
+#include <PublishQueue.h>
+#include <TopicTable.h>
+#include <SpscQueue.h>
+#include <LatencyTrace.h>
+
+#define DISPLAY_TEXT_LEN 32     ///< Maximum length of a text shown on the display, including terminator.
+#define MQTT_BACKOFF_MIN 1000   ///< First reconnect delay in milliseconds.
+#define MQTT_BACKOFF_MAX 60000  ///< Upper bound of the reconnect delay in milliseconds.
+#define MQTT_SOCKET_TIMEOUT 2   ///< Time in seconds to wait for the broker to answer a connect.
+#define QUEUE_DRAIN_BURST 4     ///< Queued publishes sent per mqtt_loop() call after a reconnect.
+#define COMMAND_QUEUE_LEN 16    ///< Capacity of the command queue, power of two.
+#define TELEMETRY_QUEUE_LEN 8   ///< Capacity of the telemetry queue, power of two.
+#define MQTT_CUSTOM_ROUTES 4    ///< Topics below the client id with their own handler.
+#define MQTT_CUSTOM_TOPIC_LEN 64    ///< Longest custom topic, including terminator.
+
+/**
+ * @brief Kind of a device command.
+ */
+enum class CommandKind : uint8_t {
+    RELAY,      ///< Switch a relay.
+    DISPLAY     ///< Show a text on the display.
+};
+
+/**
+ * @brief A device command passed from the network task to the control loop.
+ */
+struct Command {
+    CommandKind kind;               ///< Kind of the command.
+    uint8_t device;                 ///< Device id for RELAY commands.
+    bool on;                        ///< New state for RELAY commands.
+    char text[DISPLAY_TEXT_LEN];    ///< NUL-terminated text for DISPLAY commands.
+    uint32_t stamp;                 ///< TRACE_TIME_US() when the message was dispatched, 0 without tracing.
+};
+
+/**
+ * @brief A message passed from the control loop to the network task for publishing.
+ */
+struct Telemetry {
+    uint8_t topic;                      ///< Index of the topic in the topic list.
+    uint8_t length;                     ///< Payload length.
+    char payload[QUEUE_PAYLOAD_LEN];    ///< Payload, not NUL-terminated.
+};
+
+#ifdef MQTT_ASYNC
+typedef AsyncMqtt MqttClient;       ///< Event-driven, QoS 1 publishes with an in-flight window.
+#else
+typedef PubSubClient MqttClient;    ///< Polled, QoS 0 publishes.
+#endif
+
+typedef SpscQueue<Command, COMMAND_QUEUE_LEN> CommandQueue;         ///< Network task to control loop.
+typedef SpscQueue<Telemetry, TELEMETRY_QUEUE_LEN> TelemetryQueue;   ///< Control loop to network task.
+
+/**
+ * @brief States of the broker connection.
+ */
+enum class MqttState : uint8_t {
+    IDLE,           ///< mqtt_setup() was not called yet.
+    WAIT_NETWORK,   ///< Waiting for the WiFi connection.
+    BACKOFF,        ///< Waiting for the next connect attempt.
+    CONNECTING,     ///< Waiting for the CONNACK, AsyncMqtt only.
+    CONNECTED       ///< Connected and subscribed.
+};
 
 class MqttHandler{
 private:
-    std::vector<const char*> topic_list;        ///< List of topics to subscribe to.
+    TopicTable& topic_list;                     ///< Table of topics to subscribe to.
     std::vector<String> cred;                   ///< Broker credentials: cred[0] is address, cred[1] is port.
-    std::vector<uint8_t> devices;               ///< Pins of connected devices (relays), e.g., devices[0] - device1, devices[1] - device2.
-    PubSubClient& mqtt_client;                  ///< MQTT client instance.
-    DallasTemperature& temp_sensor;             ///< DallasTemperature sensor instance for reading temperature.
-    MD_Parola& disp;                            ///< Display instance for showing characters.
-
-    /**
-     * @brief Toggles a device on/off based on its state.
-     * 
-     * This function controls a relay or device by setting the pin high or low.
-     * @param state The desired state of the device (true for on, false for off).
-     * @param pin The pin number of the device to control.
-     */
-    void device(bool state, uint8_t pin);
+    DeviceRegistry& devices;                    ///< Table of connected devices (relays, display).
+    PublishQueue& queue;                        ///< Publishes pending while the broker is unreachable.
+    CommandQueue& commands;                     ///< Device commands for the control loop.
+    TelemetryQueue& telemetry;                  ///< Readings from the control loop.
+    MqttClient& mqtt_client;                    ///< MQTT client instance.
+    TopicRouter router;                         ///< Dispatch table of the subscribed topics.
+    MqttState state = MqttState::IDLE;          ///< State of the broker connection.
+    uint32_t backoff = MQTT_BACKOFF_MIN;        ///< Current reconnect delay in milliseconds.
+    uint32_t next_attempt = 0;                  ///< millis() timestamp of the next connect attempt.
+    char client_id[32];                         ///< Client id, also the root of the stats topics.
+    uint32_t read_stamp = 0;                    ///< TRACE_CYCLES() before the socket is read.
+    uint32_t attempt_stamp = 0;                 ///< TRACE_TIME_US() at the start of the connect attempt.
+    char custom_topics[MQTT_CUSTOM_ROUTES][MQTT_CUSTOM_TOPIC_LEN];  ///< Topics of the custom routes.
+    RouteHandler custom_handlers[MQTT_CUSTOM_ROUTES];               ///< Handlers of the custom routes.
+    uint8_t custom_count = 0;                   ///< Number of custom routes.
 
     /**
-     * @brief Displays a character on the display.
+     * @brief Builds the dispatch table from the topic list.
      * 
-     * This function sends a string to the display for visualization.
-     * @param letter The character or string to display.
+     * Maps the controlling topic of each entry in the device table to the device, and adds the
+     * custom routes.
      */
-    void display(String letter);
+    void routes_setup();
 
     /**
      * @brief MQTT callback function for message handling.
      * 
      * This function is called whenever a message is received on a subscribed topic.
-     * It processes the message and controls devices or updates the display accordingly.
+     * The topic is looked up in the dispatch table and the payload is handed to the
+     * handler as a non-owning view, without heap allocations. Relay and display commands
+     * are queued for the control loop.
      * @param topic The topic of the received message.
      * @param message The message payload.
      * @param length The length of the message.
      */
     void callback(char *topic, byte* message, unsigned int length);
 
+    /**
+     * @brief Makes one connect attempt and subscribes to the topics on success.
+     * 
+     * On failure the next attempt is scheduled with exponential backoff and jitter. An attempt
+     * of the asynchronous transport which is still waiting for the CONNACK is polled again.
+     */
+    void mqtt_connect();
+
+    /**
+     * @brief Subscribes to the topic list.
+     *
+     * The filters go out in one SUBSCRIBE packet with AsyncMqtt, one packet each with PubSubClient.
+     * With MQTT_WILDCARD_SUBSCRIBE the topics are collapsed into one wildcard filter when they
+     * share a prefix of at least WILDCARD_MIN_LEVELS levels. The custom topics are always
+     * subscribed to on their own.
+     */
+    void mqtt_subscribe();
+
+    /**
+     * @brief Publishes a message, or queues it if the broker is unreachable.
+     * 
+     * Messages are also queued while older ones are still pending, so they go out in order.
+     * @param topic Index of the topic in the topic list.
+     * @param payload The payload.
+     * @param length The payload length.
+     */
+    void mqtt_publish(uint8_t topic, const char* payload, size_t length);
+
+    /**
+     * @brief Sends up to QUEUE_DRAIN_BURST queued messages.
+     *
+     * Each payload is stamped with the time it was queued, once SNTP had set the clock.
+     */
+    void mqtt_drain();
+
 public:
     /**
      * @brief Constructor for the MqttHandler class.
      * 
-     * Initializes the MqttHandler with the necessary parameters for MQTT communication,
-     * temperature sensor, and display setup.
-     * @param client Reference to the PubSubClient instance.
-     * @param sensor Reference to the DallasTemperature instance.
-     * @param display Reference to the MD_Parola display instance.
-     * @param topics A list of topics to subscribe to.
+     * Initializes the MqttHandler with the necessary parameters for MQTT communication
+     * and the queues connecting it to the control loop.
+     * @param client Reference to the MQTT client instance.
+     * @param registry Reference to the table of connected devices.
+     * @param pending Reference to the queue holding publishes during broker outages.
+     * @param command_queue Reference to the queue of commands for the control loop.
+     * @param telemetry_queue Reference to the queue of readings from the control loop.
+     * @param topics The table of topics to subscribe to.
      * @param credentials A vector containing the MQTT broker address and port.
      */
-    MqttHandler(PubSubClient& client, DallasTemperature& sensor, MD_Parola& display, std::vector<const char*>& topics, std::vector<String>& credentials);
+    MqttHandler(MqttClient& client, DeviceRegistry& registry, PublishQueue& pending, CommandQueue& command_queue, TelemetryQueue& telemetry_queue, TopicTable& topics, std::vector<String>& credentials);
 
     /**
      * @brief Initializes the MQTT connection.
      * 
      * This function sets up the MQTT broker address, port, and callback function.
-     * It also connects to the broker and subscribes to the specified topics.
+     * It does not block, the connection is established by mqtt_loop().
      */
     void mqtt_setup();
 
     /**
      * @brief Maintains the MQTT connection.
      * 
-     * This function keeps the MQTT client connected to the broker, attempting to reconnect
-     * if the connection is lost. It also processes incoming messages.
+     * This function drives the connection state machine: it waits for WiFi, makes at most one
+     * connect attempt per backoff period and processes incoming messages while connected.
+     * It never waits for the broker longer than a single connect attempt, so it is safe to call
+     * from the scheduler during a broker outage.
      */
     void mqtt_loop();
 
     /**
-     * @brief Sends temperature data to the MQTT broker.
+     * @brief Returns true if connected to the broker and subscribed to the topics.
+     */
+    bool mqtt_connected();
+
+    /**
+     * @brief Publishes a diagnostic message to the '<client id>/$SYS/<name>' topic.
+     * 
+     * Stats are not queued while the broker is unreachable.
+     * @param name Name of the statistic.
+     * @param payload The payload.
+     * @return True if the message was sent.
+     */
+    bool mqtt_publish_stat(const char* name, const char* payload);
+
+    /**
+     * @brief Routes the '<client id>/<name>' topic to a handler, called after mqtt_setup().
+     * 
+     * The handler runs on the network task with a non-owning view of the payload. Payloads are
+     * limited by the receive buffer of the transport.
+     * @param name Topic below the client id.
+     * @param handler Handler of the messages.
+     * @return False if the table is full or the topic too long.
+     */
+    bool mqtt_add_handler(const char* name, RouteHandler handler);
+
+    /**
+     * @brief Sends a telemetry payload to the MQTT broker.
      * 
-     * This function reads the temperature from the DallasTemperature sensor and publishes
-     * it to the specified MQTT topic.
+     * This function publishes a payload built by the TelemetryPipeline to the telemetry topic
+     * (the first topic). Called from the control loop, the message is handed to the network
+     * task through the telemetry queue.
+     * @param payload The payload, not NUL-terminated.
+     * @param length Payload length, at most QUEUE_PAYLOAD_LEN.
      */
-    void mqtt_send_temp();
+    void mqtt_send_telemetry(const char* payload, size_t length);
 
     /**
      * @brief Disconnects from the MQTT broker.
@@ -0,0 +1,330 @@
+#include "PayloadCodec.h"
+#include <math.h>
+
+static const uint32_t decimal_scale[] = {1, 10, 100, 1000, 10000};
+
+bool codec_parse(const char* name, size_t len, Codec& codec){
+  if (len == 4 && strncasecmp(name, "text", 4) == 0) {
+    codec = Codec::TEXT;
+  } else if (len == 4 && strncasecmp(name, "json", 4) == 0) {
+    codec = Codec::JSON;
+  } else if (len == 4 && strncasecmp(name, "cbor", 4) == 0) {
+    codec = Codec::CBOR;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Writes the head of a CBOR data item with its argument in the shortest form.
+ */
+static size_t cbor_head(uint8_t* out, uint8_t major, uint32_t arg){
+  major <<= 5;
+  if (arg < 24) {
+    out[0] = major | arg;
+    return 1;
+  }
+  if (arg <= 0xFF) {
+    out[0] = major | 24;
+    out[1] = arg;
+    return 2;
+  }
+  if (arg <= 0xFFFF) {
+    out[0] = major | 25;
+    out[1] = arg >> 8;
+    out[2] = arg;
+    return 3;
+  }
+  out[0] = major | 26;
+  out[1] = arg >> 24;
+  out[2] = arg >> 16;
+  out[3] = arg >> 8;
+  out[4] = arg;
+  return 5;
+}
+
+PayloadWriter::PayloadWriter(Codec encoding, uint8_t* out, size_t len) : codec(encoding), buffer(out), capacity(len) {}
+
+size_t PayloadWriter::encode(uint8_t* field, const char* name, float value, uint8_t decimals) const {
+  size_t n = 0;
+  size_t name_len = strlen(name);
+
+  if (name_len > CODEC_NAME_MAX) {
+    name_len = CODEC_NAME_MAX;
+  }
+  if (decimals > 4) {
+    decimals = 4;
+  }
+
+  switch (codec) {
+    case Codec::TEXT:
+      if (fields > 0) {
+        field[n++] = ',';
+      }
+      memcpy(field + n, name, name_len);
+      n += name_len;
+      field[n++] = '=';
+      n += formatFixed((char*)field + n, value, decimals);
+      break;
+
+    case Codec::JSON: {
+      field[n++] = fields > 0 ? ',' : '{';
+      field[n++] = '"';
+      memcpy(field + n, name, name_len);
+      n += name_len;
+      field[n++] = '"';
+      field[n++] = ':';
+      size_t len = formatFixed((char*)field + n, value, decimals);
+      if (field[n] == 'n') {
+        memcpy(field + n, "null", 4);  ///< JSON has no NaN.
+        len = 4;
+      }
+      n += len;
+      break;
+    }
+
+    case Codec::CBOR:
+      if (fields == 0) {
+        field[n++] = 0xBF;  ///< Indefinite-length map, the field count is not known up front.
+      }
+      n += cbor_head(field + n, 3, name_len);
+      memcpy(field + n, name, name_len);
+      n += name_len;
+      if (decimals == 0 && value > -2147483000.0f && value < 2147483000.0f) {
+        int32_t v = (int32_t)lroundf(value);
+        n += v >= 0 ? cbor_head(field + n, 0, v) : cbor_head(field + n, 1, (uint32_t)(-1 - v));
+      } else {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        field[n++] = 0xFA;  ///< Single-precision float, big-endian.
+        field[n++] = bits >> 24;
+        field[n++] = bits >> 16;
+        field[n++] = bits >> 8;
+        field[n++] = bits;
+      }
+      break;
+  }
+  return n;
+}
+
+bool PayloadWriter::fits(const char* name, float value, uint8_t decimals) const {
+  uint8_t field[PAYLOAD_FIELD_MAX];
+  size_t n = encode(field, name, value, decimals);
+
+  return pos + n + (codec == Codec::TEXT ? 0 : 1) <= capacity;
+}
+
+bool PayloadWriter::number(const char* name, float value, uint8_t decimals){
+  uint8_t field[PAYLOAD_FIELD_MAX];
+  size_t n = encode(field, name, value, decimals);
+
+  if (pos + n + (codec == Codec::TEXT ? 0 : 1) > capacity) {
+    return false;
+  }
+  memcpy(buffer + pos, field, n);
+  pos += n;
+  fields++;
+  return true;
+}
+
+size_t PayloadWriter::finish(){
+  if (fields == 0) {
+    return 0;
+  }
+  if (codec == Codec::JSON) {
+    buffer[pos++] = '}';
+  } else if (codec == Codec::CBOR) {
+    buffer[pos++] = 0xFF;  ///< Break, ends the indefinite-length map.
+  }
+  return pos;
+}
+
+size_t PayloadWriter::formatFixed(char* out, float value, uint8_t decimals){
+  char digits[12];
+  char* p = out;
+  uint8_t n = 0;
+
+  if (decimals > 4) {
+    decimals = 4;
+  }
+  float scaled = value * decimal_scale[decimals];
+  if (!(scaled > -2147483000.0f && scaled < 2147483000.0f)) {
+    memcpy(out, "nan", 3);  ///< Also catches NaN, every comparison with it is false.
+    return 3;
+  }
+
+  int32_t fixed = (int32_t)lroundf(scaled);
+  uint32_t magnitude = fixed < 0 ? -(uint32_t)fixed : fixed;
+  if (fixed < 0) {
+    *p++ = '-';
+  }
+  do {
+    digits[n++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude != 0 || n <= decimals);  ///< At least one digit before the point.
+
+  while (n > decimals) {
+    *p++ = digits[--n];
+  }
+  if (decimals > 0) {
+    *p++ = '.';
+    while (n > 0) {
+      *p++ = digits[--n];
+    }
+  }
+  return p - out;
+}
+
+/**
+ * @brief Strips JSON whitespace from both ends of a payload.
+ */
+static void json_trim(const uint8_t*& payload, size_t& len){
+  while (len > 0 && isspace(payload[0])) {
+    payload++;
+    len--;
+  }
+  while (len > 0 && isspace(payload[len - 1])) {
+    len--;
+  }
+}
+
+static bool equals(const uint8_t* payload, size_t len, const char* str){
+  return len == strlen(str) && memcmp(payload, str, len) == 0;
+}
+
+size_t codec_stamp(Codec codec, uint8_t* payload, size_t len, size_t capacity, uint32_t time){
+  uint8_t field[PAYLOAD_FIELD_MAX];
+  size_t end = len;
+  size_t n = 0;
+
+  if (len == 0) {
+    return len;
+  }
+  switch (codec) {
+    case Codec::TEXT:
+      n = snprintf((char*)field, sizeof(field), "," CODEC_TIME_FIELD "=%lu", (unsigned long)time);
+      break;
+
+    case Codec::JSON:
+      if (payload[len - 1] != '}') {
+        return len;
+      }
+      end--;  ///< Reopens the object, the field brings the closing brace.
+      n = snprintf((char*)field, sizeof(field), ",\"" CODEC_TIME_FIELD "\":%lu}", (unsigned long)time);
+      break;
+
+    case Codec::CBOR:
+      if (payload[0] != 0xBF || payload[len - 1] != 0xFF) {
+        return len;
+      }
+      end--;  ///< Reopens the map, the field brings the break.
+      n = cbor_head(field, 3, strlen(CODEC_TIME_FIELD));
+      memcpy(field + n, CODEC_TIME_FIELD, strlen(CODEC_TIME_FIELD));
+      n += strlen(CODEC_TIME_FIELD);
+      n += cbor_head(field + n, 0, time);
+      field[n++] = 0xFF;
+      break;
+  }
+  if (end + n > capacity) {
+    return len;
+  }
+  memcpy(payload + end, field, n);
+  return end + n;
+}
+
+bool codec_read_switch(Codec codec, const uint8_t* payload, size_t len, bool& on){
+  switch (codec) {
+    case Codec::TEXT:
+      break;
+
+    case Codec::JSON:
+      json_trim(payload, len);
+      if (equals(payload, len, "true") || equals(payload, len, "1") || equals(payload, len, "\"on\"")) {
+        on = true;
+        return true;
+      }
+      if (equals(payload, len, "false") || equals(payload, len, "0") || equals(payload, len, "\"off\"")) {
+        on = false;
+        return true;
+      }
+      return false;
+
+    case Codec::CBOR:
+      if (len == 1 && (payload[0] == 0xF5 || payload[0] == 0x01)) {
+        on = true;
+        return true;
+      }
+      if (len == 1 && (payload[0] == 0xF4 || payload[0] == 0x00)) {
+        on = false;
+        return true;
+      }
+      if (len > 0 && (payload[0] & 0xE0) == 0x60) {
+        payload++;  ///< Short text string, "on" or "off".
+        len--;
+        break;
+      }
+      return false;
+  }
+
+  if (equals(payload, len, "on")) {
+    on = true;
+    return true;
+  }
+  if (equals(payload, len, "off")) {
+    on = false;
+    return true;
+  }
+  return false;
+}
+
+bool codec_read_text(Codec codec, const uint8_t* payload, size_t len, char* out, size_t out_len){
+  size_t n = 0;
+
+  switch (codec) {
+    case Codec::TEXT:
+      break;
+
+    case Codec::JSON:
+      json_trim(payload, len);
+      if (len < 2 || payload[0] != '"' || payload[len - 1] != '"') {
+        return false;
+      }
+      for (size_t i = 1; i < len - 1 && n + 1 < out_len; i++) {
+        if (payload[i] == '\\' && i + 2 < len && (payload[i + 1] == '"' || payload[i + 1] == '\\')) {
+          i++;  ///< Keep the escaped character.
+        }
+        out[n++] = payload[i];
+      }
+      out[n] = '\0';
+      return true;
+
+    case Codec::CBOR: {
+      if (len == 0 || (payload[0] & 0xE0) != 0x60) {
+        return false;
+      }
+      size_t head = 1;
+      size_t text_len = payload[0] & 0x1F;
+      if (text_len == 24 && len >= 2) {
+        text_len = payload[1];
+        head = 2;
+      } else if (text_len == 25 && len >= 3) {
+        text_len = (payload[1] << 8) | payload[2];
+        head = 3;
+      } else if (text_len >= 24) {
+        return false;  ///< Longer and indefinite-length strings are not used for commands.
+      }
+      if (head + text_len > len) {
+        return false;
+      }
+      payload += head;
+      len = text_len;
+      break;
+    }
+  }
+
+  n = len < out_len - 1 ? len : out_len - 1;
+  memcpy(out, payload, n);
+  out[n] = '\0';
+  return true;
+}
@@ -0,0 +1,154 @@
+#ifndef PAYLOADCODEC_H
+#define PAYLOADCODEC_H
+
+/**
+ * @file PayloadCodec.h
+ * @brief Zero-allocation streaming encoder and decoder for MQTT payloads.
+ *
+ * Three encodings are supported, chosen per topic:
+ * - TEXT, the legacy format: "on"/"off" commands and name=value,name=value telemetry.
+ * - JSON: true/false or "on"/"off" commands and {"name":value,...} telemetry.
+ * - CBOR (RFC 8949): true/false, 0/1 or "on"/"off" commands and an indefinite-length map of
+ *   text keys to integers or float32 values as telemetry.
+ * The writer appends fields straight into a caller-provided buffer and the reader parses the
+ * payload in place, neither uses the heap.
+ */
+#include <Arduino.h>
+
+#define CODEC_NAME_MAX 23       ///< Longest field name, CBOR keys use a one-byte header.
+#define PAYLOAD_FIELD_MAX (CODEC_NAME_MAX + 24)   ///< Longest field: separator, quoted name, colon, 13-char value.
+#define CODEC_TIME_FIELD "ts"    ///< Name of the field codec_stamp() appends.
+
+/**
+ * @brief Payload encoding of a topic.
+ */
+enum class Codec : uint8_t {
+    TEXT,   ///< Legacy ASCII payloads.
+    JSON,   ///< JSON values and objects.
+    CBOR    ///< CBOR values and maps.
+};
+
+/**
+ * @brief Parses a codec name ("text", "json" or "cbor").
+ *
+ * @param name The name, not NUL-terminated.
+ * @param len Length of the name.
+ * @param codec Receives the codec.
+ * @return False if the name is unknown.
+ */
+bool codec_parse(const char* name, size_t len, Codec& codec);
+
+/**
+ * @class PayloadWriter
+ * @brief Streams named numeric fields into a buffer in the encoding of a topic.
+ *
+ * A field which does not fit leaves the buffer unchanged, so the caller can put it into the
+ * next payload. One byte is kept free for the closing delimiter of JSON and CBOR.
+ */
+class PayloadWriter {
+private:
+    Codec codec;            ///< Encoding.
+    uint8_t* buffer;        ///< Output buffer.
+    size_t capacity;        ///< Size of the buffer.
+    size_t pos = 0;         ///< Bytes written.
+    uint8_t fields = 0;     ///< Fields written.
+
+    /**
+     * @brief Encodes a field without appending it.
+     *
+     * @param field Receives the field, at least PAYLOAD_FIELD_MAX bytes.
+     * @return Length of the field.
+     */
+    size_t encode(uint8_t* field, const char* name, float value, uint8_t decimals) const;
+
+public:
+    /**
+     * @brief Constructor for PayloadWriter class.
+     *
+     * @param encoding Encoding of the payload.
+     * @param out The output buffer.
+     * @param len Size of the buffer.
+     */
+    PayloadWriter(Codec encoding, uint8_t* out, size_t len);
+
+    /**
+     * @brief Appends a numeric field.
+     *
+     * Values with no decimals are written as integers, others with the given number of decimals,
+     * or as float32 in CBOR.
+     * @param name Field name, at most CODEC_NAME_MAX characters.
+     * @param value The value.
+     * @param decimals Number of decimals, at most 4.
+     * @return False if the field does not fit, nothing is written then.
+     */
+    bool number(const char* name, float value, uint8_t decimals);
+
+    /**
+     * @brief Returns true if number() would append the field.
+     */
+    bool fits(const char* name, float value, uint8_t decimals) const;
+
+    /**
+     * @brief Closes the payload.
+     *
+     * @return Length of the payload, 0 if no field was written.
+     */
+    size_t finish();
+
+    /**
+     * @brief Returns the number of fields written.
+     */
+    uint8_t count() const { return fields; }
+
+    /**
+     * @brief Formats a value with a fixed number of decimals using integer arithmetic.
+     *
+     * Values beyond the int32 range after scaling and NaN are written as "nan".
+     * @param out The output buffer, at least 13 characters, not NUL-terminated.
+     * @param value The value.
+     * @param decimals Number of decimals, at most 4.
+     * @return Number of characters written.
+     */
+    static size_t formatFixed(char* out, float value, uint8_t decimals);
+};
+
+/**
+ * @brief Appends a CODEC_TIME_FIELD field holding a Unix time to a payload closed by
+ * PayloadWriter::finish().
+ *
+ * The time is written as an exact integer, number() would round it through a float.
+ * @param codec Encoding of the payload.
+ * @param payload The payload.
+ * @param len Length of the payload.
+ * @param capacity Size of the payload buffer.
+ * @param time Unix time in seconds.
+ * @return Length of the stamped payload. If the payload is not a field list of the codec or
+ *         the field does not fit, the payload is left unchanged and len is returned.
+ */
+size_t codec_stamp(Codec codec, uint8_t* payload, size_t len, size_t capacity, uint32_t time);
+
+/**
+ * @brief Decodes an on/off command.
+ *
+ * @param codec Encoding of the payload.
+ * @param payload The payload.
+ * @param len Length of the payload.
+ * @param on Receives the state.
+ * @return False if the payload is not a valid on/off value.
+ */
+bool codec_read_switch(Codec codec, const uint8_t* payload, size_t len, bool& on);
+
+/**
+ * @brief Decodes a text command, truncated to the output buffer.
+ *
+ * TEXT payloads are taken as-is. JSON strings are unescaped for \" and \\ only.
+ * @param codec Encoding of the payload.
+ * @param payload The payload.
+ * @param len Length of the payload.
+ * @param out Receives the NUL-terminated text.
+ * @param out_len Size of the output buffer.
+ * @return False if the payload is not a string in the given encoding.
+ */
+bool codec_read_text(Codec codec, const uint8_t* payload, size_t len, char* out, size_t out_len);
+
+#endif // PAYLOADCODEC_H
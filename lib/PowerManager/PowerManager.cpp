@@ -0,0 +1,127 @@
+#include "PowerManager.h"
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <soc/gpio_struct.h>
+
+PowerManager::PowerManager(uint8_t button) : wake_pin(button) {}
+
+void PowerManager::sanitize() {
+  if (policy.max_mhz != 80 && policy.max_mhz != 160 && policy.max_mhz != 240) {
+    policy.max_mhz = POWER_MAX_MHZ;
+  }
+  if (policy.min_mhz < POWER_MIN_MHZ || policy.min_mhz > policy.max_mhz) {
+    policy.min_mhz = policy.max_mhz;  ///< The PM driver rejects a minimum above the maximum.
+  }
+}
+
+void PowerManager::begin(MemoryHandler& memory) {
+  PowerPolicy stored;
+  if (memory.getPowerPolicy((uint8_t*)&stored, sizeof(stored)) == sizeof(stored)) {
+    policy = stored;
+  }
+  apply();
+}
+
+void PowerManager::setPolicy(MemoryHandler& memory, const PowerPolicy& next) {
+  policy = next;
+  sanitize();
+  memory.putPowerPolicy((const uint8_t*)&policy, sizeof(policy));
+  apply();
+}
+
+bool PowerManager::parse(const char* text, PowerPolicy& policy) {
+  static const char* const modes[] = {"performance", "modem", "light"};
+  unsigned long numbers[3] = {0, POWER_MAX_MHZ, POWER_MAX_MHZ};
+  char* end;
+
+  while (*text == ' ') text++;
+  size_t len = strcspn(text, " ");
+  uint8_t mode = 0;
+  while (mode < 3 && (strlen(modes[mode]) != len || strncmp(text, modes[mode], len) != 0)) {
+    mode++;
+  }
+  if (mode == 3) {
+    return false;
+  }
+  text += len;
+
+  for (uint8_t i = 0; i < 3; i++) {
+    while (*text == ' ') text++;
+    if (*text == '\0') {
+      break;
+    }
+    numbers[i] = strtoul(text, &end, 10);
+    if (end == text || (*end != ' ' && *end != '\0') || numbers[i] > (i == 0 ? 255 : POWER_MAX_MHZ)) {
+      return false;
+    }
+    text = end;
+  }
+  while (*text == ' ') text++;
+  if (*text != '\0') {
+    return false;  ///< More than three numbers.
+  }
+
+  policy = {(PowerMode)mode, (uint8_t)numbers[0], (uint16_t)numbers[1], (uint16_t)numbers[2]};
+  return true;
+}
+
+bool PowerManager::apply() {
+  bool ok = true;
+  sanitize();
+
+  esp_pm_config_esp32_t pm;
+  pm.max_freq_mhz = policy.max_mhz;
+  pm.min_freq_mhz = policy.mode == PowerMode::PERFORMANCE ? policy.max_mhz : policy.min_mhz;
+  pm.light_sleep_enable = policy.mode == PowerMode::LIGHT_SLEEP;
+
+  esp_err_t err = esp_pm_configure(&pm);
+  if (err != ESP_OK && pm.light_sleep_enable) {
+    Serial.printf("Light sleep is not available (%d), scaling the CPU frequency only.\n", err);
+    pm.light_sleep_enable = false;
+    err = esp_pm_configure(&pm);
+    ok = false;
+  }
+  if (err != ESP_OK) {
+    Serial.printf("Power management is not available (%d).\n", err);
+    ok = false;
+  }
+  light_sleep = err == ESP_OK && pm.light_sleep_enable;
+
+  // Applied by the driver when the station starts, or immediately if it is running.
+  WiFi.setSleep(policy.mode == PowerMode::PERFORMANCE ? WIFI_PS_NONE :
+                policy.mode == PowerMode::MODEM_SLEEP ? WIFI_PS_MIN_MODEM : WIFI_PS_MAX_MODEM);
+
+  if (armed) {
+    armWakeup();  ///< The interrupt type of the pin follows the new policy.
+  }
+
+  Serial.printf("Power mode %u, CPU %u-%u MHz, light sleep %s.\n", (unsigned)policy.mode,
+                (unsigned)pm.min_freq_mhz, (unsigned)pm.max_freq_mhz, light_sleep ? "on" : "off");
+  return ok;
+}
+
+void PowerManager::armWakeup() {
+  armed = true;
+  portENTER_CRITICAL(&lock);
+  if (light_sleep) {
+    // Edge interrupts do not wake the chip, a level wakeup brings it up for the button ISR.
+    gpio_wakeup_enable((gpio_num_t)wake_pin, gpio_get_level((gpio_num_t)wake_pin) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+  } else {
+    gpio_wakeup_disable((gpio_num_t)wake_pin);
+    gpio_set_intr_type((gpio_num_t)wake_pin, GPIO_INTR_ANYEDGE);
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+void IRAM_ATTR PowerManager::buttonEdge() {
+  if (!light_sleep) {
+    return;
+  }
+  portENTER_CRITICAL_ISR(&lock);
+  // The register is written directly, the driver functions are not in IRAM
+  uint32_t level = wake_pin < 32 ? (GPIO.in >> wake_pin) & 1 : (GPIO.in1.data >> (wake_pin - 32)) & 1;
+  GPIO.pin[wake_pin].int_type = level ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL;
+  portEXIT_CRITICAL_ISR(&lock);
+}
@@ -0,0 +1,123 @@
+#ifndef POWERMANAGER_H
+#define POWERMANAGER_H
+
+/**
+ * @class PowerManager
+ * @brief Applies the stored power policy: CPU frequency scaling, WiFi modem sleep and
+ * automatic light sleep.
+ *
+ * With automatic light sleep the chip sleeps whenever both cores are idle. Both cores block
+ * in WakeSource::wait() until their next scheduler deadline. The chip wakes on the FreeRTOS
+ * timeout, on the button GPIO level, and at every listen interval to receive traffic buffered
+ * by the access point. Light sleep needs a framework built with CONFIG_PM_ENABLE and
+ * CONFIG_FREERTOS_USE_TICKLESS_IDLE; without them the policy falls back to frequency scaling.
+ *
+ * Only level interrupts wake the chip, and the GPIO wakeup shares the interrupt type of the pin
+ * with attachInterrupt(). While light sleep is on, the button pin therefore waits for the level
+ * opposite to its current one, and buttonEdge() flips it from the ISR, which gives the ISR the
+ * edges of a CHANGE interrupt.
+ */
+#include <Arduino.h>
+#include <WiFi.h>
+#include <MemoryHandler.h>
+
+#define POWER_MIN_MHZ 80        ///< Lowest CPU frequency which keeps WiFi running.
+#define POWER_MAX_MHZ 240       ///< Highest CPU frequency.
+
+/**
+ * @brief Power mode of the node.
+ */
+enum class PowerMode : uint8_t {
+    PERFORMANCE,    ///< No WiFi power save, fixed CPU frequency.
+    MODEM_SLEEP,    ///< WiFi modem sleeps between DTIM beacons, the Arduino default.
+    LIGHT_SLEEP     ///< Modem sleep over the listen interval, light sleep while idle.
+};
+
+/**
+ * @brief The power policy, stored as-is in memory.
+ */
+struct PowerPolicy {
+    PowerMode mode;             ///< Power mode.
+    uint8_t listen_interval;    ///< Beacon intervals between wakeups in LIGHT_SLEEP, 0 for the driver default.
+    uint16_t min_mhz;           ///< CPU frequency while idle.
+    uint16_t max_mhz;           ///< CPU frequency while busy.
+};
+
+class PowerManager {
+private:
+    PowerPolicy policy = {PowerMode::MODEM_SLEEP, 0, POWER_MAX_MHZ, POWER_MAX_MHZ};  ///< Current policy.
+    uint8_t wake_pin;           ///< Button GPIO which wakes the chip from light sleep.
+    volatile bool light_sleep = false;  ///< True if automatic light sleep is enabled, read by the ISR.
+    bool armed = false;         ///< True once armWakeup() has run, apply() then re-arms the pin.
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;   ///< Guards the interrupt type against the ISR.
+
+    /**
+     * @brief Clamps the frequencies of the policy to supported values.
+     */
+    void sanitize();
+
+public:
+    /**
+     * @brief Constructor for PowerManager class.
+     *
+     * @param button GPIO of the button.
+     */
+    PowerManager(uint8_t button);
+
+    /**
+     * @brief Loads the policy and applies it, before WiFi is started.
+     *
+     * The default policy when none is stored keeps the Arduino defaults.
+     * @param memory Reference to the MemoryHandler holding the policy.
+     */
+    void begin(MemoryHandler& memory);
+
+    /**
+     * @brief Stores and applies a new policy, the listen interval takes effect on the next connect.
+     */
+    void setPolicy(MemoryHandler& memory, const PowerPolicy& next);
+
+    /**
+     * @brief Parses a policy written as '<mode> [listen interval] [min MHz] [max MHz]'.
+     *
+     * The mode is performance, modem or light. Omitted numbers keep the driver default listen
+     * interval and POWER_MAX_MHZ, frequencies are clamped by setPolicy().
+     * @param text NUL-terminated policy text.
+     * @param policy Receives the policy.
+     * @return False if the mode is unknown or a number is malformed.
+     */
+    static bool parse(const char* text, PowerPolicy& policy);
+
+    /**
+     * @brief Applies the current policy.
+     *
+     * @return False if the policy could not be applied as a whole.
+     */
+    bool apply();
+
+    /**
+     * @brief Arms the button pin for the current policy, called after attachInterrupt(), which
+     * replaces the interrupt type of the pin.
+     *
+     * With light sleep the pin gets a level interrupt which also wakes the chip, otherwise the
+     * edge interrupt of attachInterrupt(CHANGE) is restored.
+     */
+    void armWakeup();
+
+    /**
+     * @brief Waits for the next edge of the button, called first in its ISR.
+     */
+    void IRAM_ATTR buttonEdge();
+
+    /**
+     * @brief Returns the current policy.
+     */
+    const PowerPolicy& current() const { return policy; }
+
+    /**
+     * @brief Returns true if automatic light sleep is enabled.
+     */
+    bool lightSleep() const { return light_sleep; }
+};
+
+#endif // POWERMANAGER_H
@@ -0,0 +1,190 @@
+#include "PublishQueue.h"
+
+PublishQueue::PublishQueue(fs::FS& filesystem): fs(filesystem) {}
+
+void PublishQueue::segmentPath(char* path, size_t len, uint32_t seq) {
+  snprintf(path, len, "/pq3_%lu", (unsigned long)seq);
+}
+
+void PublishQueue::begin(bool mounted) {
+  fs_ready = mounted;
+  if (!fs_ready) {
+    Serial.println("Publish queue log not available, queueing in RAM only.");
+    return;
+  }
+
+  // Segments of the older record layouts: pq_ stamped with millis(), pq2_ without a timestamp
+  static const char* const legacy_names[] = {"pq_", "pq2_"};
+  bool legacy[2] = {false, false};
+  uint32_t legacy_first[2] = {0, 0}, legacy_last[2] = {0, 0};
+
+  // Find the oldest and the newest segment left from before the reboot.
+  File root = fs.open("/");
+  for (File file = root.openNextFile(); file; file = root.openNextFile()) {
+    const char* name = file.name();
+    if (name[0] == '/') name++;  ///< Some core versions report the full path.
+    for (uint8_t i = 0; i < 2; i++) {
+      size_t len = strlen(legacy_names[i]);
+      if (strncmp(name, legacy_names[i], len) == 0) {
+        uint32_t seq = strtoul(name + len, nullptr, 10);  ///< Removed after the scan.
+        if (!legacy[i] || seq < legacy_first[i]) legacy_first[i] = seq;
+        if (!legacy[i] || seq > legacy_last[i]) legacy_last[i] = seq;
+        legacy[i] = true;
+      }
+    }
+    if (strncmp(name, "pq3_", 4) != 0) {
+      continue;
+    }
+
+    uint32_t seq = strtoul(name + 4, nullptr, 10);
+    if (log_empty || seq < read_seq) read_seq = seq;
+    if (log_empty || seq > write_seq) {
+      write_seq = seq;
+      write_idx = file.size() / sizeof(PendingPublish);
+    }
+    log_empty = false;
+  }
+  read_idx = 0;
+  for (uint8_t i = 0; i < 2; i++) {
+    for (uint32_t seq = legacy_first[i]; legacy[i] && seq <= legacy_last[i]; seq++) {
+      char path[16];
+      snprintf(path, sizeof(path), "/%s%lu", legacy_names[i], (unsigned long)seq);
+      fs.remove(path);
+    }
+  }
+
+  if (!log_empty) {
+    Serial.printf("Recovered %lu queued publish(es) from flash.\n", (unsigned long)logDepth());
+  }
+}
+
+uint32_t PublishQueue::logDepth() const {
+  if (log_empty) {
+    return 0;
+  }
+  return (write_seq - read_seq) * QUEUE_SEGMENT_RECORDS + write_idx - read_idx;
+}
+
+void PublishQueue::spill(uint8_t count) {
+  char path[16];
+
+  if (!fs_ready) {
+    drops += count;
+    head = (head + count) % QUEUE_CAPACITY;
+    ring_depth -= count;
+    return;
+  }
+
+  while (count > 0) {
+    if (log_empty) {
+      write_seq++;  ///< Always start a fresh segment file.
+      read_seq = write_seq;
+      read_idx = 0;
+      write_idx = 0;
+    } else if (write_idx >= QUEUE_SEGMENT_RECORDS) {
+      if (write_seq - read_seq + 1 >= QUEUE_SEGMENT_COUNT) {
+        // Log is full, drop the oldest segment.
+        drops += QUEUE_SEGMENT_RECORDS - read_idx;
+        segmentPath(path, sizeof(path), read_seq);
+        fs.remove(path);
+        read_seq++;
+        read_idx = 0;
+      }
+      write_seq++;
+      write_idx = 0;
+    }
+
+    // One open for the entries which fit the segment, one write per contiguous part of the ring
+    segmentPath(path, sizeof(path), write_seq);
+    File file = fs.open(path, FILE_APPEND);
+    uint16_t room = QUEUE_SEGMENT_RECORDS - write_idx;
+    do {
+      uint8_t run = count;
+      if (run > room) run = room;
+      if (run > QUEUE_CAPACITY - head) run = QUEUE_CAPACITY - head;
+      size_t bytes = run * sizeof(PendingPublish);
+      if (file && file.write((const uint8_t*)(ring + head), bytes) == bytes) {
+        write_idx += run;
+        log_empty = false;
+      } else {
+        drops += run;
+      }
+      head = (head + run) % QUEUE_CAPACITY;
+      ring_depth -= run;
+      count -= run;
+      room -= run;
+    } while (count > 0 && room > 0);
+    if (file) {
+      file.close();
+    }
+  }
+}
+
+void PublishQueue::push(uint8_t topic, const char* payload, size_t length, uint32_t timestamp) {
+  if (ring_depth == QUEUE_CAPACITY) {
+    spill(QUEUE_SPILL_BATCH);  ///< Ring is full, move its oldest entries to the log.
+  }
+
+  PendingPublish& entry = ring[(head + ring_depth) % QUEUE_CAPACITY];
+  entry.timestamp = timestamp;
+  entry.topic = topic;
+  entry.length = length > QUEUE_PAYLOAD_LEN ? QUEUE_PAYLOAD_LEN : length;
+  memcpy(entry.payload, payload, entry.length);
+  ring_depth++;
+}
+
+bool PublishQueue::front(PendingPublish& entry) {
+  char path[16];
+
+  while (!log_empty) {
+    segmentPath(path, sizeof(path), read_seq);
+    File file = fs.open(path, FILE_READ);
+    if (file && file.seek(read_idx * sizeof(PendingPublish)) &&
+        file.read((uint8_t*)&entry, sizeof(entry)) == sizeof(entry)) {
+      return true;
+    }
+
+    // Segment is missing or truncated, skip the rest of it.
+    drops += (read_seq == write_seq ? write_idx : QUEUE_SEGMENT_RECORDS) - read_idx;
+    fs.remove(path);
+    if (read_seq == write_seq) {
+      log_empty = true;
+    } else {
+      read_seq++;
+      read_idx = 0;
+    }
+  }
+
+  if (ring_depth == 0) {
+    return false;
+  }
+  entry = ring[head];
+  return true;
+}
+
+void PublishQueue::pop() {
+  char path[16];
+
+  if (!log_empty) {
+    read_idx++;
+    bool last = read_seq == write_seq;
+    if ((last && read_idx >= write_idx) || read_idx >= QUEUE_SEGMENT_RECORDS) {
+      segmentPath(path, sizeof(path), read_seq);
+      fs.remove(path);  ///< Segment fully drained.
+      if (last) {
+        log_empty = true;
+      } else {
+        read_seq++;
+        read_idx = 0;
+      }
+    }
+    drained++;
+    return;
+  }
+
+  if (ring_depth > 0) {
+    head = (head + 1) % QUEUE_CAPACITY;
+    ring_depth--;
+    drained++;
+  }
+}
@@ -0,0 +1,136 @@
+#ifndef PUBLISHQUEUE_H
+#define PUBLISHQUEUE_H
+
+/**
+ * @class PublishQueue
+ * @brief A fixed-capacity queue of publishes pending while the broker is unreachable.
+ *
+ * Entries are kept in an allocation-free ring buffer in RAM. When the ring is full, its
+ * QUEUE_SPILL_BATCH oldest entries are spilled to an append-only log on LittleFS, with one open
+ * and one write per segment file, so the log always holds older entries than the ring and
+ * draining (log first, then ring) preserves the order.
+ * The log is split into fixed-size segment files named by a growing sequence number. A fully
+ * drained segment is deleted and new entries always go to a fresh file, which spreads the writes
+ * over the flash. If all segments are in use the oldest one is dropped.
+ * The read position inside a segment is not persisted, so after a reboot entries of a partially
+ * drained segment may be published twice.
+ * Every entry keeps the Unix time it was queued at, so a reading drained from the backlog can be
+ * published with the time it was taken rather than the time the broker came back.
+ */
+#include <Arduino.h>
+#include <FS.h>
+
+#define QUEUE_CAPACITY 16           ///< Number of entries in the RAM ring.
+#define QUEUE_PAYLOAD_LEN 100       ///< Maximum payload length of an entry.
+#define QUEUE_SEGMENT_RECORDS 64    ///< Entries per log segment file.
+#define QUEUE_SEGMENT_COUNT 4       ///< Maximum number of log segment files.
+#define QUEUE_SPILL_BATCH 8         ///< Entries moved to the log at once, at most QUEUE_CAPACITY.
+#define QUEUE_CLOCK_SET 1600000000UL    ///< Timestamps below were taken before SNTP set the clock.
+
+/**
+ * @brief A pending publish, stored as-is in RAM and in the log.
+ */
+struct PendingPublish {
+    uint32_t timestamp;                 ///< Unix time when the entry was queued.
+    uint8_t topic;                      ///< Index of the topic in the topic list.
+    uint8_t length;                     ///< Payload length.
+    char payload[QUEUE_PAYLOAD_LEN];    ///< Payload, not NUL-terminated.
+};
+
+class PublishQueue {
+private:
+    fs::FS& fs;                                 ///< Filesystem holding the log.
+    bool fs_ready = false;                      ///< True if the log can be used.
+    PendingPublish ring[QUEUE_CAPACITY];        ///< RAM ring buffer.
+    uint8_t head = 0;                           ///< Index of the oldest ring entry.
+    uint8_t ring_depth = 0;                     ///< Number of entries in the ring.
+
+    uint32_t read_seq = 0;                      ///< Sequence number of the oldest log segment.
+    uint32_t write_seq = 0;                     ///< Sequence number of the segment being appended.
+    uint16_t read_idx = 0;                      ///< Next record to read in the oldest segment.
+    uint16_t write_idx = 0;                     ///< Records written to the segment being appended.
+    bool log_empty = true;                      ///< True if the log holds no unread records.
+
+    uint32_t drops = 0;                         ///< Entries lost because both ring and log were full.
+    uint32_t drained = 0;                       ///< Entries handed out by pop().
+
+    /**
+     * @brief Builds the file name of a log segment.
+     */
+    static void segmentPath(char* path, size_t len, uint32_t seq);
+
+    /**
+     * @brief Moves the oldest ring entries to the log, dropping the oldest segment if the log
+     * is full.
+     *
+     * @param count Number of entries, at most ring_depth.
+     */
+    void spill(uint8_t count);
+
+    /**
+     * @brief Returns the number of unread records in the log.
+     */
+    uint32_t logDepth() const;
+
+public:
+    /**
+     * @brief Constructor for PublishQueue class.
+     *
+     * @param filesystem The mounted filesystem used for the spill log.
+     */
+    PublishQueue(fs::FS& filesystem);
+
+    /**
+     * @brief Recovers the log segments left from before the last reboot.
+     *
+     * @param mounted True if the filesystem was mounted successfully, otherwise the queue
+     * works from RAM only.
+     */
+    void begin(bool mounted);
+
+    /**
+     * @brief Queues a publish.
+     *
+     * Payloads longer than QUEUE_PAYLOAD_LEN are truncated.
+     * @param topic Index of the topic in the topic list.
+     * @param payload The payload.
+     * @param length The payload length.
+     * @param timestamp Unix time of the payload, below QUEUE_CLOCK_SET if the clock is not set.
+     */
+    void push(uint8_t topic, const char* payload, size_t length, uint32_t timestamp);
+
+    /**
+     * @brief Copies the oldest entry without removing it.
+     *
+     * @param entry Receives the entry.
+     * @return False if the queue is empty.
+     */
+    bool front(PendingPublish& entry);
+
+    /**
+     * @brief Removes the oldest entry.
+     */
+    void pop();
+
+    /**
+     * @brief Returns true if no entry is pending.
+     */
+    bool empty() const { return ring_depth == 0 && log_empty; }
+
+    /**
+     * @brief Returns the number of pending entries in RAM and in the log.
+     */
+    uint32_t depth() const { return ring_depth + logDepth(); }
+
+    /**
+     * @brief Returns the number of entries lost because the queue was full.
+     */
+    uint32_t dropCount() const { return drops; }
+
+    /**
+     * @brief Returns the number of entries drained since boot.
+     */
+    uint32_t drainCount() const { return drained; }
+};
+
+#endif // PUBLISHQUEUE_H
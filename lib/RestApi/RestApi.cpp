@@ -0,0 +1,183 @@
+#include "RestApi.h"
+#include <stdarg.h>
+#include <WiFi.h>
+#include <PayloadCodec.h>
+#include <LatencyTrace.h>
+
+RestApi::RestApi(DeviceRegistry& registry, SensorHandler& sensor, CommandQueue& queue, WakeSource& control, RulesEngine& engine)
+  : devices(registry), sensors(sensor), commands(queue), wake(control), rules(engine) {}
+
+bool RestApi::append(const char* format, ...){
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buffer + length, sizeof(buffer) - length, format, args);
+  va_end(args);
+  if (n < 0 || (size_t)n >= sizeof(buffer) - length) {
+    return false;
+  }
+  length += n;
+  return true;
+}
+
+void RestApi::send(AsyncWebServerRequest* request, int code){
+  // The body is copied into the TCP send buffer by send(), the buffer is free again on return
+  request->send(request->beginResponse_P(code, "application/json", (const uint8_t*)buffer, length));
+}
+
+bool RestApi::authorized(AsyncWebServerRequest* request){
+  if (request->authenticate(user, pass)) {
+    return true;
+  }
+  request->requestAuthentication();
+  return false;
+}
+
+void RestApi::handleState(AsyncWebServerRequest* request){
+  uint32_t start = TRACE_TIME_US();
+  bool fits = append("{\"uptime\":%lu,\"heap\":%u,\"rssi\":%d,\"devices\":[",
+                     (unsigned long)(millis() / 1000), (unsigned)ESP.getFreeHeap(), (int)WiFi.RSSI());
+
+  for (uint8_t id = 0; id < devices.size() && fits; id++) {
+    const Device& device = devices[id];
+    fits = append("%s{\"id\":%u,\"kind\":\"%s\",\"topic\":%u", id ? "," : "", id,
+                  device.kind == DeviceKind::RELAY ? "relay" : "display", device.topic);
+    if (fits && device.kind == DeviceKind::RELAY) {
+      fits = append(",\"pin\":%u,\"on\":%s", device.pin, device.state ? "true" : "false");
+    }
+    fits = fits && append("}");
+  }
+  fits = fits && append("]}");
+  if (!fits) {
+    length = 0;
+    append("{\"error\":\"response too large\"}");
+  }
+  send(request, fits ? 200 : 500);
+  TRACE_RECORD(trace_api, TRACE_TIME_US() - start);
+}
+
+void RestApi::handleSensors(AsyncWebServerRequest* request){
+  uint32_t start = TRACE_TIME_US();
+  const float* temps = sensors.readings();   // Written by the control loop, each float is read in one access
+  bool fits = append("{\"sensors\":[");
+
+  for (uint8_t i = 0; i < sensors.size() && fits; i++) {
+    if (temps[i] == DEVICE_DISCONNECTED_C) {
+      fits = append("%snull", i ? "," : "");
+    } else {
+      char value[16];
+      value[PayloadWriter::formatFixed(value, temps[i], 2)] = '\0';
+      fits = append("%s%s", i ? "," : "", value);
+    }
+  }
+  fits = fits && append("]}");
+  if (!fits) {
+    length = 0;
+    append("{\"error\":\"response too large\"}");
+  }
+  send(request, fits ? 200 : 500);
+  TRACE_RECORD(trace_api, TRACE_TIME_US() - start);
+}
+
+void RestApi::handleRelay(AsyncWebServerRequest* request){
+  uint32_t start = TRACE_TIME_US();
+  const String& url = request->url();
+  const char* id_text = url.length() > strlen(API_RELAY_PREFIX) ? url.c_str() + strlen(API_RELAY_PREFIX) : "";
+  char* end;
+  unsigned long id = strtoul(id_text, &end, 10);
+
+  if (end == id_text || *end != '\0' || id >= devices.size() || devices[id].kind != DeviceKind::RELAY) {
+    append("{\"error\":\"unknown relay\"}");
+    send(request, 404);
+    return;
+  }
+
+  // state=on|off, from a form body or the query string
+  AsyncWebParameter* p = request->hasParam("state", true) ? request->getParam("state", true) : request->getParam("state");
+  Command cmd = {};
+  if (p == nullptr || !codec_read_switch(Codec::TEXT, (const uint8_t*)p->value().c_str(), p->value().length(), cmd.on)) {
+    append("{\"error\":\"state must be on or off\"}");
+    send(request, 400);
+    return;
+  }
+
+  cmd.kind = CommandKind::RELAY;
+  cmd.device = id;
+  cmd.stamp = TRACE_TIME_US();
+  if (!commands.push(cmd)) {
+    append("{\"error\":\"busy\"}");
+    send(request, 503);
+    return;
+  }
+  wake.signal();
+
+  // Accepted, the control loop switches the relay and publishes the new state
+  append("{\"id\":%lu,\"on\":%s}", id, cmd.on ? "true" : "false");
+  send(request, 202);
+  TRACE_RECORD(trace_api, TRACE_TIME_US() - start);
+}
+
+void RestApi::handleRules(AsyncWebServerRequest* request){
+  uint32_t start = TRACE_TIME_US();
+  length = rules.copySource(buffer, sizeof(buffer));   // Consistent copy, the control loop may be replacing it
+  AsyncWebServerResponse* response = request->beginResponse_P(200, "text/plain", (const uint8_t*)buffer, length);
+  response->addHeader("X-Rules-Status", rules.lastStatus());
+  request->send(response);
+  TRACE_RECORD(trace_api, TRACE_TIME_US() - start);
+}
+
+void RestApi::handleRulesUpload(AsyncWebServerRequest* request){
+  uint32_t start = TRACE_TIME_US();
+  AsyncWebParameter* p = request->getParam("rules", true);
+  if (p == nullptr) {
+    append("{\"error\":\"missing rules\"}");
+    send(request, 400);
+    return;
+  }
+  if (p->value().length() >= RULES_TEXT_LEN) {
+    append("{\"error\":\"rules too long\"}");
+    send(request, 413);
+    return;
+  }
+  if (!rules.submit(p->value().c_str(), p->value().length())) {
+    append("{\"error\":\"busy\"}");
+    send(request, 503);
+    return;
+  }
+  wake.signal();
+
+  // Accepted, the control loop compiles the rules, GET /api/rules shows the result
+  append("{\"length\":%u}", (unsigned)p->value().length());
+  send(request, 202);
+  TRACE_RECORD(trace_api, TRACE_TIME_US() - start);
+}
+
+void RestApi::begin(AsyncWebServer& server, const char* username, const char* password){
+  user = username;
+  pass = password;
+  server.on("/api/state", HTTP_GET, [this](AsyncWebServerRequest *request) {
+    length = 0;
+    handleState(request);
+  });
+  server.on("/api/sensors", HTTP_GET, [this](AsyncWebServerRequest *request) {
+    length = 0;
+    handleSensors(request);
+  });
+  // Also matches /api/relay/{id}
+  server.on("/api/relay", HTTP_POST, [this](AsyncWebServerRequest *request) {
+    if (!authorized(request)) {
+      return;
+    }
+    length = 0;
+    handleRelay(request);
+  });
+  server.on("/api/rules", HTTP_GET, [this](AsyncWebServerRequest *request) {
+    handleRules(request);
+  });
+  server.on("/api/rules", HTTP_POST, [this](AsyncWebServerRequest *request) {
+    if (!authorized(request)) {
+      return;
+    }
+    length = 0;
+    handleRulesUpload(request);
+  });
+}
@@ -0,0 +1,94 @@
+#ifndef RESTAPI_H
+#define RESTAPI_H
+
+/**
+ * @class RestApi
+ * @brief A JSON control and status API on the AsyncWebServer in station mode.
+ *
+ * Serves GET /api/state, GET /api/sensors and POST /api/relay/{id}, so a client on the LAN
+ * can switch relays without the round trip through the broker. GET /api/rules returns the
+ * source of the automation rules as text/plain with the compile result in X-Rules-Status, and
+ * POST /api/rules (form field "rules") replaces them. Relay commands are pushed to
+ * the control loop through their own CommandQueue, the AsyncTCP task being its only producer,
+ * and applied to the same DeviceRegistry as the MQTT commands, so the new state is published
+ * to the broker as usual.
+ *
+ * The POST endpoints change the node and require HTTP Basic authentication with the credentials
+ * of the stored configuration (see ConfigRecord::apiUser()), a request without them gets a 401
+ * challenge. The GET endpoints only read and stay open to the LAN.
+ *
+ * Responses are built in one static buffer. All handlers run on the AsyncTCP task, and a body
+ * of at most API_BUFFER_LEN bytes is copied into the TCP send buffer by send() before the next
+ * request is handled, so the buffer is never shared between two responses.
+ */
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <DeviceRegistry.h>
+#include <SensorHandler.h>
+#include <MqttHandler.h>
+#include <WakeSource.h>
+#include <RulesEngine.h>
+
+#define API_BUFFER_LEN 1024         ///< Size of the response buffer, well below the TCP send buffer.
+#define API_RELAY_PREFIX "/api/relay/"
+
+class RestApi {
+private:
+    DeviceRegistry& devices;        ///< Devices switched by the relay endpoint.
+    SensorHandler& sensors;         ///< Source of the last temperature readings.
+    CommandQueue& commands;         ///< Relay commands for the control loop, pushed by the AsyncTCP task only.
+    WakeSource& wake;               ///< Wakes the control loop after a push.
+    RulesEngine& rules;             ///< Compiles uploaded rules on the control loop.
+    const char* user = nullptr;     ///< User name of the POST endpoints, not copied.
+    const char* pass = nullptr;     ///< Password of the POST endpoints, not copied.
+    char buffer[API_BUFFER_LEN];    ///< Body of the response being sent.
+    size_t length = 0;              ///< Length of the body.
+
+    /**
+     * @brief Appends formatted text to the body.
+     *
+     * @return False if the body does not fit in the buffer.
+     */
+    bool append(const char* format, ...);
+
+    /**
+     * @brief Sends the body as application/json.
+     */
+    void send(AsyncWebServerRequest* request, int code);
+
+    /**
+     * @brief Checks the credentials of a request, answers it with a 401 challenge if they do not match.
+     *
+     * @return True if the request may proceed.
+     */
+    bool authorized(AsyncWebServerRequest* request);
+
+    void handleState(AsyncWebServerRequest* request);
+    void handleSensors(AsyncWebServerRequest* request);
+    void handleRelay(AsyncWebServerRequest* request);
+    void handleRules(AsyncWebServerRequest* request);
+    void handleRulesUpload(AsyncWebServerRequest* request);
+
+public:
+    /**
+     * @brief Constructor for RestApi class.
+     *
+     * @param registry Reference to the device table.
+     * @param sensor Reference to the temperature sensors.
+     * @param queue Queue of relay commands, not shared with another producer.
+     * @param control Wake source of the control loop.
+     * @param engine Reference to the rules engine.
+     */
+    RestApi(DeviceRegistry& registry, SensorHandler& sensor, CommandQueue& queue, WakeSource& control, RulesEngine& engine);
+
+    /**
+     * @brief Registers the endpoints, must be called before server.begin().
+     *
+     * @param server The server of the node.
+     * @param username User name required by the POST endpoints, must outlive the server.
+     * @param password Password required by the POST endpoints, must outlive the server.
+     */
+    void begin(AsyncWebServer& server, const char* username, const char* password);
+};
+
+#endif // RESTAPI_H
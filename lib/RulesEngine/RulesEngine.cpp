@@ -0,0 +1,542 @@
+#include "RulesEngine.h"
+#include <ctype.h>
+#include <math.h>
+
+#define RULES_CLOCK (1u << 31)  ///< Dirty bit of the time of day.
+
+/**
+ * @brief Bytecode operations. Comparisons push the result onto a stack of bits, AND and OR pop
+ * two and push one.
+ *
+ * OP_GT..OP_NE     [op][input][threshold float]
+ * OP_HGT, OP_HLT   [op][input][threshold float][band float][hysteresis slot]
+ * OP_TIME          [op][from minute u16][to minute u16]
+ * OP_AND, OP_OR    [op]
+ */
+enum : uint8_t { OP_GT = 1, OP_LT, OP_GE, OP_LE, OP_EQ, OP_NE, OP_HGT, OP_HLT, OP_TIME, OP_AND, OP_OR };
+
+enum : uint8_t { UPLOAD_FREE, UPLOAD_WRITING, UPLOAD_READY };
+
+namespace {
+
+struct Token {
+  enum Type : uint8_t { END, WORD, NUMBER, TIME, OPERATOR } type;
+  const char* text;
+  size_t len;
+  float number;
+  int16_t minutes;  ///< Minute of the day of a TIME, -1 if out of range.
+
+  bool is(const char* word) const {
+    return type == WORD && strlen(word) == len && strncasecmp(text, word, len) == 0;
+  }
+};
+
+/**
+ * @brief Splits one rule into words, numbers, HH:MM times and operators.
+ */
+class Lexer {
+private:
+  const char* p;
+  const char* end;
+
+public:
+  Lexer(const char* start, const char* stop) : p(start), end(stop) {}
+
+  Token next() {
+    while (p < end && isspace((uint8_t)*p)) {
+      p++;
+    }
+    Token t = { Token::END, p, 0, 0.0f, -1 };
+    if (p >= end) {
+      return t;
+    }
+    const char* start = p;
+    char c = *p;
+    bool sign = (c == '-' || c == '+' || c == '.') && p + 1 < end && (isdigit((uint8_t)p[1]) || p[1] == '.');
+
+    if (isalpha((uint8_t)c) || c == '_') {
+      while (p < end && (isalnum((uint8_t)*p) || *p == '_')) {
+        p++;
+      }
+      t.type = Token::WORD;
+    } else if (isdigit((uint8_t)c) || sign) {
+      p++;
+      while (p < end && (isdigit((uint8_t)*p) || *p == '.' || *p == ':')) {
+        p++;
+      }
+      char number[16];
+      size_t len = p - start < (ptrdiff_t)sizeof(number) ? p - start : sizeof(number) - 1;
+      memcpy(number, start, len);
+      number[len] = '\0';
+      unsigned hour, minute;
+      char extra;
+      if (memchr(start, ':', p - start) != nullptr) {
+        t.type = Token::TIME;
+        if (sscanf(number, "%u:%u%c", &hour, &minute, &extra) == 2 && hour < 24 && minute < 60) {
+          t.minutes = hour * 60 + minute;
+        }
+      } else {
+        t.type = Token::NUMBER;
+        t.number = strtof(number, nullptr);
+      }
+    } else if (strchr("<>=!", c) != nullptr) {
+      p++;
+      if (p < end && *p == '=') {
+        p++;
+      }
+      t.type = Token::OPERATOR;
+    } else {
+      p++;  ///< Anything else is a one character operator the parser rejects.
+      t.type = Token::OPERATOR;
+    }
+    t.text = start;
+    t.len = p - start;
+    return t;
+  }
+};
+
+}  // namespace
+
+RulesEngine::RulesEngine(MemoryHandler& mem) : memory(mem) {
+  for (float& value : inputs) {
+    value = NAN;
+  }
+  programs[0].count = programs[1].count = 0;
+  programs[0].code_len = programs[1].code_len = 0;
+  strcpy(status, "no rules");
+}
+
+int8_t RulesEngine::addInput(const char* name) {
+  if (input_count >= RULES_INPUTS) {
+    return -1;
+  }
+  strncpy(input_names[input_count], name, RULES_NAME_LEN - 1);
+  input_names[input_count][RULES_NAME_LEN - 1] = '\0';
+  return input_count++;
+}
+
+bool RulesEngine::addOutput(const char* name, uint8_t device) {
+  if (output_count >= RULES_OUTPUTS) {
+    return false;
+  }
+  strncpy(output_names[output_count], name, RULES_NAME_LEN - 1);
+  output_names[output_count][RULES_NAME_LEN - 1] = '\0';
+  outputs[output_count++] = device;
+  return true;
+}
+
+void RulesEngine::begin(void (*act)(uint8_t device, bool on), int32_t (*time)()) {
+  action = act;
+  clock = time;
+
+  size_t len = memory.getRules(source, sizeof(source) - 1);  ///< Compiled in place, nothing reads it yet.
+  if (len == 0) {
+    return;
+  }
+  if (compile(source, len)) {
+    activate(source, len);
+  }
+  Serial.printf("Rules: %s\n", status);
+}
+
+bool RulesEngine::compile(const char* text, size_t len) {
+  RuleProgram& prog = programs[active ^ 1];
+  const char* end = text + len;
+  const char* line = text;
+  unsigned number = 1;
+  const char* error = nullptr;
+  Token bad = { Token::END, "", 0, 0.0f, -1 };
+
+  prog.count = 0;
+  prog.code_len = 0;
+
+  auto emit = [&](const void* data, size_t size) {
+    if (prog.code_len + size > RULES_CODE_LEN) {
+      error = "rules too long";
+      return false;
+    }
+    memcpy(prog.code + prog.code_len, data, size);
+    prog.code_len += size;
+    return true;
+  };
+  auto op = [&](uint8_t code) { return emit(&code, 1); };
+  auto output = [&](Lexer& lex, uint8_t& device, bool& on) {
+    Token name = lex.next();
+    Token state = lex.next();
+    uint8_t i = 0;
+    while (i < output_count && !(name.type == Token::WORD && strlen(output_names[i]) == name.len &&
+                                 memcmp(output_names[i], name.text, name.len) == 0)) {
+      i++;
+    }
+    if (i == output_count) {
+      error = "unknown output";
+      bad = name;
+      return false;
+    }
+    if (!state.is("on") && !state.is("off")) {
+      error = "expected on or off";
+      bad = state;
+      return false;
+    }
+    device = outputs[i];
+    on = state.is("on");
+    return true;
+  };
+  // One term of a condition, t is its first token and the token after it on return
+  auto term = [&](Lexer& lex, Token& t, Rule& rule, uint8_t& slots) {
+    if (t.is("time")) {
+      Token from, to;
+      if (!lex.next().is("between") || (from = lex.next()).type != Token::TIME || !lex.next().is("and") ||
+          (to = lex.next()).type != Token::TIME || from.minutes < 0 || to.minutes < 0) {
+        error = "expected time between HH:MM and HH:MM";
+        return false;
+      }
+      uint16_t range[2] = { (uint16_t)from.minutes, (uint16_t)to.minutes };
+      rule.inputs |= RULES_CLOCK;
+      t = lex.next();
+      return op(OP_TIME) && emit(range, sizeof(range));
+    }
+
+    uint8_t input = 0;
+    while (input < input_count && !(t.type == Token::WORD && strlen(input_names[input]) == t.len &&
+                                    memcmp(input_names[input], t.text, t.len) == 0)) {
+      input++;
+    }
+    if (input == input_count) {
+      error = "unknown input";
+      bad = t;
+      return false;
+    }
+    Token cmp = lex.next();
+    static const char* const names[] = { ">", "<", ">=", "<=", "==", "!=" };
+    uint8_t code = 0;
+    for (uint8_t i = 0; i < 6 && cmp.type == Token::OPERATOR; i++) {
+      if (strlen(names[i]) == cmp.len && memcmp(names[i], cmp.text, cmp.len) == 0) {
+        code = OP_GT + i;
+      }
+    }
+    if (code == 0) {
+      error = "expected comparison";
+      bad = cmp;
+      return false;
+    }
+    Token threshold = lex.next();
+    if (threshold.type != Token::NUMBER) {
+      error = "expected number";
+      bad = threshold;
+      return false;
+    }
+    rule.inputs |= 1u << input;
+    t = lex.next();
+
+    if (!t.is("hyst")) {
+      return op(code) && emit(&input, 1) && emit(&threshold.number, sizeof(float));
+    }
+    Token band = lex.next();
+    if (band.type != Token::NUMBER || band.number < 0) {
+      error = "expected band after hyst";
+      bad = band;
+      return false;
+    }
+    if (code != OP_GT && code != OP_LT) {
+      error = "hyst needs > or <";
+      return false;
+    }
+    if (slots >= RULE_HYST_TERMS) {
+      error = "too many hyst terms";
+      return false;
+    }
+    t = lex.next();
+    uint8_t slot = slots++;
+    return op(code == OP_GT ? OP_HGT : OP_HLT) && emit(&input, 1) && emit(&threshold.number, sizeof(float)) &&
+           emit(&band.number, sizeof(float)) && emit(&slot, 1);
+  };
+
+  while (line < end && error == nullptr) {
+    // A rule ends at a newline or ';', a comment at the end of the line
+    const char* stop = line;
+    while (stop < end && *stop != '\n' && *stop != ';') {
+      stop++;
+    }
+    const char* comment = (const char*)memchr(line, '#', stop - line);
+    Lexer lex(line, comment ? comment : stop);
+    const char* next_line = stop < end ? stop + 1 : end;
+    unsigned line_number = number;
+    if (stop < end && *stop == '\n') {
+      number++;
+    }
+    line = next_line;
+
+    Token t = lex.next();
+    if (t.type == Token::END) {
+      continue;
+    }
+    if (prog.count >= RULES_MAX) {
+      error = "too many rules";
+      number = line_number;
+      break;
+    }
+
+    Rule& rule = prog.rules[prog.count];
+    memset(&rule, 0, sizeof(rule));
+    rule.code = prog.code_len;
+    rule.at = RULE_NO_TIME;
+
+    if (t.is("at")) {
+      Token when = lex.next();
+      if (when.type != Token::TIME || when.minutes < 0) {
+        error = "expected HH:MM after at";
+        bad = when;
+      }
+      rule.at = when.minutes;
+      t = lex.next();
+    }
+    if (error == nullptr && t.is("if")) {
+      // An or of ands, compiled to postfix: a b AND c OR
+      uint8_t slots = 0;
+      bool ok = true;
+      t = lex.next();
+      for (uint8_t groups = 0; ok; groups++) {
+        for (uint8_t terms = 0; ok; terms++) {
+          ok = term(lex, t, rule, slots) && (terms == 0 || op(OP_AND));
+          if (!t.is("and")) {
+            break;
+          }
+          t = lex.next();
+        }
+        ok = ok && (groups == 0 || op(OP_OR));
+        if (!t.is("or")) {
+          break;
+        }
+        t = lex.next();
+      }
+      if (prog.code_len - rule.code > 255) {
+        error = "condition too long";
+      }
+      rule.length = prog.code_len - rule.code;
+      if (error == nullptr && t.is("for")) {
+        Token hold = lex.next();
+        float scale = 1000.0f;
+        t = lex.next();
+        if (t.is("s") || t.is("m") || t.is("h")) {
+          scale = t.is("s") ? 1000.0f : t.is("m") ? 60000.0f : 3600000.0f;
+          t = lex.next();
+        }
+        if (hold.type != Token::NUMBER || hold.number < 0 || hold.number * scale > 86400000.0f) {
+          error = "expected duration up to 24h after for";
+          bad = hold;
+        } else if (rule.at != RULE_NO_TIME) {
+          error = "for is not allowed with at";
+        }
+        rule.hold_ms = hold.number * scale;
+      }
+    }
+    if (error == nullptr) {
+      if (!t.is("then")) {
+        error = rule.at == RULE_NO_TIME && rule.length == 0 ? "expected if or at" : "expected then";
+        bad = t;
+      } else if (output(lex, rule.device, rule.on)) {
+        t = lex.next();
+        if (t.is("else")) {
+          rule.has_else = output(lex, rule.else_device, rule.else_on);
+          t = lex.next();
+        }
+        if (error == nullptr && t.type != Token::END) {
+          error = "unexpected";
+          bad = t;
+        }
+        if (error == nullptr && rule.at == RULE_NO_TIME && rule.length == 0) {
+          error = "expected if or at";
+        }
+      }
+    }
+    if (error != nullptr) {
+      number = line_number;
+      break;
+    }
+    prog.count++;
+  }
+
+  if (error != nullptr) {
+    int len = bad.len > 16 ? 16 : (int)bad.len;
+    if (len > 0) {
+      snprintf(status, sizeof(status), "line %u: %s '%.*s'", number, error, len, bad.text);
+    } else {
+      snprintf(status, sizeof(status), "line %u: %s", number, error);
+    }
+    return false;
+  }
+  snprintf(status, sizeof(status), "ok: %u rules, %u bytes", prog.count, prog.code_len);
+  return true;
+}
+
+void RulesEngine::activate(const char* text, size_t len) {
+  active ^= 1;
+  dirty = ~0u;  ///< New rules start from their current inputs.
+
+  source_seq.fetch_add(1, std::memory_order_acq_rel);
+  if (text != source) {
+    memcpy(source, text, len);
+  }
+  source_len = len;
+  source_seq.fetch_add(1, std::memory_order_release);
+}
+
+bool RulesEngine::condition(Rule& rule) {
+  const uint8_t* pc = programs[active].code + rule.code;
+  const uint8_t* end = pc + rule.length;
+  uint32_t stack = 0;  ///< One bit per value, top of the stack in bit 0.
+
+  while (pc < end) {
+    uint8_t code = *pc++;
+    bool result;
+    if (code == OP_AND || code == OP_OR) {
+      bool b = stack & 1;
+      bool a = (stack >> 1) & 1;
+      stack >>= 2;
+      result = code == OP_AND ? a && b : a || b;
+    } else if (code == OP_TIME) {
+      uint16_t range[2];
+      memcpy(range, pc, sizeof(range));
+      pc += sizeof(range);
+      result = minute != RULE_NO_TIME &&
+               (range[0] <= range[1] ? minute >= range[0] && minute < range[1]
+                                     : minute >= range[0] || minute < range[1]);  ///< Wraps past midnight.
+    } else {
+      float value = inputs[pc[0]];
+      float threshold;
+      memcpy(&threshold, pc + 1, sizeof(float));
+      pc += 1 + sizeof(float);
+      // NAN, a disconnected sensor, compares false
+      switch (code) {
+        case OP_GT: result = value > threshold; break;
+        case OP_LT: result = value < threshold; break;
+        case OP_GE: result = value >= threshold; break;
+        case OP_LE: result = value <= threshold; break;
+        case OP_EQ: result = value == threshold; break;
+        case OP_NE: result = !isnan(value) && value != threshold; break;
+        default: {
+          float band;
+          memcpy(&band, pc, sizeof(float));
+          uint8_t bit = 1u << pc[sizeof(float)];
+          pc += sizeof(float) + 1;
+          bool held = rule.hyst & bit;  ///< Stays true until the input is back past the band.
+          result = code == OP_HGT ? value > (held ? threshold - band : threshold)
+                                  : value < (held ? threshold + band : threshold);
+          rule.hyst = result ? rule.hyst | bit : rule.hyst & ~bit;
+          break;
+        }
+      }
+    }
+    stack = stack << 1 | result;
+  }
+  evaluations++;
+  return stack & 1;
+}
+
+void RulesEngine::act(uint8_t device, bool on) {
+  fired_actions++;
+  if (action != nullptr) {
+    action(device, on);
+  }
+}
+
+void RulesEngine::set(uint8_t input, float value) {
+  if (input >= input_count || value == inputs[input] || (isnan(value) && isnan(inputs[input]))) {
+    return;  ///< Unchanged inputs do not wake any rule.
+  }
+  inputs[input] = value;
+  dirty |= 1u << input;
+}
+
+uint32_t RulesEngine::run(uint32_t now) {
+  RuleProgram& prog = programs[active];
+  int32_t seconds = clock != nullptr ? clock() : -1;
+  int16_t current = seconds < 0 ? RULE_NO_TIME : seconds / 60;
+  bool tick = current != minute;
+  bool clocked = false;
+  uint32_t wait = RULES_MAX_WAIT;
+
+  if (tick) {
+    minute = current;
+    dirty |= RULES_CLOCK;
+  }
+  uint32_t changed = dirty;
+  dirty = 0;
+
+  for (uint8_t i = 0; i < prog.count; i++) {
+    Rule& rule = prog.rules[i];
+    clocked |= rule.at != RULE_NO_TIME || (rule.inputs & RULES_CLOCK);
+
+    if (rule.at != RULE_NO_TIME) {
+      if (tick && minute == rule.at && (rule.length == 0 || condition(rule))) {
+        act(rule.device, rule.on);
+      }
+      continue;
+    }
+    if (rule.inputs & changed) {
+      bool cond = condition(rule);
+      if (cond != rule.cond) {
+        rule.cond = cond;
+        rule.since = now;
+        if (!cond && rule.fired && rule.has_else) {
+          act(rule.else_device, rule.else_on);
+        }
+        rule.fired = false;
+      }
+    }
+    if (rule.cond && !rule.fired) {
+      uint32_t held = now - rule.since;
+      if (held >= rule.hold_ms) {
+        rule.fired = true;
+        act(rule.device, rule.on);
+      } else if (rule.hold_ms - held < wait) {
+        wait = rule.hold_ms - held;
+      }
+    }
+  }
+
+  if (clocked && seconds >= 0 && (60 - seconds % 60) * 1000u < wait) {
+    wait = (60 - seconds % 60) * 1000u;  ///< Wake at the next minute.
+  }
+  return dirty != 0 ? 0 : wait;  ///< Actions changed inputs, run again.
+}
+
+bool RulesEngine::submit(const char* text, size_t len) {
+  uint8_t expected = UPLOAD_FREE;
+  if (len >= RULES_TEXT_LEN ||
+      !upload_state.compare_exchange_strong(expected, UPLOAD_WRITING, std::memory_order_acquire)) {
+    return false;
+  }
+  memcpy(upload, text, len);
+  upload_len = len;
+  upload_state.store(UPLOAD_READY, std::memory_order_release);
+  return true;
+}
+
+bool RulesEngine::poll() {
+  if (!pending()) {
+    return false;
+  }
+  if (compile(upload, upload_len)) {
+    activate(upload, upload_len);
+    memory.putRules(source, source_len);
+  }
+  Serial.printf("Rules: %s\n", status);
+  uploads.fetch_add(1, std::memory_order_release);
+  upload_state.store(UPLOAD_FREE, std::memory_order_release);
+  return true;
+}
+
+size_t RulesEngine::copySource(char* out, size_t len) const {
+  uint32_t seq;
+  size_t copied;
+  do {
+    seq = source_seq.load(std::memory_order_acquire);
+    copied = source_len < len - 1 ? source_len : len - 1;
+    memcpy(out, source, copied);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((seq & 1) != 0 || seq != source_seq.load(std::memory_order_relaxed));
+  out[copied] = '\0';
+  return copied;
+}
@@ -0,0 +1,218 @@
+#ifndef RULESENGINE_H
+#define RULESENGINE_H
+
+/**
+ * @class RulesEngine
+ * @brief Local automation rules compiled to bytecode and evaluated when their inputs change.
+ *
+ * Rules are plain text, one per line or separated by ';', '#' starts a comment:
+ *
+ *     if t0 > 24.5 hyst 1 for 60s then r1 on else r1 off
+ *     if t0 < 5 or t1 < 5 then r2 on
+ *     at 07:30 then r2 on
+ *     at 22:00 if time between 21:00 and 23:00 then r2 off
+ *
+ * A condition compares named inputs with constants (>, <, >=, <=, ==, !=), tests the time of day
+ * (time between HH:MM and HH:MM) and combines terms with "and", which binds tighter than "or".
+ * "hyst h" on a > or < comparison keeps it true until the input is back past the threshold by h.
+ * "for d" (seconds, or d s/m/h) requires the condition to hold that long. The "then" action runs
+ * once each time the condition becomes true; the "else" action runs when it becomes false again
+ * after the "then" action ran. "at HH:MM" rules run their action at that minute, if their
+ * optional condition holds.
+ *
+ * The text is compiled into a compact stack bytecode. Each rule records the bitmask of inputs it
+ * reads, and set() marks inputs dirty, so run() only evaluates the rules whose inputs changed,
+ * plus the rules whose hold time expires, and returns when it next needs to run.
+ *
+ * Everything but submit() and copySource() runs on the control loop. New rules are handed over
+ * from the network or AsyncTCP task through a one-slot mailbox, compiled and stored by poll().
+ */
+#include <Arduino.h>
+#include <atomic>
+#include <MemoryHandler.h>
+
+#define RULES_MAX 16                ///< Maximum number of rules.
+#define RULES_CODE_LEN 512          ///< Bytecode of all rules.
+#define RULES_TEXT_LEN 1024         ///< Longest source text.
+#define RULES_INPUTS 31             ///< Named inputs, bit 31 of the dirty mask is the clock.
+#define RULES_OUTPUTS 16            ///< Named outputs.
+#define RULES_NAME_LEN 8            ///< Longest input or output name, including terminator.
+#define RULES_STATUS_LEN 64         ///< Result of the last compile.
+#define RULES_MAX_WAIT 60000        ///< Longest time run() asks to wait, in milliseconds.
+#define RULE_HYST_TERMS 8           ///< Comparisons with hysteresis per rule.
+#define RULE_NO_TIME -1             ///< Rule without an "at" time.
+
+/**
+ * @brief One compiled rule and its evaluation state.
+ */
+struct Rule {
+    uint16_t code;          ///< Offset of the condition in the bytecode.
+    uint8_t length;         ///< Length of the condition, 0 if the rule has none.
+    uint32_t inputs;        ///< Bitmask of the inputs the condition reads.
+    uint32_t hold_ms;       ///< Time the condition must hold before the action runs.
+    int16_t at;             ///< Minute of the day of a scheduled rule, RULE_NO_TIME if none.
+    uint8_t device;         ///< Device switched by the "then" action.
+    bool on;                ///< State set by the "then" action.
+    bool has_else;          ///< True if the rule has an "else" action.
+    uint8_t else_device;    ///< Device switched by the "else" action.
+    bool else_on;           ///< State set by the "else" action.
+    uint8_t hyst;           ///< State of each hysteresis comparison.
+    bool cond;              ///< Last value of the condition.
+    bool fired;             ///< True if the "then" action ran since the condition became true.
+    uint32_t since;         ///< millis() when the condition became true.
+};
+
+/**
+ * @brief The compiled rule set.
+ */
+struct RuleProgram {
+    Rule rules[RULES_MAX];          ///< Rules in source order.
+    uint8_t count;                  ///< Number of rules.
+    uint8_t code[RULES_CODE_LEN];   ///< Bytecode of the conditions.
+    uint16_t code_len;              ///< Bytes of bytecode used.
+};
+
+class RulesEngine {
+private:
+    MemoryHandler& memory;                          ///< Storage of the source text.
+    char input_names[RULES_INPUTS][RULES_NAME_LEN]; ///< Input names.
+    float inputs[RULES_INPUTS];                     ///< Input values, NAN until set.
+    uint8_t input_count = 0;                        ///< Number of inputs.
+    char output_names[RULES_OUTPUTS][RULES_NAME_LEN];   ///< Output names.
+    uint8_t outputs[RULES_OUTPUTS];                 ///< Device of each output.
+    uint8_t output_count = 0;                       ///< Number of outputs.
+    void (*action)(uint8_t device, bool on) = nullptr;  ///< Switches a device.
+    int32_t (*clock)() = nullptr;                   ///< Seconds since local midnight, -1 if unknown.
+
+    RuleProgram programs[2];                        ///< Active program and compile scratch.
+    uint8_t active = 0;                             ///< Index of the active program.
+    uint32_t dirty = 0;                             ///< Inputs changed since the last run, bit 31 the clock.
+    int16_t minute = RULE_NO_TIME;                  ///< Minute of the day seen by the last run.
+    uint32_t evaluations = 0;                       ///< Conditions evaluated.
+    uint32_t fired_actions = 0;                     ///< Actions run.
+    char status[RULES_STATUS_LEN];                  ///< Result of the last compile.
+    std::atomic<uint32_t> uploads{0};               ///< Uploads compiled, bumped after status is written.
+
+    char source[RULES_TEXT_LEN];                    ///< Source of the active program.
+    size_t source_len = 0;                          ///< Length of the source.
+    std::atomic<uint32_t> source_seq{0};            ///< Odd while the source is rewritten.
+
+    char upload[RULES_TEXT_LEN];                    ///< Submitted source waiting for poll().
+    size_t upload_len = 0;                          ///< Length of the submitted source.
+    std::atomic<uint8_t> upload_state{0};           ///< Mailbox state: free, being written or ready.
+
+    /**
+     * @brief Compiles a source text into the scratch program.
+     *
+     * @return False on a syntax error, the reason is in status.
+     */
+    bool compile(const char* text, size_t len);
+
+    /**
+     * @brief Makes the scratch program active and keeps its source.
+     */
+    void activate(const char* text, size_t len);
+
+    /**
+     * @brief Runs the bytecode of a condition.
+     */
+    bool condition(Rule& rule);
+
+    /**
+     * @brief Counts an action and passes it to the action callback.
+     */
+    void act(uint8_t device, bool on);
+
+public:
+    /**
+     * @brief Constructor for RulesEngine class.
+     *
+     * @param mem Reference to the MemoryHandler storing the rules.
+     */
+    explicit RulesEngine(MemoryHandler& mem);
+
+    /**
+     * @brief Adds a named input.
+     *
+     * @return Id of the input, -1 if the table is full.
+     */
+    int8_t addInput(const char* name);
+
+    /**
+     * @brief Adds a named output switching a device.
+     *
+     * @return False if the table is full.
+     */
+    bool addOutput(const char* name, uint8_t device);
+
+    /**
+     * @brief Loads and compiles the stored rules, called once the inputs and outputs are added.
+     *
+     * @param act Switches a device, called from run().
+     * @param time Returns the seconds since local midnight, -1 while the clock is not set.
+     */
+    void begin(void (*act)(uint8_t device, bool on), int32_t (*time)());
+
+    /**
+     * @brief Updates an input, the rules reading it are evaluated by the next run().
+     */
+    void set(uint8_t input, float value);
+
+    /**
+     * @brief Evaluates the rules which are due.
+     *
+     * @param now Current millis().
+     * @return Time in milliseconds until run() needs to be called again, 0 if inputs changed
+     *         during the run.
+     */
+    uint32_t run(uint32_t now);
+
+    /**
+     * @brief Hands a new source text to the control loop, called from any task.
+     *
+     * @return False if the text is too long or a previous upload is still pending.
+     */
+    bool submit(const char* text, size_t len);
+
+    /**
+     * @brief Returns true if an upload waits for poll().
+     */
+    bool pending() const { return upload_state.load(std::memory_order_acquire) == 2; }
+
+    /**
+     * @brief Compiles a pending upload and stores it if it is valid.
+     *
+     * @return True if an upload was processed.
+     */
+    bool poll();
+
+    /**
+     * @brief Copies the active source text, called from any task.
+     *
+     * @return Length of the copy, truncated to len - 1 and NUL-terminated.
+     */
+    size_t copySource(char* out, size_t len) const;
+
+    /**
+     * @brief Returns the result of the last compile, "ok: N rules" or the error.
+     */
+    const char* lastStatus() const { return status; }
+
+    /**
+     * @brief Returns the number of uploads processed by poll(), called from any task.
+     */
+    uint32_t uploadCount() const { return uploads.load(std::memory_order_acquire); }
+
+    /**
+     * @brief Returns the number of active rules.
+     */
+    uint8_t size() const { return programs[active].count; }
+
+    /**
+     * @brief Returns the number of conditions evaluated and actions run.
+     */
+    uint32_t evaluationCount() const { return evaluations; }
+    uint32_t actionCount() const { return fired_actions; }
+};
+
+#endif // RULESENGINE_H
@@ -0,0 +1,132 @@
+#include "SensorHandler.h"
+
+SensorHandler::SensorHandler(DallasTemperature& bus, MemoryHandler& mem, uint8_t bits)
+: sensors(bus), memory(mem), resolution(bits) {}
+
+void SensorHandler::scan() {
+  DeviceAddress rom;
+  uint8_t known = count;
+
+  sensors.begin();  ///< Full bus search, enumerates every device.
+  scanned = millis();
+  rescan = false;
+
+  for (uint8_t i = 0; i < sensors.getDeviceCount() && count < MAX_SENSORS; i++) {
+    if (!sensors.getAddress(rom, i)) {
+      continue;
+    }
+    uint8_t id = 0;
+    while (id < count && memcmp(roms[id], rom, sizeof(rom)) != 0) {
+      id++;
+    }
+    if (id < count) {
+      continue;  ///< Known sensor, its index and resolution stay as they are.
+    }
+    memcpy(roms[count], rom, sizeof(rom));
+    sensors.setResolution(roms[count], resolution);  ///< An EEPROM copy, only for new sensors.
+    temps[count] = DEVICE_DISCONNECTED_C;
+    intervals[count] = SENSOR_INTERVAL_MIN;
+    due[count] = scanned;
+    count++;
+  }
+
+  if (count != known) {
+    memory.putSensorRoms(&roms[0][0], count * sizeof(DeviceAddress));  ///< Persist the table for the next boot.
+    Serial.printf("Found %u new temperature sensor(s) on the OneWire bus.\n", count - known);
+  }
+}
+
+void SensorHandler::resetCadence() {
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < MAX_SENSORS; i++) {
+    temps[i] = DEVICE_DISCONNECTED_C;
+    intervals[i] = SENSOR_INTERVAL_MIN;
+    due[i] = now;
+  }
+  pending = 0;
+}
+
+uint8_t SensorHandler::begin() {
+  sensors.setWaitForConversion(false);  ///< requestTemperatures() returns immediately.
+
+  size_t len = memory.getSensorRoms(&roms[0][0], sizeof(roms));
+  count = len / sizeof(DeviceAddress);
+  resetCadence();
+  if (count == 0) {
+    scan();  ///< Cold boot, no table stored yet.
+  } else {
+    Serial.printf("Loaded %u temperature sensor address(es) from memory.\n", count);
+  }
+  return count;
+}
+
+uint16_t SensorHandler::requestConversion() {
+  if (rescan && millis() - scanned >= SENSOR_RESCAN_MS) {
+    scan();  ///< Looking for a replacement, the lost sensor keeps its slot.
+  }
+  uint32_t now = millis();
+  pending = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if ((int32_t)(now - due[i]) >= 0) {
+      pending |= 1u << i;
+    }
+  }
+  if (pending == 0) {
+    return 0;  ///< Nothing to wait for.
+  }
+
+  if (pending == (1u << count) - 1) {
+    sensors.requestTemperatures();  ///< One broadcast conversion for the whole bus, does not block.
+  } else {
+    for (uint8_t i = 0; i < count; i++) {
+      if (pending & (1u << i)) {
+        sensors.requestTemperaturesByAddress(roms[i]);  ///< Steady sensors are left idle.
+      }
+    }
+  }
+  return sensors.millisToWaitForConversion(resolution);
+}
+
+const float* SensorHandler::readAll() {
+  uint32_t now = millis();
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (!(pending & (1u << i))) {
+      continue;  ///< Not converted, keep the last reading.
+    }
+    float previous = temps[i];
+    temps[i] = sensors.getTempC(roms[i]);  ///< Read the scratchpad by address, no bus search.
+    for (uint8_t retry = 0; retry < SENSOR_READ_RETRIES && temps[i] == DEVICE_DISCONNECTED_C; retry++) {
+      temps[i] = sensors.getTempC(roms[i]);  ///< A single CRC error is noise on the bus, not a lost sensor.
+    }
+    if (temps[i] == DEVICE_DISCONNECTED_C) {
+      rescan = true;  ///< A new sensor may have replaced it, search the bus before a later conversion.
+      intervals[i] = SENSOR_INTERVAL_MIN;
+    } else if (previous != DEVICE_DISCONNECTED_C) {
+      float delta = fabsf(temps[i] - previous);
+      if (delta >= SENSOR_FAST_DELTA) {
+        intervals[i] = intervals[i] / 2 < SENSOR_INTERVAL_MIN ? SENSOR_INTERVAL_MIN : intervals[i] / 2;
+      } else if (delta <= SENSOR_SLOW_DELTA) {
+        intervals[i] = intervals[i] * 2 > SENSOR_INTERVAL_MAX ? SENSOR_INTERVAL_MAX : intervals[i] * 2;
+      }
+    }
+    due[i] = now + intervals[i];
+  }
+  fresh = pending;
+  pending = 0;
+  return temps;
+}
+
+uint32_t SensorHandler::untilDue() const {
+  uint32_t now = millis();
+  uint32_t wait = SENSOR_INTERVAL_MAX;
+
+  for (uint8_t i = 0; i < count; i++) {
+    int32_t left = (int32_t)(due[i] - now);
+    if (left <= 0) {
+      return 0;
+    }
+    wait = (uint32_t)left < wait ? left : wait;
+  }
+  return wait;
+}
@@ -0,0 +1,124 @@
+#ifndef SENSORHANDLER_H
+#define SENSORHANDLER_H
+
+/**
+ * @class SensorHandler
+ * @brief A split-phase driver for DS18B20 temperature sensors on a OneWire bus.
+ *
+ * At startup the bus is scanned once and the ROM addresses of all sensors are stored in a
+ * fixed-size table, which is persisted through MemoryHandler so a warm boot skips the search.
+ * One broadcast conversion is started without waiting (setWaitForConversion(false)), and the
+ * caller schedules the read-out of every sensor by address once the resolution-dependent
+ * conversion time has passed, instead of blocking the scheduler loop for up to 750 ms.
+ *
+ * Every sensor has its own read interval. It halves while the reading changes quickly and
+ * doubles while the reading is steady, between SENSOR_INTERVAL_MIN and SENSOR_INTERVAL_MAX.
+ * Only the sensors which are due are converted and read.
+ *
+ * A sensor keeps its index in the table for good: the index names its telemetry key, history
+ * series and rule input. A lost sensor keeps its slot and reads DEVICE_DISCONNECTED_C, a search
+ * of the bus only appends the sensors it has not seen before.
+ */
+#include <Arduino.h>
+#include <DallasTemperature.h>
+#include <MemoryHandler.h>
+
+#define MAX_SENSORS 12              ///< Capacity of the ROM address table.
+#define SENSOR_INTERVAL_MIN 2000    ///< Shortest read interval of a sensor in milliseconds.
+#define SENSOR_INTERVAL_MAX 32000   ///< Longest read interval of a sensor in milliseconds.
+#define SENSOR_FAST_DELTA 0.25f     ///< Change in Celsius between two readings which halves the interval.
+#define SENSOR_SLOW_DELTA 0.0625f   ///< Change in Celsius up to which the interval doubles, one 12-bit step.
+#define SENSOR_READ_RETRIES 2       ///< Reads repeated after a failed one before a sensor counts as lost.
+#define SENSOR_RESCAN_MS 60000      ///< Shortest time between two bus searches for new sensors.
+
+class SensorHandler {
+private:
+    DallasTemperature& sensors;         ///< DallasTemperature instance bound to the OneWire bus.
+    MemoryHandler& memory;              ///< Storage for the ROM address table.
+    DeviceAddress roms[MAX_SENSORS];    ///< Cached ROM addresses of the sensors.
+    float temps[MAX_SENSORS];           ///< Results of the last read-out, in Celsius.
+    uint32_t intervals[MAX_SENSORS];    ///< Current read interval of each sensor in milliseconds.
+    uint32_t due[MAX_SENSORS];          ///< millis() timestamp of the next read of each sensor.
+    uint16_t pending = 0;               ///< Bitmask of the sensors converting since requestConversion().
+    uint16_t fresh = 0;                 ///< Bitmask of the sensors read by the last readAll().
+    uint8_t count = 0;                  ///< Number of valid entries in roms[].
+    uint8_t resolution;                 ///< Conversion resolution in bits (9..12).
+    bool rescan = false;                ///< Set when a cached sensor stops answering.
+    uint32_t scanned = 0;               ///< millis() of the last bus search.
+
+    /**
+     * @brief Searches the bus and appends the sensors which are not in the ROM address table.
+     *
+     * Known sensors keep their index and are not configured again. The resolution is applied
+     * to the new sensors only, and the table is written to memory only if it grew.
+     */
+    void scan();
+
+    /**
+     * @brief Makes every sensor due now at the shortest interval.
+     */
+    void resetCadence();
+
+public:
+    /**
+     * @brief Constructor for SensorHandler class.
+     *
+     * @param bus Reference to the DallasTemperature instance.
+     * @param mem Reference to the MemoryHandler used to persist the ROM table.
+     * @param bits Conversion resolution in bits (9..12).
+     */
+    SensorHandler(DallasTemperature& bus, MemoryHandler& mem, uint8_t bits = 12);
+
+    /**
+     * @brief Loads the ROM address table, scanning the bus only if none is stored.
+     *
+     * Switches the bus to asynchronous conversions.
+     * @return Number of sensors in the table.
+     */
+    uint8_t begin();
+
+    /**
+     * @brief Starts a conversion on the sensors which are due without waiting for it to finish.
+     *
+     * One broadcast conversion is used when all sensors are due. If a cached sensor went
+     * missing, the bus is searched for new sensors first, at most every SENSOR_RESCAN_MS.
+     * @return Time in milliseconds after which the results can be read with readAll(),
+     *         0 if no sensor is due.
+     */
+    uint16_t requestConversion();
+
+    /**
+     * @brief Reads the result of the last conversion from the sensors which were converted.
+     *
+     * Adapts the interval of every sensor read. A failed read, such as a scratchpad CRC error,
+     * is repeated up to SENSOR_READ_RETRIES times. Sensors which still do not answer are
+     * reported as DEVICE_DISCONNECTED_C, the others keep their last reading.
+     * @return Pointer to count() temperatures in Celsius, ordered as the ROM table. Only the
+     *         entries flagged by readMask() are new.
+     */
+    const float* readAll();
+
+    /**
+     * @brief Returns the bitmask of the sensors read by the last readAll(), bit i for sensor i.
+     */
+    uint16_t readMask() const { return fresh; }
+
+    /**
+     * @brief Returns the time in milliseconds until the next sensor is due.
+     */
+    uint32_t untilDue() const;
+
+    /**
+     * @brief Returns the results of the last read-out without touching the bus.
+     *
+     * @return Pointer to count() temperatures in Celsius, DEVICE_DISCONNECTED_C if not read yet.
+     */
+    const float* readings() const { return temps; }
+
+    /**
+     * @brief Returns the number of sensors in the ROM address table.
+     */
+    uint8_t size() const { return count; }
+};
+
+#endif // SENSORHANDLER_H
@@ -0,0 +1,75 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+/**
+ * @class SpscQueue
+ * @brief A lock-free single-producer single-consumer queue of fixed capacity.
+ *
+ * Used to pass commands and telemetry between the network task on core 0 and the control loop
+ * on core 1 without locks or heap allocations. Exactly one task may call push() and exactly one
+ * task may call pop(). Entries are copied in and out, so T should be a small POD.
+ *
+ * @tparam T Type of the entries.
+ * @tparam N Capacity, must be a power of two.
+ */
+#include <atomic>
+#include <stdint.h>
+
+template <typename T, uint16_t N>
+class SpscQueue {
+    static_assert((N & (N - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+private:
+    T slots[N];                         ///< Ring storage.
+    std::atomic<uint32_t> head{0};      ///< Entries popped so far, written by the consumer only.
+    std::atomic<uint32_t> tail{0};      ///< Entries pushed so far, written by the producer only.
+    uint32_t dropped = 0;               ///< Pushes rejected because the queue was full, producer only.
+
+public:
+    /**
+     * @brief Appends an entry, called by the producer only.
+     *
+     * @param item The entry to copy into the queue.
+     * @return False if the queue is full, the entry is dropped.
+     */
+    bool push(const T& item) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N) {
+            dropped++;
+            return false;
+        }
+        slots[t & (N - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);  ///< Publish the entry to the consumer.
+        return true;
+    }
+
+    /**
+     * @brief Removes the oldest entry, called by the consumer only.
+     *
+     * @param item Receives the entry.
+     * @return False if the queue is empty.
+     */
+    bool pop(T& item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = slots[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);  ///< Hand the slot back to the producer.
+        return true;
+    }
+
+    /**
+     * @brief Returns the number of queued entries, approximate while the other side is running.
+     */
+    uint32_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Returns the number of entries dropped because the queue was full.
+     */
+    uint32_t dropCount() const { return dropped; }
+};
+
+#endif // SPSCQUEUE_H
@@ -0,0 +1,87 @@
+#include "TelemetryPipeline.h"
+#include <math.h>
+
+int8_t TelemetryPipeline::add(const char* name, const MetricPolicy& policy){
+  if (count >= TELEMETRY_MAX_METRICS) {
+    return -1;
+  }
+  Metric& metric = metrics[count];
+  strlcpy(metric.name, name, sizeof(metric.name));
+  metric.policy = policy;
+  metric.valid = false;
+  metric.published = false;
+  metric.lost = false;
+  return count++;
+}
+
+void TelemetryPipeline::update(uint8_t id, float sample){
+  if (id >= count) {
+    return;
+  }
+  Metric& metric = metrics[id];
+  if (metric.valid) {
+    metric.value += metric.policy.alpha * (sample - metric.value);  ///< EWMA.
+  } else {
+    metric.value = sample;  ///< The first sample seeds the average.
+    metric.valid = true;
+    metric.lost = false;  ///< Back before its error value went out.
+  }
+  samples++;
+}
+
+void TelemetryPipeline::invalidate(uint8_t id){
+  if (id >= count || !metrics[id].valid) {
+    return;  ///< Already invalid, the error value is published once.
+  }
+  Metric& metric = metrics[id];
+  metric.valid = false;  ///< No heartbeat of the last good value.
+  metric.lost = metric.published;
+}
+
+bool TelemetryPipeline::due(const Metric& metric, uint32_t now) const {
+  if (metric.lost) {
+    return now - metric.sent_ms >= metric.policy.min_interval;
+  }
+  if (!metric.valid) {
+    return false;
+  }
+  if (!metric.published) {
+    return true;
+  }
+  uint32_t age = now - metric.sent_ms;
+  if (age >= metric.policy.max_interval) {
+    return true;  ///< Heartbeat, shows the node is alive when nothing changes.
+  }
+  return age >= metric.policy.min_interval && fabsf(metric.value - metric.sent) >= metric.policy.deadband;
+}
+
+uint8_t TelemetryPipeline::flush(PayloadWriter& writer, uint32_t now, PayloadWriter* mirror){
+  uint8_t written = 0;
+
+  for (uint8_t i = 0; i < count; i++) {
+    Metric& metric = metrics[i];
+    if (!due(metric, now)) {
+      continue;
+    }
+    float value = metric.lost ? NAN : metric.value;
+    if (mirror != nullptr && !mirror->fits(metric.name, value, metric.policy.decimals)) {
+      continue;  ///< Left due, both payloads carry the same values.
+    }
+    if (!writer.number(metric.name, value, metric.policy.decimals)) {
+      continue;  ///< Left due, goes into the next payload.
+    }
+    if (mirror != nullptr) {
+      mirror->number(metric.name, value, metric.policy.decimals);
+    }
+    metric.sent = value;
+    metric.sent_ms = now;
+    metric.published = !metric.lost;  ///< A returning source is published on its first sample.
+    metric.lost = false;
+    values++;
+    written++;
+  }
+  if (written > 0) {
+    messages++;
+  }
+  return written;
+}
@@ -0,0 +1,106 @@
+#ifndef TELEMETRYPIPELINE_H
+#define TELEMETRYPIPELINE_H
+
+/**
+ * @class TelemetryPipeline
+ * @brief Smooths metrics, drops the samples which do not change them, and coalesces the rest
+ * into compact payloads.
+ *
+ * Every metric has its own policy. Samples are smoothed with an EWMA. A value is published when
+ * it moved by at least the deadband since the last publish and the minimum interval has passed,
+ * or when the maximum interval has passed as a heartbeat. All values due at a flush are
+ * written into one payload through a PayloadWriter, in the encoding of the telemetry topic.
+ * A value which does not fit stays due for the next payload. An optional mirror writer gets the
+ * same values in another encoding, e.g. JSON for the WebSocket clients.
+ * A metric whose source is lost is invalidated: it is published once more as NaN, which the
+ * codecs write as nan, null or a float NaN, and then stays silent, without heartbeat, until
+ * a new sample arrives.
+ */
+#include <Arduino.h>
+#include <PayloadCodec.h>
+
+#define TELEMETRY_MAX_METRICS 32    ///< Capacity of the metric table.
+#define METRIC_NAME_LEN 8           ///< Maximum metric name length, including terminator.
+
+/**
+ * @brief Publish policy of one metric.
+ */
+struct MetricPolicy {
+    float deadband;             ///< Change since the last publish which makes the value due.
+    float alpha;                ///< EWMA weight of a new sample, 1 disables smoothing.
+    uint32_t min_interval;      ///< Minimum time between two publishes in milliseconds.
+    uint32_t max_interval;      ///< Time in milliseconds after which the value is published anyway.
+    uint8_t decimals;           ///< Number of decimals in the payload.
+};
+
+/**
+ * @brief State of one metric.
+ */
+struct Metric {
+    char name[METRIC_NAME_LEN]; ///< Name in the payload.
+    MetricPolicy policy;        ///< Publish policy.
+    float value;                ///< Smoothed value.
+    float sent;                 ///< Last published value.
+    uint32_t sent_ms;           ///< millis() timestamp of the last publish.
+    bool valid;                 ///< True once a sample was received.
+    bool published;             ///< True once the value was published.
+    bool lost;                  ///< True while the NaN of an invalidated metric is not published.
+};
+
+class TelemetryPipeline {
+private:
+    Metric metrics[TELEMETRY_MAX_METRICS];  ///< Metric table.
+    uint8_t count = 0;                      ///< Number of metrics.
+    uint32_t samples = 0;                   ///< Samples received.
+    uint32_t values = 0;                    ///< Values published.
+    uint32_t messages = 0;                  ///< Payloads produced.
+
+    /**
+     * @brief Returns true if the metric has to be published.
+     */
+    bool due(const Metric& metric, uint32_t now) const;
+
+public:
+    /**
+     * @brief Adds a metric.
+     *
+     * @param name Name in the payload, truncated to METRIC_NAME_LEN - 1 characters.
+     * @param policy Publish policy.
+     * @return Id of the metric, -1 if the table is full.
+     */
+    int8_t add(const char* name, const MetricPolicy& policy);
+
+    /**
+     * @brief Feeds a sample into a metric.
+     */
+    void update(uint8_t id, float sample);
+
+    /**
+     * @brief Marks the source of a metric as lost.
+     *
+     * A metric which was published is published once as NaN, the next sample starts a new
+     * average.
+     */
+    void invalidate(uint8_t id);
+
+    /**
+     * @brief Writes the values which are due into one payload and marks them as published.
+     *
+     * Call again with a new writer until it returns 0 to drain all values which are due.
+     * @param writer The writer of the payload, finished by the caller.
+     * @param now Current millis().
+     * @param mirror Optional second writer receiving the same values, a value which does not
+     *               fit in either writer is left due.
+     * @return Number of values written.
+     */
+    uint8_t flush(PayloadWriter& writer, uint32_t now, PayloadWriter* mirror = nullptr);
+
+    /**
+     * @brief Returns the number of samples received, values published and payloads produced.
+     */
+    uint32_t sampleCount() const { return samples; }
+    uint32_t valueCount() const { return values; }
+    uint32_t messageCount() const { return messages; }
+};
+
+#endif // TELEMETRYPIPELINE_H
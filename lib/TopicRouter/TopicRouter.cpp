@@ -0,0 +1,122 @@
+#include "TopicRouter.h"
+
+TopicRouter::TopicRouter() {
+  clear();
+}
+
+uint32_t TopicRouter::hash(const char* str, size_t len) {
+  uint32_t h = 2166136261u;  ///< FNV offset basis.
+  for (size_t i = 0; i < len; i++) {
+    h ^= (uint8_t)str[i];
+    h *= 16777619u;  ///< FNV prime.
+  }
+  return h;
+}
+
+bool TopicRouter::add(const char* topic, RouteKind kind, uint8_t arg, RouteHandler handler) {
+  uint8_t node = 0;
+  const char* level = topic;
+
+  for (;;) {
+    const char* slash = strchr(level, '/');
+    size_t len = slash ? slash - level : strlen(level);
+    uint32_t h = hash(level, len);
+    uint8_t child = nodes[node].child;
+
+    if (len == 1 && level[0] == '#' && slash != nullptr) {
+      return false;  ///< '#' must be the last level.
+    }
+    while (child != ROUTER_NONE &&
+           !(nodes[child].hash == h && nodes[child].length == len && memcmp(nodes[child].level, level, len) == 0)) {
+      child = nodes[child].next;
+    }
+    if (child == ROUTER_NONE) {
+      if (node_count >= ROUTER_NODES || len > 255) {
+        return false;
+      }
+      child = node_count++;
+      nodes[child] = { h, level, (uint8_t)len, ROUTER_NONE, nodes[node].child, ROUTER_NONE };
+      nodes[node].child = child;  ///< Prepended, sibling order does not matter.
+    }
+    node = child;
+    if (slash == nullptr) {
+      break;
+    }
+    level = slash + 1;
+  }
+
+  uint8_t index = nodes[node].route;
+  if (index == ROUTER_NONE) {
+    if (count >= ROUTER_CAPACITY) {
+      return false;
+    }
+    index = count++;
+    nodes[node].route = index;
+  }
+  routes[index].topic = topic;
+  routes[index].kind = kind;
+  routes[index].arg = arg;
+  routes[index].handler = handler;
+  return true;
+}
+
+uint8_t TopicRouter::multiLevel(uint8_t node) const {
+  for (uint8_t child = nodes[node].child; child != ROUTER_NONE; child = nodes[child].next) {
+    if (nodes[child].length == 1 && nodes[child].level[0] == '#') {
+      return nodes[child].route;
+    }
+  }
+  return ROUTER_NONE;
+}
+
+uint8_t TopicRouter::match(uint8_t node, const char* level) const {
+  const char* slash = strchr(level, '/');
+  size_t len = slash ? slash - level : strlen(level);
+  uint32_t h = hash(level, len);
+  uint8_t exact = ROUTER_NONE;
+  uint8_t single = ROUTER_NONE;
+  uint8_t rest = ROUTER_NONE;
+  bool wildcards = node != 0 || level[0] != '$';  ///< $SYS topics are not matched by wildcards at the root.
+
+  for (uint8_t child = nodes[node].child; child != ROUTER_NONE; child = nodes[child].next) {
+    const TrieNode& n = nodes[child];
+    if (n.length == 1 && n.level[0] == '#') {
+      rest = wildcards ? n.route : ROUTER_NONE;
+    } else if (n.length == 1 && n.level[0] == '+') {
+      single = wildcards ? child : ROUTER_NONE;
+    } else if (n.hash == h && n.length == len && memcmp(n.level, level, len) == 0) {
+      exact = child;
+    }
+  }
+
+  for (uint8_t next : { exact, single }) {
+    if (next == ROUTER_NONE) {
+      continue;
+    }
+    uint8_t route;
+    if (slash == nullptr) {
+      // Last level: the filter ends here, or continues with '#' which also matches its parent
+      route = nodes[next].route != ROUTER_NONE ? nodes[next].route : multiLevel(next);
+    } else {
+      route = match(next, slash + 1);
+    }
+    if (route != ROUTER_NONE) {
+      return route;
+    }
+  }
+  return rest;
+}
+
+const Route* TopicRouter::find(const char* topic) const {
+  uint8_t route = match(0, topic);
+  return route != ROUTER_NONE ? &routes[route] : nullptr;
+}
+
+void TopicRouter::clear() {
+  nodes[0] = { 0, "", 0, ROUTER_NONE, ROUTER_NONE, ROUTER_NONE };
+  node_count = 1;
+  for (Route& route : routes) {
+    route = Route();
+  }
+  count = 0;
+}
@@ -0,0 +1,112 @@
+#ifndef TOPICROUTER_H
+#define TOPICROUTER_H
+
+/**
+ * @class TopicRouter
+ * @brief A fixed-size topic trie mapping MQTT topic filters to their handlers.
+ *
+ * Every level of a filter is a node of the trie, hashed once when the route is added. Incoming
+ * topics are walked level by level, each level hashed once per visited node and compared against
+ * the children of the node, so dispatching a message neither allocates nor compares against
+ * every subscribed topic. Filters may use the '+' (one level) and '#' (remaining levels)
+ * wildcards; an exact level wins over '+', which wins over '#'.
+ * The router does not own the topic strings, they must outlive the trie.
+ */
+#include <Arduino.h>
+
+#define ROUTER_CAPACITY 32      ///< Maximum number of routes.
+#define ROUTER_NODES 96         ///< Maximum number of trie nodes, one per distinct filter prefix.
+#define ROUTER_NONE 0xFF        ///< No node or route.
+
+/**
+ * @brief Kind of handler a topic is routed to.
+ */
+enum class RouteKind : uint8_t {
+    NONE,       ///< Empty slot.
+    RELAY,      ///< Switches a relay, arg is the device id.
+    DISPLAY,    ///< Shows the payload on the display.
+    CUSTOM      ///< Calls a user supplied handler.
+};
+
+/**
+ * @brief Handler invoked for CUSTOM routes with a non-owning view of the payload.
+ */
+typedef void (*RouteHandler)(const uint8_t* payload, unsigned int length);
+
+/**
+ * @brief One route of the trie.
+ */
+struct Route {
+    const char* topic = nullptr;        ///< Topic filter, owned by the caller.
+    RouteKind kind = RouteKind::NONE;   ///< Kind of handler.
+    uint8_t arg = 0;                    ///< Handler argument, e.g. device id.
+    RouteHandler handler = nullptr;     ///< Handler for CUSTOM routes.
+};
+
+/**
+ * @brief One level of a topic filter.
+ */
+struct TrieNode {
+    uint32_t hash;              ///< hash() of the level.
+    const char* level;          ///< Start of the level in the filter, not NUL-terminated.
+    uint8_t length;             ///< Length of the level.
+    uint8_t child;              ///< First child node, ROUTER_NONE if none.
+    uint8_t next;               ///< Next sibling node, ROUTER_NONE if none.
+    uint8_t route;              ///< Route of the filter ending here, ROUTER_NONE if none.
+};
+
+class TopicRouter {
+private:
+    TrieNode nodes[ROUTER_NODES];       ///< Trie nodes, nodes[0] is the root.
+    Route routes[ROUTER_CAPACITY];      ///< Routes referenced by the nodes.
+    uint8_t node_count = 1;             ///< Number of used nodes, including the root.
+    uint8_t count = 0;                  ///< Number of routes.
+
+    /**
+     * @brief Matches the remaining levels of a topic below a node.
+     *
+     * @param node The node matched by the previous level.
+     * @param level Start of the next level of the topic.
+     * @return Index of the route, ROUTER_NONE if the topic does not match.
+     */
+    uint8_t match(uint8_t node, const char* level) const;
+
+    /**
+     * @brief Returns the route of the '#' child of a node, ROUTER_NONE if none.
+     */
+    uint8_t multiLevel(uint8_t node) const;
+
+public:
+    TopicRouter();
+
+    /**
+     * @brief Computes the 32-bit FNV-1a hash of a string.
+     */
+    static uint32_t hash(const char* str, size_t len);
+
+    /**
+     * @brief Adds a route for a topic filter, replacing an existing route for the same filter.
+     *
+     * @param topic The topic filter, must stay valid while the route exists.
+     * @param kind Kind of handler.
+     * @param arg Handler argument, e.g. device id.
+     * @param handler Handler for CUSTOM routes.
+     * @return False if the trie is full or '#' is not the last level.
+     */
+    bool add(const char* topic, RouteKind kind, uint8_t arg = 0, RouteHandler handler = nullptr);
+
+    /**
+     * @brief Looks up the route of a topic.
+     *
+     * @param topic The topic of the received message.
+     * @return The route, or nullptr if the topic is not routed.
+     */
+    const Route* find(const char* topic) const;
+
+    /**
+     * @brief Removes all routes.
+     */
+    void clear();
+};
+
+#endif // TOPICROUTER_H
@@ -0,0 +1,49 @@
+#include "TopicTable.h"
+
+void TopicTable::load(const ConfigRecord& record) {
+  memcpy(arena, record.arena, sizeof(arena));  ///< One copy of the whole arena.
+  count = record.topic_count;
+
+  for (uint8_t i = 0; i < count; i++) {
+    offsets[i] = record.topics[i].offset;
+    lengths[i] = record.topics[i].length;
+    codecs[i] = Codec::TEXT;
+  }
+}
+
+void TopicTable::setCodecs(const uint8_t* list, size_t len) {
+  for (uint8_t i = 0; i < count; i++) {
+    codecs[i] = i < len && list[i] <= (uint8_t)Codec::CBOR ? (Codec)list[i] : Codec::TEXT;
+  }
+}
+
+bool TopicTable::wildcard(char* out, size_t len) const {
+  size_t prefix;
+  uint8_t levels = 0;
+
+  if (count < 2) {
+    return false;
+  }
+  // Longest common prefix of all topics, cut back to the last complete level
+  prefix = lengths[0];
+  for (uint8_t i = 1; i < count; i++) {
+    size_t n = 0;
+    while (n < prefix && n < lengths[i] && arena[offsets[0] + n] == arena[offsets[i] + n]) {
+      n++;
+    }
+    prefix = n;
+  }
+  while (prefix > 0 && arena[offsets[0] + prefix - 1] != '/') {
+    prefix--;
+  }
+  for (size_t n = 0; n < prefix; n++) {
+    levels += arena[offsets[0] + n] == '/';
+  }
+  if (levels < WILDCARD_MIN_LEVELS || prefix + 2 > len) {
+    return false;  ///< Too broad, it would pull in the traffic of other nodes.
+  }
+  memcpy(out, arena + offsets[0], prefix);
+  out[prefix] = '#';
+  out[prefix + 1] = '\0';
+  return true;
+}
@@ -0,0 +1,74 @@
+#ifndef TOPICTABLE_H
+#define TOPICTABLE_H
+
+/**
+ * @class TopicTable
+ * @brief A fixed-capacity table of the broker topics backed by one static arena.
+ *
+ * The topics are copied once from the configuration record into a single buffer and addressed
+ * by offset and length. Reloading the table reuses the same storage and never touches the heap.
+ * Each topic also carries the payload codec used on it, TEXT unless configured.
+ */
+#include <Arduino.h>
+#include <MemoryHandler.h>
+#include <PayloadCodec.h>
+
+#define WILDCARD_MIN_LEVELS 2   ///< Levels the common prefix needs before wildcard() collapses the topics.
+
+class TopicTable {
+private:
+    char arena[CONFIG_ARENA_LEN];           ///< NUL-terminated topic strings, back to back.
+    uint16_t offsets[CONFIG_MAX_TOPICS];    ///< Offset of each topic in the arena.
+    uint8_t lengths[CONFIG_MAX_TOPICS];     ///< Length of each topic without the terminator.
+    Codec codecs[CONFIG_MAX_TOPICS];        ///< Payload codec of each topic.
+    uint8_t count = 0;                      ///< Number of topics.
+
+public:
+    /**
+     * @brief Loads the topics of a configuration record.
+     *
+     * @param record The configuration record.
+     */
+    void load(const ConfigRecord& record);
+
+    /**
+     * @brief Sets the payload codecs, in topic order. Topics beyond the list use TEXT.
+     *
+     * @param list Codec of each topic, as stored by MemoryHandler::putCodecs().
+     * @param len Number of entries.
+     */
+    void setCodecs(const uint8_t* list, size_t len);
+
+    /**
+     * @brief Returns the number of topics.
+     */
+    uint8_t size() const { return count; }
+
+    /**
+     * @brief Returns a topic as a NUL-terminated string.
+     */
+    const char* operator[](uint8_t i) const { return arena + offsets[i]; }
+
+    /**
+     * @brief Returns the length of a topic.
+     */
+    uint8_t length(uint8_t i) const { return lengths[i]; }
+
+    /**
+     * @brief Builds one filter covering all topics, e.g. home/node1/# for home/node1/relay1
+     * and home/node1/temp.
+     *
+     * @param out Receives the NUL-terminated filter.
+     * @param len Size of the buffer.
+     * @return False if there are fewer than two topics or their common prefix is shorter than
+     *         WILDCARD_MIN_LEVELS levels.
+     */
+    bool wildcard(char* out, size_t len) const;
+
+    /**
+     * @brief Returns the payload codec of a topic.
+     */
+    Codec codec(uint8_t i) const { return i < count ? codecs[i] : Codec::TEXT; }
+};
+
+#endif // TOPICTABLE_H
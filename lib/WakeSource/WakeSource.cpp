@@ -0,0 +1,82 @@
+#include "WakeSource.h"
+#include <Hal.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <esp_vfs_eventfd.h>
+#else
+#include <sys/eventfd.h>
+#define EFD_SUPPORT_ISR 0
+#endif
+
+bool WakeSource::begin(){
+#ifdef ARDUINO_ARCH_ESP32
+  static bool registered = false;
+  if (!registered) {
+    esp_vfs_eventfd_config_t eventfd_config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    registered = esp_vfs_eventfd_register(&eventfd_config) == ESP_OK;  ///< Once for all wake sources.
+  }
+#endif
+  event_fd = eventfd(0, EFD_SUPPORT_ISR);  ///< Writable from the button ISR.
+  return event_fd >= 0;
+}
+
+void WakeSource::signal(){
+  uint64_t one = 1;
+  if (event_fd >= 0) {
+    write(event_fd, &one, sizeof(one));  ///< Counts up, so signals are never lost before wait() reads them.
+  }
+}
+
+uint8_t WakeSource::wait(int socket_fd, uint32_t timeout_ms){
+  fd_set readable;
+  struct timeval tv;
+  int max_fd = -1;
+  uint8_t reason = WAKE_TIMEOUT;
+
+  if (timeout_ms > WAKE_MAX_IDLE) {
+    timeout_ms = WAKE_MAX_IDLE;
+  }
+  int64_t start = hal_time_us();
+  int64_t deadline = start + (int64_t)timeout_ms * 1000;
+
+  FD_ZERO(&readable);
+  if (event_fd >= 0) {
+    FD_SET(event_fd, &readable);
+    max_fd = event_fd;
+  }
+  if (socket_fd >= 0) {
+    FD_SET(socket_fd, &readable);
+    max_fd = socket_fd > max_fd ? socket_fd : max_fd;
+  }
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+  int ready = max_fd >= 0 ? select(max_fd + 1, &readable, nullptr, nullptr, &tv) : 0;
+  wakeups++;
+  if (ready < 0) {
+    delay(1);  ///< Socket closed under us, the caller passes -1 once the client noticed.
+    return WAKE_TIMEOUT;
+  }
+  if (max_fd < 0) {
+    delay(timeout_ms);  ///< No eventfd, plain sleep.
+  }
+  idle_us += hal_time_us() - start;
+  if (ready > 0 && event_fd >= 0 && FD_ISSET(event_fd, &readable)) {
+    uint64_t count;
+    read(event_fd, &count, sizeof(count));  ///< Consume all pending signals at once.
+    reason |= WAKE_SIGNAL;
+    signals++;
+  }
+  if (ready > 0 && socket_fd >= 0 && FD_ISSET(socket_fd, &readable)) {
+    reason |= WAKE_SOCKET;
+    sockets++;
+  }
+  if (reason == WAKE_TIMEOUT) {
+    int64_t late = hal_time_us() - deadline;
+    timers++;
+    lateness_us += late > 0 ? late : 0;
+  }
+  return reason;
+}
@@ -0,0 +1,76 @@
+#ifndef WAKESOURCE_H
+#define WAKESOURCE_H
+
+/**
+ * @class WakeSource
+ * @brief Puts a scheduler task to sleep until its next timer, a signal or socket data.
+ *
+ * Each task running a Scheduler owns one WakeSource. Instead of polling, the task calls wait()
+ * with the time until its next scheduled run. The call blocks in select() on an eventfd, plus
+ * optionally a socket, so the task wakes when the timer expires, when another task or an ISR
+ * calls signal(), or when the socket becomes readable.
+ *
+ * The counters show how often the task wakes and why, how long it was idle, and how late
+ * timer wakeups are, which is the latency the sleeping adds.
+ */
+#include <Arduino.h>
+
+#define WAKE_MAX_IDLE 1000      ///< Upper bound of one wait in milliseconds.
+
+#define WAKE_TIMEOUT 0x00       ///< wait() returned because the timeout expired.
+#define WAKE_SIGNAL 0x01        ///< wait() returned because signal() was called.
+#define WAKE_SOCKET 0x02        ///< wait() returned because the socket is readable.
+
+class WakeSource {
+private:
+    int event_fd = -1;                  ///< eventfd written by signal().
+    uint32_t wakeups = 0;               ///< Number of returns from wait().
+    uint32_t signals = 0;               ///< Wakeups caused by signal().
+    uint32_t sockets = 0;               ///< Wakeups caused by socket data.
+    uint32_t timers = 0;                ///< Wakeups caused by the timeout.
+    uint64_t lateness_us = 0;           ///< Sum of the delays of timer wakeups past their deadline.
+    uint64_t idle_us = 0;               ///< Time spent blocked in wait(), asleep if light sleep is on.
+
+public:
+    /**
+     * @brief Creates the eventfd, signals sent before are lost.
+     *
+     * @return False if the eventfd could not be created, wait() then only sleeps.
+     */
+    bool begin();
+
+    /**
+     * @brief Wakes the owning task, may be called from any task or from an ISR.
+     */
+    void signal();
+
+    /**
+     * @brief Sleeps until the timeout, a signal or socket data, whichever comes first.
+     *
+     * Called by the owning task only. Pending signals are consumed.
+     * @param socket_fd Socket to watch, -1 for none.
+     * @param timeout_ms Time to sleep at most, capped to WAKE_MAX_IDLE.
+     * @return Bitmask of WAKE_SIGNAL and WAKE_SOCKET, WAKE_TIMEOUT if neither.
+     */
+    uint8_t wait(int socket_fd, uint32_t timeout_ms);
+
+    /**
+     * @brief Returns the number of wakeups, and by cause.
+     */
+    uint32_t wakeupCount() const { return wakeups; }
+    uint32_t signalCount() const { return signals; }
+    uint32_t socketCount() const { return sockets; }
+    uint32_t timerCount() const { return timers; }
+
+    /**
+     * @brief Returns the average delay of timer wakeups past their deadline, in microseconds.
+     */
+    uint32_t averageLateness() const { return timers ? lateness_us / timers : 0; }
+
+    /**
+     * @brief Returns the total time spent in wait() in microseconds.
+     */
+    uint64_t idleTime() const { return idle_us; }
+};
+
+#endif // WAKESOURCE_H
@@ -1,48 +1,109 @@
 #include "WifiHandler.h"
 
-WifiHandler::WifiHandler(WiFiClass &WIFI, std::vector<String> &cred, uint8_t led, const char *ssid, const char *passphrase) 
-: wifi(WIFI), credentials(cred), status_led(led), ap_ssid(ssid), ap_passphrase(passphrase) {}
+WifiHandler::WifiHandler(WiFiClass &WIFI, std::vector<String> &cred, uint8_t led, const char *ssid, const char *passphrase, MemoryHandler &mem) 
+: wifi(WIFI), credentials(cred), status_led(led), ap_ssid(ssid), ap_passphrase(passphrase), memory(mem) {}
 
 void WifiHandler::WiFiStationConnected(WiFiEvent_t event, WiFiEventInfo_t info) {
     Serial.printf("Connection to %s is successful!\n", WiFi.SSID().c_str());
+    // Remember a new access point, it is written to memory from wifi_tick().
+    if (channel != info.wifi_sta_connected.channel || memcmp(bssid, info.wifi_sta_connected.bssid, sizeof(bssid)) != 0) {
+        memcpy(bssid, info.wifi_sta_connected.bssid, sizeof(bssid));
+        channel = info.wifi_sta_connected.channel;
+        cache_dirty = true;
+    }
 }
 
 void WifiHandler::WiFiGotIP(WiFiEvent_t event, WiFiEventInfo_t info) {
     Serial.printf("Current IP is: %s\n", WiFi.localIP().toString().c_str());
+    if (connect_ms == 0) {
+        connect_ms = millis();  ///< Boot-to-connected time.
+        Serial.printf("WiFi connected %u ms after boot\n", (unsigned)connect_ms);
+    }
+    connected = true;
 }
 
 void WifiHandler::WiFiStationDisconnected(WiFiEvent_t event, WiFiEventInfo_t info) {
     Serial.println("Disconnected from WiFi access point");
     Serial.print("WiFi lost connection. Reason: ");
     Serial.println(info.wifi_sta_disconnected.reason);
-    Serial.println("Trying to Reconnect");
-    setupWiFi(); ///< Attempt to reconnect to WiFi.
+    connected = false;
+    next_attempt = millis() + backoff;  ///< Reconnect is made by wifi_tick(), not from the event task.
+}
+
+void WifiHandler::connect() {
+    // begin() writes a fresh station config, which resets the listen interval. With an interval
+    // set, begin() only configures, the interval is patched in and the connect started after it.
+    bool connect_now = listen_interval == 0;
+    if (use_cache) {
+        wifi.begin(credentials[0].c_str(), credentials[1].c_str(), channel, bssid, connect_now);  ///< Skip the scan.
+    } else {
+        wifi.begin(credentials[0].c_str(), credentials[1].c_str(), 0, nullptr, connect_now);  ///< Start WiFi connection using credentials.
+    }
+    if (!connect_now) {
+        wifi_config_t conf;
+        esp_wifi_get_config(WIFI_IF_STA, &conf);
+        conf.sta.listen_interval = listen_interval;  ///< Sent to the access point in the association request.
+        esp_wifi_set_config(WIFI_IF_STA, &conf);
+        esp_wifi_connect();
+    }
 }
 
-void WifiHandler::setupWiFi() {
-    // Using lambdas to bind the non-static member functions to WiFi events
-    wifi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
-        this->WiFiStationConnected(event, info);
-    }, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_CONNECTED);
+void WifiHandler::setupWiFi(const uint8_t* cached_bssid, uint8_t cached_channel) {
+    if (!events_registered) {
+        // Using lambdas to bind the non-static member functions to WiFi events
+        wifi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
+            this->WiFiStationConnected(event, info);
+        }, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_CONNECTED);
 
-    wifi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
-        this->WiFiGotIP(event, info);
-    }, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_GOT_IP);
+        wifi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
+            this->WiFiGotIP(event, info);
+        }, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_GOT_IP);
 
-    wifi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
-        this->WiFiStationDisconnected(event, info);
-    }, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+        wifi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
+            this->WiFiStationDisconnected(event, info);
+        }, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+        events_registered = true;
+    }
 
+    wifi.persistent(false);  ///< Credentials are kept by MemoryHandler, no need to write them to flash on every begin().
+    wifi.setAutoReconnect(false);  ///< Reconnects are made by wifi_tick().
     wifi.mode(WIFI_STA);  ///< Set the WiFi mode to station (client).
-    wifi.begin(credentials[0].c_str(), credentials[1].c_str());  ///< Start WiFi connection using credentials.
 
-    // Wait for connection, blink status LED while trying to connect.
-    while (wifi.status() != WL_CONNECTED) {
+    if (cached_bssid != nullptr) {
+        memcpy(bssid, cached_bssid, sizeof(bssid));  ///< Already loaded with the rest of the configuration.
+        channel = cached_channel;
+    } else {
+        channel = memory.getWifiCache(bssid);
+    }
+    use_cache = channel != 0;
+    next_attempt = millis() + WIFI_BACKOFF_MAX;  ///< Give the first attempt time before retrying.
+    connect();
+}
+
+void WifiHandler::wifi_tick() {
+    if (connected) {
+        backoff = WIFI_BACKOFF_MIN;
         digitalWrite(status_led, HIGH);
-        delay(1000);
-        digitalWrite(status_led, LOW);
-        delay(1000);
+        if (cache_dirty) {
+            cache_dirty = false;
+            memory.putWifiCache(bssid, channel);
+        }
+        return;
+    }
+
+    led_on = !led_on;
+    digitalWrite(status_led, led_on);  ///< Blink the status LED while trying to connect.
+
+    if ((int32_t)(millis() - next_attempt) < 0) {
+        return;
     }
+
+    // A failed attempt with the cached access point falls back to a full scan.
+    use_cache = false;
+    Serial.println("Trying to Reconnect");
+    connect();
+    next_attempt = millis() + backoff;
+    backoff = backoff * 2 > WIFI_BACKOFF_MAX ? WIFI_BACKOFF_MAX : backoff * 2;
 }
 
 void WifiHandler::setupAP() {
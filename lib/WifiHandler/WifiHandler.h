@@ -5,6 +5,10 @@
 #include <WiFi.h>
 #include <memory.h>
 #include <vector>
+#include <MemoryHandler.h>
+
+#define WIFI_BACKOFF_MIN 500    ///< First reconnect delay in milliseconds.
+#define WIFI_BACKOFF_MAX 30000  ///< Upper bound of the reconnect delay in milliseconds.
 
 /**
  * @class WifiHandler
@@ -13,6 +17,9 @@
  * This class manages the connection to a WiFi network, monitors the WiFi connection status,
  * and provides functionality for setting up an access point (AP) mode.
  * It also handles events related to WiFi connection, IP assignment, and disconnection.
+ * The event handlers are registered once and only record the new state; reconnects are made
+ * by wifi_tick() from a scheduler task with exponential backoff. The BSSID and channel of the
+ * last access point are cached in memory, so a warm boot connects without a full scan.
  */
 class WifiHandler{
 private:
@@ -21,6 +28,26 @@ private:
     uint8_t status_led; ///< GPIO pin for the status LED.
     const char* ap_ssid; ///< SSID for the access point.
     const char* ap_passphrase; ///< Passphrase for the access point.
+    MemoryHandler& memory; ///< Storage for the cached BSSID and channel.
+
+    bool events_registered = false; ///< True once the event handlers are registered.
+    volatile bool connected = false; ///< Set by the event handlers.
+    volatile bool cache_dirty = false; ///< Set when the access point differs from the cached one.
+    volatile uint32_t next_attempt = 0; ///< millis() timestamp of the next connect attempt.
+    uint32_t backoff = WIFI_BACKOFF_MIN; ///< Current reconnect delay in milliseconds.
+    uint8_t bssid[6]; ///< Cached BSSID of the access point.
+    uint8_t channel = 0; ///< Cached channel of the access point, 0 if none is cached.
+    bool use_cache = false; ///< True if the next attempt uses the cached BSSID and channel.
+    bool led_on = false; ///< Status LED level while connecting.
+    uint32_t connect_ms = 0; ///< Time from boot to the first IP address, 0 until connected.
+    uint8_t listen_interval = 0; ///< Beacon intervals between wakeups in modem sleep, 0 for the driver default.
+
+    /**
+     * @brief Starts one connect attempt, with the cached BSSID and channel if available.
+     *
+     * A listen interval set with setListenInterval() goes into the association request.
+     */
+    void connect();
 
     /**
      * @brief Event handler for WiFi station connection.
@@ -59,16 +86,39 @@ public:
      * @param led GPIO pin number for the status LED.
      * @param ssid SSID for the access point.
      * @param passphrase Passphrase for the access point.
+     * @param mem Reference to the MemoryHandler holding the cached BSSID and channel.
      */
-    WifiHandler(WiFiClass &WIFI, std::vector<String> &cred, uint8_t led, const char *ssid, const char *passphrase);
+    WifiHandler(WiFiClass &WIFI, std::vector<String> &cred, uint8_t led, const char *ssid, const char *passphrase, MemoryHandler &mem);
 
     /**
-     * @brief Sets up the WiFi station mode and attempts to connect to the provided WiFi network.
+     * @brief Sets up the WiFi station mode and starts connecting to the provided WiFi network.
      *
-     * This method sets up the WiFi in station mode, attempts to connect using provided credentials, 
-     * and monitors the WiFi connection status.
+     * This method registers the event handlers, sets up the WiFi in station mode and starts
+     * the first connect attempt. It does not wait for the connection, see wifi_tick().
+     * @param cached_bssid BSSID of the last access point, nullptr to read it from memory.
+     * @param cached_channel Channel of the last access point, 0 if none is cached.
+     */
+    void setupWiFi(const uint8_t* cached_bssid = nullptr, uint8_t cached_channel = 0);
+
+    /**
+     * @brief Sets the listen interval used by WIFI_PS_MAX_MODEM, applied on the next connect.
+     *
+     * @param beacons Beacon intervals between wakeups, 0 for the driver default.
+     */
+    void setListenInterval(uint8_t beacons) { listen_interval = beacons; }
+
+    /**
+     * @brief Supervises the WiFi connection, to be called periodically from a scheduler task.
+     *
+     * Blinks the status LED while disconnected, retries with backoff and stores the BSSID and
+     * channel of a new access point.
+     */
+    void wifi_tick();
+
+    /**
+     * @brief Returns the time in milliseconds from boot to the first IP address, 0 until connected.
      */
-    void setupWiFi();
+    uint32_t connectTime() const { return connect_ms; }
 
     /**
      * @brief Sets up the WiFi in access point (AP) mode.
@@ -0,0 +1,90 @@
+"""Gzips the portal assets in web/ and embeds them in lib/HttpServer/WebAssets.h.
+
+Runs as a PlatformIO pre-build script and can also be run by hand. The header is only
+rewritten when its content changes, so unchanged assets do not trigger a rebuild.
+"""
+import gzip
+import hashlib
+import os
+
+try:
+    Import("env")  # noqa: F821, provided by PlatformIO
+    PROJECT_DIR = env["PROJECT_DIR"]  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+WEB_DIR = os.path.join(PROJECT_DIR, "web")
+HEADER = os.path.join(PROJECT_DIR, "lib", "HttpServer", "WebAssets.h")
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".svg": "image/svg+xml",
+}
+
+
+def symbol(name):
+    return "asset_" + "".join(c if c.isalnum() else "_" for c in name)
+
+
+def main():
+    assets = []
+    for name in sorted(os.listdir(WEB_DIR)):
+        ext = os.path.splitext(name)[1]
+        if ext not in CONTENT_TYPES:
+            continue
+        with open(os.path.join(WEB_DIR, name), "rb") as f:
+            raw = f.read()
+        packed = gzip.compress(raw, compresslevel=9, mtime=0)  # mtime=0 keeps the output reproducible
+        etag = '\\"' + hashlib.sha1(raw).hexdigest()[:16] + '\\"'
+        assets.append((name, CONTENT_TYPES[ext], packed, etag, len(raw)))
+
+    lines = [
+        "// Generated by scripts/embed_assets.py from web/, do not edit.",
+        "#ifndef WEBASSETS_H",
+        "#define WEBASSETS_H",
+        "",
+        "#include <Arduino.h>",
+        "",
+        "/**",
+        " * @brief A gzip-compressed static file of the portal.",
+        " */",
+        "struct WebAsset {",
+        "    const char* path;       ///< URL path.",
+        "    const char* type;       ///< Content type.",
+        "    const uint8_t* data;    ///< Gzip-compressed content in flash.",
+        "    size_t length;          ///< Compressed length.",
+        "    const char* etag;       ///< Quoted content hash.",
+        "};",
+        "",
+    ]
+    for name, ctype, packed, etag, raw_len in assets:
+        lines.append("// %s: %d bytes, %d gzipped" % (name, raw_len, len(packed)))
+        lines.append("const uint8_t %s[] PROGMEM = {" % symbol(name))
+        for i in range(0, len(packed), 16):
+            lines.append("    " + ", ".join("0x%02x" % b for b in packed[i:i + 16]) + ",")
+        lines.append("};")
+        lines.append("")
+
+    lines.append("const WebAsset web_assets[] = {")
+    for name, ctype, packed, etag, raw_len in assets:
+        path = "/" if name == "index.html" else "/" + name
+        lines.append('    {"%s", "%s", %s, sizeof(%s), "%s"},' % (path, ctype, symbol(name), symbol(name), etag))
+    lines.append("};")
+    lines.append("")
+    lines.append("#endif // WEBASSETS_H")
+    content = "\n".join(lines) + "\n"
+
+    old = None
+    if os.path.exists(HEADER):
+        with open(HEADER) as f:
+            old = f.read()
+    if content != old:
+        with open(HEADER, "w") as f:
+            f.write(content)
+    for name, ctype, packed, etag, raw_len in assets:
+        print("embed_assets: %s %d -> %d bytes" % (name, raw_len, len(packed)))
+
+
+main()
@@ -1,5 +1,17 @@
 #include "main.h"
 
+// Tasks re-armed from the callbacks, defined with the others below
+extern Task t1, t2, t3, t4, t7, t8, t11, t12;
+
+// Re-arming a task, delay(0) would mean one full interval
+void rearm(Task& task, uint32_t ms){
+  if (ms == 0) {
+    task.forceNextIteration();
+  } else {
+    task.delay(ms);
+  }
+}
+
 void DuringLongPress(void *oneButton){
   digitalWrite(LED_BUILTIN, LOW);
   delay(100);
@@ -9,22 +21,438 @@ void DuringLongPress(void *oneButton){
 void LongPressStop(void *oneButton){
   runner.pause();
   runner.disableAll();
+  vTaskSuspend(net_task);   // The client belongs to the network task
   mqttHandler -> mqtt_disconnect();
   memoryHandler.clearMemory();
   WiFi.disconnect();
   esp_restart();
 }
 
-void temperature(){mqttHandler -> mqtt_send_temp();}
-void status_led(){digitalWrite(LED_BUILTIN, WiFi.status() == WL_CONNECTED);}
-void mqtt(){mqttHandler -> mqtt_loop();}
-void button_tick(){button.tick();}
+// Publishing the values which are due, as few payloads as fit
+void telemetry_flush(){
+  uint8_t payload[QUEUE_PAYLOAD_LEN];
+  Telemetry frame;
+  bool sent = false;
+
+  for (;;) {
+    uint32_t start = TRACE_CYCLES();
+    PayloadWriter writer(topics.codec(0), payload, sizeof(payload));   // Encoding of the telemetry topic
+    PayloadWriter mirror(Codec::JSON, (uint8_t*)frame.payload, sizeof(frame.payload));
+    bool live_push = live.active();   // The same deltas as JSON for the WebSocket clients
+    pipeline.flush(writer, millis(), live_push ? &mirror : nullptr);
+    size_t len = writer.finish();
+    TRACE_RECORD(trace_format, TRACE_CYCLES() - start);
+    if (len == 0) {
+      break;
+    }
+    mqttHandler -> mqtt_send_telemetry((const char*)payload, len);
+    if (live_push) {
+      frame.topic = 0;
+      frame.length = mirror.finish();
+      live_frames.push(frame);
+    }
+    sent = true;
+  }
+  if (sent) {
+    net_wake.signal();                    // Publishing now, not on the next housekeeping pass
+  }
+}
+void temperature_read(){
+  const float* temps = sensorHandler.readAll();
+  uint16_t fresh = sensorHandler.readMask();   // The other sensors were not converted this cycle
+  uint32_t now = time(nullptr);           // Unix time, history starts once SNTP has set the clock
+  for (uint8_t i = 0; i < sensorHandler.size(); i++) {
+    if (!(fresh & (1u << i))) {
+      continue;
+    }
+    if (temps[i] != DEVICE_DISCONNECTED_C) {
+      pipeline.update(temp_metrics + i, temps[i]);
+      history.record(i, now, temps[i]);
+    } else {
+      pipeline.invalidate(temp_metrics + i);   // Published once as an error, then no heartbeat
+    }
+    rules.set(i, temps[i] != DEVICE_DISCONNECTED_C ? temps[i] : NAN);   // Rules on a lost sensor are false
+  }
+  telemetry_flush();
+  t11.forceNextIteration();               // Evaluating the rules reading a changed sensor
+  rearm(t1, sensorHandler.untilDue());    // Next conversion when the first sensor is due
+}
+void telemetry_sample(){
+  if (WiFi.status() == WL_CONNECTED) {
+    pipeline.update(rssi_metric, WiFi.RSSI());
+  }
+  pipeline.update(heap_metric, ESP.getFreeHeap());
+  telemetry_flush();                      // Also sends values held back by their minimum interval
+}
+Task t5(TASK_IMMEDIATE, TASK_ONCE, &temperature_read);   // Conversion read-out, re-armed by temperature()
+void temperature(){
+  uint16_t wait_ms = sensorHandler.requestConversion();
+  if (wait_ms > 0) {
+    t5.restartDelayed(wait_ms);
+  } else {
+    rearm(t1, sensorHandler.untilDue());
+  }
+}
+void wifi(){
+  wifiHandler -> wifi_tick();
+  if (WiFi.status() == WL_CONNECTED) {
+    t2.delay(WIFI_IDLE_INTERVAL);   // Only the cache write is left to do, a disconnect wakes the task
+  }
+}
+// Received data the network task has not processed yet
+bool mqtt_buffered(){
+#ifdef MQTT_ASYNC
+  return client.available() > 0;
+#else
+  return espClient.available() > 0;
+#endif
+}
+// Socket the network task sleeps on, the async transport wakes it through its receive hook instead
+int mqtt_fd(){
+#ifdef MQTT_ASYNC
+  return -1;
+#else
+  return mqttHandler -> mqtt_connected() ? espClient.fd() : -1;
+#endif
+}
+void mqtt(){
+  static bool boot_reported = false;
+  static uint32_t rules_reported = 0;
+  mqttHandler -> mqtt_loop();
+  if (commands.size() > 0) {
+    control_wake.signal();          // Relays switch now, not on the next control pass
+  }
+  // Reporting the result of a rules upload, compiled by the control loop
+  if (rules.uploadCount() != rules_reported && mqttHandler -> mqtt_publish_stat("rules", rules.lastStatus())) {
+    rules_reported = rules.uploadCount();
+  }
+
+  if (mqtt_buffered()) {
+    t3.forceNextIteration();        // More packets already buffered, the socket will not signal them
+  } else if (mqttHandler -> mqtt_connected() && !publishQueue.empty()) {
+    t3.delay(MQTT_DRAIN_INTERVAL);  // Backlog after a reconnect
+  }
+
+  // Publishing the boot breakdown once, on the first connect
+  if (!boot_reported && mqttHandler -> mqtt_connected()) {
+    char report[256];
+    bootProfiler.mark("mqtt");
+    size_t len = bootProfiler.format(report, sizeof(report));
+    snprintf(report + len, sizeof(report) - len, ",wifi_ms=%u,nvs_opens=%u",
+             (unsigned)wifiHandler -> connectTime(), memoryHandler.openCount());
+    mqttHandler -> mqtt_publish_stat("boot", report);
+    boot_reported = true;
+  }
+}
+void button_tick(){
+  button.tick();
+  if (button.isIdle()) {
+    t4.disable();   // Released and nothing pending, the next edge interrupt enables polling again
+  }
+}
+void IRAM_ATTR button_isr(){
+  power.buttonEdge();   // A level interrupt under light sleep, waiting for the opposite level next
+  button_stamp = TRACE_TIME_US();
+  button_edge = true;
+  control_wake.signal();
+}
+// Applies one command, returns true if a relay changed
+bool apply(const Command& cmd){
+  if (cmd.kind == CommandKind::RELAY) {
+    return deviceRegistry.set(cmd.device, cmd.on);
+  }
+  uint32_t start = TRACE_CYCLES();
+  display.show(cmd.text);   // Queued, frames are sent by display_tick()
+  t12.enableIfNot();
+  TRACE_RECORD(trace_display, TRACE_CYCLES() - start);
+  return false;
+}
+// Writing changed relays out, publishing them and passing them to the rules
+void relays_commit(){
+  deviceRegistry.commit();   // One register write for all relays changed in this pass
+  for (uint8_t id = 0; id < deviceRegistry.size(); id++) {
+    if (deviceRegistry[id].kind == DeviceKind::RELAY) {
+      pipeline.update(device_metrics + id, deviceRegistry[id].state);
+      rules.set(relay_inputs + id, deviceRegistry[id].state);
+    }
+  }
+  telemetry_flush();
+  t11.forceNextIteration();
+}
+void control(){
+  Command cmd;
+  bool relays_changed = false;
+#ifdef LATENCY_TRACE
+  uint32_t stamps[COMMAND_QUEUE_LEN];
+  uint32_t http_stamps[COMMAND_QUEUE_LEN];
+  uint8_t traced = 0;
+  uint8_t http_traced = 0;
+#endif
+
+  while (commands.pop(cmd)) {
+    relays_changed |= apply(cmd);
+#ifdef LATENCY_TRACE
+    if (cmd.kind == CommandKind::RELAY && traced < COMMAND_QUEUE_LEN) stamps[traced++] = cmd.stamp;
+#endif
+  }
+  while (http_commands.pop(cmd)) {   // REST API, bypasses the broker
+    relays_changed |= apply(cmd);
+#ifdef LATENCY_TRACE
+    if (http_traced < COMMAND_QUEUE_LEN) http_stamps[http_traced++] = cmd.stamp;
+#endif
+  }
+  if (relays_changed) {
+    relays_commit();
+  }
+#ifdef LATENCY_TRACE
+  uint32_t edge = TRACE_TIME_US();   // All relays of this pass switched on the same write
+  for (uint8_t i = 0; i < traced; i++) {
+    TRACE_RECORD(trace_gpio, edge - stamps[i]);
+  }
+  for (uint8_t i = 0; i < http_traced; i++) {
+    TRACE_RECORD(trace_http_gpio, edge - http_stamps[i]);
+  }
+#endif
+}
+// Switching a relay from a rule, the same path as a command
+void rule_action(uint8_t device, bool on){
+  if (deviceRegistry.set(device, on)) {
+    relays_commit();
+  }
+}
+// Seconds since local midnight for the schedules, -1 until SNTP has set the clock
+int32_t rule_clock(){
+  time_t now = time(nullptr);
+  struct tm local;
+  if (now < 1600000000 || localtime_r(&now, &local) == nullptr) {
+    return -1;
+  }
+  return local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec;
+}
+// Evaluating the rules whose inputs changed or whose hold time ran out
+void rules_run(){
+  if (rules.poll()) {
+    net_wake.signal();                    // Compile result published by mqtt()
+  }
+  rearm(t11, rules.run(millis()));        // Next hold time or schedule minute
+}
+// Sending the next display frame, stopping once the text is shown and nothing is queued
+void display_tick(){
+  if (!display.tick()) {
+    t12.disable();    // Enabled again by the next display command
+  }
+}
+// Rules uploaded to '<client id>/rules', compiled by the control loop
+void rules_upload(const uint8_t* payload, unsigned int length){
+  if (rules.submit((const char*)payload, length)) {
+    control_wake.signal();
+  }
+}
+// Power policy sent to '<client id>/power', applied on the network task which owns WiFi
+void power_upload(const uint8_t* payload, unsigned int length){
+  char text[48];
+  char report[64];
+  PowerPolicy next;
+  unsigned int len = length < sizeof(text) - 1 ? length : sizeof(text) - 1;
+
+  memcpy(text, payload, len);
+  text[len] = '\0';
+  if (!PowerManager::parse(text, next)) {
+    mqttHandler -> mqtt_publish_stat("power", "error=policy");
+    return;
+  }
+  power.setPolicy(memoryHandler, next);
+  wifiHandler -> setListenInterval(next.mode == PowerMode::LIGHT_SLEEP ? next.listen_interval : 0);   // From the next association
+  const PowerPolicy& applied = power.current();
+  snprintf(report, sizeof(report), "mode=%u,listen=%u,mhz=%u-%u,light_sleep=%u", (unsigned)applied.mode,
+           (unsigned)applied.listen_interval, (unsigned)applied.min_mhz, (unsigned)applied.max_mhz, (unsigned)power.lightSleep());
+  mqttHandler -> mqtt_publish_stat("power", report);
+}
+// Device table sent to '<client id>/devices', stored if valid and loaded on the next boot
+void devices_upload(const uint8_t* payload, unsigned int length){
+  char text[DEVICE_TEXT_LEN];
+  char report[48];
+  Device table[DEVICE_CAPACITY];
+  const char* error = "too long";
+  uint8_t count = 0;
+
+  if (length < sizeof(text)) {
+    memcpy(text, payload, length);
+    text[length] = '\0';
+    count = DeviceRegistry::parse(text, topics.size(), table, error);
+  }
+  if (count == 0) {
+    snprintf(report, sizeof(report), "error=%s", error);
+  } else {
+    memoryHandler.putDevices((const uint8_t*)table, count * sizeof(Device));
+    snprintf(report, sizeof(report), "stored=%u,restart=1", (unsigned)count);
+  }
+  mqttHandler -> mqtt_publish_stat("devices", report);
+}
+void heap_stats(){
+  char report[96];
+  snprintf(report, sizeof(report), "free=%u,largest=%u,min=%u",
+           (unsigned)ESP.getFreeHeap(), (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT), (unsigned)ESP.getMinFreeHeap());
+  mqttHandler -> mqtt_publish_stat("heap", report);   // Fragmentation shows as largest falling behind free
+}
+void latency_stats(){
+  static uint8_t next = 0;   // Histogram of the round to publish next
+  char name[32];
+  char report[LATENCY_SUMMARY_LEN];
+
+  // One topic per stage, count/p50/p99/max in microseconds
+  for (const LatencyHistogram* hist; (hist = latency_histogram(next)) != nullptr; next++) {
+    snprintf(name, sizeof(name), "latency/%s", hist->metric());
+    hist->summary(report, sizeof(report));
+    if (!mqttHandler -> mqtt_publish_stat(name, report)) {
+      if (mqttHandler -> mqtt_connected()) {
+        t8.delay(1000);   // Publish window full, the rest of the round goes out once acknowledged
+        return;
+      }
+      break;
+    }
+  }
+  next = 0;
+}
+void sched_stats(){
+  static uint32_t last_ms = 0, last_net = 0, last_control = 0;
+  static uint64_t last_net_idle = 0, last_control_idle = 0;
+  char report[192];
+  uint32_t now = millis();
+  uint32_t elapsed = now - last_ms > 0 ? now - last_ms : 1;
+
+  // Idle is time blocked between deadlines, the chip is in light sleep while both cores are idle
+  snprintf(report, sizeof(report), "net_wps=%u,control_wps=%u,net_idle=%u%%,control_idle=%u%%,net_late_us=%u,control_late_us=%u,socket=%u,signal=%u,mode=%u,light_sleep=%u",
+           (unsigned)((net_wake.wakeupCount() - last_net) * 1000 / elapsed),
+           (unsigned)((control_wake.wakeupCount() - last_control) * 1000 / elapsed),
+           (unsigned)((net_wake.idleTime() - last_net_idle) / 10 / elapsed),
+           (unsigned)((control_wake.idleTime() - last_control_idle) / 10 / elapsed),
+           (unsigned)net_wake.averageLateness(), (unsigned)control_wake.averageLateness(),
+           (unsigned)net_wake.socketCount(), (unsigned)(net_wake.signalCount() + control_wake.signalCount()),
+           (unsigned)power.current().mode, (unsigned)power.lightSleep());
+  mqttHandler -> mqtt_publish_stat("sched", report);   // Wakeups per second, idle share and added timer latency
+  last_ms = now;
+  last_net = net_wake.wakeupCount();
+  last_control = control_wake.wakeupCount();
+  last_net_idle = net_wake.idleTime();
+  last_control_idle = control_wake.idleTime();
+}
+void metrics(Print& out){
+  latency_prometheus(out);
+  live.metrics(out);
+  history.metrics(out);
+  display.metrics(out);
+#ifdef MQTT_ASYNC
+  client.metrics(out);
+#endif
+  out.printf("# TYPE publish_queue_depth gauge\npublish_queue_depth %lu\n", (unsigned long)publishQueue.depth());
+  out.printf("# TYPE publish_queue_drained_total counter\npublish_queue_drained_total %lu\n", (unsigned long)publishQueue.drainCount());
+  out.printf("# TYPE publish_queue_dropped_total counter\npublish_queue_dropped_total %lu\n", (unsigned long)publishQueue.dropCount());
+  out.printf("# TYPE command_queue_dropped_total counter\ncommand_queue_dropped_total %lu\n", (unsigned long)commands.dropCount());
+  out.printf("# TYPE http_command_queue_dropped_total counter\nhttp_command_queue_dropped_total %lu\n", (unsigned long)http_commands.dropCount());
+  out.printf("# TYPE rules_evaluations_total counter\nrules_evaluations_total %lu\n", (unsigned long)rules.evaluationCount());
+  out.printf("# TYPE rules_actions_total counter\nrules_actions_total %lu\n", (unsigned long)rules.actionCount());
+  out.printf("# TYPE telemetry_samples_total counter\ntelemetry_samples_total %lu\n", (unsigned long)pipeline.sampleCount());
+  out.printf("# TYPE telemetry_values_total counter\ntelemetry_values_total %lu\n", (unsigned long)pipeline.valueCount());
+  out.printf("# TYPE telemetry_messages_total counter\ntelemetry_messages_total %lu\n", (unsigned long)pipeline.messageCount());
+  out.printf("# TYPE heap_free_bytes gauge\nheap_free_bytes %u\n", (unsigned)ESP.getFreeHeap());
+  out.printf("# TYPE wakeups_total counter\nwakeups_total{task=\"network\"} %lu\nwakeups_total{task=\"control\"} %lu\n",
+             (unsigned long)net_wake.wakeupCount(), (unsigned long)control_wake.wakeupCount());
+  out.printf("# TYPE wakeup_lateness_us gauge\nwakeup_lateness_us{task=\"network\"} %lu\nwakeup_lateness_us{task=\"control\"} %lu\n",
+             (unsigned long)net_wake.averageLateness(), (unsigned long)control_wake.averageLateness());
+  out.printf("# TYPE idle_seconds_total counter\nidle_seconds_total{task=\"network\"} %.3f\nidle_seconds_total{task=\"control\"} %.3f\n",
+             net_wake.idleTime() / 1e6, control_wake.idleTime() / 1e6);
+}
+
+// Creating tasks, control loop on core 1
+Task t1(SENSOR_INTERVAL_MAX, TASK_FOREVER, &temperature);     // Re-armed for the first sensor due
+Task t4(BUTTON_ACTIVE_INTERVAL, TASK_FOREVER, &button_tick);  // Enabled by the button interrupt
+Task t7(TASK_IMMEDIATE, TASK_ONCE, &control);                 // Restarted when commands arrive
+Task t10(TELEMETRY_WINDOW, TASK_FOREVER, &telemetry_sample);
+Task t11(RULES_MAX_WAIT, TASK_FOREVER, &rules_run);            // Re-armed for the next rule deadline
+Task t12(DISPLAY_FRAME_MS, TASK_FOREVER, &display_tick);        // Enabled by display commands
+Task* const control_tasks[] = {&t1, &t4, &t5, &t7, &t10, &t11, &t12};
+
+// Publish policies: deadband, EWMA weight, min and max interval in ms, decimals
+const MetricPolicy temp_policy = {0.1f, 0.5f, 5000, 300000, 2};
+const MetricPolicy relay_policy = {0.5f, 1.0f, 0, 300000, 0};
+const MetricPolicy rssi_policy = {5.0f, 0.25f, 30000, 300000, 0};
+const MetricPolicy heap_policy = {4096.0f, 1.0f, 30000, 300000, 0};
+
+// Registering the metrics, names are the keys of the telemetry payload
+void telemetry_setup(){
+  char name[METRIC_NAME_LEN];
 
-// Creating tasks
-Task t1(2000, TASK_FOREVER, &temperature);
-Task t2(2000, TASK_FOREVER, &status_led);
-Task t3(100, TASK_FOREVER, &mqtt);
-Task t4(50, TASK_FOREVER, &button_tick);
+  temp_metrics = 0;
+  for (uint8_t i = 0; i < MAX_SENSORS; i++) {
+    snprintf(name, sizeof(name), "t%u", i);
+    pipeline.add(name, temp_policy);    // The whole table, a rescan may find more sensors
+  }
+  device_metrics = MAX_SENSORS;
+  for (uint8_t id = 0; id < deviceRegistry.size(); id++) {
+    snprintf(name, sizeof(name), "r%u", id);
+    pipeline.add(name, relay_policy);   // Never updated for the display, so never published
+  }
+  rssi_metric = pipeline.add("rssi", rssi_policy);
+  heap_metric = pipeline.add("heap", heap_policy);
+}
+
+// Naming the rule inputs and outputs after the telemetry keys, then loading the stored rules
+void rules_setup(){
+  char name[RULES_NAME_LEN];
+
+  for (uint8_t i = 0; i < MAX_SENSORS; i++) {
+    snprintf(name, sizeof(name), "t%u", i);
+    rules.addInput(name);               // Input id is the sensor index
+  }
+  relay_inputs = MAX_SENSORS;
+  for (uint8_t id = 0; id < deviceRegistry.size(); id++) {
+    snprintf(name, sizeof(name), "r%u", id);
+    rules.addInput(name);               // Input id is relay_inputs + device id
+    if (deviceRegistry[id].kind == DeviceKind::RELAY) {
+      rules.addOutput(name, id);
+    }
+  }
+  rules.begin(rule_action, rule_clock);
+}
+
+// Creating tasks, network stack on core 0
+Task t2(WIFI_ACTIVE_INTERVAL, TASK_FOREVER, &wifi);
+Task t3(MQTT_IDLE_INTERVAL, TASK_FOREVER, &mqtt);             // Woken early by broker data
+Task t6(60000, TASK_FOREVER, &heap_stats);
+Task t8(60000, TASK_FOREVER, &latency_stats);
+Task t9(60000, TASK_FOREVER, &sched_stats);
+Task* const net_tasks[] = {&t2, &t3, &t6, &t8, &t9};
+
+// Time until the first enabled task of a scheduler is due
+uint32_t idle_time(Scheduler& scheduler, Task* const tasks[], uint8_t count){
+  uint32_t idle = WAKE_MAX_IDLE;
+  for (uint8_t i = 0; i < count; i++) {
+    long left = scheduler.timeUntilNextIteration(*tasks[i]);
+    if (left >= 0 && (uint32_t)left < idle) {
+      idle = left;
+    }
+  }
+  return idle;
+}
+
+void network(void *param){
+  for (;;) {
+    net_runner.execute();
+    live.drain();
+    history.drain();                // Encoding readings, flash writes stay off the control loop
+
+    // Sleeping until a task is due, the broker sends data or the control loop queues telemetry
+    int fd = mqtt_fd();
+    uint8_t reason = net_wake.wait(fd, idle_time(net_runner, net_tasks, sizeof(net_tasks) / sizeof(net_tasks[0])));
+    if (reason & WAKE_SIGNAL) {
+      t2.forceNextIteration();
+    }
+    if (reason != WAKE_TIMEOUT) {
+      t3.forceNextIteration();
+    }
+  }
+}
 
 void setup(){
   // Defining Serial speed
@@ -33,45 +461,96 @@ void setup(){
 
   // Defining Pin Modes
   pinMode(LED_BUILTIN, OUTPUT);
-  digitalWrite(26, HIGH);
-  digitalWrite(27, HIGH);
-  pinMode(26, OUTPUT);
-  pinMode(27, OUTPUT);
+  deviceRegistry.begin(memoryHandler);   // Loading device table, relays start switched off
+  bootProfiler.mark("io");
+
+  // Loading the whole configuration in one pass
+  bool configured = memoryHandler.loadConfig(config);
+  bootProfiler.mark("config");
+
+  wifiHandler = new WifiHandler(WiFi, config.wifi, LED_BUILTIN, SSID, PASS, memoryHandler);   // Initializing Handler, and passing to global pointer.
+  if (configured) {
+    power.begin(memoryHandler);     // Sleep policy, applied before the station starts
+    if (power.current().mode == PowerMode::LIGHT_SLEEP) {
+      wifiHandler -> setListenInterval(power.current().listen_interval);
+    }
+    wifiHandler -> setupWiFi(config.record.bssid, config.record.channel);   // Starting WiFi early, it associates while the rest of setup runs
+    bootProfiler.mark("wifi");
+  }
 
   // 8x8 Matrix setup
+  matrix.begin();
+  matrix.control(MD_MAX72XX::INTENSITY, 0);
   display.begin();
-  display.displayClear();
-  display.setIntensity(0);
-  display.displayClear();
+  bootProfiler.mark("display");
   
   // Button setup
   button.attachDuringLongPress(DuringLongPress, &button);
   button.attachLongPressStop(LongPressStop, &button);
   button.setLongPressIntervalMs(2000);
-  
-  wifiHandler = new WifiHandler(WiFi, wifi_credentials, LED_BUILTIN, SSID, PASS);   // Initializing Handler, and passing to global pointer.
 
   // Cheking for errors in Configurations
-  if (memoryHandler.isWiFiConfigAvailable() == true && memoryHandler.isBrokerConfigAvailable() == true) {
-    // Load Topics to global
-    wifi_credentials = memoryHandler.getWifiCredentials();
-    topics = memoryHandler.getBrokerTopics();
-    brocker_cred = memoryHandler.getBrokerCredentials();
-
-    mqttHandler = new MqttHandler(client, sensors, display, topics, brocker_cred);   // Initializing Handler, and passing to global pointer.
-    wifiHandler -> setupWiFi();     // Connecting to WiFi
+  if (configured) {
+    bool mounted = LittleFS.begin(true);
+    publishQueue.begin(mounted);    // Recovering queued publishes from the spill log
+    history.begin(mounted);         // Indexing the stored history pages
+    bootProfiler.mark("fs");
+    topics.load(config.record);     // Copying topics into the static table, hashing them once
+    uint8_t codecs[CONFIG_MAX_TOPICS];
+    topics.setCodecs(codecs, memoryHandler.getCodecs(codecs, sizeof(codecs)));   // TEXT unless configured
+    mqttHandler = new MqttHandler(client, deviceRegistry, publishQueue, commands, telemetry, topics, config.broker);   // Initializing Handler, and passing to global pointer.
     mqttHandler -> mqtt_setup();    // Conecting to MQTT broker
+    mqttHandler -> mqtt_add_handler("rules", rules_upload);
+    mqttHandler -> mqtt_add_handler("power", power_upload);
+    mqttHandler -> mqtt_add_handler("devices", devices_upload);
+#ifndef MQTT_ASYNC
+    client.setBufferSize(RULES_TEXT_LEN + 128);   // Room for a rules upload, AsyncMqtt takes up to MQTT_ASYNC_LARGE
+#endif
+    sensorHandler.begin();          // Loading sensor table, switching to async conversions
+    telemetry_setup();
+    rules_setup();
+    configTzTime(RULES_TZ, RULES_NTP);   // Schedules start once SNTP has set the clock
+    bootProfiler.mark("sensors");
 
-    // Adding tasks to Task manager
+    // Adding tasks to Task managers
     runner.init();
     runner.addTask(t1);
-    runner.addTask(t2);
-    runner.addTask(t3);
     runner.addTask(t4);
+    runner.addTask(t5);
+    runner.addTask(t7);
+    runner.addTask(t10);
+    runner.addTask(t11);
+    runner.addTask(t12);
     t1.enable();
+    t10.enable();
+    t11.enable();
+    control_wake.begin();
+    attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), button_isr, CHANGE);   // Polling only while pressed
+    power.armWakeup();              // attachInterrupt() replaced the wakeup level of the pin
+
+    net_runner.init();
+    net_runner.addTask(t2);
+    net_runner.addTask(t3);
+    net_runner.addTask(t6);
+    net_runner.addTask(t8);
+    net_runner.addTask(t9);
     t2.enable();
     t3.enable();
-    t4.enable();
+    t6.enable();
+    t8.enable();
+    t9.enable();
+    net_wake.begin();
+#ifdef MQTT_ASYNC
+    client.onReceive([]{ net_wake.signal(); });   // Received packets are processed by mqtt(), no socket to select on
+#endif
+    WiFi.onEvent([](WiFiEvent_t, WiFiEventInfo_t){ net_wake.signal(); }, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+    WiFi.onEvent([](WiFiEvent_t, WiFiEventInfo_t){ net_wake.signal(); }, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    xTaskCreatePinnedToCore(network, "network", NET_STACK, nullptr, 1, &net_task, NET_CORE);
+    api.begin(server, config.record.apiUser(), config.record.apiPass());    // LAN control without the broker, POSTs ask for the credentials
+    live.begin(server, config.record.apiUser(), config.record.apiPass());   // Telemetry deltas pushed to dashboards, same credentials
+    history.serve(server);          // Sensor history streamed from flash
+    runMetricsServer(metrics);      // Scrape endpoint, listens once WiFi is up
+    bootProfiler.mark("scheduler");
   } else {
     // Run the configuration web server.
     wifiHandler -> setupAP();
@@ -81,4 +560,19 @@ void setup(){
 
 void loop() {
   runner.execute();
+
+  // Sleeping until a task is due, commands arrive or the button changes
+  if (control_wake.wait(-1, idle_time(runner, control_tasks, sizeof(control_tasks) / sizeof(control_tasks[0]))) & WAKE_SIGNAL) {
+    if (button_edge) {
+      button_edge = false;
+      TRACE_RECORD(trace_button, TRACE_TIME_US() - button_stamp);   // Includes the wakeup from light sleep
+      t4.enableIfNot();
+    }
+    if (commands.size() > 0 || http_commands.size() > 0) {
+      t7.restart();
+    }
+    if (rules.pending()) {
+      t11.forceNextIteration();
+    }
+  }
 }
\ No newline at end of file
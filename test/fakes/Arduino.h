@@ -0,0 +1,206 @@
+#ifndef FAKE_ARDUINO_H
+#define FAKE_ARDUINO_H
+
+/**
+ * @file Arduino.h
+ * @brief Host fake of the subset of the Arduino ESP32 core used by the libraries.
+ *
+ * Part of the fakes of the native environment, which stand in for the framework headers so the
+ * libraries compile and run on the development host:
+ * - Time is a fake clock, millis() only moves when a test calls fake_advance() or delay().
+ * - Pins are an array of levels, digitalWrite() and digitalRead() go through fake_pins.
+ * - Serial discards its output, FAKE_SERIAL_STDOUT prints it.
+ * - FreeRTOS mutexes and critical sections map to std::mutex, so the libraries keep their
+ *   locking when a test runs them on several threads.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <mutex>
+#include <string>
+
+typedef uint8_t byte;
+
+#define IRAM_ATTR
+#define PROGMEM
+#define LOW 0x0
+#define HIGH 0x1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define FAKE_PINS 40                            ///< GPIOs of the ESP32.
+
+inline uint32_t fake_ms = 0;                    ///< Value of millis().
+inline uint8_t fake_pins[FAKE_PINS];            ///< Pin levels.
+inline uint8_t fake_modes[FAKE_PINS];           ///< Pin modes.
+inline uint32_t fake_seed = 1;                  ///< State of random().
+inline uint32_t fake_heap = 200000;             ///< Value of ESP.getFreeHeap().
+
+/**
+ * @brief Moves the fake clock forward.
+ */
+inline void fake_advance(uint32_t ms) { fake_ms += ms; }
+
+inline unsigned long millis() { return fake_ms; }
+inline unsigned long micros() { return fake_ms * 1000UL; }
+inline void delay(uint32_t ms) { fake_ms += ms; }
+inline void yield() {}
+
+inline void pinMode(uint8_t pin, uint8_t mode) { if (pin < FAKE_PINS) fake_modes[pin] = mode; }
+inline void digitalWrite(uint8_t pin, uint8_t level) { if (pin < FAKE_PINS) fake_pins[pin] = level != LOW; }
+inline int digitalRead(uint8_t pin) { return pin < FAKE_PINS ? fake_pins[pin] : LOW; }
+
+inline long random(long max) {
+    fake_seed = fake_seed * 1103515245u + 12345u;  ///< Deterministic, a test run repeats exactly.
+    return max > 0 ? (long)((fake_seed >> 8) % (uint32_t)max) : 0;
+}
+inline long random(long min, long max) { return min + random(max - min); }
+
+#ifndef __APPLE__
+inline size_t fake_strlcpy(char* dst, const char* src, size_t size) {
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#define strlcpy fake_strlcpy
+#endif
+
+/**
+ * @brief Arduino String on top of std::string, with the members used by the libraries.
+ */
+class String {
+private:
+    std::string text;
+
+public:
+    String() {}
+    String(const char* s) : text(s ? s : "") {}
+    String(const std::string& s) : text(s) {}
+    String(char c) : text(1, c) {}
+    String(int v) : text(std::to_string(v)) {}
+    String(unsigned int v) : text(std::to_string(v)) {}
+    String(long v) : text(std::to_string(v)) {}
+    String(unsigned long v) : text(std::to_string(v)) {}
+
+    const char* c_str() const { return text.c_str(); }
+    unsigned int length() const { return text.size(); }
+    bool isEmpty() const { return text.empty(); }
+    long toInt() const { return strtol(text.c_str(), nullptr, 10); }
+    float toFloat() const { return strtof(text.c_str(), nullptr); }
+    char operator[](unsigned int i) const { return i < text.size() ? text[i] : '\0'; }
+    int indexOf(char c, unsigned int from = 0) const {
+        size_t pos = text.find(c, from);
+        return pos == std::string::npos ? -1 : (int)pos;
+    }
+    String substring(unsigned int from, unsigned int to) const { return String(text.substr(from, to > from ? to - from : 0)); }
+    String substring(unsigned int from) const { return String(text.substr(from < text.size() ? from : text.size())); }
+    bool equals(const String& other) const { return text == other.text; }
+    bool operator==(const String& other) const { return text == other.text; }
+    bool operator==(const char* other) const { return text == other; }
+    bool operator!=(const String& other) const { return text != other.text; }
+    String& operator+=(const String& other) { text += other.text; return *this; }
+    String& operator+=(const char* other) { text += other; return *this; }
+    String& operator+=(char c) { text += c; return *this; }
+    friend String operator+(const String& a, const String& b) { return String(a.text + b.text); }
+};
+
+/**
+ * @brief Arduino Print, everything ends up in write().
+ */
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+    size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+    size_t print(const char* s) { return write(s); }
+    size_t print(const String& s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int v) { return printf("%d", v); }
+    size_t print(unsigned int v) { return printf("%u", v); }
+    size_t print(long v) { return printf("%ld", v); }
+    size_t print(unsigned long v) { return printf("%lu", v); }
+    size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char buffer[512];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if (n < 0) return 0;
+        return write((const uint8_t*)buffer, (size_t)n < sizeof(buffer) ? n : sizeof(buffer) - 1);
+    }
+};
+
+/**
+ * @brief A Print collecting its output, for checking formatted text in tests.
+ */
+class FakePrint : public Print {
+public:
+    std::string text;   ///< Everything written.
+    size_t write(uint8_t c) override { text += (char)c; return 1; }
+    size_t write(const uint8_t* buffer, size_t size) override { text.append((const char*)buffer, size); return size; }
+    using Print::write;
+};
+
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c) override {
+#ifdef FAKE_SERIAL_STDOUT
+        putchar(c);
+#else
+        (void)c;
+#endif
+        return 1;
+    }
+    using Print::write;
+};
+inline HardwareSerial Serial;
+
+class EspClass {
+public:
+    uint32_t getFreeHeap() { return fake_heap; }
+    uint32_t getMinFreeHeap() { return fake_heap; }
+    uint32_t getMaxAllocHeap() { return fake_heap; }
+    void restart() {}
+};
+inline EspClass ESP;
+
+// FreeRTOS, a mutex is a std::mutex and a critical section locks one
+typedef std::mutex* SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdTRUE 1
+#define pdFALSE 0
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new std::mutex; }
+inline int xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t) { mutex->lock(); return pdTRUE; }
+inline int xSemaphoreGive(SemaphoreHandle_t mutex) { mutex->unlock(); return pdTRUE; }
+
+struct portMUX_TYPE { std::mutex mutex; };
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) (mux)->mutex.lock()
+#define portEXIT_CRITICAL(mux) (mux)->mutex.unlock()
+#define portENTER_CRITICAL_ISR(mux) (mux)->mutex.lock()
+#define portEXIT_CRITICAL_ISR(mux) (mux)->mutex.unlock()
+
+#endif // FAKE_ARDUINO_H
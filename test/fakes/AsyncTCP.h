@@ -0,0 +1,88 @@
+#ifndef FAKE_ASYNCTCP_H
+#define FAKE_ASYNCTCP_H
+
+/**
+ * @file AsyncTCP.h
+ * @brief Host fake of the AsyncTCP client, driven by the test instead of an AsyncTCP task.
+ *
+ * connect() only records the attempt and makes the client AsyncClient::last, so a test can reach
+ * the socket of a client it does not own. The test then plays the events a broker would cause
+ * with fakeOpen(), fakeReceive() and fakeClose(), which run the callbacks on the calling thread.
+ * The bytes written are appended to sent.
+ */
+#include <Arduino.h>
+#include <functional>
+#include <string>
+
+class AsyncClient;
+
+typedef std::function<void(void*, AsyncClient*)> AcConnectHandler;
+typedef std::function<void(void*, AsyncClient*, void* data, size_t len)> AcDataHandler;
+
+class AsyncClient {
+private:
+    AcConnectHandler connect_cb;
+    AcConnectHandler disconnect_cb;
+    AcDataHandler data_cb;
+    void* connect_arg = nullptr;
+    void* disconnect_arg = nullptr;
+    void* data_arg = nullptr;
+    bool open = false;
+
+public:
+    std::string sent;                   ///< Bytes written, until the test clears it.
+    size_t window = 5744;               ///< Value of space() while connected.
+    uint32_t connects = 0;              ///< Calls of connect().
+    bool refuse = false;                ///< True to make connect() fail at once.
+
+    static inline AsyncClient* last = nullptr;  ///< Client of the latest connect().
+
+    void onConnect(AcConnectHandler cb, void* arg = nullptr) { connect_cb = cb; connect_arg = arg; }
+    void onDisconnect(AcConnectHandler cb, void* arg = nullptr) { disconnect_cb = cb; disconnect_arg = arg; }
+    void onData(AcDataHandler cb, void* arg = nullptr) { data_cb = cb; data_arg = arg; }
+
+    bool connect(const char*, uint16_t) {
+        connects++;
+        last = this;
+        return !refuse;
+    }
+    bool connected() const { return open; }
+    size_t space() const { return open ? window : 0; }
+    size_t add(const char* data, size_t size, uint8_t apiflags = 0) {
+        (void)apiflags;
+        if (!open) return 0;
+        sent.append(data, size);
+        return size;
+    }
+    bool send() { return open; }
+    void close(bool now = false) {
+        (void)now;
+        fakeClose();
+    }
+
+    /**
+     * @brief Completes the TCP handshake.
+     */
+    void fakeOpen() {
+        open = true;
+        if (connect_cb) connect_cb(connect_arg, this);
+    }
+
+    /**
+     * @brief Delivers bytes from the peer.
+     */
+    void fakeReceive(const void* data, size_t len) {
+        if (data_cb) data_cb(data_arg, this, (void*)data, len);
+    }
+
+    /**
+     * @brief Closes the connection, from either side.
+     */
+    void fakeClose() {
+        bool was_open = open;
+        open = false;
+        if (was_open && disconnect_cb) disconnect_cb(disconnect_arg, this);
+    }
+};
+
+#endif // FAKE_ASYNCTCP_H
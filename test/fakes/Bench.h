@@ -0,0 +1,70 @@
+#ifndef FAKE_BENCH_H
+#define FAKE_BENCH_H
+
+/**
+ * @file Bench.h
+ * @brief Micro-benchmark helpers of the native suites, reporting ns/op and allocs/op.
+ *
+ * Replaces the global operator new and delete to count the heap allocations, so it must be
+ * included by exactly one file of a suite, its test_main.cpp. bench_run() times a batch of
+ * calls on the host clock and prints one line per benchmark:
+ *
+ *     BENCH callback_dispatch              41.3 ns/op     0.00 allocs/op
+ *
+ * Times depend on the host and are only reported. The allocation counts do not, the suites
+ * assert them, so a hot path which starts allocating fails the native tests.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"    // The replacements below pair malloc() with free()
+#endif
+
+inline std::atomic<uint64_t> bench_allocs{0};  ///< Heap allocations since start.
+
+void* operator new(size_t size) {
+    bench_allocs.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+/**
+ * @brief Result of a benchmark.
+ */
+struct BenchResult {
+    double ns_per_op;       ///< Mean time per call.
+    double allocs_per_op;   ///< Mean heap allocations per call.
+};
+
+/**
+ * @brief Runs a body once to warm up, then iterations times, and prints the result.
+ */
+template <typename Body>
+BenchResult bench_run(const char* name, uint32_t iterations, Body&& body) {
+    body();
+    uint64_t allocs = bench_allocs.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        body();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    BenchResult result;
+    result.ns_per_op = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    result.allocs_per_op = (double)(bench_allocs.load(std::memory_order_relaxed) - allocs) / iterations;
+    printf("BENCH %-28s %10.1f ns/op %8.2f allocs/op\n", name, result.ns_per_op, result.allocs_per_op);
+    return result;
+}
+
+#endif // FAKE_BENCH_H
@@ -0,0 +1,136 @@
+#ifndef FAKE_DALLASTEMPERATURE_H
+#define FAKE_DALLASTEMPERATURE_H
+
+/**
+ * @file DallasTemperature.h
+ * @brief Host fake of the DS18B20 driver, a bus of sensors whose readings the test sets.
+ *
+ * fakeAdd() puts a sensor on the bus. A conversion copies the temperature set by the test into
+ * the scratchpad, so getTempC() returns the value of the last conversion, as on the bus. A
+ * sensor marked disconnected reads DEVICE_DISCONNECTED_C, fakeGlitch() makes the next reads of
+ * a sensor fail as a scratchpad CRC error does.
+ *
+ * begin() searches the bus as the driver does: the connected sensors are enumerated in ROM
+ * order, so a sensor appearing or leaving shifts the index of the ones after it.
+ *
+ * bus_us adds up the time the operations hold the bus at the standard OneWire speed, about
+ * 70 us a bit slot and 1 ms for a reset and presence pulse, so a test can compare the bus time
+ * of a strategy with the number of sensors.
+ */
+#include <Arduino.h>
+#include <OneWire.h>
+#include <algorithm>
+#include <vector>
+
+#define DEVICE_DISCONNECTED_C -127
+
+#define FAKE_ONEWIRE_RESET_US 1000      ///< Reset and presence pulse.
+#define FAKE_ONEWIRE_SLOT_US 70         ///< One bit slot.
+
+typedef uint8_t DeviceAddress[8];
+
+class DallasTemperature {
+private:
+    struct FakeSensor {
+        uint8_t rom[8];
+        float temperature;      ///< Value of the next conversion.
+        float scratchpad;       ///< Value of the last conversion.
+        bool connected;
+        uint8_t glitches;       ///< Reads left which fail their CRC.
+    };
+    std::vector<FakeSensor> bus;
+    std::vector<size_t> found;  ///< Sensors enumerated by the last begin(), in ROM order.
+    bool wait = true;
+
+    FakeSensor* find(const uint8_t* rom) {
+        for (FakeSensor& s : bus) {
+            if (memcmp(s.rom, rom, 8) == 0) return &s;
+        }
+        return nullptr;
+    }
+    void transaction(uint32_t bits) { bus_us += FAKE_ONEWIRE_RESET_US + bits * FAKE_ONEWIRE_SLOT_US; }
+
+public:
+    uint32_t conversions = 0;   ///< Conversions started, broadcast or addressed.
+    uint32_t reads = 0;         ///< Scratchpad reads.
+    uint32_t searches = 0;      ///< Bus searches run by begin().
+    uint32_t resolutions = 0;   ///< setResolution() calls, each an EEPROM copy on a DS18B20.
+    uint64_t bus_us = 0;        ///< Time the bus was busy, in microseconds.
+
+    DallasTemperature() {}
+    explicit DallasTemperature(OneWire*) {}
+
+    /**
+     * @brief Puts a sensor on the bus, its ROM code is derived from serial, by default the index.
+     */
+    void fakeAdd(float temperature, int serial = -1) {
+        uint8_t id = serial < 0 ? (uint8_t)bus.size() : (uint8_t)serial;
+        FakeSensor s = {{0x28, id, 0, 0, 0, 0, 0, 0}, temperature, (float)DEVICE_DISCONNECTED_C, true, 0};
+        bus.push_back(s);
+    }
+    void fakeSet(uint8_t index, float temperature) { bus[index].temperature = temperature; }
+    void fakeConnect(uint8_t index, bool connected) { bus[index].connected = connected; }
+    void fakeGlitch(uint8_t index, uint8_t count) { bus[index].glitches = count; }
+
+    void begin() {
+        found.clear();
+        for (size_t i = 0; i < bus.size(); i++) {
+            if (bus[i].connected) found.push_back(i);
+        }
+        std::sort(found.begin(), found.end(), [this](size_t a, size_t b) {
+            return memcmp(bus[a].rom, bus[b].rom, 8) < 0;
+        });
+        searches++;
+        bus_us += (found.size() + 1) * (FAKE_ONEWIRE_RESET_US + (8 + 64 * 3) * FAKE_ONEWIRE_SLOT_US);
+    }
+    uint8_t getDeviceCount() { return found.size(); }
+    bool getAddress(uint8_t* rom, uint8_t index) {
+        if (index >= found.size()) return false;
+        memcpy(rom, bus[found[index]].rom, 8);
+        return true;
+    }
+    bool setResolution(const uint8_t*, uint8_t) {
+        resolutions++;
+        transaction(8 + 64 + 8 + 24);
+        transaction(8 + 64 + 8);
+        bus_us += 20000;    ///< The driver waits for the EEPROM copy.
+        return true;
+    }
+    void setWaitForConversion(bool flag) { wait = flag; }
+    bool getWaitForConversion() const { return wait; }
+    int16_t millisToWaitForConversion(uint8_t bits) {
+        switch (bits) {
+        case 9: return 94;
+        case 10: return 188;
+        case 11: return 375;
+        default: return 750;
+        }
+    }
+    void requestTemperatures() {
+        for (FakeSensor& s : bus) {
+            if (s.connected) s.scratchpad = s.temperature;
+        }
+        conversions++;
+        transaction(8 + 8);     ///< Skip ROM, convert.
+    }
+    bool requestTemperaturesByAddress(const uint8_t* rom) {
+        FakeSensor* s = find(rom);
+        transaction(8 + 64 + 8);    ///< Match ROM, convert.
+        if (!s || !s->connected) return false;
+        s->scratchpad = s->temperature;
+        conversions++;
+        return true;
+    }
+    float getTempC(const uint8_t* rom) {
+        FakeSensor* s = find(rom);
+        reads++;
+        transaction(8 + 64 + 8 + 72);   ///< Match ROM, read scratchpad, 9 bytes.
+        if (s && s->glitches > 0) {
+            s->glitches--;
+            return DEVICE_DISCONNECTED_C;
+        }
+        return s && s->connected ? s->scratchpad : DEVICE_DISCONNECTED_C;
+    }
+};
+
+#endif // FAKE_DALLASTEMPERATURE_H
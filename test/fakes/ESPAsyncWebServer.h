@@ -0,0 +1,294 @@
+#ifndef FAKE_ESPASYNCWEBSERVER_H
+#define FAKE_ESPASYNCWEBSERVER_H
+
+/**
+ * @file ESPAsyncWebServer.h
+ * @brief Host fake of the subset of ESPAsyncWebServer used by the libraries.
+ *
+ * A test builds an AsyncWebServerRequest with its parameters and credentials, hands it to
+ * AsyncWebServer::fakeRequest() and checks the code, headers and body of the response the
+ * handler sent. Chunked responses are filled to the end when sent. WebSocket clients are opened
+ * and closed by AsyncWebSocket::fakeConnect() and fakeDisconnect(), which run the event handler
+ * as the AsyncTCP task would; the frames queued on a client are kept in its messages. An open
+ * client takes fake_ws_client_heap bytes off ESP.getFreeHeap(), as its connection and buffers do
+ * on the device.
+ */
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <map>
+
+typedef enum {
+    HTTP_GET = 0b00000001,
+    HTTP_POST = 0b00000010,
+    HTTP_DELETE = 0b00000100,
+    HTTP_PUT = 0b00001000,
+    HTTP_ANY = 0b01111111
+} WebRequestMethod;
+
+class AsyncWebServerRequest;
+
+typedef std::function<void(AsyncWebServerRequest*)> ArRequestHandlerFunction;
+typedef std::function<size_t(uint8_t*, size_t, size_t)> AwsResponseFiller;
+typedef std::function<void(void)> ArDisconnectHandler;
+
+class AsyncWebParameter {
+private:
+    String name_;
+    String value_;
+    bool post_;
+
+public:
+    AsyncWebParameter(const String& name, const String& value, bool post) : name_(name), value_(value), post_(post) {}
+    const String& name() const { return name_; }
+    const String& value() const { return value_; }
+    bool isPost() const { return post_; }
+};
+
+class AsyncWebServerResponse {
+public:
+    int code = 200;                                 ///< Status code.
+    String type;                                    ///< Content type.
+    std::string body;                               ///< Body, chunked ones filled in full.
+    std::map<std::string, std::string> headers;     ///< Headers added by the handler.
+    AwsResponseFiller filler;                       ///< Fills a chunked body.
+
+    virtual ~AsyncWebServerResponse() {}
+    void addHeader(const String& name, const String& value) { headers[name.c_str()] = value.c_str(); }
+};
+
+class AsyncResponseStream : public AsyncWebServerResponse, public Print {
+public:
+    size_t write(uint8_t c) override { body += (char)c; return 1; }
+    size_t write(const uint8_t* buffer, size_t size) override { body.append((const char*)buffer, size); return size; }
+    using Print::write;
+};
+
+class AsyncWebServerRequest {
+private:
+    String path;
+    std::vector<AsyncWebParameter> params;
+    std::map<std::string, std::string> request_headers;
+    String user;
+    String pass;
+    ArDisconnectHandler disconnect;
+
+public:
+    std::unique_ptr<AsyncWebServerResponse> response;  ///< Response sent by the handler, null if none.
+    bool challenged = false;                            ///< True if requestAuthentication() was called.
+
+    explicit AsyncWebServerRequest(const char* url) : path(url) {}
+
+    /**
+     * @brief Adds a query (post false) or form (post true) parameter.
+     */
+    AsyncWebServerRequest& fakeParam(const char* name, const char* value, bool post = false) {
+        params.emplace_back(name, value, post);
+        return *this;
+    }
+    AsyncWebServerRequest& fakeHeader(const char* name, const char* value) {
+        request_headers[name] = value;
+        return *this;
+    }
+    AsyncWebServerRequest& fakeCredentials(const char* username, const char* password) {
+        user = username;
+        pass = password;
+        return *this;
+    }
+
+    /**
+     * @brief Runs the disconnect handler, as a client going away does.
+     */
+    void fakeDisconnect() { if (disconnect) disconnect(); }
+
+    const String& url() const { return path; }
+    bool hasParam(const char* name, bool post = false) { return getParam(name, post) != nullptr; }
+    AsyncWebParameter* getParam(const char* name, bool post = false) {
+        for (AsyncWebParameter& p : params) {
+            if (p.name() == name && p.isPost() == post) return &p;
+        }
+        return nullptr;
+    }
+    bool hasHeader(const char* name) const { return request_headers.count(name) != 0; }
+    String header(const char* name) const {
+        auto found = request_headers.find(name);
+        return found == request_headers.end() ? String() : String(found->second);
+    }
+    bool authenticate(const char* username, const char* password) {
+        return user.length() > 0 && user == username && pass == password;
+    }
+    void requestAuthentication() {
+        challenged = true;
+        send(401);
+    }
+    void onDisconnect(ArDisconnectHandler fn) { disconnect = fn; }
+
+    AsyncWebServerResponse* beginResponse(int code, const String& type = String(), const String& body = String()) {
+        AsyncWebServerResponse* r = new AsyncWebServerResponse;
+        r->code = code;
+        r->type = type;
+        r->body = body.c_str();
+        return r;
+    }
+    AsyncWebServerResponse* beginResponse_P(int code, const String& type, const uint8_t* data, size_t len) {
+        AsyncWebServerResponse* r = beginResponse(code, type);
+        r->body.assign((const char*)data, len);
+        return r;
+    }
+    AsyncWebServerResponse* beginChunkedResponse(const String& type, AwsResponseFiller fill) {
+        AsyncWebServerResponse* r = beginResponse(200, type);
+        r->filler = fill;
+        return r;
+    }
+    AsyncResponseStream* beginResponseStream(const String& type) {
+        AsyncResponseStream* r = new AsyncResponseStream;
+        r->type = type;
+        return r;
+    }
+
+    void send(AsyncWebServerResponse* r) {
+        if (r->filler) {
+            uint8_t chunk[256];
+            size_t n;
+            while ((n = r->filler(chunk, sizeof(chunk), r->body.size())) > 0) {
+                r->body.append((const char*)chunk, n);
+            }
+        }
+        response.reset(r);
+    }
+    void send(int code, const String& type = String(), const String& body = String()) {
+        send(beginResponse(code, type, body));
+    }
+};
+
+class AsyncWebHandler {
+public:
+    virtual ~AsyncWebHandler() {}
+};
+
+class AsyncWebServer {
+private:
+    struct Route {
+        std::string path;
+        int method;
+        ArRequestHandlerFunction handler;
+    };
+    std::vector<Route> routes;
+
+public:
+    std::vector<AsyncWebHandler*> handlers;     ///< Handlers added, such as WebSockets.
+
+    explicit AsyncWebServer(uint16_t port) { (void)port; }
+    void begin() {}
+    void on(const char* path, int method, ArRequestHandlerFunction handler) {
+        routes.push_back({path, method, handler});
+    }
+    void addHandler(AsyncWebHandler* handler) { handlers.push_back(handler); }
+
+    /**
+     * @brief Runs the first handler registered for the path and method of a request.
+     *
+     * @return False if none is registered, as a 404 would be.
+     */
+    bool fakeRequest(AsyncWebServerRequest& request, int method) {
+        for (Route& route : routes) {
+            std::string url = request.url().c_str();
+            // As AsyncCallbackWebHandler, a path also matches the URLs below it
+            bool match = url == route.path || url.compare(0, route.path.size() + 1, route.path + "/") == 0;
+            if ((route.method & method) && match) {
+                route.handler(&request);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// WebSocket
+typedef enum { WS_DISCONNECTED, WS_CONNECTED, WS_DISCONNECTING } AwsClientStatus;
+typedef enum { WS_EVT_CONNECT, WS_EVT_DISCONNECT, WS_EVT_PONG, WS_EVT_ERROR, WS_EVT_DATA } AwsEventType;
+
+#define WS_MAX_QUEUED_MESSAGES 8
+
+inline uint32_t fake_ws_client_heap = 0;    ///< Heap taken by each open WebSocket client.
+
+class AsyncWebSocket;
+
+class AsyncWebSocketClient {
+private:
+    uint32_t client_id;
+
+public:
+    AwsClientStatus state = WS_CONNECTED;       ///< Value of status().
+    std::vector<std::string> messages;          ///< Frames queued, until the test clears them.
+    size_t queue_limit = WS_MAX_QUEUED_MESSAGES; ///< Queued frames making queueIsFull() true.
+
+    explicit AsyncWebSocketClient(uint32_t id) : client_id(id) {}
+    uint32_t id() const { return client_id; }
+    AwsClientStatus status() const { return state; }
+    bool queueIsFull() const { return messages.size() >= queue_limit || state != WS_CONNECTED; }
+    void text(const char* message, size_t len) {
+        if (state == WS_CONNECTED && messages.size() < queue_limit) messages.emplace_back(message, len);
+    }
+    void text(const char* message) { text(message, strlen(message)); }
+    void close() { state = WS_DISCONNECTING; }
+};
+
+typedef std::function<void(AsyncWebSocket*, AsyncWebSocketClient*, AwsEventType, void*, uint8_t*, size_t)> AwsEventHandler;
+
+class AsyncWebSocket : public AsyncWebHandler {
+private:
+    String path;
+    AwsEventHandler handler;
+    uint32_t next_id = 1;
+
+public:
+    std::vector<std::unique_ptr<AsyncWebSocketClient>> clients;    ///< Open clients.
+    String username;                            ///< Credentials set by setAuthentication().
+    String password;
+
+    explicit AsyncWebSocket(const String& url) : path(url) {}
+    const char* url() const { return path.c_str(); }
+    void onEvent(AwsEventHandler fn) { handler = fn; }
+    void setAuthentication(const char* user, const char* pass) {
+        username = user;
+        password = pass;
+    }
+    size_t count() const { return clients.size(); }
+
+    /**
+     * @brief Opens a client with the given credentials, refused as by the library if they do
+     *        not match the ones set.
+     *
+     * @return The client, nullptr if the handshake was refused.
+     */
+    AsyncWebSocketClient* fakeConnect(const char* user = "", const char* pass = "") {
+        if (username.length() > 0 && (username != user || password != pass)) {
+            return nullptr;
+        }
+        clients.emplace_back(new AsyncWebSocketClient(next_id++));
+        AsyncWebSocketClient* client = clients.back().get();
+        fake_heap -= fake_ws_client_heap;
+        if (handler) handler(this, client, WS_EVT_CONNECT, nullptr, nullptr, 0);
+        return client;
+    }
+
+    /**
+     * @brief Closes a client, the event runs before it is destroyed as in the library.
+     */
+    void fakeDisconnect(AsyncWebSocketClient* client) {
+        client->state = WS_DISCONNECTED;
+        if (handler) handler(this, client, WS_EVT_DISCONNECT, nullptr, nullptr, 0);
+        for (size_t i = 0; i < clients.size(); i++) {
+            if (clients[i].get() == client) {
+                clients.erase(clients.begin() + i);
+                fake_heap += fake_ws_client_heap;
+                break;
+            }
+        }
+    }
+};
+
+#endif // FAKE_ESPASYNCWEBSERVER_H
@@ -0,0 +1,107 @@
+#ifndef FAKE_FS_H
+#define FAKE_FS_H
+
+/**
+ * @file FS.h
+ * @brief Host fake of the Arduino FS with files kept in memory.
+ *
+ * A FakeFS is a flat directory of named byte vectors, enough for the segment logs of PublishQueue
+ * and HistoryStore. A File holds a shared pointer to its data, so a file removed while open stays
+ * readable as on LittleFS. fail_writes makes every write fail, to test a full flash.
+ */
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+typedef std::map<std::string, std::shared_ptr<std::vector<uint8_t>>> FakeDirectory;
+
+class File {
+private:
+    std::string path;
+    std::shared_ptr<std::vector<uint8_t>> data;
+    std::vector<std::string> entries;    ///< Files of a directory, in name order.
+    const FakeDirectory* directory = nullptr;
+    size_t position = 0;
+    size_t next = 0;
+    bool writable = false;
+    const bool* fail_writes = nullptr;
+
+public:
+    File() {}
+    File(const std::string& name, std::shared_ptr<std::vector<uint8_t>> bytes, bool write, size_t at, const bool* fail)
+        : path(name), data(bytes), position(at), writable(write), fail_writes(fail) {}
+    File(const FakeDirectory* files) : path("/"), directory(files) {
+        for (const auto& entry : *files) entries.push_back(entry.first);
+    }
+
+    operator bool() const { return data != nullptr || directory != nullptr; }
+    const char* name() const { return path.c_str() + 1; }   ///< Without the leading slash, as core 2.x.
+    size_t size() const { return data ? data->size() : 0; }
+    bool isDirectory() const { return directory != nullptr; }
+
+    bool seek(uint32_t pos) {
+        if (!data || pos > data->size()) return false;
+        position = pos;
+        return true;
+    }
+    size_t read(uint8_t* buffer, size_t size) {
+        if (!data || position >= data->size()) return 0;
+        size_t n = data->size() - position < size ? data->size() - position : size;
+        memcpy(buffer, data->data() + position, n);
+        position += n;
+        return n;
+    }
+    size_t write(const uint8_t* buffer, size_t size) {
+        if (!data || !writable || (fail_writes && *fail_writes)) return 0;
+        if (position + size > data->size()) data->resize(position + size);
+        memcpy(data->data() + position, buffer, size);
+        position += size;
+        return size;
+    }
+    void close() { data.reset(); directory = nullptr; }
+
+    File openNextFile() {
+        while (directory && next < entries.size()) {
+            auto found = directory->find(entries[next++]);
+            if (found != directory->end()) return File(found->first, found->second, false, 0, nullptr);
+        }
+        return File();
+    }
+};
+
+class FS {
+public:
+    FakeDirectory files;        ///< Path to contents.
+    bool fail_writes = false;   ///< True to make every write fail.
+
+    File open(const char* path, const char* mode = FILE_READ) {
+        std::string name(path);
+        if (name == "/") return File(&files);
+        auto found = files.find(name);
+        if (mode[0] == 'r') {
+            return found == files.end() ? File() : File(name, found->second, false, 0, nullptr);
+        }
+        if (found == files.end() || mode[0] == 'w') {
+            files[name] = std::make_shared<std::vector<uint8_t>>();
+            found = files.find(name);
+        }
+        return File(name, found->second, true, found->second->size(), &fail_writes);
+    }
+    bool exists(const char* path) { return files.count(path) != 0; }
+    bool remove(const char* path) { return files.erase(path) != 0; }
+    void format() { files.clear(); }
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+
+#endif // FAKE_FS_H
@@ -0,0 +1,17 @@
+#ifndef FAKE_LITTLEFS_H
+#define FAKE_LITTLEFS_H
+
+/**
+ * @file LittleFS.h
+ * @brief Host fake of LittleFS, a FakeFS which always mounts.
+ */
+#include <FS.h>
+
+class LittleFSFS : public fs::FS {
+public:
+    bool begin(bool format_on_fail = false) { (void)format_on_fail; return true; }
+    void end() {}
+};
+inline LittleFSFS LittleFS;
+
+#endif // FAKE_LITTLEFS_H
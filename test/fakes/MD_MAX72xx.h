@@ -0,0 +1,72 @@
+#ifndef FAKE_MD_MAX72XX_H
+#define FAKE_MD_MAX72XX_H
+
+/**
+ * @file MD_MAX72xx.h
+ * @brief Host fake of the MD_MAX72XX matrix driver, recording the columns and the updates.
+ *
+ * Columns are counted from the right as in the library. The font is a fixed 5 column glyph per
+ * character, made of the character code, enough to tell the rendered texts apart.
+ *
+ * update() counts the SPI bytes as the library sends them: one transaction per digit line changed
+ * on any device, 2 bytes for every device of the chain, no-ops for the unchanged ones. A column
+ * changes one digit line of its device, or all eight on the modules which wire the digits to the
+ * rows (every type but GENERIC_HW).
+ */
+#include <Arduino.h>
+
+class MD_MAX72XX {
+public:
+    enum moduleType_t { GENERIC_HW, FC16_HW, PAROLA_HW, ICSTATION_HW };
+    enum controlRequest_t { SHUTDOWN, SCANLIMIT, INTENSITY, TEST, DECODE, WRAPAROUND, UPDATE };
+    enum controlValue_t { OFF = 0, ON = 1 };
+
+    static const uint16_t FAKE_COLUMNS = 16 * 8;   ///< Columns of the largest chain.
+
+    uint8_t columns[FAKE_COLUMNS];      ///< Column contents, index 0 on the right.
+    uint8_t changed[FAKE_COLUMNS / 8];  ///< Digit lines of each device changed since the last update().
+    uint8_t devices;                    ///< Devices in the chain.
+    bool digit_rows;                    ///< True if the digits drive the matrix rows.
+    uint32_t updates = 0;               ///< Calls of update().
+    uint32_t writes = 0;                ///< Calls of setColumn().
+    uint32_t spi_bytes = 0;             ///< Bytes sent by update().
+    bool auto_update = true;            ///< UPDATE control.
+
+    MD_MAX72XX(moduleType_t type, uint8_t, uint8_t count) : devices(count), digit_rows(type != GENERIC_HW) {
+        memset(columns, 0, sizeof(columns));
+        memset(changed, 0, sizeof(changed));
+    }
+
+    bool begin() { return true; }
+    bool control(controlRequest_t request, int value) {
+        if (request == UPDATE) auto_update = value == ON;
+        return true;
+    }
+    void clear() {
+        memset(columns, 0, sizeof(columns));
+        memset(changed, 0xFF, sizeof(changed));
+    }
+    void update() {
+        updates++;
+        for (uint8_t line = 0; line < 8; line++) {
+            bool any = false;
+            for (uint8_t d = 0; d < devices; d++) any = any || (changed[d] & (1 << line));
+            if (any) spi_bytes += 2 * devices;
+        }
+        memset(changed, 0, sizeof(changed));
+    }
+    bool setColumn(uint16_t column, uint8_t value) {
+        if (column >= FAKE_COLUMNS) return false;
+        columns[column] = value;
+        changed[column / 8] |= digit_rows ? 0xFF : 1 << (column % 8);
+        writes++;
+        return true;
+    }
+    uint8_t getChar(uint16_t c, uint8_t size, uint8_t* buffer) {
+        uint8_t width = size < 5 ? size : 5;
+        for (uint8_t i = 0; i < width; i++) buffer[i] = (uint8_t)(c + i);
+        return width;
+    }
+};
+
+#endif // FAKE_MD_MAX72XX_H
@@ -0,0 +1,16 @@
+#ifndef FAKE_ONEWIRE_H
+#define FAKE_ONEWIRE_H
+
+/**
+ * @file OneWire.h
+ * @brief Host fake of the OneWire bus, only the pin is kept, DallasTemperature holds the devices.
+ */
+#include <Arduino.h>
+
+class OneWire {
+public:
+    uint8_t pin;    ///< Bus pin.
+    explicit OneWire(uint8_t bus_pin = 0) : pin(bus_pin) {}
+};
+
+#endif // FAKE_ONEWIRE_H
@@ -0,0 +1,85 @@
+#ifndef FAKE_PREFERENCES_H
+#define FAKE_PREFERENCES_H
+
+/**
+ * @file Preferences.h
+ * @brief Host fake of the NVS Preferences, namespaces of keys kept in memory.
+ *
+ * Values are stored as bytes whatever their type, as NVS blobs. fake_nvs is shared by every
+ * instance, so a test can prepare the flash before the code under test opens it. Every key looked
+ * up by a read counts in fake_nvs_lookups, each one is a search of the NVS pages on the device.
+ */
+#include <Arduino.h>
+#include <map>
+#include <vector>
+
+typedef std::map<std::string, std::map<std::string, std::vector<uint8_t>>> FakeNvs;
+inline FakeNvs fake_nvs;    ///< Namespace to key to value.
+inline uint32_t fake_nvs_lookups = 0;   ///< Keys looked up by isKey() and the getters.
+
+class Preferences {
+private:
+    std::map<std::string, std::vector<uint8_t>>* space = nullptr;
+    bool read_only = false;
+
+    const std::vector<uint8_t>* find(const char* key) const {
+        if (!space) return nullptr;
+        fake_nvs_lookups++;
+        auto found = space->find(key);
+        return found == space->end() ? nullptr : &found->second;
+    }
+    size_t put(const char* key, const void* value, size_t len) {
+        if (!space || read_only) return 0;
+        (*space)[key].assign((const uint8_t*)value, (const uint8_t*)value + len);
+        return len;
+    }
+
+public:
+    bool begin(const char* name, bool readOnly = false) {
+        space = &fake_nvs[name];
+        read_only = readOnly;
+        return true;
+    }
+    void end() { space = nullptr; }
+    bool clear() {
+        if (!space || read_only) return false;
+        space->clear();
+        return true;
+    }
+    bool remove(const char* key) { return space && !read_only && space->erase(key) != 0; }
+    bool isKey(const char* key) { return find(key) != nullptr; }
+
+    size_t putBytes(const char* key, const void* value, size_t len) { return put(key, value, len); }
+    size_t getBytes(const char* key, void* buffer, size_t max_len) {
+        const std::vector<uint8_t>* value = find(key);
+        if (!value || value->size() > max_len) return 0;   ///< As NVS, a blob larger than the buffer is not read.
+        memcpy(buffer, value->data(), value->size());
+        return value->size();
+    }
+    size_t getBytesLength(const char* key) {
+        const std::vector<uint8_t>* value = find(key);
+        return value ? value->size() : 0;
+    }
+
+    size_t putString(const char* key, const char* value) { return put(key, value, strlen(value)); }
+    size_t putString(const char* key, const String& value) { return putString(key, value.c_str()); }
+    String getString(const char* key, const String& fallback = String()) {
+        const std::vector<uint8_t>* value = find(key);
+        return value ? String(std::string(value->begin(), value->end())) : fallback;
+    }
+
+    size_t putBool(const char* key, bool value) { uint8_t v = value; return put(key, &v, 1); }
+    bool getBool(const char* key, bool fallback = false) {
+        const std::vector<uint8_t>* value = find(key);
+        return value && value->size() == 1 ? (*value)[0] != 0 : fallback;
+    }
+    size_t putUInt(const char* key, uint32_t value) { return put(key, &value, sizeof(value)); }
+    uint32_t getUInt(const char* key, uint32_t fallback = 0) {
+        const std::vector<uint8_t>* value = find(key);
+        uint32_t v = fallback;
+        if (value && value->size() == sizeof(v)) memcpy(&v, value->data(), sizeof(v));
+        return v;
+    }
+};
+
+#endif // FAKE_PREFERENCES_H
@@ -0,0 +1,107 @@
+#ifndef FAKE_PUBSUBCLIENT_H
+#define FAKE_PUBSUBCLIENT_H
+
+/**
+ * @file PubSubClient.h
+ * @brief Host fake of the PubSubClient transport, recording what is sent.
+ *
+ * Publishes and subscriptions are appended to vectors a test can check, deliver() runs the
+ * callback as loop() would for a received message. connect() succeeds unless refuse_connect is
+ * set, fail_publish makes publishes fail as a full TCP buffer does. connect_pending makes the
+ * next connects report MQTT_CONNECTING, as the asynchronous transport does while the CONNACK is
+ * on its way, so the polling of an attempt can be tested with this fake too.
+ */
+#include <Arduino.h>
+#include <WiFi.h>
+#include <functional>
+#include <vector>
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+#define MQTT_CONNECTING -5          ///< Never reported by PubSubClient, see connect_pending.
+
+#define MQTT_MAX_PACKET_SIZE 256
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+/**
+ * @brief A publish sent through the fake.
+ */
+struct FakePublish {
+    std::string topic;      ///< Topic name.
+    std::string payload;    ///< Payload bytes.
+};
+
+class PubSubClient {
+private:
+    MQTT_CALLBACK_SIGNATURE;
+    int status = MQTT_DISCONNECTED;
+
+public:
+    std::vector<FakePublish> published;         ///< Publishes sent, oldest first.
+    std::vector<std::string> subscribed;        ///< Filters subscribed, oldest first.
+    bool refuse_connect = false;                ///< True to make connect() fail.
+    bool fail_publish = false;                  ///< True to make publish() fail.
+    uint8_t connect_pending = 0;                ///< Connects answered with MQTT_CONNECTING first.
+    uint32_t connects = 0;                      ///< Calls of connect().
+    bool record = true;                         ///< False to only count the publishes, as benchmarks do.
+    uint32_t publishes = 0;                     ///< Publishes sent.
+    uint32_t loops = 0;                         ///< Calls of loop().
+
+    PubSubClient() {}
+    PubSubClient(WiFiClient&) {}
+
+    PubSubClient& setServer(const char*, uint16_t) { return *this; }
+    PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE) { this->callback = callback; return *this; }
+    PubSubClient& setSocketTimeout(uint16_t) { return *this; }
+    PubSubClient& setKeepAlive(uint16_t) { return *this; }
+    bool setBufferSize(uint16_t) { return true; }
+
+    bool connect(const char*) {
+        connects++;
+        if (connect_pending > 0) {
+            connect_pending--;
+            status = MQTT_CONNECTING;
+            return false;
+        }
+        status = refuse_connect ? MQTT_CONNECT_FAILED : MQTT_CONNECTED;
+        return status == MQTT_CONNECTED;
+    }
+    bool connect(const char* id, const char*, const char*) { return connect(id); }
+    void disconnect() { status = MQTT_DISCONNECTED; }
+    bool connected() { return status == MQTT_CONNECTED; }
+    int state() { return status; }
+    bool loop() { loops++; return connected(); }
+
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length) {
+        if (!connected() || fail_publish) return false;
+        if (record) published.push_back({topic, std::string((const char*)payload, length)});
+        publishes++;
+        return true;
+    }
+    bool publish(const char* topic, const char* payload) {
+        return publish(topic, (const uint8_t*)payload, strlen(payload));
+    }
+    bool subscribe(const char* filter) {
+        if (!connected()) return false;
+        subscribed.push_back(filter);
+        return true;
+    }
+
+    /**
+     * @brief Runs the callback for a message as if the broker had sent it.
+     */
+    void deliver(const char* topic, const char* payload) {
+        char name[MQTT_MAX_PACKET_SIZE];
+        uint8_t bytes[MQTT_MAX_PACKET_SIZE];    ///< Copied as PubSubClient hands out its receive buffer.
+        size_t length = strlen(payload) < sizeof(bytes) ? strlen(payload) : sizeof(bytes);
+        strlcpy(name, topic, sizeof(name));
+        memcpy(bytes, payload, length);
+        if (callback) callback(name, bytes, length);
+    }
+};
+
+#endif // FAKE_PUBSUBCLIENT_H
@@ -0,0 +1,131 @@
+#ifndef FAKE_WIFI_H
+#define FAKE_WIFI_H
+
+/**
+ * @file WiFi.h
+ * @brief Host fake of the WiFi station and soft AP, connected unless a test sets fake_wifi_status.
+ *
+ * Handlers registered with onEvent() are run by fakeEvent(), on the calling thread instead of the
+ * event task. begin() only counts the attempts and records the channel asked for, the test plays
+ * the events of the association.
+ *
+ * As on the device, begin() writes a fresh station configuration, which resets the listen
+ * interval, and connects unless told not to. fake_wifi_assoc_interval is the listen interval of
+ * the last connect, the one the access point is told in the association request.
+ */
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA } wifi_mode_t;
+typedef enum { WIFI_PS_NONE, WIFI_PS_MIN_MODEM, WIFI_PS_MAX_MODEM } wifi_ps_type_t;
+typedef enum { WIFI_IF_STA, WIFI_IF_AP } wifi_interface_t;
+
+enum WiFiEvent_t {
+    ARDUINO_EVENT_WIFI_STA_CONNECTED,
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+    ARDUINO_EVENT_WIFI_STA_GOT_IP
+};
+
+typedef union {
+    struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t channel; } wifi_sta_connected;
+    struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t reason; } wifi_sta_disconnected;
+} WiFiEventInfo_t;
+
+typedef union {
+    struct { uint16_t listen_interval; } sta;
+} wifi_config_t;
+
+typedef int esp_err_t;
+#define ESP_OK 0
+
+inline wifi_config_t fake_wifi_config;                  ///< Configuration of esp_wifi_get_config().
+inline esp_err_t esp_wifi_get_config(wifi_interface_t, wifi_config_t* conf) { *conf = fake_wifi_config; return ESP_OK; }
+inline esp_err_t esp_wifi_set_config(wifi_interface_t, wifi_config_t* conf) { fake_wifi_config = *conf; return ESP_OK; }
+inline uint32_t fake_wifi_connects = 0;                 ///< Connects started, by begin() or esp_wifi_connect().
+inline uint16_t fake_wifi_assoc_interval = 0;           ///< Listen interval of the last connect.
+inline esp_err_t esp_wifi_connect() {
+    fake_wifi_connects++;
+    fake_wifi_assoc_interval = fake_wifi_config.sta.listen_interval;
+    return ESP_OK;
+}
+
+inline wl_status_t fake_wifi_status = WL_CONNECTED;    ///< Value of WiFi.status().
+
+class IPAddress {
+private:
+    uint8_t octets[4];
+
+public:
+    IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : octets{a, b, c, d} {}
+    String toString() const {
+        char text[16];
+        snprintf(text, sizeof(text), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+        return String(text);
+    }
+};
+
+typedef std::function<void(WiFiEvent_t, WiFiEventInfo_t)> WiFiEventFuncCb;
+
+class WiFiClass {
+private:
+    struct Handler {
+        WiFiEventFuncCb cb;
+        WiFiEvent_t event;
+    };
+    std::vector<Handler> handlers;
+
+public:
+    wifi_mode_t mode_set = WIFI_OFF;    ///< Last mode().
+    uint32_t begins = 0;                ///< Calls of begin().
+    int32_t begin_channel = 0;          ///< Channel of the last begin(), 0 for a full scan.
+
+    wl_status_t status() { return fake_wifi_status; }
+    String macAddress() { return String("24:0A:C4:00:00:01"); }
+    String SSID() { return String("fake"); }
+    IPAddress localIP() { return IPAddress(192, 168, 1, 2); }
+    IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+    int8_t RSSI() { return -60; }
+
+    wl_status_t begin(const char*, const char* = nullptr, int32_t channel = 0, const uint8_t* = nullptr, bool connect = true) {
+        begins++;
+        begin_channel = channel;
+        fake_wifi_config.sta.listen_interval = 0;
+        if (connect) esp_wifi_connect();
+        return fake_wifi_status;
+    }
+    bool disconnect(bool = false, bool = true) { return true; }
+    bool mode(wifi_mode_t m) { mode_set = m; return true; }
+    void persistent(bool) {}
+    bool setAutoReconnect(bool) { return true; }
+    bool setSleep(wifi_ps_type_t) { return true; }
+    bool softAP(const char*, const char* = nullptr) { return true; }
+
+    void onEvent(WiFiEventFuncCb cb, WiFiEvent_t event) { handlers.push_back({cb, event}); }
+
+    /**
+     * @brief Runs the handlers registered for an event.
+     */
+    void fakeEvent(WiFiEvent_t event, WiFiEventInfo_t info = {}) {
+        for (Handler& h : handlers) {
+            if (h.event == event) h.cb(event, info);
+        }
+    }
+};
+inline WiFiClass WiFi;
+
+/**
+ * @brief A TCP client, only held by PubSubClient.
+ */
+class WiFiClient {};
+
+#endif // FAKE_WIFI_H
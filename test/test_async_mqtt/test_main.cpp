@@ -0,0 +1,332 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the AsyncMqtt packet framer and QoS 1 window, with the broker played through
+ *        the AsyncTCP fake.
+ */
+#include <unity.h>
+#include <AsyncMqtt.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A PUBLISH handed to the callback.
+ */
+struct Received {
+  std::string topic;
+  std::string payload;
+};
+
+static std::unique_ptr<AsyncMqtt> mqtt;
+static std::vector<Received> received;
+static uint32_t wakes;
+
+static void wake() {
+  wakes++;
+}
+
+// Encodes a packet with its remaining length
+static std::string packet(uint8_t type, const std::string& body) {
+  std::string out(1, (char)type);
+  size_t remaining = body.size();
+  do {
+    uint8_t digit = remaining & 0x7F;
+    remaining >>= 7;
+    out += (char)(remaining > 0 ? digit | 0x80 : digit);
+  } while (remaining > 0);
+  return out + body;
+}
+
+static std::string str(const std::string& text) {
+  return std::string(1, (char)(text.size() >> 8)) + (char)(text.size() & 0xFF) + text;
+}
+
+static std::string publish(const std::string& topic, const std::string& payload, uint16_t id = 0) {
+  std::string body = str(topic);
+  if (id) body += std::string(1, (char)(id >> 8)) + (char)(id & 0xFF);
+  return packet(id ? 0x32 : 0x30, body + payload);
+}
+
+static void receive(const std::string& bytes) {
+  AsyncClient::last->fakeReceive(bytes.data(), bytes.size());
+}
+
+// Connects and answers the CONNECT with an accepting CONNACK
+static void connect() {
+  TEST_ASSERT_FALSE(mqtt->connect("node1"));
+  TEST_ASSERT_EQUAL(MQTT_CONNECTING, mqtt->state());
+  AsyncClient::last->fakeOpen();
+  receive(packet(0x20, std::string("\0\0", 2)));
+  TEST_ASSERT_TRUE(mqtt->connect("node1"));
+  AsyncClient::last->sent.clear();
+}
+
+void setUp(void) {
+  fake_ms = 1000;
+  received.clear();
+  wakes = 0;
+  mqtt.reset(new AsyncMqtt());
+  mqtt->setServer("broker", 1883).setSocketTimeout(15).onReceive(wake);
+  mqtt->setCallback([](char* topic, uint8_t* payload, unsigned int length) {
+    received.push_back({topic, std::string((const char*)payload, length)});
+  });
+}
+void tearDown(void) {}
+
+static std::string metrics() {
+  FakePrint out;
+  mqtt->metrics(out);
+  return out.text;
+}
+
+static void test_connect_packet() {
+  TEST_ASSERT_FALSE(mqtt->connect("node1"));
+  AsyncClient* tcp = AsyncClient::last;
+  TEST_ASSERT_EQUAL(1, tcp->connects);
+  tcp->fakeOpen();
+
+  std::string expected = packet(0x10, str("MQTT") + std::string("\x04\x00\x00\x0F", 4) + str("node1"));
+  TEST_ASSERT_EQUAL(expected.size(), tcp->sent.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected.data(), tcp->sent.data(), expected.size());
+
+  receive(packet(0x20, std::string("\0\0", 2)));
+  TEST_ASSERT_EQUAL(1, wakes);
+  TEST_ASSERT_EQUAL(1, mqtt->available());
+  TEST_ASSERT_TRUE(mqtt->connect("node1"));
+  TEST_ASSERT_TRUE(mqtt->connected());
+  TEST_ASSERT_EQUAL(0, mqtt->available());
+}
+
+static void test_connect_refused() {
+  mqtt->connect("node1");
+  AsyncClient::last->fakeOpen();
+  receive(packet(0x20, std::string("\0\x05", 2)));
+  TEST_ASSERT_FALSE(mqtt->loop());
+  TEST_ASSERT_EQUAL(5, mqtt->state());
+  TEST_ASSERT_FALSE(AsyncClient::last->connected());
+}
+
+// A broker which never answers times the attempt out, the late close of its socket is ignored
+static void test_connect_timeout() {
+  mqtt->connect("node1");
+  AsyncClient* first = AsyncClient::last;
+  first->fakeOpen();
+  fake_advance(14999);
+  TEST_ASSERT_FALSE(mqtt->connect("node1"));
+  TEST_ASSERT_EQUAL(MQTT_CONNECTING, mqtt->state());
+  fake_advance(1);
+  TEST_ASSERT_FALSE(mqtt->connect("node1"));
+  TEST_ASSERT_EQUAL(MQTT_CONNECTION_TIMEOUT, mqtt->state());
+
+  mqtt->connect("node1");
+  AsyncClient* second = AsyncClient::last;
+  TEST_ASSERT_TRUE(first != second);
+  second->fakeOpen();
+  first->fakeOpen();
+  first->fakeClose();
+  TEST_ASSERT_EQUAL(MQTT_CONNECTING, mqtt->state());
+  second->fakeReceive("\x20\x02\x00\x00", 4);
+  TEST_ASSERT_TRUE(mqtt->connect("node1"));
+}
+
+static void test_framer_split_and_batched() {
+  connect();
+  std::string a = publish("home/node1/relay1", "on");
+  std::string b = publish("home/node1/display", "hello world");
+  std::string both = a + b;
+
+  // One byte at a time, the length and body split anywhere
+  for (char c : both) {
+    receive(std::string(1, c));
+  }
+  TEST_ASSERT_EQUAL(2, mqtt->available());
+  TEST_ASSERT_TRUE(mqtt->loop());
+  TEST_ASSERT_EQUAL(2, received.size());
+  TEST_ASSERT_EQUAL_STRING("home/node1/relay1", received[0].topic.c_str());
+  TEST_ASSERT_EQUAL_STRING("on", received[0].payload.c_str());
+  TEST_ASSERT_EQUAL_STRING("hello world", received[1].payload.c_str());
+
+  // Several packets in one segment
+  receive(both + both);
+  mqtt->loop();
+  TEST_ASSERT_EQUAL(6, received.size());
+  TEST_ASSERT_EQUAL_STRING("home/node1/display", received[5].topic.c_str());
+}
+
+static void test_framer_long_length() {
+  connect();
+  std::string payload(300, 'x');
+  std::string bytes = publish("t", payload);
+  TEST_ASSERT_EQUAL(0x80 | ((300 + 3) & 0x7F), (uint8_t)bytes[1]);  // Two length bytes
+  receive(bytes.substr(0, 2));
+  receive(bytes.substr(2));
+  mqtt->loop();
+  TEST_ASSERT_EQUAL(1, received.size());
+  TEST_ASSERT_EQUAL(300, received[0].payload.size());
+
+  // Larger than a large buffer, skipped without losing the framing
+  receive(publish("t", std::string(MQTT_ASYNC_LARGE, 'y')) + publish("t", "after"));
+  mqtt->loop();
+  TEST_ASSERT_EQUAL(2, received.size());
+  TEST_ASSERT_EQUAL_STRING("after", received[1].payload.c_str());
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "mqtt_rx_dropped_total 1\n"));
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "mqtt_buffers_used{size=\"128\"} 0\n"));
+}
+
+static void test_framer_malformed_length() {
+  connect();
+  receive(std::string("\x30\xFF\xFF\xFF\xFF\x01", 6));
+  TEST_ASSERT_FALSE(mqtt->loop());
+  TEST_ASSERT_EQUAL(MQTT_CONNECTION_LOST, mqtt->state());
+  TEST_ASSERT_FALSE(AsyncClient::last->connected());
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "mqtt_malformed_total 1\n"));
+
+  // The next attempt frames from a clean state
+  connect();
+  receive(publish("t", "ok"));
+  mqtt->loop();
+  TEST_ASSERT_EQUAL(1, received.size());
+}
+
+// A partial packet of a closed connection goes back to its pool
+static void test_close_mid_packet() {
+  connect();
+  std::string bytes = publish("t", "partial");
+  receive(bytes.substr(0, 5));
+  AsyncClient::last->fakeClose();
+  TEST_ASSERT_FALSE(mqtt->loop());
+  TEST_ASSERT_EQUAL(MQTT_CONNECTION_LOST, mqtt->state());
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "mqtt_buffers_used{size=\"128\"} 0\n"));
+}
+
+static void test_qos1_received_acked() {
+  connect();
+  receive(publish("t", "q1", 0x1234));
+  mqtt->loop();
+  TEST_ASSERT_EQUAL(1, received.size());
+  TEST_ASSERT_EQUAL_STRING("q1", received[0].payload.c_str());
+  TEST_ASSERT_EQUAL(4, AsyncClient::last->sent.size());
+  TEST_ASSERT_EQUAL_MEMORY("\x40\x02\x12\x34", AsyncClient::last->sent.data(), 4);
+}
+
+static void test_publish_window_and_retransmit() {
+  connect();
+  AsyncClient* tcp = AsyncClient::last;
+  for (int i = 0; i < MQTT_ASYNC_WINDOW; i++) {
+    TEST_ASSERT_TRUE(mqtt->publish("t", std::to_string(i).c_str()));
+  }
+  TEST_ASSERT_FALSE(mqtt->publish("t", "full"));   // Window full
+  std::string first = publish("t", "0", 2);         // Ids start at 2, 1 went to no packet
+  TEST_ASSERT_EQUAL_MEMORY("\x32\x06\x00\x01t\x00\x02", tcp->sent.data(), 7);
+  TEST_ASSERT_EQUAL(first.size() * MQTT_ASYNC_WINDOW, tcp->sent.size());
+
+  // Acknowledging the first frees one slot
+  receive(packet(0x40, std::string("\x00\x02", 2)));
+  mqtt->loop();
+  TEST_ASSERT_TRUE(mqtt->publish("t", "8"));
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "mqtt_acked_total 1\n"));
+
+  // After a reconnect the unacknowledged ones are sent again in order, with DUP
+  tcp->fakeClose();
+  TEST_ASSERT_FALSE(mqtt->loop());
+  connect();
+  TEST_ASSERT_TRUE(AsyncClient::last != tcp);
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "mqtt_retransmits_total 8\n"));
+}
+
+static void test_retransmit_order() {
+  connect();
+  mqtt->publish("t", "a");
+  mqtt->publish("t", "b");
+  mqtt->publish("t", "c");
+  receive(packet(0x40, std::string("\x00\x03", 2)));   // b acknowledged
+  mqtt->loop();
+  AsyncClient::last->fakeClose();
+  mqtt->loop();
+
+  TEST_ASSERT_FALSE(mqtt->connect("node1"));
+  AsyncClient* tcp = AsyncClient::last;
+  tcp->fakeOpen();
+  tcp->sent.clear();
+  receive(packet(0x20, std::string("\0\0", 2)));
+  TEST_ASSERT_TRUE(mqtt->connect("node1"));
+
+  std::string a = publish("t", "a", 2);
+  std::string c = publish("t", "c", 4);
+  a[0] |= 0x08;
+  c[0] |= 0x08;
+  TEST_ASSERT_EQUAL(a.size() + c.size(), tcp->sent.size());
+  TEST_ASSERT_EQUAL_MEMORY((a + c).data(), tcp->sent.data(), a.size() + c.size());
+}
+
+static void test_publish_send_buffer_full() {
+  connect();
+  AsyncClient::last->window = 4;
+  TEST_ASSERT_FALSE(mqtt->publish("t", "too long"));
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "mqtt_inflight 0\n"));
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "mqtt_buffers_used{size=\"128\"} 0\n"));
+}
+
+static void test_keepalive() {
+  connect();
+  AsyncClient* tcp = AsyncClient::last;
+  fake_advance(MQTT_ASYNC_KEEPALIVE * 1000 / 2 - 1);
+  mqtt->loop();
+  TEST_ASSERT_EQUAL(0, tcp->sent.size());
+  fake_advance(1);
+  mqtt->loop();
+  TEST_ASSERT_EQUAL_MEMORY("\xC0\x00", tcp->sent.data(), 2);
+
+  receive(std::string("\xD0\x00", 2));
+  TEST_ASSERT_TRUE(mqtt->loop());
+  tcp->sent.clear();
+
+  // An unanswered ping drops the connection after a keepalive period
+  fake_advance(MQTT_ASYNC_KEEPALIVE * 1000 / 2);
+  mqtt->loop();
+  TEST_ASSERT_EQUAL(2, tcp->sent.size());
+  fake_advance(MQTT_ASYNC_KEEPALIVE * 1000);
+  TEST_ASSERT_FALSE(mqtt->loop());
+  TEST_ASSERT_EQUAL(MQTT_CONNECTION_TIMEOUT, mqtt->state());
+}
+
+static void test_subscribe_batched() {
+  connect();
+  const char* topics[] = { "home/node1/relay1", "home/node1/relay2", "home/node1/display" };
+  TEST_ASSERT_EQUAL(1, mqtt->subscribe(topics, 3));
+  std::string body = std::string("\x00\x02", 2);
+  for (const char* topic : topics) {
+    body += str(topic) + std::string(1, '\0');
+  }
+  std::string expected = packet(0x82, body);
+  TEST_ASSERT_EQUAL(expected.size(), AsyncClient::last->sent.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected.data(), AsyncClient::last->sent.data(), expected.size());
+
+  // Filters which do not fit one buffer go in several packets
+  static char long_topics[4][200];
+  const char* many[4];
+  for (int i = 0; i < 4; i++) {
+    memset(long_topics[i], 'a' + i, 199);
+    long_topics[i][199] = '\0';
+    many[i] = long_topics[i];
+  }
+  TEST_ASSERT_EQUAL(2, mqtt->subscribe(many, 4));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_connect_packet);
+  RUN_TEST(test_connect_refused);
+  RUN_TEST(test_connect_timeout);
+  RUN_TEST(test_framer_split_and_batched);
+  RUN_TEST(test_framer_long_length);
+  RUN_TEST(test_framer_malformed_length);
+  RUN_TEST(test_close_mid_packet);
+  RUN_TEST(test_qos1_received_acked);
+  RUN_TEST(test_publish_window_and_retransmit);
+  RUN_TEST(test_retransmit_order);
+  RUN_TEST(test_publish_send_buffer_full);
+  RUN_TEST(test_keepalive);
+  RUN_TEST(test_subscribe_batched);
+  return UNITY_END();
+}
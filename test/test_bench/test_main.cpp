@@ -0,0 +1,173 @@
+/**
+ * @file test_main.cpp
+ * @brief Micro-benchmarks of the hot paths of the network task, run with pio test -e native -v.
+ *
+ * Each benchmark prints ns/op and allocs/op (see Bench.h). The paths run for every message
+ * must not touch the heap, their allocation counts are asserted.
+ */
+#include <unity.h>
+#include <Bench.h>
+#include <LittleFS.h>
+#include <MemoryHandler.h>
+#include <MqttHandler.h>
+#include <PayloadCodec.h>
+
+#define BENCH_ITERATIONS 100000
+#define BENCH_TOPICS "home/node1/telemetry:home/node1/relay1:home/node1/relay2:home/node1/display"
+
+static Preferences prefs;
+static MemoryHandler memory(prefs);
+static NodeConfig config;
+static TopicTable topics;
+static DeviceRegistry registry;
+static PublishQueue pending(LittleFS);
+static CommandQueue commands;
+static TelemetryQueue telemetry;
+static PubSubClient client;
+static MqttHandler* mqtt;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Provisions the node as the portal and the MQTT devices topic would, then connects
+static void provision() {
+  Device table[DEVICE_CAPACITY];
+  const char* error = nullptr;
+
+  memory.writeCredentials("bench", "wifi-pass", "192.168.1.10:1883", "user", "broker-pass", false, BENCH_TOPICS);
+  TEST_ASSERT_TRUE(memory.loadConfig(config));
+  topics.load(config.record);
+  uint8_t count = DeviceRegistry::parse("relay:27:1,relay:26:2,display:3", topics.size(), table, error);
+  TEST_ASSERT_EQUAL(3, count);
+  memory.putDevices((const uint8_t*)table, count * sizeof(Device));
+  registry.begin(memory);
+  pending.begin(true);
+
+  mqtt = new MqttHandler(client, registry, pending, commands, telemetry, topics, config.broker);
+  mqtt->mqtt_setup();
+  mqtt->mqtt_loop();  // Connects at once, WiFi is up and no backoff is pending
+  TEST_ASSERT_TRUE(mqtt->mqtt_connected());
+  client.record = false;  // Publishes are only counted, a benchmark must not grow a vector
+}
+
+static void test_callback_dispatch_relay() {
+  Command cmd;
+  BenchResult r = bench_run("callback_dispatch_relay", BENCH_ITERATIONS, [&] {
+    client.deliver("home/node1/relay1", "on");
+    commands.pop(cmd);
+  });
+  TEST_ASSERT_EQUAL(CommandKind::RELAY, cmd.kind);
+  TEST_ASSERT_TRUE(cmd.on);
+  TEST_ASSERT_EQUAL(0, r.allocs_per_op);
+}
+
+static void test_callback_dispatch_display() {
+  Command cmd;
+  BenchResult r = bench_run("callback_dispatch_display", BENCH_ITERATIONS, [&] {
+    client.deliver("home/node1/display", "Hello, world");
+    commands.pop(cmd);
+  });
+  TEST_ASSERT_EQUAL(CommandKind::DISPLAY, cmd.kind);
+  TEST_ASSERT_EQUAL_STRING("Hello, world", cmd.text);
+  TEST_ASSERT_EQUAL(0, r.allocs_per_op);
+}
+
+static void test_callback_dispatch_unrouted() {
+  BenchResult r = bench_run("callback_dispatch_unrouted", BENCH_ITERATIONS, [&] {
+    client.deliver("home/node1/unknown/topic", "on");
+  });
+  TEST_ASSERT_EQUAL(0, commands.size());
+  TEST_ASSERT_EQUAL(0, r.allocs_per_op);
+}
+
+static void test_config_load() {
+  NodeConfig loaded;
+  bool ok = false;
+  // A fresh config each time as at boot, reported only: the credential vectors allocate once per boot
+  bench_run("config_load", BENCH_ITERATIONS / 10, [&] {
+    NodeConfig boot;
+    ok = memory.loadConfig(boot);
+    loaded.record = boot.record;
+  });
+  TEST_ASSERT_TRUE(ok);
+  TEST_ASSERT_EQUAL(4, loaded.record.topic_count);
+  TEST_ASSERT_EQUAL_STRING("home/node1/display", loaded.record.topic(3));
+}
+
+static void test_topic_parse() {
+  TopicTable table;
+  BenchResult r = bench_run("topic_table_load", BENCH_ITERATIONS, [&] {
+    table.load(config.record);
+  });
+  TEST_ASSERT_EQUAL(4, table.size());
+  TEST_ASSERT_EQUAL_STRING("home/node1/relay2", table[2]);
+  TEST_ASSERT_EQUAL(0, r.allocs_per_op);
+
+  TopicRouter router;
+  for (uint8_t i = 0; i < table.size(); i++) {
+    router.add(table[i], RouteKind::RELAY, i);
+  }
+  const Route* route = nullptr;
+  r = bench_run("topic_router_find", BENCH_ITERATIONS, [&] {
+    route = router.find("home/node1/relay2");
+  });
+  TEST_ASSERT_NOT_NULL(route);
+  TEST_ASSERT_EQUAL(2, route->arg);
+  TEST_ASSERT_EQUAL(0, r.allocs_per_op);
+}
+
+static void bench_format(const char* name, Codec codec) {
+  uint8_t payload[QUEUE_PAYLOAD_LEN];
+  size_t length = 0;
+  BenchResult r = bench_run(name, BENCH_ITERATIONS, [&] {
+    PayloadWriter writer(codec, payload, sizeof(payload));
+    writer.number("t0", 21.4375f, 2);
+    writer.number("t1", -3.5f, 2);
+    writer.number("t2", 100.0f, 1);
+    writer.number("hum", 48.25f, 1);
+    length = writer.finish();
+  });
+  TEST_ASSERT_GREATER_THAN(0, length);
+  TEST_ASSERT_EQUAL(0, r.allocs_per_op);
+}
+
+static void test_publish_format() {
+  bench_format("publish_format_text", Codec::TEXT);
+  bench_format("publish_format_json", Codec::JSON);
+  bench_format("publish_format_cbor", Codec::CBOR);
+}
+
+static void test_publish_telemetry() {
+  const char payload[] = "{\"t0\":21.44,\"t1\":-3.50}";
+  uint32_t before = client.publishes;
+  BenchResult r = bench_run("publish_telemetry", BENCH_ITERATIONS, [&] {
+    mqtt->mqtt_send_telemetry(payload, sizeof(payload) - 1);
+    mqtt->mqtt_loop();
+  });
+  TEST_ASSERT_EQUAL(BENCH_ITERATIONS + 1, client.publishes - before);
+  TEST_ASSERT_TRUE(pending.empty());
+  TEST_ASSERT_EQUAL(0, r.allocs_per_op);
+}
+
+static void test_publish_stat() {
+  bool sent = false;
+  BenchResult r = bench_run("publish_stat", BENCH_ITERATIONS, [&] {
+    sent = mqtt->mqtt_publish_stat("heap", "123456");
+  });
+  TEST_ASSERT_TRUE(sent);
+  TEST_ASSERT_EQUAL(0, r.allocs_per_op);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  provision();
+  RUN_TEST(test_callback_dispatch_relay);
+  RUN_TEST(test_callback_dispatch_display);
+  RUN_TEST(test_callback_dispatch_unrouted);
+  RUN_TEST(test_config_load);
+  RUN_TEST(test_topic_parse);
+  RUN_TEST(test_publish_format);
+  RUN_TEST(test_publish_telemetry);
+  RUN_TEST(test_publish_stat);
+  return UNITY_END();
+}
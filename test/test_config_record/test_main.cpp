@@ -0,0 +1,345 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the ConfigRecord blob, its CRC and layout checks, and the migration of the
+ *        legacy per-key configuration, and a benchmark of the record against the legacy keys.
+ */
+#include <unity.h>
+#include <Bench.h>
+#include <MemoryHandler.h>
+#include <Hal.h>
+#include <stddef.h>
+#include <string>
+#include <thread>
+
+static Preferences preferences;
+static MemoryHandler memory(preferences);
+
+void setUp(void) {
+  fake_nvs.clear();
+}
+void tearDown(void) {}
+
+static std::vector<uint8_t>& stored() {
+  return fake_nvs["node"]["cfg"];
+}
+
+// Stores the configuration the portal writes for a node with two topics
+static void write_default() {
+  memory.writeCredentials("home", "wifi-pass", "192.168.1.10:1883", "user", "broker-pass", false,
+                          "home/node1/relay1:home/node1/display");
+}
+
+static void test_crc_check_value() {
+  TEST_ASSERT_EQUAL_HEX32(0xCBF43926, hal_crc32((const uint8_t*)"123456789", 9));
+  TEST_ASSERT_EQUAL_HEX32(0, hal_crc32(nullptr, 0));
+}
+
+static void test_round_trip() {
+  NodeConfig config;
+  write_default();
+  TEST_ASSERT_EQUAL(sizeof(ConfigRecord), stored().size());
+  TEST_ASSERT_TRUE(memory.loadConfig(config));
+
+  const ConfigRecord& record = config.record;
+  TEST_ASSERT_EQUAL(CONFIG_VERSION, record.version);
+  TEST_ASSERT_EQUAL(sizeof(ConfigRecord), record.size);
+  TEST_ASSERT_EQUAL_STRING("home", record.ssid);
+  TEST_ASSERT_EQUAL_STRING("wifi-pass", record.wifi_pass);
+  TEST_ASSERT_EQUAL_STRING("192.168.1.10", record.broker_ip);
+  TEST_ASSERT_EQUAL(1883, record.broker_port);
+  TEST_ASSERT_EQUAL_STRING("user", record.broker_usr);
+  TEST_ASSERT_EQUAL_STRING("broker-pass", record.broker_pass);
+  TEST_ASSERT_FALSE(record.anonymous);
+  TEST_ASSERT_EQUAL(0, record.channel);
+  TEST_ASSERT_EQUAL(2, record.topic_count);
+  TEST_ASSERT_EQUAL_STRING("home/node1/relay1", record.topic(0));
+  TEST_ASSERT_EQUAL_STRING("home/node1/display", record.topic(1));
+  TEST_ASSERT_EQUAL(17, record.topics[0].length);
+  TEST_ASSERT_EQUAL(18, record.topics[1].offset);
+
+  TEST_ASSERT_EQUAL(2, config.wifi.size());
+  TEST_ASSERT_EQUAL_STRING("wifi-pass", config.wifi[1].c_str());
+  TEST_ASSERT_EQUAL(4, config.broker.size());
+  TEST_ASSERT_EQUAL_STRING("1883", config.broker[1].c_str());
+  TEST_ASSERT_EQUAL_STRING("user", record.apiUser());
+  TEST_ASSERT_EQUAL_STRING("broker-pass", record.apiPass());
+}
+
+// Every byte before the CRC is covered, padding included
+static void test_corruption_detected() {
+  NodeConfig config;
+  write_default();
+  const std::vector<uint8_t> good = stored();
+
+  for (size_t i = 0; i < offsetof(ConfigRecord, crc); i += 7) {
+    stored() = good;
+    stored()[i] ^= 0x01;
+    TEST_ASSERT_FALSE(memory.loadConfig(config));
+  }
+  stored() = good;
+  stored()[offsetof(ConfigRecord, crc)] ^= 0x80;
+  TEST_ASSERT_FALSE(memory.loadConfig(config));
+
+  stored() = good;
+  TEST_ASSERT_TRUE(memory.loadConfig(config));
+}
+
+static void test_layout_mismatch_rejected() {
+  NodeConfig config;
+  write_default();
+  ConfigRecord record;
+
+  // A record of another version is rejected even with a valid CRC
+  memcpy(&record, stored().data(), sizeof(record));
+  record.version = CONFIG_VERSION + 1;
+  record.crc = hal_crc32((const uint8_t*)&record, offsetof(ConfigRecord, crc));
+  stored().assign((uint8_t*)&record, (uint8_t*)&record + sizeof(record));
+  TEST_ASSERT_FALSE(memory.loadConfig(config));
+
+  memcpy(&record, stored().data(), sizeof(record));
+  record.version = CONFIG_VERSION;
+  record.size = sizeof(record) - 4;
+  record.crc = hal_crc32((const uint8_t*)&record, offsetof(ConfigRecord, crc));
+  stored().assign((uint8_t*)&record, (uint8_t*)&record + sizeof(record));
+  TEST_ASSERT_FALSE(memory.loadConfig(config));
+
+  // A shorter blob, written by an older layout
+  write_default();
+  stored().resize(sizeof(ConfigRecord) - 4);
+  TEST_ASSERT_FALSE(memory.loadConfig(config));
+
+  fake_nvs.clear();
+  TEST_ASSERT_FALSE(memory.loadConfig(config));
+}
+
+static void put_legacy(const char* space, const char* key, const char* value) {
+  const char* end = value + strlen(value);
+  fake_nvs[space][key].assign((const uint8_t*)value, (const uint8_t*)end);
+}
+
+// The legacy keys of a node with the configuration of write_default()
+static void seed_legacy() {
+  put_legacy("wifi", "ssid", "home");
+  put_legacy("wifi", "pass", "wifi-pass");
+  put_legacy("broker", "ip", "192.168.1.10");
+  put_legacy("broker", "port", "1883");
+  put_legacy("broker", "usr", "user");
+  put_legacy("broker", "pass", "broker-pass");
+  put_legacy("broker", "topics", "home/node1/relay1:home/node1/display");
+  fake_nvs["broker"]["anonymous"] = {0};
+}
+
+static void test_legacy_migration() {
+  NodeConfig config;
+  put_legacy("wifi", "ssid", "legacy");
+  put_legacy("wifi", "pass", "legacy-pass");
+  put_legacy("broker", "ip", "10.0.0.2");
+  put_legacy("broker", "port", "8883");
+  put_legacy("broker", "usr", "old");
+  put_legacy("broker", "pass", "old-pass");
+  put_legacy("broker", "topics", "a/b/c:a/b/d:a/e");
+  fake_nvs["broker"]["anonymous"] = {0};
+
+  TEST_ASSERT_TRUE(memory.loadConfig(config));
+  TEST_ASSERT_EQUAL_STRING("legacy", config.record.ssid);
+  TEST_ASSERT_EQUAL_STRING("10.0.0.2", config.record.broker_ip);
+  TEST_ASSERT_EQUAL(8883, config.record.broker_port);
+  TEST_ASSERT_EQUAL_STRING("old-pass", config.record.broker_pass);
+  TEST_ASSERT_FALSE(config.record.anonymous);
+  TEST_ASSERT_EQUAL(3, config.record.topic_count);
+  TEST_ASSERT_EQUAL_STRING("a/e", config.record.topic(2));
+
+  // The record replaces the legacy keys
+  TEST_ASSERT_TRUE(fake_nvs["wifi"].empty());
+  TEST_ASSERT_TRUE(fake_nvs["broker"].empty());
+  TEST_ASSERT_EQUAL(sizeof(ConfigRecord), stored().size());
+
+  // The next boot reads the record alone, one namespace open
+  NodeConfig again;
+  uint16_t opens = memory.openCount();
+  TEST_ASSERT_TRUE(memory.loadConfig(again));
+  TEST_ASSERT_EQUAL(opens + 1, memory.openCount());
+  TEST_ASSERT_EQUAL(0, memcmp(&config.record, &again.record, sizeof(ConfigRecord)));
+
+  // A corrupted record does not fall back to the removed legacy values
+  stored()[10] ^= 0xFF;
+  TEST_ASSERT_FALSE(memory.loadConfig(again));
+}
+
+static void test_legacy_anonymous_default() {
+  NodeConfig config;
+  put_legacy("wifi", "ssid", "legacy");
+  put_legacy("wifi", "pass", "legacy-pass");
+  put_legacy("broker", "ip", "10.0.0.2");
+  put_legacy("broker", "port", "1883");
+
+  TEST_ASSERT_TRUE(memory.loadConfig(config));
+  TEST_ASSERT_TRUE(config.record.anonymous);
+  TEST_ASSERT_EQUAL(1, config.record.topic_count);      // An empty list packs one empty topic
+  TEST_ASSERT_EQUAL_STRING("admin", config.record.apiUser());
+  TEST_ASSERT_EQUAL_STRING("legacy-pass", config.record.apiPass());
+}
+
+// loadConfig() at boot from the record, against the legacy keys it read before the record. The
+// legacy keys are migrated on the first load, so they are stored again before each one; the cost
+// of storing them is measured on its own and taken off. On the device a boot is dominated by the
+// namespace opens and key lookups, which are asserted. The host times are only reported, they
+// include the bitwise CRC of the host build where the device has the table in ROM.
+static void test_load_bench() {
+  const uint32_t iterations = 20000;
+  NodeConfig config;
+
+  write_default();
+  uint16_t opens = memory.openCount();
+  uint32_t lookups = fake_nvs_lookups;
+  TEST_ASSERT_TRUE(memory.loadConfig(config));
+  TEST_ASSERT_EQUAL(1, memory.openCount() - opens);
+  TEST_ASSERT_EQUAL(2, fake_nvs_lookups - lookups);       // isKey() and getBytes() of the blob
+  BenchResult record = bench_run("config_load_record", iterations, [&] {
+    memory.loadConfig(config);
+  });
+
+  fake_nvs.clear();
+  seed_legacy();
+  opens = memory.openCount();
+  lookups = fake_nvs_lookups;
+  TEST_ASSERT_TRUE(memory.loadConfig(config));
+  TEST_ASSERT_EQUAL(3 + 3, memory.openCount() - opens);   // The record and the two legacy namespaces, then the migration
+  TEST_ASSERT_EQUAL(1 + 9, fake_nvs_lookups - lookups);   // The missing blob, "ssid" and a key per field
+  ConfigRecord migrated = config.record;
+  BenchResult seed = bench_run("config_legacy_seed", iterations, [&] {
+    fake_nvs["node"].erase("cfg");
+    seed_legacy();
+  });
+  BenchResult legacy = bench_run("config_load_legacy", iterations, [&] {
+    fake_nvs["node"].erase("cfg");
+    seed_legacy();
+    memory.loadConfig(config);
+  });
+  TEST_ASSERT_EQUAL(0, memcmp(&migrated, &config.record, sizeof(ConfigRecord)));
+
+  NodeConfig expected;
+  write_default();
+  TEST_ASSERT_TRUE(memory.loadConfig(expected));
+  TEST_ASSERT_EQUAL(0, memcmp(&expected.record, &config.record, sizeof(ConfigRecord)));   // Same configuration both ways
+  printf("BENCH %-28s %10.1f ns/op %8.2f allocs/op\n", "config_load_legacy_net",
+         legacy.ns_per_op - seed.ns_per_op, legacy.allocs_per_op - seed.allocs_per_op);
+  TEST_ASSERT_TRUE(record.allocs_per_op < legacy.allocs_per_op - seed.allocs_per_op);
+}
+
+static void test_incomplete_configuration_rejected() {
+  NodeConfig config;
+  memory.writeCredentials("home", "", "192.168.1.10:1883", "user", "pass", false, "a/b");
+  TEST_ASSERT_FALSE(memory.loadConfig(config));
+  memory.writeCredentials("home", "wifi-pass", "192.168.1.10", "user", "pass", false, "a/b");
+  TEST_ASSERT_FALSE(memory.loadConfig(config));
+  memory.writeCredentials("home", "wifi-pass", "192.168.1.10:1883", "", "pass", false, "a/b");
+  TEST_ASSERT_FALSE(memory.loadConfig(config));
+  memory.writeCredentials("home", "wifi-pass", "192.168.1.10:1883", "", "", true, "a/b");
+  TEST_ASSERT_TRUE(memory.loadConfig(config));
+}
+
+static void test_topics_limits() {
+  NodeConfig config;
+  std::string topics;
+  for (int i = 0; i <= CONFIG_MAX_TOPICS; i++) {
+    topics += (i ? ":t/" : "t/") + std::to_string(i);
+  }
+  memory.writeCredentials("home", "wifi-pass", "10.0.0.1:1883", "user", "pass", false, topics.c_str());
+  TEST_ASSERT_TRUE(memory.loadConfig(config));
+  TEST_ASSERT_EQUAL(CONFIG_MAX_TOPICS, config.record.topic_count);
+  TEST_ASSERT_EQUAL_STRING("t/15", config.record.topic(CONFIG_MAX_TOPICS - 1));
+
+  // Topics which overflow the arena are dropped, the ones before them kept whole
+  std::string topic(200, 'x');
+  topics = topic + ":" + topic + ":" + topic;
+  memory.writeCredentials("home", "wifi-pass", "10.0.0.1:1883", "user", "pass", false, topics.c_str());
+  TEST_ASSERT_TRUE(memory.loadConfig(config));
+  TEST_ASSERT_EQUAL(2, config.record.topic_count);
+  TEST_ASSERT_EQUAL(200, strlen(config.record.topic(1)));
+
+  topics = std::string(256, 'y');
+  memory.writeCredentials("home", "wifi-pass", "10.0.0.1:1883", "user", "pass", false, topics.c_str());
+  TEST_ASSERT_FALSE(memory.loadConfig(config));  // Longer than a view can hold, no topics left
+}
+
+static void test_wifi_cache() {
+  uint8_t bssid[6] = {1, 2, 3, 4, 5, 6};
+  uint8_t read[6] = {};
+  NodeConfig config;
+
+  TEST_ASSERT_EQUAL(0, memory.getWifiCache(read));
+  write_default();
+  memory.putWifiCache(bssid, 11);
+  TEST_ASSERT_EQUAL(11, memory.getWifiCache(read));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(bssid, read, 6);
+  TEST_ASSERT_TRUE(memory.loadConfig(config));       // The rewrite keeps a valid CRC
+  TEST_ASSERT_EQUAL_STRING("home", config.record.ssid);
+
+  write_default();                                    // New credentials drop the cached access point
+  TEST_ASSERT_EQUAL(0, memory.getWifiCache(read));
+}
+
+static void test_clear_memory() {
+  write_default();
+  memory.putRules("if t0 > 1 then r1 on", 20);
+  memory.putDevices((const uint8_t*)"\x01\x02", 2);
+  memory.clearMemory();
+
+  NodeConfig config;
+  char rules[32];
+  uint8_t devices[8];
+  TEST_ASSERT_FALSE(memory.loadConfig(config));
+  TEST_ASSERT_EQUAL(0, memory.getRules(rules, sizeof(rules)));
+  TEST_ASSERT_EQUAL(0, memory.getDevices(devices, sizeof(devices)));
+}
+
+// The network task and the control loop store their tables at the same time, on the one handle
+static void test_concurrent_stores() {
+  const int rounds = 2000;
+  uint8_t roms[16], devices[10];
+  memset(roms, 0x28, sizeof(roms));
+  memset(devices, 0x1B, sizeof(devices));
+  write_default();
+  uint16_t opens = memory.openCount();
+
+  std::thread network([&]() {
+    for (int i = 0; i < rounds; i++) {
+      memory.putDevices(devices, sizeof(devices));
+      memory.putWifiCache(devices, 6);
+    }
+  });
+  for (int i = 0; i < rounds; i++) {
+    memory.putSensorRoms(roms, sizeof(roms));
+    memory.putRules("if t0 > 1 then r1 on", 20);
+  }
+  network.join();
+
+  uint8_t read[16];
+  TEST_ASSERT_EQUAL(sizeof(roms), memory.getSensorRoms(read, sizeof(read)));
+  TEST_ASSERT_EQUAL_MEMORY(roms, read, sizeof(roms));
+  TEST_ASSERT_EQUAL(sizeof(devices), memory.getDevices(read, sizeof(read)));
+  TEST_ASSERT_EQUAL_MEMORY(devices, read, sizeof(devices));
+  TEST_ASSERT_EQUAL((uint16_t)(opens + rounds * 5 + 2), memory.openCount());  // The cache is a read and a write
+
+  NodeConfig config;
+  TEST_ASSERT_TRUE(memory.loadConfig(config));
+  TEST_ASSERT_EQUAL(6, config.record.channel);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_crc_check_value);
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_corruption_detected);
+  RUN_TEST(test_layout_mismatch_rejected);
+  RUN_TEST(test_legacy_migration);
+  RUN_TEST(test_legacy_anonymous_default);
+  RUN_TEST(test_load_bench);
+  RUN_TEST(test_incomplete_configuration_rejected);
+  RUN_TEST(test_topics_limits);
+  RUN_TEST(test_wifi_cache);
+  RUN_TEST(test_clear_memory);
+  RUN_TEST(test_concurrent_stores);
+  return UNITY_END();
+}
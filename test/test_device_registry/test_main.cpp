@@ -0,0 +1,184 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the DeviceRegistry table parser, its validation of pins and topics, and of the
+ *        table loaded at boot.
+ */
+#include <unity.h>
+#include <DeviceRegistry.h>
+
+static Device devices[DEVICE_CAPACITY];
+static const char* error;
+
+void setUp(void) {
+  memset(devices, 0xAA, sizeof(devices));
+  error = nullptr;
+  fake_nvs.clear();
+}
+void tearDown(void) {}
+
+static uint8_t parse(const char* text, uint8_t topic_count = 4) {
+  return DeviceRegistry::parse(text, topic_count, devices, error);
+}
+
+static void test_parse_entries() {
+  TEST_ASSERT_EQUAL(4, parse("relay:27:1,relay:26:2:high,display:3,relay:4:0:low"));
+  TEST_ASSERT_NULL(error);
+
+  TEST_ASSERT_EQUAL(27, devices[0].pin);
+  TEST_ASSERT_TRUE(devices[0].active_low);
+  TEST_ASSERT_EQUAL(1, devices[0].topic);
+  TEST_ASSERT_EQUAL(DeviceKind::RELAY, devices[0].kind);
+  TEST_ASSERT_FALSE(devices[0].state);
+
+  TEST_ASSERT_FALSE(devices[1].active_low);
+  TEST_ASSERT_EQUAL(DeviceKind::DISPLAY, devices[2].kind);
+  TEST_ASSERT_EQUAL(3, devices[2].topic);
+  TEST_ASSERT_FALSE(devices[2].state);
+  TEST_ASSERT_TRUE(devices[3].active_low);
+  TEST_ASSERT_EQUAL(0, devices[3].topic);
+}
+
+static void test_parse_empty_entries_skipped() {
+  TEST_ASSERT_EQUAL(2, parse(",relay:27:1,,display:0,"));
+  TEST_ASSERT_EQUAL(0, parse(",,"));
+  TEST_ASSERT_EQUAL_STRING("no devices", error);
+  TEST_ASSERT_EQUAL(0, parse(""));
+  TEST_ASSERT_EQUAL_STRING("no devices", error);
+}
+
+static void test_parse_errors() {
+  static const char* const cases[][2] = {
+    { "relay:27", "unknown device" },
+    { "relay:27:1:high:x", "unknown device" },
+    { "lamp:27:1", "unknown device" },
+    { "display", "unknown device" },
+    { "relay:x:1", "malformed relay" },
+    { "relay:27:1x", "malformed relay" },
+    { "relay:-1:1", "pin is not an output" },
+    { "relay:27:1:hi", "malformed relay" },
+    { "display:a", "malformed display" },
+    { "relay:6:1", "pin is not an output" },        // Flash
+    { "relay:11:1", "pin is not an output" },
+    { "relay:20:1", "pin is not an output" },       // Missing
+    { "relay:34:1", "pin is not an output" },       // Input only
+    { "relay:99:1", "pin is not an output" },
+    { "relay:2:1", "pin is used by the node" },
+    { "relay:23:1", "pin is used by the node" },
+    { "relay:27:1,relay:27:2", "pin is used twice" },
+    { "display:1,display:2", "second display" },
+    { "relay:27:4", "unknown topic" },
+    { "display:9", "unknown topic" },
+    { "relay:27:1,relay:26:0000000000000000000000001", "entry too long" },
+  };
+  for (const auto& c : cases) {
+    error = nullptr;
+    TEST_ASSERT_EQUAL_MESSAGE(0, parse(c[0]), c[0]);
+    TEST_ASSERT_NOT_NULL(error);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(c[1], error, c[0]);
+  }
+}
+
+// UART0 and the strapping pins are output-capable but would break the console or the boot
+static void test_parse_reserved_pins() {
+  static const uint8_t pins[] = { 0, 1, 3, 12 };
+  char text[16];
+  for (uint8_t pin : pins) {
+    snprintf(text, sizeof(text), "relay:%u:0", pin);
+    TEST_ASSERT_EQUAL_MESSAGE(0, parse(text), text);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("pin is used by the node", error, text);
+  }
+}
+
+// The twelve pins left for relays are accepted in one table, together with the display. With
+// the default reserved pins the table cannot reach DEVICE_CAPACITY.
+static void test_parse_usable_pins() {
+  static const uint8_t pins[] = { 4, 13, 16, 17, 19, 21, 22, 25, 26, 27, 32, 33 };
+  char text[DEVICE_TEXT_LEN];
+  size_t len = 0;
+  for (uint8_t pin : pins) {
+    len += snprintf(text + len, sizeof(text) - len, "relay:%u:0,", pin);
+  }
+  snprintf(text + len, sizeof(text) - len, "display:0");
+  TEST_ASSERT_EQUAL(13, parse(text));
+  TEST_ASSERT_EQUAL(33, devices[11].pin);
+  TEST_ASSERT_EQUAL(DeviceKind::DISPLAY, devices[12].kind);
+
+  // No other pin is accepted
+  uint64_t usable = 0;
+  for (uint8_t pin : pins) {
+    usable |= 1ULL << pin;
+  }
+  for (uint8_t pin = 0; pin < 40; pin++) {
+    char entry[16];
+    snprintf(entry, sizeof(entry), "relay:%u:0", pin);
+    TEST_ASSERT_EQUAL_MESSAGE((usable >> pin) & 1, parse(entry), entry);
+  }
+}
+
+static void test_begin_legacy_layout() {
+  Preferences preferences;
+  MemoryHandler memory(preferences);
+  DeviceRegistry registry;
+  registry.begin(memory);
+
+  TEST_ASSERT_EQUAL(3, registry.size());
+  TEST_ASSERT_EQUAL(27, registry[0].pin);
+  TEST_ASSERT_EQUAL(26, registry[1].pin);
+  TEST_ASSERT_EQUAL(DeviceKind::DISPLAY, registry[2].kind);
+  TEST_ASSERT_EQUAL(OUTPUT, fake_modes[27]);
+  TEST_ASSERT_EQUAL(OUTPUT, fake_modes[26]);
+}
+
+static void test_begin_stored_table() {
+  Preferences preferences;
+  MemoryHandler memory(preferences);
+  DeviceRegistry registry;
+  uint8_t count = parse("relay:4:0:high,display:1,relay:13:2");
+  devices[0].state = true;   // Stored states are ignored, every relay starts off
+  memory.putDevices((const uint8_t*)devices, count * sizeof(Device));
+  registry.begin(memory);
+
+  TEST_ASSERT_EQUAL(3, registry.size());
+  TEST_ASSERT_EQUAL(4, registry[0].pin);
+  TEST_ASSERT_FALSE(registry[0].state);
+  TEST_ASSERT_EQUAL(OUTPUT, fake_modes[13]);
+
+  TEST_ASSERT_TRUE(registry.set(0, true));
+  TEST_ASSERT_TRUE(registry[0].state);
+  TEST_ASSERT_FALSE(registry.set(1, true));   // The display has no pin
+  TEST_ASSERT_FALSE(registry.set(3, true));
+  registry.commit();
+}
+
+// A table stored before a pin was reserved keeps its ids, the reserved pin is never driven
+static void test_begin_reserved_pin_disabled() {
+  Preferences preferences;
+  MemoryHandler memory(preferences);
+  DeviceRegistry registry;
+  Device stored[] = {
+    {1, true, 1, DeviceKind::RELAY, false},
+    {27, true, 2, DeviceKind::RELAY, false},
+  };
+  fake_modes[1] = INPUT;
+  memory.putDevices((const uint8_t*)stored, sizeof(stored));
+  registry.begin(memory);
+
+  TEST_ASSERT_EQUAL(2, registry.size());
+  TEST_ASSERT_EQUAL(INPUT, fake_modes[1]);
+  TEST_ASSERT_EQUAL(OUTPUT, fake_modes[27]);
+  TEST_ASSERT_FALSE(registry.set(0, true));
+  TEST_ASSERT_TRUE(registry.set(1, true));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_entries);
+  RUN_TEST(test_parse_empty_entries_skipped);
+  RUN_TEST(test_parse_errors);
+  RUN_TEST(test_parse_reserved_pins);
+  RUN_TEST(test_parse_usable_pins);
+  RUN_TEST(test_begin_legacy_layout);
+  RUN_TEST(test_begin_stored_table);
+  RUN_TEST(test_begin_reserved_pin_disabled);
+  return UNITY_END();
+}
@@ -0,0 +1,119 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the DisplayEngine frame diff on the MD_MAX72XX fake: the columns written and
+ *        the SPI bytes sent for an unchanged frame, a changed one and a scrolling text.
+ */
+#include <unity.h>
+#include <DisplayEngine.h>
+#include <memory>
+#include <string>
+
+#define TEST_DEVICES 4
+#define TEST_FULL_FRAME (8 * 2 * TEST_DEVICES)  // SPI bytes of a frame sent in full
+
+static std::unique_ptr<MD_MAX72XX> matrix;
+static std::unique_ptr<DisplayEngine> display;
+
+// A chain of TEST_DEVICES, cleared by begin() so the counters start from the blank matrix
+static void setup(MD_MAX72XX::moduleType_t type, bool rows) {
+  matrix.reset(new MD_MAX72XX(type, 5, TEST_DEVICES));
+  display.reset(new DisplayEngine(*matrix, TEST_DEVICES, rows));
+  display->begin();
+  TEST_ASSERT_FALSE(matrix->auto_update);
+  TEST_ASSERT_EQUAL(TEST_FULL_FRAME, matrix->spi_bytes);
+  matrix->updates = 0;
+  matrix->writes = 0;
+  matrix->spi_bytes = 0;
+}
+
+void setUp(void) {
+  setup(MD_MAX72XX::GENERIC_HW, false);
+}
+void tearDown(void) {}
+
+static unsigned long metric(const char* name) {
+  FakePrint out;
+  display->metrics(out);
+  std::string line = std::string("\n") + name + " ";
+  const char* found = strstr(out.text.c_str(), line.c_str());
+  TEST_ASSERT_NOT_NULL(found);
+  return strtoul(found + line.size(), nullptr, 10);
+}
+
+static void test_unchanged_frame() {
+  display->show("Hi", DisplayEffect::PRINT);
+  TEST_ASSERT_FALSE(display->tick());
+  TEST_ASSERT_EQUAL(10, matrix->writes);                // Two glyphs, the blank spacing column is unchanged
+  TEST_ASSERT_EQUAL(1, matrix->updates);
+  uint32_t bytes = matrix->spi_bytes;
+
+  // The same text again renders the same frame, nothing is written or sent
+  display->show("Hi", DisplayEffect::PRINT);
+  TEST_ASSERT_FALSE(display->tick());
+  TEST_ASSERT_EQUAL(10, matrix->writes);
+  TEST_ASSERT_EQUAL(1, matrix->updates);
+  TEST_ASSERT_EQUAL(bytes, matrix->spi_bytes);
+  TEST_ASSERT_EQUAL(2, metric("display_frames_total"));
+  TEST_ASSERT_EQUAL(1, metric("display_frames_skipped_total"));
+  TEST_ASSERT_EQUAL(bytes, metric("display_spi_bytes_total"));
+}
+
+// Digits on the columns: only the digit lines of the changed columns are sent
+static void test_changed_frame() {
+  display->show("Hi", DisplayEffect::PRINT);
+  display->tick();
+  uint32_t writes = matrix->writes, bytes = matrix->spi_bytes;
+
+  display->show("Ho", DisplayEffect::PRINT);
+  display->tick();
+  TEST_ASSERT_EQUAL(5, matrix->writes - writes);        // The columns of the second glyph
+  TEST_ASSERT_EQUAL(5 * 2 * TEST_DEVICES, matrix->spi_bytes - bytes);
+  TEST_ASSERT_EQUAL(matrix->spi_bytes - bytes, metric("display_spi_bytes_last"));
+  TEST_ASSERT_EQUAL(matrix->spi_bytes, metric("display_spi_bytes_total"));
+  TEST_ASSERT_EQUAL(matrix->writes, metric("display_columns_total"));
+  TEST_ASSERT_EQUAL('o', matrix->columns[TEST_DEVICES * 8 - 1 - 6]);
+}
+
+// Digits on the rows: a changed device resends all its lines, the SPI bytes of a full frame
+static void test_changed_frame_digit_rows() {
+  setup(MD_MAX72XX::FC16_HW, true);
+  display->show("Hi", DisplayEffect::PRINT);
+  display->tick();
+  uint32_t writes = matrix->writes, bytes = matrix->spi_bytes;
+
+  display->show("Ho", DisplayEffect::PRINT);
+  display->tick();
+  TEST_ASSERT_EQUAL(5, matrix->writes - writes);
+  TEST_ASSERT_EQUAL(TEST_FULL_FRAME, matrix->spi_bytes - bytes);
+  TEST_ASSERT_EQUAL(matrix->spi_bytes - bytes, metric("display_spi_bytes_last"));
+  TEST_ASSERT_EQUAL(matrix->spi_bytes, metric("display_spi_bytes_total"));
+}
+
+// One pass of a scrolling text, against every frame sent in full as MD_Parola does
+static void test_scroll_pass() {
+  const uint16_t text_columns = 12 * 5 + 11;             // "Hello, world", glyphs and spacing
+  const uint16_t pass = text_columns + TEST_DEVICES * 8;
+  display->show("Hello, world", DisplayEffect::SCROLL);
+  for (uint16_t i = 0; i < pass; i++) {
+    TEST_ASSERT_TRUE(display->tick());
+  }
+
+  printf("SPI scroll pass frames=%u columns=%lu bytes=%lu (full frames: columns=%u bytes=%u)\n",
+         pass, (unsigned long)matrix->writes, (unsigned long)matrix->spi_bytes,
+         pass * TEST_DEVICES * 8, pass * TEST_FULL_FRAME);
+  TEST_ASSERT_EQUAL(pass, metric("display_frames_total"));
+  TEST_ASSERT_EQUAL(matrix->writes, metric("display_columns_total"));
+  TEST_ASSERT_EQUAL(matrix->spi_bytes, metric("display_spi_bytes_total"));
+  TEST_ASSERT_EQUAL(matrix->updates, pass - metric("display_frames_skipped_total"));
+  TEST_ASSERT_TRUE(matrix->writes < pass * TEST_DEVICES * 8);
+  TEST_ASSERT_TRUE(matrix->spi_bytes <= pass * TEST_FULL_FRAME);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_unchanged_frame);
+  RUN_TEST(test_changed_frame);
+  RUN_TEST(test_changed_frame_digit_rows);
+  RUN_TEST(test_scroll_pass);
+  return UNITY_END();
+}
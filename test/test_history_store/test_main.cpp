@@ -0,0 +1,408 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the Gorilla page codec and of the HistoryStore segments, index and queries on
+ *        a fake filesystem, with the compression, append cost and query throughput benchmarks.
+ */
+#include <unity.h>
+#include <Bench.h>
+#include <HistoryStore.h>
+#include <math.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define T0 1700000000       ///< A timestamp after HISTORY_TIME_MIN.
+
+static fs::FS flash;
+static std::unique_ptr<HistoryStore> store;
+static std::unique_ptr<AsyncWebServer> server;
+
+void setUp(void) {
+  flash.format();
+  flash.fail_writes = false;
+  fake_ms = 0;
+  store.reset(new HistoryStore(flash));
+  store->begin(true);
+  server.reset(new AsyncWebServer(80));
+  store->serve(*server);
+}
+void tearDown(void) {}
+
+/**
+ * @brief A sample of a test series.
+ */
+struct Point {
+  uint32_t time;
+  float value;
+};
+
+// A DS18B20 in a room: one reading a minute with a little jitter, 0.0625 degree steps
+static std::vector<Point> room_series(size_t count) {
+  std::vector<Point> points;
+  uint32_t seed = 1;
+  float value = 21.0f;
+  uint32_t time = T0;
+  for (size_t i = 0; i < count; i++) {
+    seed = seed * 1103515245 + 12345;
+    if ((seed >> 16) % 4 == 0) {
+      value += ((int)((seed >> 20) % 3) - 1) * 0.0625f;
+    }
+    time += (seed >> 24) % 8 == 0 ? 61 : 60;
+    points.push_back({time, value});
+  }
+  return points;
+}
+
+// Encodes points into a fresh page until it is full, returns the number encoded
+static size_t encode(uint8_t* page, GorillaState& state, const std::vector<Point>& points) {
+  memset(page, 0, HISTORY_PAGE_LEN);
+  state = GorillaState();
+  size_t n = 0;
+  while (n < points.size() && gorilla_append(page, state, points[n].time, points[n].value)) {
+    n++;
+  }
+  return n;
+}
+
+// Decodes a page and checks it matches the first count points bit for bit
+static void assert_decodes(const uint8_t* page, const std::vector<Point>& points, size_t count) {
+  GorillaState state = GorillaState();
+  uint32_t time;
+  float value;
+  for (size_t i = 0; i < count; i++) {
+    TEST_ASSERT_TRUE(gorilla_next(page, state, time, value));
+    TEST_ASSERT_EQUAL_UINT32(points[i].time, time);
+    TEST_ASSERT_EQUAL_MEMORY(&points[i].value, &value, sizeof(float));
+  }
+  TEST_ASSERT_FALSE(gorilla_next(page, state, time, value));
+}
+
+static void test_gorilla_round_trip() {
+  uint8_t page[HISTORY_PAGE_LEN];
+  GorillaState state;
+  std::vector<Point> points = room_series(50);
+  TEST_ASSERT_EQUAL(50, encode(page, state, points));
+  assert_decodes(page, points, 50);
+
+  HistoryPageHeader header;
+  memcpy(&header, page, sizeof(header));
+  TEST_ASSERT_EQUAL(50, header.count);
+  TEST_ASSERT_EQUAL_UINT32(points[0].time, header.first);
+  TEST_ASSERT_EQUAL_UINT32(points[49].time, header.last);
+}
+
+// Intervals chosen so the delta of delta falls on each edge of every bucket
+static void test_gorilla_timestamp_buckets() {
+  static const int32_t dods[] = { 0, -63, 64, -64, 65, -255, 256, -256, 257, -2047, 2048, -2048, 2049,
+                                  100000, -100000, 0, 1, -1 };
+  std::vector<Point> points;
+  uint32_t time = T0;
+  int32_t delta = 200000;
+  points.push_back({time, 1.0f});
+  for (int32_t dod : dods) {
+    delta += dod;
+    time += delta;
+    points.push_back({time, 1.0f});
+  }
+  uint8_t page[HISTORY_PAGE_LEN];
+  GorillaState state;
+  TEST_ASSERT_EQUAL(points.size(), encode(page, state, points));
+  assert_decodes(page, points, points.size());
+
+  // Samples at the same second are kept, a sample older than the last one is refused
+  TEST_ASSERT_TRUE(gorilla_append(page, state, time, 2.0f));
+  points.push_back({time, 2.0f});
+  uint8_t before[HISTORY_PAGE_LEN];
+  memcpy(before, page, sizeof(page));
+  TEST_ASSERT_FALSE(gorilla_append(page, state, time - 1, 3.0f));
+  TEST_ASSERT_EQUAL_MEMORY(before, page, sizeof(page));
+  assert_decodes(page, points, points.size());
+}
+
+static void test_gorilla_values() {
+  static const float values[] = { 21.5f, 21.5f, 21.5625f, 21.5f, -3.25f, 0.0f, -0.0f, 1e30f, -1e-30f,
+                                  INFINITY, -INFINITY, 85.0f, 85.0f, 127.9375f, -55.0f };
+  std::vector<Point> points;
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    points.push_back({T0 + (uint32_t)i * 10, values[i]});
+  }
+  uint32_t nan_bits = 0x7FC00001;  // Payload bits kept as well
+  float nan;
+  memcpy(&nan, &nan_bits, sizeof(nan));
+  points.push_back({T0 + 1000, nan});
+  points.push_back({T0 + 1010, 20.0f});
+
+  uint8_t page[HISTORY_PAGE_LEN];
+  GorillaState state;
+  TEST_ASSERT_EQUAL(points.size(), encode(page, state, points));
+  assert_decodes(page, points, points.size());
+}
+
+// A full page refuses the sample and stays decodable, nothing past its last sample is kept
+static void test_gorilla_page_full() {
+  std::vector<Point> points;
+  uint32_t seed = 7;
+  for (uint32_t i = 0; i < 1000; i++) {
+    seed = seed * 1103515245 + 12345;
+    float value;
+    memcpy(&value, &seed, sizeof(value));   // Random bits, the worst case of the XOR coding
+    if (isnan(value)) value = 1.0f;
+    points.push_back({T0 + i * i, value});
+  }
+  uint8_t page[HISTORY_PAGE_LEN];
+  GorillaState state;
+  size_t count = encode(page, state, points);
+  TEST_ASSERT_GREATER_THAN(1, count);
+  TEST_ASSERT_LESS_THAN(points.size(), count);
+  TEST_ASSERT_LESS_OR_EQUAL(HISTORY_PAGE_BITS, state.bits);
+
+  GorillaState full = state;
+  TEST_ASSERT_FALSE(gorilla_append(page, state, points[count].time, points[count].value));
+  TEST_ASSERT_EQUAL(full.bits, state.bits);
+  TEST_ASSERT_EQUAL(full.count, state.count);
+  assert_decodes(page, points, count);
+}
+
+// A damaged page stops decoding instead of reading past its end
+static void test_gorilla_corrupt_page() {
+  uint8_t page[HISTORY_PAGE_LEN];
+  GorillaState state;
+  std::vector<Point> points = room_series(40);
+  encode(page, state, points);
+
+  HistoryPageHeader header;
+  memcpy(&header, page, sizeof(header));
+  header.count = 60000;
+  memcpy(page, &header, sizeof(header));
+  memset(page + sizeof(header) + 4, 0xFF, HISTORY_PAGE_LEN - sizeof(header) - 4);
+
+  GorillaState read = GorillaState();
+  uint32_t time;
+  float value;
+  size_t decoded = 0;
+  while (gorilla_next(page, read, time, value) && decoded < 60000) {
+    decoded++;
+  }
+  TEST_ASSERT_LESS_THAN(60000, decoded);
+}
+
+static void test_bytes_per_sample() {
+  std::vector<Point> points = room_series(2000);
+  uint8_t page[HISTORY_PAGE_LEN];
+  GorillaState state;
+  size_t total = 0, pages = 0;
+
+  for (size_t start = 0; start < points.size(); pages++) {
+    std::vector<Point> rest(points.begin() + start, points.end());
+    size_t n = encode(page, state, rest);
+    assert_decodes(page, rest, n);
+    start += n;
+    total += n;
+  }
+  double per_sample = (double)pages * HISTORY_PAGE_LEN / total;
+  printf("BENCH %-28s %10.2f bytes/sample %6.1f samples/page\n", "history_room_series", per_sample, (double)total / pages);
+  TEST_ASSERT_LESS_THAN(2.0, per_sample);   // 8 bytes raw, time and float
+}
+
+static void test_bench_append() {
+  std::vector<Point> points = room_series(4096);
+  uint8_t page[HISTORY_PAGE_LEN];
+  GorillaState state = GorillaState();
+  size_t i = 0;
+
+  BenchResult result = bench_run("gorilla_append", 200000, [&]() {
+    const Point& p = points[i++ % points.size()];
+    if (!gorilla_append(page, state, p.time, p.value)) {
+      state = GorillaState();   // Page full or the series wrapped, start the next page
+      gorilla_append(page, state, p.time, p.value);
+    }
+  });
+  TEST_ASSERT_EQUAL_FLOAT(0.0, result.allocs_per_op);
+
+  encode(page, state, points);
+  GorillaState read = GorillaState();
+  result = bench_run("gorilla_next", 200000, [&]() {
+    uint32_t time;
+    float value;
+    if (!gorilla_next(page, read, time, value)) {
+      read = GorillaState();
+    }
+  });
+  TEST_ASSERT_EQUAL_FLOAT(0.0, result.allocs_per_op);
+}
+
+// Records count readings of a series through the queue, as the control loop and network task do
+static void record(uint8_t sensor, const std::vector<Point>& points) {
+  for (size_t i = 0; i < points.size(); i++) {
+    store->record(sensor, points[i].time, points[i].value);
+    if (i % (HISTORY_QUEUE_LEN / 2) == 0) {
+      store->drain();
+    }
+  }
+  store->drain();
+}
+
+// Runs GET /api/history and returns the body
+static std::string query(const char* sensor, const char* from = nullptr, const char* to = nullptr, int* code = nullptr) {
+  AsyncWebServerRequest request("/api/history");
+  request.fakeParam("sensor", sensor);
+  if (from) request.fakeParam("from", from);
+  if (to) request.fakeParam("to", to);
+  TEST_ASSERT_TRUE(server->fakeRequest(request, HTTP_GET));
+  TEST_ASSERT_NOT_NULL(request.response.get());
+  if (code) *code = request.response->code;
+  return request.response->body;
+}
+
+// Parses the points of a response, [[t,v],...]
+static std::vector<Point> parse(const std::string& body) {
+  std::vector<Point> points;
+  const char* p = strstr(body.c_str(), "\"points\":[");
+  TEST_ASSERT_NOT_NULL(p);
+  p += 10;
+  while (*p == '[' || *p == ',') {
+    if (*p == ',') p++;
+    unsigned long time;
+    float value;
+    int used;
+    TEST_ASSERT_EQUAL(2, sscanf(p, "[%lu,%f]%n", &time, &value, &used));
+    points.push_back({(uint32_t)time, value});
+    p += used;
+  }
+  TEST_ASSERT_EQUAL_STRING("]}", p);
+  return points;
+}
+
+static void test_store_query() {
+  std::vector<Point> room = room_series(600);
+  std::vector<Point> other = room_series(30);
+  record(3, room);
+  record(4, other);
+  TEST_ASSERT_GREATER_THAN(0, flash.files.size());    // Full pages reached the flash
+
+  std::vector<Point> got = parse(query("3"));
+  TEST_ASSERT_EQUAL(room.size(), got.size());
+  for (size_t i = 0; i < room.size(); i++) {
+    TEST_ASSERT_EQUAL_UINT32(room[i].time, got[i].time);
+    TEST_ASSERT_EQUAL_FLOAT(room[i].value, got[i].value);
+  }
+
+  // Only the points in the range, both ends included
+  char from[16], to[16];
+  snprintf(from, sizeof(from), "%lu", (unsigned long)room[100].time);
+  snprintf(to, sizeof(to), "%lu", (unsigned long)room[250].time);
+  got = parse(query("3", from, to));
+  TEST_ASSERT_EQUAL(151, got.size());
+  TEST_ASSERT_EQUAL_UINT32(room[100].time, got.front().time);
+  TEST_ASSERT_EQUAL_UINT32(room[250].time, got.back().time);
+
+  TEST_ASSERT_EQUAL(30, parse(query("4")).size());
+  TEST_ASSERT_EQUAL(0, parse(query("5")).size());
+  TEST_ASSERT_EQUAL_STRING("{\"sensor\":5,\"points\":[]}", query("5").c_str());
+
+  int code;
+  query("12", nullptr, nullptr, &code);
+  TEST_ASSERT_EQUAL(400, code);
+  query("x", nullptr, nullptr, &code);
+  TEST_ASSERT_EQUAL(400, code);
+}
+
+static void test_store_ignores_unset_clock() {
+  store->record(0, HISTORY_TIME_MIN - 1, 20.0f);
+  store->record(HISTORY_SERIES, T0, 20.0f);
+  store->drain();
+  TEST_ASSERT_EQUAL(0, parse(query("0")).size());
+}
+
+// A page older than HISTORY_PAGE_AGE is written even if it is not full
+static void test_store_page_age() {
+  record(1, room_series(5));
+  TEST_ASSERT_EQUAL(0, flash.files.size());
+  fake_advance(HISTORY_PAGE_AGE);
+  store->drain();
+  TEST_ASSERT_TRUE(flash.exists("/hs_1"));
+  TEST_ASSERT_EQUAL(HISTORY_PAGE_LEN, flash.files["/hs_1"]->size());
+  TEST_ASSERT_EQUAL(5, parse(query("1")).size());
+}
+
+static void test_store_recovered_after_reboot() {
+  std::vector<Point> room = room_series(600);
+  record(2, room);
+  size_t stored = parse(query("2")).size();
+  TEST_ASSERT_EQUAL(room.size(), stored);
+
+  // The open page is lost with the RAM, the written pages are indexed again
+  store.reset(new HistoryStore(flash));
+  store->begin(true);
+  server.reset(new AsyncWebServer(80));
+  store->serve(*server);
+  std::vector<Point> got = parse(query("2"));
+  TEST_ASSERT_GREATER_THAN(0, got.size());
+  TEST_ASSERT_LESS_THAN(room.size(), got.size());
+  TEST_ASSERT_EQUAL_UINT32(room[0].time, got[0].time);
+  TEST_ASSERT_EQUAL_UINT32(room[got.size() - 1].time, got.back().time);
+}
+
+// When every segment is in use the oldest one is deleted, the query starts at what is left
+static void test_store_full_drops_oldest() {
+  std::vector<Point> points;
+  uint32_t seed = 3;
+  for (uint32_t i = 0; i < 40000; i++) {
+    seed = seed * 1103515245 + 12345;
+    float value;
+    memcpy(&value, &seed, sizeof(value));
+    if (isnan(value)) value = 0.0f;
+    points.push_back({T0 + i * 60, value});
+  }
+  record(0, points);
+  TEST_ASSERT_LESS_OR_EQUAL(HISTORY_SEGMENT_COUNT, flash.files.size());
+  TEST_ASSERT_FALSE(flash.exists("/hs_1"));
+
+  std::vector<Point> got = parse(query("0"));
+  TEST_ASSERT_GREATER_THAN(0, got.size());
+  TEST_ASSERT_LESS_THAN(points.size(), got.size());
+  TEST_ASSERT_EQUAL_UINT32(points.back().time, got.back().time);
+  for (size_t i = 1; i < got.size(); i++) {
+    TEST_ASSERT_EQUAL_UINT32(got[i - 1].time + 60, got[i].time);
+  }
+}
+
+static void test_store_failed_write() {
+  flash.fail_writes = true;
+  record(0, room_series(600));
+  flash.fail_writes = false;
+  FakePrint out;
+  store->metrics(out);
+  TEST_ASSERT_NOT_NULL(strstr(out.text.c_str(), "history_pages_written_total 0\n"));
+  TEST_ASSERT_NULL(strstr(out.text.c_str(), "history_write_errors_total 0\n"));
+}
+
+static void test_bench_query() {
+  std::vector<Point> room = room_series(5000);
+  record(0, room);
+  size_t points = 0;
+  BenchResult result = bench_run("history_query_5000_points", 20, [&]() {
+    points = query("0").size();
+  });
+  TEST_ASSERT_GREATER_THAN(0, points);
+  printf("BENCH %-28s %10.1f ns/point\n", "history_query_point", result.ns_per_op / room.size());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_gorilla_round_trip);
+  RUN_TEST(test_gorilla_timestamp_buckets);
+  RUN_TEST(test_gorilla_values);
+  RUN_TEST(test_gorilla_page_full);
+  RUN_TEST(test_gorilla_corrupt_page);
+  RUN_TEST(test_bytes_per_sample);
+  RUN_TEST(test_bench_append);
+  RUN_TEST(test_store_query);
+  RUN_TEST(test_store_ignores_unset_clock);
+  RUN_TEST(test_store_page_age);
+  RUN_TEST(test_store_recovered_after_reboot);
+  RUN_TEST(test_store_full_drops_oldest);
+  RUN_TEST(test_store_failed_write);
+  RUN_TEST(test_bench_query);
+  return UNITY_END();
+}
@@ -0,0 +1,169 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the LivePush WebSocket channel: the handshake credentials, the fan-out of the
+ *        frames, the per-client backpressure, and the heap taken per connected client with the
+ *        number of clients the free heap holds at a 1 Hz update rate.
+ */
+#include <unity.h>
+#include <LivePush.h>
+#include <memory>
+#include <string>
+
+#define TEST_CLIENT_HEAP 6000   // Heap of one open client in the fake, connection and buffers
+
+static std::unique_ptr<TelemetryQueue> frames;
+static std::unique_ptr<AsyncWebServer> server;
+static std::unique_ptr<LivePush> live;
+static AsyncWebSocket* ws;
+
+void setUp(void) {
+  fake_heap = 200000;
+  fake_ws_client_heap = TEST_CLIENT_HEAP;
+  frames.reset(new TelemetryQueue());
+  server.reset(new AsyncWebServer(80));
+  live.reset(new LivePush(*frames));
+  live->begin(*server, "admin", "secret");
+  ws = static_cast<AsyncWebSocket*>(server->handlers[0]);
+}
+void tearDown(void) {}
+
+static void push(const char* text) {
+  Telemetry frame;
+  frame.topic = 0;
+  frame.length = strlen(text);
+  memcpy(frame.payload, text, frame.length);
+  TEST_ASSERT_TRUE(frames->push(frame));
+}
+
+static std::string metrics() {
+  FakePrint out;
+  live->metrics(out);
+  return out.text;
+}
+
+static void test_credentials_required() {
+  TEST_ASSERT_EQUAL_STRING(LIVE_PATH, ws->url());
+  TEST_ASSERT_NULL(ws->fakeConnect());
+  TEST_ASSERT_NULL(ws->fakeConnect("admin", "wrong"));
+  TEST_ASSERT_FALSE(live->active());
+  TEST_ASSERT_NOT_NULL(ws->fakeConnect("admin", "secret"));
+  TEST_ASSERT_TRUE(live->active());
+}
+
+static void test_fanout() {
+  AsyncWebSocketClient* a = ws->fakeConnect("admin", "secret");
+  AsyncWebSocketClient* b = ws->fakeConnect("admin", "secret");
+  push("{\"t0\":20.5}");
+  push("{\"relay1\":true}");
+  live->drain();
+  TEST_ASSERT_EQUAL(2, a->messages.size());
+  TEST_ASSERT_EQUAL(2, b->messages.size());
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":20.5}", b->messages[0].c_str());
+  TEST_ASSERT_EQUAL_STRING("{\"relay1\":true}", b->messages[1].c_str());
+
+  // A client gone is out of the table before it is destroyed
+  ws->fakeDisconnect(a);
+  push("{\"t0\":20.6}");
+  live->drain();
+  TEST_ASSERT_EQUAL(3, b->messages.size());
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "live_frames_sent_total 5\n"));
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "live_clients 1\n"));
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "live_clients_peak 2\n"));
+}
+
+static void test_table_full() {
+  for (int i = 0; i < LIVE_MAX_CLIENTS; i++) {
+    TEST_ASSERT_EQUAL(WS_CONNECTED, ws->fakeConnect("admin", "secret")->status());
+  }
+  AsyncWebSocketClient* extra = ws->fakeConnect("admin", "secret");
+  TEST_ASSERT_EQUAL(WS_DISCONNECTING, extra->status());   // Closed at once
+  push("{\"t0\":20.5}");
+  live->drain();
+  TEST_ASSERT_EQUAL(0, extra->messages.size());
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "live_clients 4\n"));
+}
+
+static void test_stale_resync() {
+  AsyncWebSocketClient* slow = ws->fakeConnect("admin", "secret");
+  slow->queue_limit = 2;
+  push("{\"t0\":1}");
+  push("{\"t0\":2}");
+  push("{\"t0\":3}");
+  live->drain();
+  TEST_ASSERT_EQUAL(2, slow->messages.size());            // The third frame is dropped, not queued
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "live_frames_dropped_total 1\n"));
+
+  slow->messages.clear();
+  push("{\"t0\":4}");
+  live->drain();
+  TEST_ASSERT_EQUAL(2, slow->messages.size());
+  TEST_ASSERT_EQUAL_STRING("{\"resync\":true}", slow->messages[0].c_str());
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":4}", slow->messages[1].c_str());
+}
+
+// The estimate of /metrics against the heap the fake takes per client: it is measured from the
+// baseline drain() sees while nobody is connected, and bounds the clients the heap still holds
+static void test_heap_per_client() {
+  fake_heap = 60000;
+  live->drain();                                          // Idle baseline
+  ws->fakeConnect("admin", "secret");
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "live_heap_per_client_bytes 6000\n"));
+  ws->fakeConnect("admin", "secret");
+  ws->fakeConnect("admin", "secret");
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "live_heap_per_client_bytes 6000\n"));
+
+  // 42000 B free, 32768 B of them kept for the firmware: one more client fits
+  TEST_ASSERT_EQUAL(42000, ESP.getFreeHeap());
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "live_clients_capacity 4\n"));
+  fake_heap -= 4000;                                      // Taken by the rest of the firmware
+  TEST_ASSERT_NOT_NULL(strstr(metrics().c_str(), "live_clients_capacity 3\n"));
+}
+
+// Ten minutes of 1 Hz frames to a full table, one of the clients reading its socket every 10 s
+// only. The queues stay bounded, so a client holds at most its connection and
+// WS_MAX_QUEUED_MESSAGES frames however slow it is.
+static void test_clients_at_1hz() {
+  AsyncWebSocketClient* table[LIVE_MAX_CLIENTS];
+  size_t queued_max = 0;
+  char text[QUEUE_PAYLOAD_LEN];
+
+  live->drain();
+  for (int i = 0; i < LIVE_MAX_CLIENTS; i++) {
+    table[i] = ws->fakeConnect("admin", "secret");
+  }
+  for (uint32_t second = 0; second < 600; second++) {
+    snprintf(text, sizeof(text), "{\"t0\":%lu,\"t1\":%lu,\"relay1\":true}", (unsigned long)second, (unsigned long)second);
+    push(text);
+    live->drain();
+    for (int i = 0; i < LIVE_MAX_CLIENTS; i++) {
+      queued_max = table[i]->messages.size() > queued_max ? table[i]->messages.size() : queued_max;
+      if (i > 0 || second % 10 == 9) {
+        table[i]->messages.clear();                       // Read by the client
+      }
+    }
+  }
+
+  std::string text_metrics = metrics();
+  unsigned long sent = 0, dropped = 0;
+  sscanf(strstr(text_metrics.c_str(), "\nlive_frames_sent_total "), "\nlive_frames_sent_total %lu", &sent);
+  sscanf(strstr(text_metrics.c_str(), "\nlive_frames_dropped_total "), "\nlive_frames_dropped_total %lu", &dropped);
+  printf("HEAP per_client=%u B (+%u B of queued frames at most), clients=%u, sent=%lu, dropped=%lu\n",
+         (unsigned)TEST_CLIENT_HEAP, (unsigned)(WS_MAX_QUEUED_MESSAGES * QUEUE_PAYLOAD_LEN),
+         (unsigned)LIVE_MAX_CLIENTS, sent, dropped);
+  TEST_ASSERT_EQUAL(WS_MAX_QUEUED_MESSAGES, queued_max);
+  TEST_ASSERT_EQUAL(3 * 600 + 600 - dropped, sent);         // The fast clients miss nothing
+  // The slow one misses the frames past its queue, one more after the first read for the resync
+  TEST_ASSERT_EQUAL((10 - WS_MAX_QUEUED_MESSAGES) + 59 * (10 - WS_MAX_QUEUED_MESSAGES + 1), dropped);
+  TEST_ASSERT_NOT_NULL(strstr(text_metrics.c_str(), "live_heap_per_client_bytes 6000\n"));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_credentials_required);
+  RUN_TEST(test_fanout);
+  RUN_TEST(test_table_full);
+  RUN_TEST(test_stale_resync);
+  RUN_TEST(test_heap_per_client);
+  RUN_TEST(test_clients_at_1hz);
+  return UNITY_END();
+}
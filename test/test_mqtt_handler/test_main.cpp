@@ -0,0 +1,185 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the MqttHandler connection state machine on the PubSubClient fake: waiting for
+ *        the network, the reconnect backoff, a polled attempt and the backlog after a reconnect.
+ */
+#include <unity.h>
+#include <MemoryHandler.h>
+#include <MqttHandler.h>
+#include <memory>
+#include <vector>
+
+#define TEST_TOPICS "home/node1/telemetry:home/node1/relay1"
+#define TEST_STEP 10    // Polling period of mqtt_loop() in milliseconds
+
+static Preferences prefs;
+static MemoryHandler memory(prefs);
+static NodeConfig config;
+static fs::FS flash;
+static std::unique_ptr<TopicTable> topics;
+static std::unique_ptr<DeviceRegistry> registry;
+static std::unique_ptr<PublishQueue> pending;
+static std::unique_ptr<CommandQueue> commands;
+static std::unique_ptr<TelemetryQueue> telemetry;
+static std::unique_ptr<PubSubClient> client;
+static std::unique_ptr<MqttHandler> mqtt;
+
+void setUp(void) {
+  fake_nvs.clear();
+  flash.format();
+  fake_ms = 0;
+  fake_wifi_status = WL_CONNECTED;
+  memory.writeCredentials("test", "wifi-pass", "192.168.1.10:1883", "user", "broker-pass", false, TEST_TOPICS);
+  TEST_ASSERT_TRUE(memory.loadConfig(config));
+  topics.reset(new TopicTable());
+  topics->load(config.record);
+  registry.reset(new DeviceRegistry());
+  registry->begin(memory);
+  pending.reset(new PublishQueue(flash));
+  pending->begin(true);
+  commands.reset(new CommandQueue());
+  telemetry.reset(new TelemetryQueue());
+  client.reset(new PubSubClient());
+  mqtt.reset(new MqttHandler(*client, *registry, *pending, *commands, *telemetry, *topics, config.broker));
+  mqtt->mqtt_setup();
+}
+void tearDown(void) {}
+
+// Polls mqtt_loop() every TEST_STEP ms until a connect attempt is made, returns the time waited
+static uint32_t next_attempt(uint32_t limit = 2 * MQTT_BACKOFF_MAX) {
+  uint32_t start = millis();
+  uint32_t connects = client->connects;
+  while (client->connects == connects) {
+    TEST_ASSERT_TRUE(millis() - start <= limit);
+    fake_advance(TEST_STEP);
+    mqtt->mqtt_loop();
+  }
+  return millis() - start;
+}
+
+static void test_waits_for_network() {
+  fake_wifi_status = WL_DISCONNECTED;
+  for (int i = 0; i < 100; i++) {
+    fake_advance(1000);
+    mqtt->mqtt_loop();
+  }
+  TEST_ASSERT_EQUAL(0, client->connects);
+
+  // The first attempt is made on the call which sees the network, not one backoff later
+  fake_wifi_status = WL_CONNECTED;
+  mqtt->mqtt_loop();
+  TEST_ASSERT_EQUAL(1, client->connects);
+  TEST_ASSERT_TRUE(mqtt->mqtt_connected());
+  TEST_ASSERT_EQUAL(2, client->subscribed.size());
+}
+
+static void test_backoff_doubles_and_caps() {
+  client->refuse_connect = true;
+  mqtt->mqtt_loop();
+  TEST_ASSERT_EQUAL(1, client->connects);
+  TEST_ASSERT_FALSE(mqtt->mqtt_connected());
+
+  // The delay is drawn from [backoff / 2, backoff], the backoff doubles up to MQTT_BACKOFF_MAX
+  std::vector<uint32_t> waits;
+  uint32_t backoff = MQTT_BACKOFF_MIN;
+  for (int i = 0; i < 10; i++) {
+    uint32_t wait = next_attempt();
+    TEST_ASSERT_TRUE(wait >= backoff / 2);
+    TEST_ASSERT_TRUE(wait <= backoff + TEST_STEP);
+    waits.push_back(wait);
+    backoff = backoff * 2 > MQTT_BACKOFF_MAX ? MQTT_BACKOFF_MAX : backoff * 2;
+  }
+  TEST_ASSERT_TRUE(waits[2] > waits[0]);                // 2..4 s against 0.5..1 s
+  TEST_ASSERT_TRUE(waits[4] > waits[2]);                // 8..16 s against 2..4 s
+  for (int i = 6; i < 10; i++) {
+    TEST_ASSERT_TRUE(waits[i] >= MQTT_BACKOFF_MAX / 2);     // Capped, not doubling any further
+  }
+
+  // A successful attempt resets the backoff
+  client->refuse_connect = false;
+  next_attempt();
+  TEST_ASSERT_TRUE(mqtt->mqtt_connected());
+  client->refuse_connect = true;
+  client->disconnect();
+  mqtt->mqtt_loop();                                    // Loss noticed, waiting for the network
+  TEST_ASSERT_FALSE(mqtt->mqtt_connected());
+  TEST_ASSERT_TRUE(next_attempt() <= TEST_STEP);        // The first reconnect is not delayed
+  TEST_ASSERT_TRUE(next_attempt() <= MQTT_BACKOFF_MIN + TEST_STEP);
+}
+
+static void test_network_lost_in_backoff() {
+  client->refuse_connect = true;
+  mqtt->mqtt_loop();
+  fake_wifi_status = WL_DISCONNECTED;
+  mqtt->mqtt_loop();
+  for (int i = 0; i < 100; i++) {
+    fake_advance(1000);
+    mqtt->mqtt_loop();
+  }
+  TEST_ASSERT_EQUAL(1, client->connects);
+
+  // Back on the network the attempt is due already
+  client->refuse_connect = false;
+  fake_wifi_status = WL_CONNECTED;
+  mqtt->mqtt_loop();
+  TEST_ASSERT_EQUAL(2, client->connects);
+  TEST_ASSERT_TRUE(mqtt->mqtt_connected());
+}
+
+static void test_connecting_polled() {
+  client->connect_pending = 2;
+  mqtt->mqtt_loop();
+  TEST_ASSERT_EQUAL(1, client->connects);
+  TEST_ASSERT_FALSE(mqtt->mqtt_connected());
+
+  // Waiting for the CONNACK is not a failure, the attempt is polled without a backoff
+  mqtt->mqtt_loop();
+  TEST_ASSERT_EQUAL(2, client->connects);
+  mqtt->mqtt_loop();
+  TEST_ASSERT_EQUAL(3, client->connects);
+  TEST_ASSERT_TRUE(mqtt->mqtt_connected());
+  TEST_ASSERT_EQUAL(2, client->subscribed.size());
+  TEST_ASSERT_EQUAL(0, millis());
+}
+
+static void test_backlog_after_reconnect() {
+  fake_wifi_status = WL_DISCONNECTED;
+  char payload[16];
+  for (int i = 0; i < 6; i++) {
+    int len = snprintf(payload, sizeof(payload), "t0=%d", 20 + i);
+    mqtt->mqtt_send_telemetry(payload, len);
+    mqtt->mqtt_loop();
+  }
+  TEST_ASSERT_EQUAL(6, pending->depth());
+
+  // Drained in order, QUEUE_DRAIN_BURST per call, each stamped with the time it was queued
+  fake_wifi_status = WL_CONNECTED;
+  mqtt->mqtt_loop();
+  TEST_ASSERT_TRUE(mqtt->mqtt_connected());
+  TEST_ASSERT_EQUAL(0, client->published.size());
+  mqtt->mqtt_loop();
+  TEST_ASSERT_EQUAL(QUEUE_DRAIN_BURST, client->published.size());
+  mqtt->mqtt_loop();
+  TEST_ASSERT_EQUAL(6, client->published.size());
+  TEST_ASSERT_TRUE(pending->empty());
+  for (int i = 0; i < 6; i++) {
+    snprintf(payload, sizeof(payload), "t0=%d,ts=", 20 + i);
+    TEST_ASSERT_EQUAL_STRING("home/node1/telemetry", client->published[i].topic.c_str());
+    TEST_ASSERT_EQUAL(0, client->published[i].payload.compare(0, strlen(payload), payload));
+  }
+
+  // Once the backlog is gone, publishes go out at once and unstamped
+  mqtt->mqtt_send_telemetry("t0=30", 5);
+  mqtt->mqtt_loop();
+  TEST_ASSERT_EQUAL_STRING("t0=30", client->published.back().payload.c_str());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_waits_for_network);
+  RUN_TEST(test_backoff_doubles_and_caps);
+  RUN_TEST(test_network_lost_in_backoff);
+  RUN_TEST(test_connecting_polled);
+  RUN_TEST(test_backlog_after_reconnect);
+  return UNITY_END();
+}
@@ -0,0 +1,336 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of PayloadCodec: fields written by PayloadWriter are decoded back by minimal
+ *        readers of the three encodings, and the command readers are checked on valid and
+ *        malformed payloads.
+ */
+#include <unity.h>
+#include <PayloadCodec.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FIELDS_MAX 16
+
+/**
+ * @brief A decoded field.
+ */
+struct Field {
+    char name[CODEC_NAME_MAX + 1];
+    float value;
+};
+
+// name=value,name=value
+static int decode_text(const uint8_t* p, size_t len, Field* out) {
+  char text[256];
+  memcpy(text, p, len);
+  text[len] = '\0';
+  int n = 0;
+  for (char* item = strtok(text, ","); item != nullptr; item = strtok(nullptr, ",")) {
+    char* eq = strchr(item, '=');
+    if (eq == nullptr) return -1;
+    *eq = '\0';
+    strcpy(out[n].name, item);
+    out[n++].value = strcmp(eq + 1, "nan") == 0 ? NAN : strtof(eq + 1, nullptr);
+  }
+  return n;
+}
+
+// {"name":value,...}, values are numbers or null
+static int decode_json(const uint8_t* p, size_t len, Field* out) {
+  if (len < 2 || p[0] != '{' || p[len - 1] != '}') return -1;
+  int n = 0;
+  size_t i = 1;
+  while (i < len - 1) {
+    if (p[i] != '"') return -1;
+    size_t end = i + 1;
+    while (end < len && p[end] != '"') end++;
+    memcpy(out[n].name, p + i + 1, end - i - 1);
+    out[n].name[end - i - 1] = '\0';
+    if (p[end + 1] != ':') return -1;
+    i = end + 2;
+    char value[32];
+    size_t v = 0;
+    while (i < len - 1 && p[i] != ',') value[v++] = p[i++];
+    value[v] = '\0';
+    out[n++].value = strcmp(value, "null") == 0 ? NAN : strtof(value, nullptr);
+    if (p[i] == ',') i++;
+  }
+  return n;
+}
+
+static uint32_t cbor_arg(const uint8_t*& p) {
+  uint8_t info = *p++ & 0x1F;
+  uint32_t v = 0;
+  if (info < 24) return info;
+  int bytes = info == 24 ? 1 : info == 25 ? 2 : 4;
+  while (bytes--) v = (v << 8) | *p++;
+  return v;
+}
+
+// Indefinite-length map of text keys to integers or float32
+static int decode_cbor(const uint8_t* p, size_t len, Field* out) {
+  const uint8_t* end = p + len;
+  if (len < 2 || *p++ != 0xBF || end[-1] != 0xFF) return -1;
+  int n = 0;
+  while (p < end - 1) {
+    if ((*p & 0xE0) != 0x60) return -1;
+    uint32_t name_len = cbor_arg(p);
+    memcpy(out[n].name, p, name_len);
+    out[n].name[name_len] = '\0';
+    p += name_len;
+    uint8_t major = *p >> 5;
+    if (*p == 0xFA) {
+      uint32_t bits = (p[1] << 24) | (p[2] << 16) | (p[3] << 8) | p[4];
+      memcpy(&out[n].value, &bits, sizeof(bits));
+      p += 5;
+    } else if (major == 0) {
+      out[n].value = (float)cbor_arg(p);
+    } else if (major == 1) {
+      out[n].value = -1.0f - (float)cbor_arg(p);
+    } else {
+      return -1;
+    }
+    n++;
+  }
+  return n;
+}
+
+static int decode(Codec codec, const uint8_t* p, size_t len, Field* out) {
+  switch (codec) {
+    case Codec::TEXT: return decode_text(p, len, out);
+    case Codec::JSON: return decode_json(p, len, out);
+    default: return decode_cbor(p, len, out);
+  }
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void test_format_fixed() {
+  struct { float value; uint8_t decimals; const char* text; } cases[] = {
+    {21.4375f, 2, "21.44"}, {-0.5f, 1, "-0.5"}, {-0.04f, 1, "0.0"}, {0.0f, 0, "0"},
+    {7.0f, 3, "7.000"}, {-1234.5f, 0, "-1235"}, {0.0625f, 4, "0.0625"}, {1.5f, 9, "1.5000"},
+    {NAN, 2, "nan"}, {3e9f, 0, "nan"}, {-3e7f, 2, "nan"},
+  };
+  for (auto& c : cases) {
+    char out[16];
+    size_t n = PayloadWriter::formatFixed(out, c.value, c.decimals);
+    out[n] = '\0';
+    TEST_ASSERT_EQUAL_STRING(c.text, out);
+  }
+}
+
+static void round_trip(Codec codec) {
+  static const struct { const char* name; float value; uint8_t decimals; } fields[] = {
+    {"t0", 21.4375f, 2}, {"t1", -3.5f, 1}, {"cnt", 0.0f, 0}, {"big", 70000.0f, 0},
+    {"neg", -300.0f, 0}, {"b", 23.0f, 0}, {"c", 24.0f, 0}, {"d", 255.0f, 0}, {"e", 256.0f, 0},
+    {"hum", 48.25f, 1}, {"p", 1013.2534f, 4},
+  };
+  const size_t count = sizeof(fields) / sizeof(fields[0]);
+  uint8_t payload[256];
+  PayloadWriter writer(codec, payload, sizeof(payload));
+
+  for (auto& f : fields) {
+    TEST_ASSERT_TRUE(writer.number(f.name, f.value, f.decimals));
+  }
+  TEST_ASSERT_EQUAL(count, writer.count());
+  size_t len = writer.finish();
+
+  Field out[FIELDS_MAX];
+  TEST_ASSERT_EQUAL(count, decode(codec, payload, len, out));
+  for (size_t i = 0; i < count; i++) {
+    TEST_ASSERT_EQUAL_STRING(fields[i].name, out[i].name);
+    // Text encodings are rounded to the decimals, CBOR floats are exact
+    float tolerance = codec == Codec::CBOR ? 0.0f : 0.5f / powf(10, fields[i].decimals) + 1e-4f;
+    if (codec == Codec::CBOR && fields[i].decimals == 0) tolerance = 0.5f;
+    TEST_ASSERT_FLOAT_WITHIN(tolerance, fields[i].value, out[i].value);
+  }
+}
+
+static void test_round_trip_text() { round_trip(Codec::TEXT); }
+static void test_round_trip_json() { round_trip(Codec::JSON); }
+static void test_round_trip_cbor() { round_trip(Codec::CBOR); }
+
+static void test_nan_per_codec() {
+  uint8_t payload[64];
+  Field out[FIELDS_MAX];
+  Codec codecs[] = {Codec::TEXT, Codec::JSON, Codec::CBOR};
+
+  for (Codec codec : codecs) {
+    PayloadWriter writer(codec, payload, sizeof(payload));
+    TEST_ASSERT_TRUE(writer.number("lost", NAN, 2));
+    size_t len = writer.finish();
+    TEST_ASSERT_EQUAL(1, decode(codec, payload, len, out));
+    TEST_ASSERT_FLOAT_IS_NAN(out[0].value);
+  }
+  PayloadWriter json(Codec::JSON, payload, sizeof(payload));
+  json.number("lost", NAN, 2);
+  size_t len = json.finish();
+  TEST_ASSERT_EQUAL_STRING_LEN("{\"lost\":null}", (const char*)payload, len);
+}
+
+static void test_long_name_truncated() {
+  uint8_t payload[128];
+  Field out[FIELDS_MAX];
+  PayloadWriter writer(Codec::CBOR, payload, sizeof(payload));
+  TEST_ASSERT_TRUE(writer.number("a_name_longer_than_the_limit", 1.0f, 0));
+  size_t len = writer.finish();
+  TEST_ASSERT_EQUAL(1, decode(Codec::CBOR, payload, len, out));
+  TEST_ASSERT_EQUAL(CODEC_NAME_MAX, strlen(out[0].name));
+}
+
+// A field which does not fit leaves the buffer as it was and the payload stays well-formed
+static void test_full_buffer() {
+  Codec codecs[] = {Codec::TEXT, Codec::JSON, Codec::CBOR};
+
+  for (Codec codec : codecs) {
+    uint8_t payload[24];
+    Field out[FIELDS_MAX];
+    PayloadWriter writer(codec, payload, sizeof(payload));
+    int written = 0;
+    while (writer.fits("temp", 12.5f, 1)) {
+      TEST_ASSERT_TRUE(writer.number("temp", 12.5f, 1));
+      written++;
+    }
+    TEST_ASSERT_GREATER_THAN(0, written);
+    TEST_ASSERT_FALSE(writer.number("temp", 12.5f, 1));
+    size_t len = writer.finish();
+    TEST_ASSERT_LESS_OR_EQUAL(sizeof(payload), len);
+    TEST_ASSERT_EQUAL(written, decode(codec, payload, len, out));
+  }
+}
+
+static void test_empty_payload() {
+  uint8_t payload[16];
+  PayloadWriter writer(Codec::JSON, payload, sizeof(payload));
+  TEST_ASSERT_EQUAL(0, writer.finish());
+}
+
+// The time is appended as an exact integer, the payload stays well-formed
+static void test_stamp() {
+  Codec codecs[] = {Codec::TEXT, Codec::JSON, Codec::CBOR};
+  const uint32_t time = 1700000123;
+
+  for (Codec codec : codecs) {
+    uint8_t payload[48];
+    Field out[FIELDS_MAX];
+    PayloadWriter writer(codec, payload, sizeof(payload));
+    TEST_ASSERT_TRUE(writer.number("t0", 21.5f, 1));
+    size_t len = codec_stamp(codec, payload, writer.finish(), sizeof(payload), time);
+    TEST_ASSERT_EQUAL(2, decode(codec, payload, len, out));
+    TEST_ASSERT_EQUAL_STRING(CODEC_TIME_FIELD, out[1].name);
+    TEST_ASSERT_EQUAL_FLOAT(21.5f, out[0].value);
+  }
+
+  uint8_t json[32];
+  PayloadWriter writer(Codec::JSON, json, sizeof(json));
+  writer.number("t0", 21.5f, 1);
+  size_t len = codec_stamp(Codec::JSON, json, writer.finish(), sizeof(json), time);
+  TEST_ASSERT_EQUAL_STRING_LEN("{\"t0\":21.5,\"ts\":1700000123}", (const char*)json, len);
+
+  uint8_t cbor[16];
+  PayloadWriter packed(Codec::CBOR, cbor, sizeof(cbor));
+  packed.number("t0", 21, 0);
+  len = codec_stamp(Codec::CBOR, cbor, packed.finish(), sizeof(cbor), time);
+  const uint8_t expected[] = {0xBF, 0x62, 't', '0', 0x15, 0x62, 't', 's', 0x1A, 0x65, 0x53, 0xF1, 0x7B, 0xFF};
+  TEST_ASSERT_EQUAL(sizeof(expected), len);
+  TEST_ASSERT_EQUAL_MEMORY(expected, cbor, len);
+
+  // A field which does not fit and a payload which is not a field list are left as they are
+  TEST_ASSERT_EQUAL(14, codec_stamp(Codec::CBOR, cbor, 14, 16, time));
+  TEST_ASSERT_EQUAL_MEMORY(expected, cbor, len);
+  uint8_t scalar[16] = {'t', 'r', 'u', 'e'};
+  TEST_ASSERT_EQUAL(4, codec_stamp(Codec::JSON, scalar, 4, sizeof(scalar), time));
+  TEST_ASSERT_EQUAL(0, codec_stamp(Codec::TEXT, scalar, 0, sizeof(scalar), time));
+}
+
+static void test_codec_parse() {
+  Codec codec = Codec::TEXT;
+  TEST_ASSERT_TRUE(codec_parse("CBOR", 4, codec));
+  TEST_ASSERT_EQUAL(Codec::CBOR, codec);
+  TEST_ASSERT_TRUE(codec_parse("json", 4, codec));
+  TEST_ASSERT_EQUAL(Codec::JSON, codec);
+  TEST_ASSERT_TRUE(codec_parse("text:json", 4, codec));  // Not NUL-terminated, as in a list
+  TEST_ASSERT_EQUAL(Codec::TEXT, codec);
+  TEST_ASSERT_FALSE(codec_parse("msgpack", 7, codec));
+  TEST_ASSERT_FALSE(codec_parse("jso", 3, codec));
+}
+
+static bool read_switch(Codec codec, const void* payload, size_t len, bool& on) {
+  return codec_read_switch(codec, (const uint8_t*)payload, len, on);
+}
+
+static void test_read_switch() {
+  bool on = false;
+  TEST_ASSERT_TRUE(read_switch(Codec::TEXT, "on", 2, on));
+  TEST_ASSERT_TRUE(on);
+  TEST_ASSERT_TRUE(read_switch(Codec::TEXT, "off", 3, on));
+  TEST_ASSERT_FALSE(on);
+  TEST_ASSERT_FALSE(read_switch(Codec::TEXT, "ON", 2, on));
+  TEST_ASSERT_FALSE(read_switch(Codec::TEXT, "on ", 3, on));
+
+  TEST_ASSERT_TRUE(read_switch(Codec::JSON, " true\n", 6, on));
+  TEST_ASSERT_TRUE(on);
+  TEST_ASSERT_TRUE(read_switch(Codec::JSON, "\"off\"", 5, on));
+  TEST_ASSERT_FALSE(on);
+  TEST_ASSERT_TRUE(read_switch(Codec::JSON, "1", 1, on));
+  TEST_ASSERT_TRUE(on);
+  TEST_ASSERT_FALSE(read_switch(Codec::JSON, "on", 2, on));
+  TEST_ASSERT_FALSE(read_switch(Codec::JSON, "", 0, on));
+
+  const uint8_t cbor_true[] = {0xF5}, cbor_zero[] = {0x00}, cbor_on[] = {0x62, 'o', 'n'}, cbor_map[] = {0xA0};
+  TEST_ASSERT_TRUE(read_switch(Codec::CBOR, cbor_true, 1, on));
+  TEST_ASSERT_TRUE(on);
+  TEST_ASSERT_TRUE(read_switch(Codec::CBOR, cbor_zero, 1, on));
+  TEST_ASSERT_FALSE(on);
+  TEST_ASSERT_TRUE(read_switch(Codec::CBOR, cbor_on, 3, on));
+  TEST_ASSERT_TRUE(on);
+  TEST_ASSERT_FALSE(read_switch(Codec::CBOR, cbor_map, 1, on));
+  TEST_ASSERT_FALSE(read_switch(Codec::CBOR, cbor_on, 0, on));
+}
+
+static void test_read_text() {
+  char out[8];
+  const char* json = " \"say \\\"hi\\\"\" ";
+  TEST_ASSERT_TRUE(codec_read_text(Codec::JSON, (const uint8_t*)json, strlen(json), out, sizeof(out)));
+  TEST_ASSERT_EQUAL_STRING("say \"hi", out);  // Unescaped and truncated to the buffer
+  TEST_ASSERT_FALSE(codec_read_text(Codec::JSON, (const uint8_t*)"hello", 5, out, sizeof(out)));
+
+  TEST_ASSERT_TRUE(codec_read_text(Codec::TEXT, (const uint8_t*)"hello world", 11, out, sizeof(out)));
+  TEST_ASSERT_EQUAL_STRING("hello w", out);
+
+  const uint8_t short_text[] = {0x65, 'h', 'e', 'l', 'l', 'o'};
+  TEST_ASSERT_TRUE(codec_read_text(Codec::CBOR, short_text, sizeof(short_text), out, sizeof(out)));
+  TEST_ASSERT_EQUAL_STRING("hello", out);
+
+  uint8_t long_text[2 + 30];
+  long_text[0] = 0x78;  // One-byte length follows
+  long_text[1] = 30;
+  memset(long_text + 2, 'x', 30);
+  char wide[40];
+  TEST_ASSERT_TRUE(codec_read_text(Codec::CBOR, long_text, sizeof(long_text), wide, sizeof(wide)));
+  TEST_ASSERT_EQUAL(30, strlen(wide));
+  TEST_ASSERT_FALSE(codec_read_text(Codec::CBOR, long_text, 20, wide, sizeof(wide)));  // Cut short
+
+  const uint8_t indefinite[] = {0x7F, 0x61, 'a', 0xFF}, number[] = {0x18, 0x20};
+  TEST_ASSERT_FALSE(codec_read_text(Codec::CBOR, indefinite, sizeof(indefinite), out, sizeof(out)));
+  TEST_ASSERT_FALSE(codec_read_text(Codec::CBOR, number, sizeof(number), out, sizeof(out)));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_format_fixed);
+  RUN_TEST(test_round_trip_text);
+  RUN_TEST(test_round_trip_json);
+  RUN_TEST(test_round_trip_cbor);
+  RUN_TEST(test_nan_per_codec);
+  RUN_TEST(test_long_name_truncated);
+  RUN_TEST(test_full_buffer);
+  RUN_TEST(test_empty_payload);
+  RUN_TEST(test_stamp);
+  RUN_TEST(test_codec_parse);
+  RUN_TEST(test_read_switch);
+  RUN_TEST(test_read_text);
+  return UNITY_END();
+}
@@ -0,0 +1,238 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the PublishQueue ring, its spill log on a fake filesystem, the recovery of the
+ *        log after a reboot and the drop accounting when RAM and flash are full.
+ */
+#include <unity.h>
+#include <PublishQueue.h>
+#include <memory>
+#include <string>
+
+static fs::FS flash;
+static std::unique_ptr<PublishQueue> queue;
+
+void setUp(void) {
+  flash.format();
+  flash.fail_writes = false;
+  queue.reset(new PublishQueue(flash));
+  queue->begin(true);
+}
+void tearDown(void) {}
+
+// Queues entries first to first + count - 1, the payload is the decimal number, the timestamp
+// the number of seconds after QUEUE_CLOCK_SET
+static void push_range(int first, int count) {
+  char payload[16];
+  for (int i = first; i < first + count; i++) {
+    int len = snprintf(payload, sizeof(payload), "%d", i);
+    queue->push(i % 4, payload, len, QUEUE_CLOCK_SET + i);
+  }
+}
+
+// Drains count entries and checks they are first, first + 1... in order
+static void drain_range(int first, int count) {
+  PendingPublish entry;
+  char expected[16];
+  for (int i = first; i < first + count; i++) {
+    TEST_ASSERT_TRUE(queue->front(entry));
+    int len = snprintf(expected, sizeof(expected), "%d", i);
+    TEST_ASSERT_EQUAL(len, entry.length);
+    TEST_ASSERT_EQUAL_STRING_LEN(expected, entry.payload, len);
+    TEST_ASSERT_EQUAL(i % 4, entry.topic);
+    TEST_ASSERT_EQUAL(QUEUE_CLOCK_SET + i, entry.timestamp);   // Also kept through the log
+    queue->pop();
+  }
+}
+
+// Number of segment files in the flash
+static size_t segments() {
+  size_t count = 0;
+  for (const auto& file : flash.files) {
+    count += file.first.compare(0, 5, "/pq3_") == 0;
+  }
+  return count;
+}
+
+static void test_ring_only() {
+  PendingPublish entry;
+  TEST_ASSERT_TRUE(queue->empty());
+  TEST_ASSERT_FALSE(queue->front(entry));
+
+  push_range(0, QUEUE_CAPACITY);
+  TEST_ASSERT_EQUAL(QUEUE_CAPACITY, queue->depth());
+  TEST_ASSERT_EQUAL(0, flash.files.size());     // Nothing reaches the flash while the ring has room
+  drain_range(0, QUEUE_CAPACITY);
+  TEST_ASSERT_TRUE(queue->empty());
+  TEST_ASSERT_EQUAL(QUEUE_CAPACITY, queue->drainCount());
+
+  queue->pop();                                 // Popping an empty queue is harmless
+  TEST_ASSERT_EQUAL(QUEUE_CAPACITY, queue->drainCount());
+}
+
+static void test_payload_truncated() {
+  std::string payload(QUEUE_PAYLOAD_LEN + 20, 'p');
+  PendingPublish entry;
+  queue->push(1, payload.c_str(), payload.size(), 0);
+  TEST_ASSERT_TRUE(queue->front(entry));
+  TEST_ASSERT_EQUAL(QUEUE_PAYLOAD_LEN, entry.length);
+}
+
+static void test_spill_and_drain_in_order() {
+  push_range(0, QUEUE_CAPACITY + 1);
+  TEST_ASSERT_EQUAL(1, segments());
+  TEST_ASSERT_EQUAL(QUEUE_SPILL_BATCH * sizeof(PendingPublish), flash.files["/pq3_1"]->size());
+  TEST_ASSERT_EQUAL(QUEUE_CAPACITY + 1, queue->depth());
+
+  // Further spills append to the same segment until it is full
+  push_range(QUEUE_CAPACITY + 1, 3 * QUEUE_SPILL_BATCH);
+  TEST_ASSERT_EQUAL(1, segments());
+  TEST_ASSERT_EQUAL(4 * QUEUE_SPILL_BATCH * sizeof(PendingPublish), flash.files["/pq3_1"]->size());
+
+  // Entries pushed while draining queue up behind the older ones
+  int total = QUEUE_CAPACITY + 1 + 3 * QUEUE_SPILL_BATCH;
+  drain_range(0, 5);
+  push_range(total, 10);
+  drain_range(5, total + 5);
+  TEST_ASSERT_TRUE(queue->empty());
+  TEST_ASSERT_EQUAL(0, segments());             // Drained segments are deleted
+  TEST_ASSERT_EQUAL(0, queue->dropCount());
+}
+
+static void test_segments_rotate() {
+  int total = QUEUE_CAPACITY + 2 * QUEUE_SEGMENT_RECORDS;
+  push_range(0, total);
+  TEST_ASSERT_EQUAL(2, segments());
+  TEST_ASSERT_TRUE(flash.exists("/pq3_1"));
+  TEST_ASSERT_TRUE(flash.exists("/pq3_2"));
+
+  drain_range(0, QUEUE_SEGMENT_RECORDS);
+  TEST_ASSERT_FALSE(flash.exists("/pq3_1"));
+
+  // A new spill goes to a fresh file, never to the drained one
+  drain_range(QUEUE_SEGMENT_RECORDS, QUEUE_SEGMENT_RECORDS);
+  push_range(total, QUEUE_CAPACITY + 1);
+  TEST_ASSERT_EQUAL(1, segments());
+  TEST_ASSERT_TRUE(flash.exists("/pq3_3"));
+  drain_range(2 * QUEUE_SEGMENT_RECORDS, QUEUE_CAPACITY * 2 + 1);
+  TEST_ASSERT_TRUE(queue->empty());
+}
+
+// With every segment in use the oldest one is dropped, the newest entries are kept
+static void test_full_log_drops_oldest() {
+  int total = 400;
+  push_range(0, total);
+  TEST_ASSERT_TRUE(segments() <= QUEUE_SEGMENT_COUNT);
+  TEST_ASSERT_TRUE(queue->dropCount() > 0);
+  TEST_ASSERT_EQUAL(total, queue->dropCount() + queue->depth());
+
+  int first = queue->dropCount();
+  drain_range(first, total - first);
+  TEST_ASSERT_TRUE(queue->empty());
+  TEST_ASSERT_EQUAL(0, segments());
+}
+
+static void test_not_mounted_keeps_newest_in_ram() {
+  queue.reset(new PublishQueue(flash));
+  queue->begin(false);
+  push_range(0, QUEUE_CAPACITY + 1);
+  TEST_ASSERT_EQUAL(QUEUE_SPILL_BATCH, queue->dropCount());
+  TEST_ASSERT_EQUAL(QUEUE_CAPACITY + 1 - QUEUE_SPILL_BATCH, queue->depth());
+  TEST_ASSERT_EQUAL(0, flash.files.size());
+  drain_range(QUEUE_SPILL_BATCH, QUEUE_CAPACITY + 1 - QUEUE_SPILL_BATCH);
+}
+
+static void test_failed_writes_dropped() {
+  flash.fail_writes = true;
+  push_range(0, QUEUE_CAPACITY + QUEUE_SPILL_BATCH);
+  TEST_ASSERT_EQUAL(QUEUE_SPILL_BATCH, queue->dropCount());
+  TEST_ASSERT_EQUAL(QUEUE_CAPACITY, queue->depth());
+
+  // The empty segment left by the failed write is skipped, the ring drains
+  drain_range(QUEUE_SPILL_BATCH, QUEUE_CAPACITY);
+  TEST_ASSERT_TRUE(queue->empty());
+
+  flash.fail_writes = false;
+  push_range(100, QUEUE_CAPACITY + 1);
+  drain_range(100, QUEUE_CAPACITY + 1);
+  TEST_ASSERT_EQUAL(QUEUE_SPILL_BATCH, queue->dropCount());
+}
+
+static void test_missing_segment_skipped() {
+  push_range(0, QUEUE_CAPACITY + QUEUE_SEGMENT_RECORDS + 1);
+  TEST_ASSERT_EQUAL(2, segments());
+  flash.remove("/pq3_1");
+
+  drain_range(QUEUE_SEGMENT_RECORDS, QUEUE_CAPACITY + 1);
+  TEST_ASSERT_EQUAL(QUEUE_SEGMENT_RECORDS, queue->dropCount());
+  TEST_ASSERT_TRUE(queue->empty());
+}
+
+static void test_recovered_after_reboot() {
+  int spilled = 3 * QUEUE_SPILL_BATCH;
+  push_range(0, QUEUE_CAPACITY + spilled);
+
+  // The ring is lost with the RAM, the log is found again
+  queue.reset(new PublishQueue(flash));
+  queue->begin(true);
+  TEST_ASSERT_EQUAL(spilled, queue->depth());
+  drain_range(0, 5);
+
+  // The read position is not persisted, a partially drained segment is replayed
+  queue.reset(new PublishQueue(flash));
+  queue->begin(true);
+  TEST_ASSERT_EQUAL(spilled, queue->depth());
+  push_range(spilled, QUEUE_CAPACITY + 1);
+  drain_range(0, spilled + QUEUE_CAPACITY + 1);
+  TEST_ASSERT_TRUE(queue->empty());
+  TEST_ASSERT_EQUAL(0, segments());
+}
+
+static void test_recovered_segments_continue() {
+  push_range(0, QUEUE_CAPACITY + QUEUE_SEGMENT_RECORDS + QUEUE_SPILL_BATCH);
+  TEST_ASSERT_EQUAL(2, segments());
+
+  queue.reset(new PublishQueue(flash));
+  queue->begin(true);
+  TEST_ASSERT_EQUAL(QUEUE_SEGMENT_RECORDS + QUEUE_SPILL_BATCH, queue->depth());
+
+  // New spills append to the newest segment found
+  int next = QUEUE_CAPACITY + QUEUE_SEGMENT_RECORDS + QUEUE_SPILL_BATCH;
+  push_range(next, QUEUE_CAPACITY + QUEUE_SPILL_BATCH);
+  TEST_ASSERT_EQUAL(2, segments());
+  drain_range(0, QUEUE_SEGMENT_RECORDS + QUEUE_SPILL_BATCH);
+  drain_range(next, QUEUE_CAPACITY + QUEUE_SPILL_BATCH);
+  TEST_ASSERT_TRUE(queue->empty());
+}
+
+static void test_legacy_segments_removed() {
+  flash.files["/pq_3"] = std::make_shared<std::vector<uint8_t>>(120, 0);
+  flash.files["/pq_5"] = std::make_shared<std::vector<uint8_t>>(120, 0);
+  flash.files["/pq2_1"] = std::make_shared<std::vector<uint8_t>>(102, 0);
+  flash.files["/pq2_2"] = std::make_shared<std::vector<uint8_t>>(102, 0);
+  flash.files["/history.log"] = std::make_shared<std::vector<uint8_t>>(4, 0);
+
+  queue.reset(new PublishQueue(flash));
+  queue->begin(true);
+  TEST_ASSERT_FALSE(flash.exists("/pq_3"));
+  TEST_ASSERT_FALSE(flash.exists("/pq_5"));
+  TEST_ASSERT_FALSE(flash.exists("/pq2_1"));
+  TEST_ASSERT_FALSE(flash.exists("/pq2_2"));
+  TEST_ASSERT_TRUE(flash.exists("/history.log"));
+  TEST_ASSERT_TRUE(queue->empty());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_ring_only);
+  RUN_TEST(test_payload_truncated);
+  RUN_TEST(test_spill_and_drain_in_order);
+  RUN_TEST(test_segments_rotate);
+  RUN_TEST(test_full_log_drops_oldest);
+  RUN_TEST(test_not_mounted_keeps_newest_in_ram);
+  RUN_TEST(test_failed_writes_dropped);
+  RUN_TEST(test_missing_segment_skipped);
+  RUN_TEST(test_recovered_after_reboot);
+  RUN_TEST(test_recovered_segments_continue);
+  RUN_TEST(test_legacy_segments_removed);
+  return UNITY_END();
+}
@@ -0,0 +1,408 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the RulesEngine compiler errors, the evaluation of conditions, hysteresis and
+ *        hold times, the "at" schedule and the upload mailbox, and a benchmark of the evaluation.
+ */
+#include <unity.h>
+#include <Bench.h>
+#include <RulesEngine.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define BENCH_RUNS 100000
+
+struct Action {
+  uint8_t device;
+  bool on;
+};
+
+static Preferences preferences;
+static MemoryHandler memory(preferences);
+static std::unique_ptr<RulesEngine> rules;
+static std::vector<Action> actions;
+static int32_t seconds = -1;     ///< Time of day returned by the clock, -1 while not set.
+static int8_t t0, t1;
+
+static void record(uint8_t device, bool on) {
+  actions.push_back({device, on});
+}
+
+static int32_t now_seconds() {
+  return seconds;
+}
+
+void setUp(void) {
+  fake_nvs.clear();
+  actions.clear();
+  seconds = -1;
+  rules.reset(new RulesEngine(memory));
+  t0 = rules->addInput("t0");
+  t1 = rules->addInput("t1");
+  rules->addOutput("r1", 1);
+  rules->addOutput("r2", 2);
+  rules->begin(record, now_seconds);
+}
+void tearDown(void) {}
+
+// Uploads a source as the web task does and compiles it as the control loop does
+static bool load(const char* text) {
+  TEST_ASSERT_TRUE(rules->submit(text, strlen(text)));
+  TEST_ASSERT_TRUE(rules->poll());
+  return strncmp(rules->lastStatus(), "ok", 2) == 0;
+}
+
+static void assert_action(size_t index, uint8_t device, bool on) {
+  TEST_ASSERT_TRUE(index < actions.size());
+  TEST_ASSERT_EQUAL(device, actions[index].device);
+  TEST_ASSERT_EQUAL(on, actions[index].on);
+}
+
+static void test_compile_ok() {
+  TEST_ASSERT_TRUE(load("# Comment line\n"
+                        "if t0 > 24.5 hyst 1 for 60s then r1 on else r1 off\n"
+                        "if t0 < 5 or t1 < 5 then r2 on; at 07:30 then r2 on\n"
+                        "at 22:00 if time between 21:00 and 23:00 then r2 off  # trailing comment\n"));
+  TEST_ASSERT_EQUAL(4, rules->size());
+  TEST_ASSERT_EQUAL(0, strncmp(rules->lastStatus(), "ok: 4 rules,", 12));
+}
+
+static void test_compile_errors() {
+  static const char* const cases[][2] = {
+    { "if t9 > 1 then r1 on", "line 1: unknown input 't9'" },
+    { "if t0 > then r1 on", "line 1: expected number 'then'" },
+    { "if t0 1 then r1 on", "line 1: expected comparison '1'" },
+    { "if t0 >= 1 hyst 1 then r1 on", "line 1: hyst needs > or <" },
+    { "if t0 > 1 hyst -1 then r1 on", "line 1: expected band after hyst '-1'" },
+    { "if t0 > 1 then r9 on", "line 1: unknown output 'r9'" },
+    { "if t0 > 1 then r1 maybe", "line 1: expected on or off 'maybe'" },
+    { "if t0 > 1 then r1 on r2", "line 1: unexpected 'r2'" },
+    { "if t0 > 1 r1 on", "line 1: expected then 'r1'" },
+    { "then r1 on", "line 1: expected if or at" },
+    { "r1 on", "line 1: expected if or at 'r1'" },
+    { "at 25:00 then r1 on", "line 1: expected HH:MM after at '25:00'" },
+    { "at 07:00 if t0 > 1 for 5s then r1 on", "line 1: for is not allowed with at" },
+    { "if t0 > 1 for 2d then r1 on", "line 1: expected then 'd'" },
+    { "if t0 > 1 for 25h then r1 on", "line 1: expected duration up to 24h after for '25'" },
+    { "if time between 9:00 and 25:00 then r1 on", "line 1: expected time between HH:MM and HH:MM" },
+    { "if t0 > 1 then r1 on\n\nif t1 > 1 then r2 of", "line 3: expected on or off 'of'" },
+    { "if t0 > 1 then r1 on; if t1 ? 1 then r2 on\nif t0 < 0 then r2 off", "line 1: expected comparison '?'" },
+  };
+  for (const auto& c : cases) {
+    TEST_ASSERT_FALSE_MESSAGE(load(c[0]), c[0]);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(c[1], rules->lastStatus(), c[0]);
+  }
+}
+
+static void test_compile_limits() {
+  std::string text;
+  for (int i = 0; i <= RULES_MAX; i++) {
+    text += "if t0 > 1 then r1 on\n";
+  }
+  TEST_ASSERT_FALSE(load(text.c_str()));
+  TEST_ASSERT_EQUAL_STRING("line 17: too many rules", rules->lastStatus());
+
+  text = "if t0 > 0 hyst 1";
+  for (int i = 1; i <= RULE_HYST_TERMS; i++) {
+    text += " and t0 > " + std::to_string(i) + " hyst 1";
+  }
+  text += " then r1 on";
+  TEST_ASSERT_FALSE(load(text.c_str()));
+  TEST_ASSERT_EQUAL_STRING("line 1: too many hyst terms", rules->lastStatus());
+}
+
+// A rejected upload keeps the active rules and leaves the stored source alone
+static void test_error_keeps_active_rules() {
+  char source[64];
+  TEST_ASSERT_TRUE(load("if t0 > 1 then r1 on"));
+  TEST_ASSERT_FALSE(load("if t0 > 1 then r1 on\nif bogus"));
+  TEST_ASSERT_EQUAL(1, rules->size());
+  TEST_ASSERT_EQUAL(2, rules->uploadCount());
+  rules->copySource(source, sizeof(source));
+  TEST_ASSERT_EQUAL_STRING("if t0 > 1 then r1 on", source);
+
+  char stored[64] = {};
+  TEST_ASSERT_EQUAL(20, memory.getRules(stored, sizeof(stored)));
+  TEST_ASSERT_EQUAL_STRING("if t0 > 1 then r1 on", stored);
+
+  rules->set(t0, 2);
+  rules->run(0);
+  TEST_ASSERT_EQUAL(1, actions.size());
+}
+
+static void test_stored_rules_compiled_at_begin() {
+  const char* text = "if t1 >= 3 then r2 on";
+  memory.putRules(text, strlen(text));
+  rules.reset(new RulesEngine(memory));
+  rules->addInput("t0");
+  rules->addInput("t1");
+  rules->addOutput("r1", 1);
+  rules->addOutput("r2", 2);
+  rules->begin(record, now_seconds);
+  TEST_ASSERT_EQUAL(1, rules->size());
+
+  rules->set(1, 3);
+  rules->run(0);
+  TEST_ASSERT_EQUAL(1, actions.size());
+  assert_action(0, 2, true);
+}
+
+static void test_then_and_else_on_edges() {
+  TEST_ASSERT_TRUE(load("if t0 > 10 then r1 on else r1 off"));
+  rules->run(0);
+  TEST_ASSERT_EQUAL(0, actions.size());     // NAN, the sensor is not read yet, compares false
+
+  rules->set(t0, 11);
+  rules->run(1);
+  rules->set(t0, 12);
+  rules->run(2);                            // Still true, the action does not repeat
+  TEST_ASSERT_EQUAL(1, actions.size());
+  assert_action(0, 1, true);
+
+  rules->set(t0, 9);
+  rules->run(3);
+  TEST_ASSERT_EQUAL(2, actions.size());
+  assert_action(1, 1, false);
+
+  rules->set(t0, NAN);                      // Disconnected, the condition stays false
+  rules->run(4);
+  TEST_ASSERT_EQUAL(2, actions.size());
+}
+
+static void test_and_binds_tighter_than_or() {
+  TEST_ASSERT_TRUE(load("if t0 > 10 or t1 > 10 and t0 < 0 then r1 on else r1 off"));
+  rules->set(t0, 5);
+  rules->set(t1, 20);
+  rules->run(0);
+  TEST_ASSERT_EQUAL(0, actions.size());
+
+  rules->set(t0, -1);
+  rules->run(1);
+  TEST_ASSERT_EQUAL(1, actions.size());
+
+  rules->set(t1, 0);
+  rules->run(2);
+  rules->set(t0, 11);
+  rules->run(3);
+  TEST_ASSERT_EQUAL(3, actions.size());
+  assert_action(1, 1, false);
+  assert_action(2, 1, true);
+}
+
+static void test_hysteresis() {
+  TEST_ASSERT_TRUE(load("if t0 > 24.5 hyst 1 then r1 on else r1 off"));
+  rules->set(t0, 24.5);
+  rules->run(0);
+  TEST_ASSERT_EQUAL(0, actions.size());
+
+  rules->set(t0, 24.6);
+  rules->run(1);
+  TEST_ASSERT_EQUAL(1, actions.size());
+
+  // Held true while the input stays above 23.5
+  rules->set(t0, 24.0);
+  rules->run(2);
+  rules->set(t0, 23.6);
+  rules->run(3);
+  TEST_ASSERT_EQUAL(1, actions.size());
+
+  rules->set(t0, 23.5);
+  rules->run(4);
+  TEST_ASSERT_EQUAL(2, actions.size());
+  assert_action(1, 1, false);
+
+  // Released, the threshold is back at 24.5
+  rules->set(t0, 24.0);
+  rules->run(5);
+  TEST_ASSERT_EQUAL(2, actions.size());
+}
+
+static void test_hysteresis_below() {
+  TEST_ASSERT_TRUE(load("if t0 < 5 hyst 2 then r2 on else r2 off"));
+  rules->set(t0, 4);
+  rules->run(0);
+  rules->set(t0, 6.9);
+  rules->run(1);
+  TEST_ASSERT_EQUAL(1, actions.size());
+  rules->set(t0, 7);
+  rules->run(2);
+  TEST_ASSERT_EQUAL(2, actions.size());
+  assert_action(1, 2, false);
+}
+
+static void test_hold_time() {
+  TEST_ASSERT_TRUE(load("if t0 > 30 for 90s then r1 on else r1 off"));
+  rules->set(t0, 31);
+  TEST_ASSERT_EQUAL(RULES_MAX_WAIT, rules->run(1000));   // Capped, the loop may wake earlier
+  TEST_ASSERT_EQUAL(30000, rules->run(61000));
+  TEST_ASSERT_EQUAL(1, rules->run(90999));
+  TEST_ASSERT_EQUAL(0, actions.size());
+
+  rules->run(91000);
+  TEST_ASSERT_EQUAL(1, actions.size());
+  assert_action(0, 1, true);
+  TEST_ASSERT_EQUAL(RULES_MAX_WAIT, rules->run(200000));
+  TEST_ASSERT_EQUAL(1, actions.size());
+}
+
+// A condition which drops before the hold time restarts it, and runs no "else" action
+static void test_hold_restarts() {
+  TEST_ASSERT_TRUE(load("if t0 > 30 for 1m then r1 on else r1 off"));
+  rules->set(t0, 31);
+  rules->run(0);
+  rules->set(t0, 29);
+  rules->run(50000);
+  TEST_ASSERT_EQUAL(0, actions.size());
+
+  rules->set(t0, 32);
+  rules->run(55000);
+  rules->run(114999);
+  TEST_ASSERT_EQUAL(0, actions.size());
+  rules->run(115000);
+  TEST_ASSERT_EQUAL(1, actions.size());
+
+  // The clock wraps around, the held time is still right
+  rules.reset();
+  setUp();
+  TEST_ASSERT_TRUE(load("if t0 > 30 for 10s then r1 on"));
+  rules->set(t0, 31);
+  rules->run(0xFFFFF000u);
+  rules->run(0xFFFFF000u + 9999);
+  TEST_ASSERT_EQUAL(0, actions.size());
+  rules->run(0xFFFFF000u + 10000);
+  TEST_ASSERT_EQUAL(1, actions.size());
+}
+
+static void test_only_dirty_rules_evaluated() {
+  TEST_ASSERT_TRUE(load("if t0 > 1 then r1 on\nif t1 > 1 then r2 on"));
+  rules->run(0);                                // A new program evaluates every rule once
+  uint32_t evaluations = rules->evaluationCount();
+  TEST_ASSERT_EQUAL(2, evaluations);
+
+  rules->set(t1, 5);
+  rules->run(1);
+  TEST_ASSERT_EQUAL(evaluations + 1, rules->evaluationCount());
+
+  rules->set(t1, 5);                            // Unchanged, nothing to evaluate
+  rules->run(2);
+  TEST_ASSERT_EQUAL(evaluations + 1, rules->evaluationCount());
+}
+
+static void test_at_schedule() {
+  TEST_ASSERT_TRUE(load("at 07:30 then r2 on\nat 22:00 if t0 > 20 then r2 off"));
+  rules->run(0);                                // Clock not set, nothing runs
+  TEST_ASSERT_EQUAL(0, actions.size());
+
+  seconds = 7 * 3600 + 29 * 60 + 50;
+  TEST_ASSERT_EQUAL(10000, rules->run(1000));   // Wakes at the next minute
+  TEST_ASSERT_EQUAL(0, actions.size());
+
+  seconds = 7 * 3600 + 30 * 60;
+  rules->run(11000);
+  seconds += 30;
+  rules->run(41000);                            // Same minute, the action runs once
+  TEST_ASSERT_EQUAL(1, actions.size());
+  assert_action(0, 2, true);
+
+  seconds = 22 * 3600;
+  rules->run(100000);
+  TEST_ASSERT_EQUAL(1, actions.size());         // The condition does not hold
+
+  rules->set(t0, 21);
+  seconds = 7 * 3600 + 30 * 60;
+  rules->run(200000);
+  seconds = 22 * 3600;
+  rules->run(300000);
+  TEST_ASSERT_EQUAL(3, actions.size());
+  assert_action(2, 2, false);
+}
+
+static void test_time_between_wraps_midnight() {
+  TEST_ASSERT_TRUE(load("if time between 23:00 and 06:00 then r1 on else r1 off"));
+  seconds = 22 * 3600 + 59 * 60;
+  rules->run(0);
+  TEST_ASSERT_EQUAL(0, actions.size());
+
+  seconds = 23 * 3600;
+  rules->run(60000);
+  seconds = 3 * 3600;
+  rules->run(120000);
+  TEST_ASSERT_EQUAL(1, actions.size());
+
+  seconds = 6 * 3600;
+  rules->run(180000);
+  TEST_ASSERT_EQUAL(2, actions.size());
+  assert_action(1, 1, false);
+}
+
+static void test_mailbox() {
+  const char* text = "if t0 > 1 then r1 on";
+  TEST_ASSERT_FALSE(rules->poll());
+  TEST_ASSERT_TRUE(rules->submit(text, strlen(text)));
+  TEST_ASSERT_TRUE(rules->pending());
+  TEST_ASSERT_FALSE(rules->submit(text, strlen(text)));  // One slot, the first upload waits
+  TEST_ASSERT_TRUE(rules->poll());
+  TEST_ASSERT_FALSE(rules->pending());
+  TEST_ASSERT_TRUE(rules->submit(text, strlen(text)));
+
+  static char large[RULES_TEXT_LEN];
+  memset(large, ' ', sizeof(large));
+  rules->poll();
+  TEST_ASSERT_FALSE(rules->submit(large, sizeof(large)));
+
+  char copy[8];
+  TEST_ASSERT_EQUAL(7, rules->copySource(copy, sizeof(copy)));
+  TEST_ASSERT_EQUAL_STRING("if t0 >", copy);
+}
+
+// A rule set as a node would run it, every comparison kind, "and", "or", hysteresis, a hold time
+// and the time of day. Both inputs change on each run, so every input rule is evaluated.
+static void test_evaluation_bench() {
+  TEST_ASSERT_TRUE(load("if t0 > 24.5 hyst 1 for 60s then r1 on else r1 off\n"
+                        "if t0 < 5 or t1 < 5 then r2 on\n"
+                        "if t0 > 20 and t1 > 20 then r1 on else r1 off\n"
+                        "if t1 >= 30 then r2 off\n"
+                        "if t0 <= 18 and time between 21:00 and 23:00 then r2 on\n"
+                        "if t1 > 22 hyst 0.5 then r2 on else r2 off\n"
+                        "if t0 == 21 or t1 != 21 then r1 on\n"
+                        "at 07:30 then r2 on"));
+  seconds = 22 * 3600;
+  actions.reserve(64);
+  uint32_t now = 0;
+  uint32_t evaluations = rules->evaluationCount();
+  BenchResult r = bench_run("rules_run", BENCH_RUNS, [&] {
+    bool high = (now / 1000) & 1;
+    rules->set(t0, high ? 26.0f : 17.0f);
+    rules->set(t1, high ? 31.0f : 21.0f);
+    rules->run(now);
+    now += 1000;
+    actions.clear();
+  });
+  uint32_t runs = BENCH_RUNS + 1;                       // With the warm-up run
+  double per_run = (double)(rules->evaluationCount() - evaluations) / runs;
+  printf("BENCH %-28s %10.1f ns/rule\n", "rules_evaluate", r.ns_per_op / per_run);
+  TEST_ASSERT_EQUAL_FLOAT(7.0, per_run);                // The "at" rule waits for its minute
+  TEST_ASSERT_TRUE(rules->actionCount() > runs);        // The edges fire actions on every run
+  TEST_ASSERT_EQUAL_FLOAT(0.0, r.allocs_per_op);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_compile_ok);
+  RUN_TEST(test_compile_errors);
+  RUN_TEST(test_compile_limits);
+  RUN_TEST(test_error_keeps_active_rules);
+  RUN_TEST(test_stored_rules_compiled_at_begin);
+  RUN_TEST(test_then_and_else_on_edges);
+  RUN_TEST(test_and_binds_tighter_than_or);
+  RUN_TEST(test_hysteresis);
+  RUN_TEST(test_hysteresis_below);
+  RUN_TEST(test_hold_time);
+  RUN_TEST(test_hold_restarts);
+  RUN_TEST(test_only_dirty_rules_evaluated);
+  RUN_TEST(test_at_schedule);
+  RUN_TEST(test_time_between_wraps_midnight);
+  RUN_TEST(test_mailbox);
+  RUN_TEST(test_evaluation_bench);
+  return UNITY_END();
+}
@@ -0,0 +1,266 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the SensorHandler on a fake DS18B20 bus: the split conversion and read-out,
+ *        the adaptive read intervals, read retries and lost sensors, the stability of the sensor
+ *        indices across bus searches, and the bus time spent against the number of sensors.
+ */
+#include <unity.h>
+#include <SensorHandler.h>
+#include <memory>
+
+static Preferences preferences;
+static MemoryHandler memory(preferences);
+static std::unique_ptr<DallasTemperature> bus;
+static std::unique_ptr<SensorHandler> sensors;
+
+void setUp(void) {
+  fake_nvs.clear();
+  fake_ms = 0;
+  bus.reset(new DallasTemperature());
+  sensors.reset(new SensorHandler(*bus, memory));
+}
+void tearDown(void) {}
+
+// Puts count sensors at 20, 21, 22... Celsius on the bus, with ROM serials 10, 20, 30...
+static void add_sensors(int count) {
+  for (int i = 0; i < count; i++) {
+    bus->fakeAdd(20.0f + i, 10 * (i + 1));
+  }
+}
+
+// One pass of the control loop: waits until a sensor is due, converts and reads it
+static void cycle() {
+  fake_advance(sensors->untilDue());
+  uint16_t wait = sensors->requestConversion();
+  fake_advance(wait);
+  sensors->readAll();
+}
+
+void test_cold_boot_scans_and_stores(void) {
+  add_sensors(3);
+  uint16_t opens = memory.openCount();
+  TEST_ASSERT_EQUAL(3, sensors->begin());
+  TEST_ASSERT_EQUAL(1, bus->searches);
+  TEST_ASSERT_EQUAL(3, bus->resolutions);
+  TEST_ASSERT_EQUAL(opens + 2, memory.openCount());  // one read of the empty table, one write
+
+  // A warm boot loads the table and leaves the bus alone
+  sensors.reset(new SensorHandler(*bus, memory));
+  TEST_ASSERT_EQUAL(3, sensors->begin());
+  TEST_ASSERT_EQUAL(1, bus->searches);
+  TEST_ASSERT_EQUAL(3, bus->resolutions);
+}
+
+void test_async_split(void) {
+  add_sensors(3);
+  sensors->begin();
+  TEST_ASSERT_FALSE(bus->getWaitForConversion());
+
+  uint16_t wait = sensors->requestConversion();
+  TEST_ASSERT_EQUAL(750, wait);
+  TEST_ASSERT_EQUAL(1, bus->conversions);  // one broadcast for the whole bus
+  TEST_ASSERT_EQUAL(0, bus->reads);
+
+  bus->fakeSet(0, 30.0f);  // after the conversion, not seen before the next one
+  fake_advance(wait);
+  const float* temps = sensors->readAll();
+  TEST_ASSERT_EQUAL(3, bus->reads);
+  TEST_ASSERT_EQUAL(0x7, sensors->readMask());
+  TEST_ASSERT_EQUAL_FLOAT(20.0f, temps[0]);
+  TEST_ASSERT_EQUAL_FLOAT(21.0f, temps[1]);
+  TEST_ASSERT_EQUAL_FLOAT(22.0f, temps[2]);
+  TEST_ASSERT_EQUAL(0, sensors->requestConversion());  // nothing due yet
+}
+
+void test_adaptive_interval(void) {
+  add_sensors(1);
+  sensors->begin();
+
+  // The first reading has nothing to compare with, then every steady reading doubles
+  uint32_t expected[] = {2000, 4000, 8000, 16000, 32000, 32000};
+  for (uint32_t interval : expected) {
+    cycle();
+    TEST_ASSERT_EQUAL(interval, sensors->untilDue());
+  }
+
+  // A step of a full degree halves the interval on every read until the minimum
+  float temperature = 20.0f;
+  uint32_t fast[] = {16000, 8000, 4000, 2000, 2000};
+  for (uint32_t interval : fast) {
+    temperature += 1.0f;
+    bus->fakeSet(0, temperature);
+    cycle();
+    TEST_ASSERT_EQUAL(interval, sensors->untilDue());
+  }
+
+  // A change between the two thresholds keeps the interval
+  bus->fakeSet(0, temperature + 0.125f);
+  cycle();
+  TEST_ASSERT_EQUAL(2000, sensors->untilDue());
+}
+
+void test_only_due_sensors_converted(void) {
+  add_sensors(2);
+  sensors->begin();
+  cycle();
+  cycle();  // both steady, both at 4 s
+  bus->fakeSet(1, 25.0f);
+  cycle();  // sensor 1 jumps, back to 2 s, sensor 0 at 8 s
+
+  uint32_t conversions = bus->conversions;
+  cycle();
+  TEST_ASSERT_EQUAL(0x2, sensors->readMask());
+  TEST_ASSERT_EQUAL(conversions + 1, bus->conversions);  // addressed, sensor 0 is left idle
+}
+
+void test_glitch_retried(void) {
+  add_sensors(3);
+  sensors->begin();
+  cycle();
+
+  bus->fakeGlitch(1, SENSOR_READ_RETRIES);
+  uint32_t reads = bus->reads;
+  cycle();
+  TEST_ASSERT_EQUAL_FLOAT(21.0f, sensors->readings()[1]);
+  TEST_ASSERT_EQUAL(reads + 3 + SENSOR_READ_RETRIES, bus->reads);
+
+  // No bus search follows, however long the loop runs
+  fake_advance(SENSOR_RESCAN_MS);
+  cycle();
+  TEST_ASSERT_EQUAL(1, bus->searches);
+}
+
+void test_lost_sensor_keeps_slot(void) {
+  add_sensors(3);
+  sensors->begin();
+  cycle();
+
+  bus->fakeConnect(1, false);
+  cycle();
+  const float* temps = sensors->readings();
+  TEST_ASSERT_EQUAL_FLOAT(DEVICE_DISCONNECTED_C, temps[1]);
+  TEST_ASSERT_EQUAL_FLOAT(20.0f, temps[0]);
+  TEST_ASSERT_EQUAL_FLOAT(22.0f, temps[2]);
+
+  // The search finds nothing new: no resolution written, no table stored, same indices
+  uint16_t opens = memory.openCount();
+  fake_advance(SENSOR_RESCAN_MS);
+  cycle();
+  TEST_ASSERT_EQUAL(2, bus->searches);
+  TEST_ASSERT_EQUAL(3, bus->resolutions);
+  TEST_ASSERT_EQUAL(opens, memory.openCount());
+  TEST_ASSERT_EQUAL(3, sensors->size());
+  TEST_ASSERT_EQUAL_FLOAT(22.0f, sensors->readings()[2]);
+
+  // The sensor comes back in its own slot
+  bus->fakeConnect(1, true);
+  for (int i = 0; i < 3; i++) {
+    cycle();
+  }
+  TEST_ASSERT_EQUAL_FLOAT(21.0f, sensors->readings()[1]);
+}
+
+void test_rescan_throttled(void) {
+  add_sensors(2);
+  sensors->begin();
+  bus->fakeConnect(0, false);
+
+  // The lost sensor is read every 2 s, the bus is searched once a minute
+  fake_advance(SENSOR_RESCAN_MS);
+  uint32_t start = millis();
+  while (millis() - start < 5 * SENSOR_RESCAN_MS) {
+    cycle();
+  }
+  TEST_ASSERT_EQUAL(1 + 5, bus->searches);
+}
+
+void test_new_sensor_appended(void) {
+  add_sensors(3);
+  sensors->begin();
+  cycle();
+
+  // A replacement with a lower ROM code is enumerated first by the search
+  bus->fakeConnect(1, false);
+  bus->fakeAdd(40.0f, 5);
+  cycle();
+  fake_advance(SENSOR_RESCAN_MS);
+  uint16_t opens = memory.openCount();
+  cycle();
+  cycle();
+
+  TEST_ASSERT_EQUAL(4, sensors->size());
+  TEST_ASSERT_EQUAL(4, bus->resolutions);  // only the new sensor is configured
+  TEST_ASSERT_EQUAL(opens + 1, memory.openCount());
+  const float* temps = sensors->readings();
+  TEST_ASSERT_EQUAL_FLOAT(20.0f, temps[0]);
+  TEST_ASSERT_EQUAL_FLOAT(DEVICE_DISCONNECTED_C, temps[1]);
+  TEST_ASSERT_EQUAL_FLOAT(22.0f, temps[2]);
+  TEST_ASSERT_EQUAL_FLOAT(40.0f, temps[3]);
+
+  // The stored table keeps the order after a reboot
+  sensors.reset(new SensorHandler(*bus, memory));
+  TEST_ASSERT_EQUAL(4, sensors->begin());
+  for (int i = 0; i < 2; i++) {
+    cycle();
+  }
+  temps = sensors->readings();
+  TEST_ASSERT_EQUAL_FLOAT(20.0f, temps[0]);
+  TEST_ASSERT_EQUAL_FLOAT(22.0f, temps[2]);
+  TEST_ASSERT_EQUAL_FLOAT(40.0f, temps[3]);
+}
+
+// Bus time of ten minutes of steady readings, against the same loop reading every sensor
+// each 2 s with one broadcast conversion, and against one full search and setup of the bus
+void test_bus_time_vs_sensor_count(void) {
+  const uint32_t period = 600000;
+  uint8_t counts[] = {1, 2, 4, 8, 12};
+  uint64_t previous = 0;
+
+  for (uint8_t n : counts) {
+    setUp();
+    add_sensors(n);
+    sensors->begin();
+    uint64_t setup_us = bus->bus_us;
+
+    uint64_t start = bus->bus_us;
+    while (millis() < period) {
+      cycle();
+    }
+    uint64_t adaptive_us = bus->bus_us - start;
+
+    DallasTemperature fixed;
+    for (int i = 0; i < n; i++) {
+      fixed.fakeAdd(20.0f + i, 10 * (i + 1));
+    }
+    DeviceAddress rom = {0x28, 0, 0, 0, 0, 0, 0, 0};
+    for (uint32_t t = 0; t < period; t += SENSOR_INTERVAL_MIN) {
+      fixed.requestTemperatures();
+      for (int i = 0; i < n; i++) {
+        rom[1] = 10 * (i + 1);
+        fixed.getTempC(rom);
+      }
+    }
+
+    printf("BUS sensors=%u adaptive=%llu us fixed=%llu us search+setup=%llu us\n", n,
+           (unsigned long long)adaptive_us, (unsigned long long)fixed.bus_us,
+           (unsigned long long)setup_us);
+    TEST_ASSERT_TRUE(adaptive_us * 4 < fixed.bus_us);  // steady sensors settle at 32 s
+    TEST_ASSERT_TRUE(adaptive_us > previous);
+    TEST_ASSERT_TRUE(setup_us > (uint64_t)n * 20000);  // why a search must not run on every glitch
+    previous = adaptive_us;
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_cold_boot_scans_and_stores);
+  RUN_TEST(test_async_split);
+  RUN_TEST(test_adaptive_interval);
+  RUN_TEST(test_only_due_sensors_converted);
+  RUN_TEST(test_glitch_retried);
+  RUN_TEST(test_lost_sensor_keeps_slot);
+  RUN_TEST(test_rescan_throttled);
+  RUN_TEST(test_new_sensor_appended);
+  RUN_TEST(test_bus_time_vs_sensor_count);
+  return UNITY_END();
+}
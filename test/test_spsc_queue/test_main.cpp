@@ -0,0 +1,170 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of SpscQueue, single-threaded semantics and a two-thread stress run.
+ */
+#include <unity.h>
+#include <SpscQueue.h>
+#include <string.h>
+#include <thread>
+
+#ifndef STRESS_ENTRIES
+#define STRESS_ENTRIES 1000000     ///< Entries per stress run.
+#endif
+
+/**
+ * @brief An entry wider than a word, a torn copy shows as a mismatch between the fields.
+ */
+struct Entry {
+    uint32_t seq;
+    uint32_t check;
+    uint8_t pad[24];
+};
+
+static Entry make(uint32_t seq) {
+  Entry e;
+  e.seq = seq;
+  e.check = ~seq * 2654435761u;
+  memset(e.pad, (uint8_t)seq, sizeof(e.pad));
+  return e;
+}
+
+static bool intact(const Entry& e) {
+  for (uint8_t b : e.pad) {
+    if (b != (uint8_t)e.seq) return false;
+  }
+  return e.check == ~e.seq * 2654435761u;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void test_empty_pop_fails() {
+  SpscQueue<int, 4> q;
+  int v = 7;
+  TEST_ASSERT_FALSE(q.pop(v));
+  TEST_ASSERT_EQUAL(7, v);
+  TEST_ASSERT_EQUAL(0, q.size());
+}
+
+static void test_fifo_order() {
+  SpscQueue<int, 8> q;
+  for (int i = 0; i < 5; i++) TEST_ASSERT_TRUE(q.push(i));
+  TEST_ASSERT_EQUAL(5, q.size());
+  for (int i = 0; i < 5; i++) {
+    int v;
+    TEST_ASSERT_TRUE(q.pop(v));
+    TEST_ASSERT_EQUAL(i, v);
+  }
+  TEST_ASSERT_EQUAL(0, q.size());
+}
+
+static void test_full_drops_newest() {
+  SpscQueue<int, 4> q;
+  for (int i = 0; i < 4; i++) TEST_ASSERT_TRUE(q.push(i));
+  TEST_ASSERT_FALSE(q.push(99));
+  TEST_ASSERT_FALSE(q.push(100));
+  TEST_ASSERT_EQUAL(2, q.dropCount());
+  TEST_ASSERT_EQUAL(4, q.size());
+
+  int v;
+  TEST_ASSERT_TRUE(q.pop(v));
+  TEST_ASSERT_EQUAL(0, v);
+  TEST_ASSERT_TRUE(q.push(4));  // A slot is free again
+  for (int i = 1; i <= 4; i++) {
+    TEST_ASSERT_TRUE(q.pop(v));
+    TEST_ASSERT_EQUAL(i, v);
+  }
+}
+
+static void test_wraps_around_the_ring() {
+  SpscQueue<int, 4> q;
+  for (int i = 0; i < 1000; i++) {
+    TEST_ASSERT_TRUE(q.push(i));
+    TEST_ASSERT_TRUE(q.push(i + 1));
+    int v;
+    TEST_ASSERT_TRUE(q.pop(v));
+    TEST_ASSERT_EQUAL(i, v);
+    TEST_ASSERT_TRUE(q.pop(v));
+    TEST_ASSERT_EQUAL(i + 1, v);
+  }
+  TEST_ASSERT_EQUAL(0, q.dropCount());
+}
+
+// Producer retries on full: every entry arrives once, in order and intact
+static void test_two_threads_lossless() {
+  static SpscQueue<Entry, 16> q;
+  uint32_t received = 0;
+  bool ordered = true, whole = true;
+
+  std::thread consumer([&] {
+    Entry e;
+    while (received < STRESS_ENTRIES) {
+      if (!q.pop(e)) {
+        std::this_thread::yield();  // Lets the producer run on a single-core host
+        continue;
+      }
+      ordered = ordered && e.seq == received;
+      whole = whole && intact(e);
+      received++;
+    }
+  });
+  for (uint32_t i = 0; i < STRESS_ENTRIES; i++) {
+    Entry e = make(i);
+    while (!q.push(e)) {
+      std::this_thread::yield();
+    }
+  }
+  consumer.join();
+
+  TEST_ASSERT_EQUAL(STRESS_ENTRIES, received);
+  TEST_ASSERT_TRUE_MESSAGE(ordered, "entries out of order");
+  TEST_ASSERT_TRUE_MESSAGE(whole, "torn entry");
+  TEST_ASSERT_EQUAL(0, q.size());
+}
+
+// Producer drops on full as the tasks do: the rest arrives in order, nothing is duplicated
+static void test_two_threads_with_drops() {
+  static SpscQueue<Entry, 8> q;
+  std::atomic<bool> done{false};
+  uint32_t received = 0;
+  int64_t last = -1;
+  bool ordered = true, whole = true;
+
+  std::thread consumer([&] {
+    Entry e;
+    for (;;) {
+      bool finished = done.load(std::memory_order_acquire);
+      if (!q.pop(e)) {
+        if (finished) break;
+        std::this_thread::yield();
+        continue;
+      }
+      ordered = ordered && (int64_t)e.seq > last;
+      whole = whole && intact(e);
+      last = e.seq;
+      received++;
+    }
+  });
+  uint32_t accepted = 0;
+  for (uint32_t i = 0; i < STRESS_ENTRIES; i++) {
+    accepted += q.push(make(i));
+  }
+  done.store(true, std::memory_order_release);
+  consumer.join();
+
+  TEST_ASSERT_EQUAL(accepted, received);
+  TEST_ASSERT_EQUAL(STRESS_ENTRIES, accepted + q.dropCount());
+  TEST_ASSERT_TRUE_MESSAGE(ordered, "entries out of order or duplicated");
+  TEST_ASSERT_TRUE_MESSAGE(whole, "torn entry");
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_pop_fails);
+  RUN_TEST(test_fifo_order);
+  RUN_TEST(test_full_drops_newest);
+  RUN_TEST(test_wraps_around_the_ring);
+  RUN_TEST(test_two_threads_lossless);
+  RUN_TEST(test_two_threads_with_drops);
+  return UNITY_END();
+}
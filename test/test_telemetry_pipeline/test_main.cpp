@@ -0,0 +1,210 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the TelemetryPipeline policies: EWMA smoothing, deadband, minimum and maximum
+ *        interval, lost sources, coalescing into payloads, and the number of messages saved on
+ *        a simulated day of sensor readings.
+ */
+#include <unity.h>
+#include <TelemetryPipeline.h>
+#include <math.h>
+#include <memory>
+#include <string>
+
+static std::unique_ptr<TelemetryPipeline> pipeline;
+
+void setUp(void) {
+  pipeline.reset(new TelemetryPipeline());
+}
+void tearDown(void) {}
+
+// Flushes one JSON payload, empty if nothing was due
+static std::string flush(uint32_t now, size_t capacity = 128) {
+  uint8_t payload[128];
+  PayloadWriter writer(Codec::JSON, payload, capacity);
+  pipeline->flush(writer, now);
+  size_t len = writer.finish();
+  return std::string((const char*)payload, len);
+}
+
+static void test_first_sample_published() {
+  MetricPolicy policy = {0.5f, 1.0f, 5000, 60000, 1};
+  pipeline->add("t0", policy);
+  TEST_ASSERT_EQUAL_STRING("", flush(0).c_str());   // Nothing before the first sample
+
+  pipeline->update(0, 20.0f);
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":20.0}", flush(0).c_str());
+  TEST_ASSERT_EQUAL_STRING("", flush(1000).c_str());
+}
+
+static void test_deadband() {
+  MetricPolicy policy = {0.5f, 1.0f, 0, 600000, 1};
+  pipeline->add("t0", policy);
+  pipeline->update(0, 20.0f);
+  flush(0);
+
+  pipeline->update(0, 20.4f);
+  TEST_ASSERT_EQUAL_STRING("", flush(1000).c_str());
+  pipeline->update(0, 19.6f);                       // Measured from the last publish, not the last sample
+  TEST_ASSERT_EQUAL_STRING("", flush(2000).c_str());
+  pipeline->update(0, 20.5f);
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":20.5}", flush(3000).c_str());
+}
+
+static void test_ewma() {
+  MetricPolicy policy = {0.0f, 0.25f, 0, 600000, 2};
+  pipeline->add("t0", policy);
+  pipeline->update(0, 20.0f);                       // Seeds the average
+  flush(0);
+
+  pipeline->update(0, 24.0f);
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":21.00}", flush(1000).c_str());
+  pipeline->update(0, 24.0f);
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":21.75}", flush(2000).c_str());
+}
+
+// A single spike moves the average by alpha of its size only, and stays inside the deadband
+static void test_ewma_spike() {
+  MetricPolicy policy = {0.5f, 0.1f, 0, 600000, 1};
+  pipeline->add("t0", policy);
+  pipeline->update(0, 20.0f);
+  flush(0);
+
+  pipeline->update(0, 24.0f);
+  TEST_ASSERT_EQUAL_STRING("", flush(1000).c_str());
+  pipeline->update(0, 20.0f);
+  TEST_ASSERT_EQUAL_STRING("", flush(2000).c_str());
+}
+
+static void test_min_interval() {
+  MetricPolicy policy = {0.1f, 1.0f, 5000, 600000, 1};
+  pipeline->add("t0", policy);
+  pipeline->update(0, 20.0f);
+  flush(0);
+
+  pipeline->update(0, 21.0f);
+  TEST_ASSERT_EQUAL_STRING("", flush(1000).c_str());    // Held back, not dropped
+  pipeline->update(0, 22.0f);
+  TEST_ASSERT_EQUAL_STRING("", flush(4999).c_str());
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":22.0}", flush(5000).c_str());
+}
+
+static void test_max_interval() {
+  MetricPolicy policy = {0.5f, 1.0f, 5000, 60000, 1};
+  pipeline->add("t0", policy);
+  pipeline->update(0, 20.0f);
+  flush(0);
+
+  // A steady value is repeated as a heartbeat, once per maximum interval
+  pipeline->update(0, 20.0f);
+  TEST_ASSERT_EQUAL_STRING("", flush(59999).c_str());
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":20.0}", flush(60000).c_str());
+  TEST_ASSERT_EQUAL_STRING("", flush(60001).c_str());
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":20.0}", flush(120000).c_str());
+}
+
+static void test_lost_source() {
+  MetricPolicy policy = {0.5f, 0.5f, 5000, 60000, 1};
+  pipeline->add("t0", policy);
+  pipeline->update(0, 20.0f);
+  flush(0);
+
+  // Published once as an error value, then no heartbeat of the last good value
+  pipeline->invalidate(0);
+  TEST_ASSERT_EQUAL_STRING("", flush(1000).c_str());    // Minimum interval still applies
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":null}", flush(5000).c_str());
+  pipeline->invalidate(0);
+  for (uint32_t now = 60000; now <= 600000; now += 60000) {
+    TEST_ASSERT_EQUAL_STRING("", flush(now).c_str());
+  }
+
+  // The first sample after the loss is published as is, not averaged with the old value
+  pipeline->update(0, 30.0f);
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":30.0}", flush(601000).c_str());
+}
+
+static void test_lost_source_short() {
+  MetricPolicy policy = {0.5f, 1.0f, 5000, 60000, 1};
+  pipeline->add("t0", policy);
+  pipeline->add("t1", policy);
+  pipeline->invalidate(0);                          // Never published, nothing to retract
+  TEST_ASSERT_EQUAL_STRING("", flush(0).c_str());
+
+  // Back before the error value went out, which is then not sent
+  pipeline->update(1, 20.0f);
+  flush(0);
+  pipeline->invalidate(1);
+  pipeline->update(1, 20.2f);
+  TEST_ASSERT_EQUAL_STRING("", flush(5000).c_str());
+  TEST_ASSERT_EQUAL_STRING("{\"t1\":20.2}", flush(60000).c_str());
+}
+
+static void test_coalesced() {
+  MetricPolicy policy = {0.5f, 1.0f, 5000, 60000, 1};
+  pipeline->add("t0", policy);
+  pipeline->add("t1", policy);
+  pipeline->add("t2", policy);
+  for (uint8_t i = 0; i < 3; i++) {
+    pipeline->update(i, 20.0f + i);
+  }
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":20.0,\"t1\":21.0,\"t2\":22.0}", flush(0).c_str());
+  TEST_ASSERT_EQUAL(1, pipeline->messageCount());
+
+  // Values which do not fit stay due for the next payload
+  for (uint8_t i = 0; i < 3; i++) {
+    pipeline->update(i, 30.0f + i);
+  }
+  TEST_ASSERT_EQUAL_STRING("{\"t0\":30.0,\"t1\":31.0}", flush(5000, 24).c_str());
+  TEST_ASSERT_EQUAL_STRING("{\"t2\":32.0}", flush(5000, 24).c_str());
+  TEST_ASSERT_EQUAL(6, pipeline->valueCount());
+  TEST_ASSERT_EQUAL(3, pipeline->messageCount());
+}
+
+// A day of four sensors read every 2 s with the policy of the firmware: a slow daily swing of
+// a few degrees, 12-bit steps and one step of noise. Without the pipeline every read is one
+// message.
+static void test_messages_saved() {
+  const MetricPolicy temp_policy = {0.1f, 0.5f, 5000, 300000, 2};
+  const uint8_t sensors = 4;
+  const uint32_t day = 86400000, period = 2000;
+  uint32_t seed = 1;
+
+  for (uint8_t i = 0; i < sensors; i++) {
+    char name[METRIC_NAME_LEN];
+    snprintf(name, sizeof(name), "t%u", i);
+    pipeline->add(name, temp_policy);
+  }
+  uint32_t reads = 0;
+  for (uint32_t now = 0; now < day; now += period) {
+    for (uint8_t i = 0; i < sensors; i++) {
+      seed = seed * 1103515245 + 12345;
+      float noise = ((int)((seed >> 16) % 3) - 1) * 0.0625f;
+      float swing = (1.0f + i) * sinf(2.0f * (float)M_PI * now / day);
+      pipeline->update(i, roundf((20.0f + swing) * 16.0f) / 16.0f + noise);
+    }
+    reads++;
+    while (flush(now).size() > 0) {
+    }
+  }
+
+  printf("SAVED reads=%lu samples=%lu values=%lu messages=%lu (%.1f%% of the reads)\n",
+         (unsigned long)reads, (unsigned long)pipeline->sampleCount(), (unsigned long)pipeline->valueCount(),
+         (unsigned long)pipeline->messageCount(), 100.0 * pipeline->messageCount() / reads);
+  TEST_ASSERT_EQUAL(reads * sensors, pipeline->sampleCount());
+  TEST_ASSERT_TRUE(pipeline->messageCount() * 10 < reads);
+  TEST_ASSERT_TRUE(pipeline->messageCount() >= day / temp_policy.max_interval);   // Heartbeats
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_sample_published);
+  RUN_TEST(test_deadband);
+  RUN_TEST(test_ewma);
+  RUN_TEST(test_ewma_spike);
+  RUN_TEST(test_min_interval);
+  RUN_TEST(test_max_interval);
+  RUN_TEST(test_lost_source);
+  RUN_TEST(test_lost_source_short);
+  RUN_TEST(test_coalesced);
+  RUN_TEST(test_messages_saved);
+  return UNITY_END();
+}
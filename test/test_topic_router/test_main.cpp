@@ -0,0 +1,220 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the TopicRouter trie, exact and wildcard matching and its limits, and of the
+ *        wildcard filter built by TopicTable for batched subscriptions.
+ */
+#include <unity.h>
+#include <TopicRouter.h>
+#include <TopicTable.h>
+#include <string.h>
+
+static TopicRouter router;
+
+void setUp(void) {
+  router.clear();
+}
+void tearDown(void) {}
+
+// Returns the argument of the route of a topic, -1 if it is not routed
+static int routed(const char* topic) {
+  const Route* route = router.find(topic);
+  return route ? route->arg : -1;
+}
+
+static void test_exact_levels() {
+  TEST_ASSERT_TRUE(router.add("home/node1/relay1", RouteKind::RELAY, 1));
+  TEST_ASSERT_TRUE(router.add("home/node1/relay2", RouteKind::RELAY, 2));
+  TEST_ASSERT_TRUE(router.add("home/node1", RouteKind::DISPLAY, 3));
+
+  TEST_ASSERT_EQUAL(1, routed("home/node1/relay1"));
+  TEST_ASSERT_EQUAL(2, routed("home/node1/relay2"));
+  TEST_ASSERT_EQUAL(3, routed("home/node1"));
+  TEST_ASSERT_EQUAL(-1, routed("home"));
+  TEST_ASSERT_EQUAL(-1, routed("home/node1/relay1/extra"));
+  TEST_ASSERT_EQUAL(-1, routed("home/node1/relay"));
+  TEST_ASSERT_EQUAL(-1, routed("Home/node1/relay1"));
+  TEST_ASSERT_EQUAL(-1, routed("home/node1/"));
+
+  const Route* route = router.find("home/node1/relay2");
+  TEST_ASSERT_EQUAL(RouteKind::RELAY, route->kind);
+  TEST_ASSERT_EQUAL_STRING("home/node1/relay2", route->topic);
+}
+
+static void test_single_level_wildcard() {
+  TEST_ASSERT_TRUE(router.add("home/+/temp", RouteKind::CUSTOM, 1));
+  TEST_ASSERT_TRUE(router.add("+/status", RouteKind::CUSTOM, 2));
+
+  TEST_ASSERT_EQUAL(1, routed("home/node1/temp"));
+  TEST_ASSERT_EQUAL(1, routed("home//temp"));          // '+' also matches an empty level
+  TEST_ASSERT_EQUAL(-1, routed("home/a/b/temp"));      // but only one level
+  TEST_ASSERT_EQUAL(-1, routed("home/node1"));
+  TEST_ASSERT_EQUAL(2, routed("node7/status"));
+  TEST_ASSERT_EQUAL(-1, routed("node7/status/x"));
+}
+
+static void test_multi_level_wildcard() {
+  TEST_ASSERT_TRUE(router.add("home/node1/#", RouteKind::CUSTOM, 1));
+
+  TEST_ASSERT_EQUAL(1, routed("home/node1/relay1"));
+  TEST_ASSERT_EQUAL(1, routed("home/node1/a/b/c"));
+  TEST_ASSERT_EQUAL(1, routed("home/node1"));          // '#' also matches its parent level
+  TEST_ASSERT_EQUAL(-1, routed("home/node2/relay1"));
+  TEST_ASSERT_EQUAL(-1, routed("home"));
+
+  TEST_ASSERT_TRUE(router.add("#", RouteKind::CUSTOM, 9));
+  TEST_ASSERT_EQUAL(9, routed("anything/at/all"));
+  TEST_ASSERT_EQUAL(1, routed("home/node1/x"));        // The longer filter still wins
+}
+
+static void test_precedence() {
+  TEST_ASSERT_TRUE(router.add("a/#", RouteKind::CUSTOM, 3));
+  TEST_ASSERT_TRUE(router.add("a/+/c", RouteKind::CUSTOM, 2));
+  TEST_ASSERT_TRUE(router.add("a/b/c", RouteKind::CUSTOM, 1));
+  TEST_ASSERT_TRUE(router.add("a/b/d", RouteKind::CUSTOM, 4));
+
+  TEST_ASSERT_EQUAL(1, routed("a/b/c"));   // Exact over '+'
+  TEST_ASSERT_EQUAL(2, routed("a/x/c"));   // '+' over '#'
+  TEST_ASSERT_EQUAL(4, routed("a/b/d"));
+  TEST_ASSERT_EQUAL(3, routed("a/b/e"));   // The exact branch fails, falls back to '#'
+  TEST_ASSERT_EQUAL(3, routed("a/x/d"));
+}
+
+// The exact branch dead-ends below the level, the '+' branch has to be tried as well
+static void test_backtracking() {
+  TEST_ASSERT_TRUE(router.add("a/b/x", RouteKind::CUSTOM, 1));
+  TEST_ASSERT_TRUE(router.add("a/+/y", RouteKind::CUSTOM, 2));
+  TEST_ASSERT_TRUE(router.add("+/b/z", RouteKind::CUSTOM, 3));
+
+  TEST_ASSERT_EQUAL(2, routed("a/b/y"));
+  TEST_ASSERT_EQUAL(3, routed("a/b/z"));
+  TEST_ASSERT_EQUAL(-1, routed("a/b/w"));
+}
+
+static void test_sys_topics_not_matched_by_root_wildcards() {
+  TEST_ASSERT_TRUE(router.add("#", RouteKind::CUSTOM, 1));
+  TEST_ASSERT_TRUE(router.add("+/uptime", RouteKind::CUSTOM, 2));
+  TEST_ASSERT_EQUAL(-1, routed("$SYS/uptime"));
+  TEST_ASSERT_EQUAL(2, routed("node/uptime"));
+
+  TEST_ASSERT_TRUE(router.add("$SYS/#", RouteKind::CUSTOM, 3));
+  TEST_ASSERT_EQUAL(3, routed("$SYS/uptime"));
+
+  // Below the root a '$' level is an ordinary level
+  TEST_ASSERT_TRUE(router.add("esp32-client-1/#", RouteKind::CUSTOM, 4));
+  TEST_ASSERT_EQUAL(4, routed("esp32-client-1/$SYS/power"));
+}
+
+static void test_add_replaces_same_filter() {
+  TEST_ASSERT_TRUE(router.add("home/relay", RouteKind::RELAY, 1));
+  TEST_ASSERT_TRUE(router.add("home/relay", RouteKind::DISPLAY, 2));
+  const Route* route = router.find("home/relay");
+  TEST_ASSERT_NOT_NULL(route);
+  TEST_ASSERT_EQUAL(RouteKind::DISPLAY, route->kind);
+  TEST_ASSERT_EQUAL(2, route->arg);
+}
+
+static void test_hash_must_be_last() {
+  TEST_ASSERT_FALSE(router.add("home/#/relay", RouteKind::CUSTOM, 1));
+  TEST_ASSERT_EQUAL(-1, routed("home/x/relay"));
+}
+
+static void custom(const uint8_t* payload, unsigned int length) {}
+
+static void test_custom_handler_kept() {
+  TEST_ASSERT_TRUE(router.add("node/power", RouteKind::CUSTOM, 0, custom));
+  TEST_ASSERT_TRUE(router.find("node/power")->handler == custom);
+}
+
+static void test_capacity() {
+  static char topics[ROUTER_CAPACITY + 1][16];
+  for (int i = 0; i <= ROUTER_CAPACITY; i++) {
+    snprintf(topics[i], sizeof(topics[i]), "r/%d", i);
+    TEST_ASSERT_EQUAL(i < ROUTER_CAPACITY, router.add(topics[i], RouteKind::RELAY, i));
+  }
+  TEST_ASSERT_EQUAL(ROUTER_CAPACITY - 1, routed("r/31"));
+  TEST_ASSERT_EQUAL(-1, routed("r/32"));
+
+  router.clear();
+  TEST_ASSERT_EQUAL(-1, routed("r/0"));
+  TEST_ASSERT_TRUE(router.add(topics[0], RouteKind::RELAY, 0));
+}
+
+static void test_node_limit() {
+  // Every level of a deep filter takes a node, the trie refuses a filter once they run out
+  static char deep[ROUTER_NODES * 2 + 1];
+  for (int i = 0; i < ROUTER_NODES; i++) {
+    deep[2 * i] = 'a' + i % 26;
+    deep[2 * i + 1] = '/';
+  }
+  deep[2 * ROUTER_NODES - 1] = '\0';
+  TEST_ASSERT_FALSE(router.add(deep, RouteKind::CUSTOM, 1));
+
+  router.clear();
+  deep[2 * (ROUTER_NODES - 1) - 1] = '\0';  // Exactly the nodes left after the root
+  TEST_ASSERT_TRUE(router.add(deep, RouteKind::CUSTOM, 1));
+  TEST_ASSERT_EQUAL(1, routed(deep));
+}
+
+static void load_topics(TopicTable& table, const char* const* topics, uint8_t count) {
+  static ConfigRecord record;
+  uint16_t pos = 0;
+  memset(&record, 0, sizeof(record));
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t len = strlen(topics[i]);
+    memcpy(record.arena + pos, topics[i], len + 1);
+    record.topics[i] = {pos, len};
+    pos += len + 1;
+  }
+  record.topic_count = count;
+  table.load(record);
+}
+
+static void test_wildcard_filter() {
+  TopicTable table;
+  char filter[64];
+
+  const char* node[] = {"home/node1/telemetry", "home/node1/relay1", "home/node1/relay2"};
+  load_topics(table, node, 3);
+  TEST_ASSERT_TRUE(table.wildcard(filter, sizeof(filter)));
+  TEST_ASSERT_EQUAL_STRING("home/node1/#", filter);
+
+  // The prefix is cut back to the last complete level
+  const char* partial[] = {"home/node1a/relay", "home/node1b/relay"};
+  load_topics(table, partial, 2);
+  TEST_ASSERT_FALSE(table.wildcard(filter, sizeof(filter)));  // Only "home/" is common, too broad
+
+  const char* deep[] = {"site/floor2/room/relay1", "site/floor2/room/lamp"};
+  load_topics(table, deep, 2);
+  TEST_ASSERT_TRUE(table.wildcard(filter, sizeof(filter)));
+  TEST_ASSERT_EQUAL_STRING("site/floor2/room/#", filter);
+  TEST_ASSERT_FALSE(table.wildcard(filter, 10));  // Does not fit the buffer
+
+  const char* single[] = {"home/node1/relay1"};
+  load_topics(table, single, 1);
+  TEST_ASSERT_FALSE(table.wildcard(filter, sizeof(filter)));
+
+  // The filter routes every topic of the table
+  load_topics(table, node, 3);
+  table.wildcard(filter, sizeof(filter));
+  TEST_ASSERT_TRUE(router.add(filter, RouteKind::CUSTOM, 7));
+  for (uint8_t i = 0; i < table.size(); i++) {
+    TEST_ASSERT_EQUAL(7, routed(table[i]));
+  }
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_exact_levels);
+  RUN_TEST(test_single_level_wildcard);
+  RUN_TEST(test_multi_level_wildcard);
+  RUN_TEST(test_precedence);
+  RUN_TEST(test_backtracking);
+  RUN_TEST(test_sys_topics_not_matched_by_root_wildcards);
+  RUN_TEST(test_add_replaces_same_filter);
+  RUN_TEST(test_hash_must_be_last);
+  RUN_TEST(test_custom_handler_kept);
+  RUN_TEST(test_capacity);
+  RUN_TEST(test_node_limit);
+  RUN_TEST(test_wildcard_filter);
+  return UNITY_END();
+}
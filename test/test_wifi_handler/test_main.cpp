@@ -0,0 +1,61 @@
+/**
+ * @file test_main.cpp
+ * @brief Tests of the WifiHandler connect attempts: the listen interval of modem sleep reaches the
+ *        association request, on the first attempt and on the reconnects of wifi_tick().
+ */
+#include <unity.h>
+#include <WifiHandler.h>
+#include <memory>
+
+static Preferences prefs;
+static MemoryHandler memory(prefs);
+static std::vector<String> credentials;
+static std::unique_ptr<WifiHandler> wifi;
+
+void setUp(void) {
+  fake_nvs.clear();
+  fake_ms = 0;
+  fake_wifi_connects = 0;
+  fake_wifi_assoc_interval = 0;
+  fake_wifi_config = {};
+  credentials = {String("home"), String("wifi-pass")};
+  wifi.reset(new WifiHandler(WiFi, credentials, 2, "node-setup", "setup-pass", memory));
+}
+void tearDown(void) {}
+
+static void test_default_interval() {
+  wifi->setupWiFi();
+  TEST_ASSERT_EQUAL(WIFI_STA, WiFi.mode_set);
+  TEST_ASSERT_EQUAL(1, fake_wifi_connects);
+  TEST_ASSERT_EQUAL(0, fake_wifi_assoc_interval);
+}
+
+// begin() resets the interval, it must be set between the configuration and the connect
+static void test_interval_in_association() {
+  wifi->setListenInterval(3);
+  wifi->setupWiFi();
+  TEST_ASSERT_EQUAL(1, fake_wifi_connects);     // One attempt, not a connect and a reconnect
+  TEST_ASSERT_EQUAL(3, fake_wifi_assoc_interval);
+}
+
+static void test_interval_on_reconnect() {
+  const uint8_t bssid[6] = {0x24, 0x0A, 0xC4, 0, 0, 1};
+  wifi->setupWiFi(bssid, 6);
+  TEST_ASSERT_EQUAL(6, WiFi.begin_channel);
+
+  // A new power mode applies from the next association, made by wifi_tick() after a failure
+  wifi->setListenInterval(10);
+  fake_advance(WIFI_BACKOFF_MAX);
+  wifi->wifi_tick();
+  TEST_ASSERT_EQUAL(2, fake_wifi_connects);
+  TEST_ASSERT_EQUAL(0, WiFi.begin_channel);     // Full scan after the cached access point failed
+  TEST_ASSERT_EQUAL(10, fake_wifi_assoc_interval);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_default_interval);
+  RUN_TEST(test_interval_in_association);
+  RUN_TEST(test_interval_on_reconnect);
+  return UNITY_END();
+}